@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Throughput measurements, not correctness checks
+// Disabled by default; run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+// Paths are relative to the UnitTests project folder
+
+class kipBenchmark : public testing::Test
+{
+  void SetUp() override
+  {
+    memory.resize(0x10000);
+    machine.memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+  }
+
+public:
+  // Loads and builds the given example, returning false on failure
+  bool Load(const std::string& name)
+  {
+    lines.clear();
+    if (!kip::LoadFile(folder + "/" + name, lines))
+      return false;
+    machine.context = kip::Instruction::Context();
+    machine.context.folder = folder;
+    if (!kip::BuildContext(machine.context, lines).back())
+      return false;
+    instructions = kip::BuildInstructions(machine.context, lines);
+    program = kip::DecodeInstructions(instructions, machine.context);
+    bytecode = kip::CompileInstructionsToBytecode(instructions, machine.context);
+    return kip::LoadBytecode(bytecodeProgram, machine.context, bytecode).back();
+  }
+
+  // Runs the loaded example repeatedly for about the given time and returns instructions/second
+  template <typename Run>
+  double Measure(Run run, double seconds = 1.0)
+  {
+    typedef std::chrono::steady_clock Clock;
+    machine.context.executed = 0;
+    const Clock::time_point begin = Clock::now();
+    double elapsed = 0.0;
+    while (elapsed < seconds)
+    {
+      machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+      EXPECT_TRUE(run().back());
+      elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+    return machine.context.executed / elapsed;
+  }
+
+  void Report(const std::string& name)
+  {
+    ASSERT_TRUE(Load(name));
+    const double fallback = Measure([this]() { return kip::InterpretInstructions(instructions, machine.memory, machine.context, 0); });
+    const double program = Measure([this]() { return kip::InterpretProgram(this->program, machine, 0); });
+    const double bytecode = Measure([this]() { return kip::InterpretBytecode(bytecodeProgram, machine.memory, machine.context, 0); });
+    std::vector<kip::Instruction> optimizedInstructions = instructions;
+    const kip::OptimizationReport report = kip::OptimizeInstructions(optimizedInstructions);
+    const kip::Program optimizedProgram = kip::DecodeInstructions(optimizedInstructions, machine.context);
+    const double optimized = Measure([this, &optimizedProgram]() { return kip::InterpretProgram(optimizedProgram, machine, 0); });
+    kip::Program fusedProgram = optimizedProgram;
+    kip::ProgramProfile profile;
+    machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+    ASSERT_TRUE(kip::ProfileProgram(fusedProgram, machine, profile).back());
+    const kip::FusionReport fusions = kip::FuseProgram(fusedProgram, &profile);
+    const double fused = Measure([this, &fusedProgram]() { return kip::InterpretProgram(fusedProgram, machine, 0); });
+    kip::JitProgram jit;
+    const std::vector<kip::InterpretResult> compiled = kip::CompileProgram(jit, optimizedProgram, machine.context, 0);
+    const double native = Measure([this, &jit]() { return kip::InterpretJitProgram(jit, machine); });
+    std::cout << name << ": InterpretInstructions " << uint64_t(fallback) << " instructions/s, InterpretProgram " << uint64_t(program) << " instructions/s, InterpretBytecode " << uint64_t(bytecode) << " instructions/s, optimized InterpretProgram " << uint64_t(optimized) << " instructions/s, optimized and fused InterpretProgram " << uint64_t(fused) << " instructions/s, optimized InterpretJitProgram " << uint64_t(native) << " instructions/s" << std::endl;
+    std::cout << name << ": " << report.Describe().str << std::endl;
+    std::cout << name << ": " << compiled.back().str << std::endl;
+    for (const kip::InterpretResult& fusion : fusions.Describe())
+      std::cout << name << ": " << fusion.str << std::endl;
+  }
+
+  // Generates roughly the given number of bytes of varied kip source
+  static std::vector<std::string> GenerateSource(size_t bytes)
+  {
+    const char* const templates[] = {
+      "STB %u $%X          ; store",
+      "ADB *$%X :1010 $%X",
+      "FIL 0 #17 $%X",
+      "JNE LABEL%u *$10 %u",
+      "STS \"generated string %u\" $%X",
+      "CPY $%X $20 4      | copy",
+      "",
+    };
+    std::vector<std::string> lines;
+    size_t total = 0;
+    char buffer[128];
+    for (unsigned i = 0; total < bytes; ++i)
+    {
+      if (i % 16 == 0)
+        std::snprintf(buffer, sizeof(buffer), ">label%u", i / 16);
+      else
+        std::snprintf(buffer, sizeof(buffer), templates[i % 7], (i / 16) % 1000, i & 0xFFF);
+      lines.push_back(buffer);
+      total += lines.back().size() + 1;
+    }
+    return lines;
+  }
+
+  const std::string folder = "../examples";
+  kip::Machine machine;
+  std::vector<unsigned char> memory;
+  std::vector<std::string> lines;
+  std::vector<kip::Instruction> instructions;
+  kip::Program program;
+  kip::Bytecode::Data bytecode;
+  kip::BytecodeProgram bytecodeProgram;
+};
+
+TEST_F(kipBenchmark, DISABLED_Fibonacci)
+{
+  Report("fibonacci.kip");
+}
+
+TEST_F(kipBenchmark, DISABLED_RecursiveFibonacci)
+{
+  Report("recursiveFibonacci.kip");
+}
+
+TEST_F(kipBenchmark, DISABLED_ParserThroughput)
+{
+  typedef std::chrono::steady_clock Clock;
+  const std::vector<std::string> source = GenerateSource(8 << 20);
+  size_t bytes = 0;
+  for (const std::string& line : source)
+    bytes += line.size() + 1;
+
+  std::vector<std::string> lines = source;
+  kip::Instruction::Context context;
+  const Clock::time_point begin = Clock::now();
+  ASSERT_TRUE(kip::BuildContext(context, lines).back());
+  const double contextSeconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  std::cout << source.size() << " lines, " << bytes / 1000000.0 << "MB: BuildContext " << bytes / 1000000.0 / contextSeconds << "MB/s" << std::endl;
+
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned threads = 1; threads <= cores; threads *= 2)
+  {
+    std::vector<std::string> copy = lines;
+    const Clock::time_point start = Clock::now();
+    instructions = kip::BuildInstructions(context, copy, threads);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "BuildInstructions with " << threads << " threads: " << bytes / 1000000.0 / seconds << "MB/s" << std::endl;
+  }
+}
+
+TEST_F(kipBenchmark, DISABLED_SchedulerThroughput)
+{
+  typedef std::chrono::steady_clock Clock;
+  std::vector<std::string> source = {
+    "STB 16 $10",
+    ">outer",
+    "STB 255 $11",
+    ">inner",
+    "ADB *$12 *$11 $12",
+    "DCB $11",
+    "JNE inner *$11 0",
+    "DCB $10",
+    "JNE outer *$10 0",
+  };
+  kip::Instruction::Context context;
+  ASSERT_TRUE(kip::BuildContext(context, source).back());
+  const std::shared_ptr<const kip::Program> script = std::make_shared<const kip::Program>(kip::DecodeInstructions(kip::BuildInstructions(context, source), context));
+  const size_t scripts = 4096;
+  std::vector<std::array<unsigned char, 0x100>> memories(scripts);
+
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  double single = 0.0;
+  for (unsigned threads = 1; threads <= cores; threads = threads < cores && threads * 2 > cores ? cores : threads * 2)
+  {
+    kip::Scheduler scheduler(threads);
+    const Clock::time_point begin = Clock::now();
+    for (std::array<unsigned char, 0x100>& memory : memories)
+    {
+      memory.fill(0);
+      std::unique_ptr<kip::Machine> vm = std::make_unique<kip::Machine>();
+      vm->memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+      vm->memory.SetStackPointer((kip::Argument::Address)memory.size());
+      scheduler.Submit(script, std::move(vm), [](std::unique_ptr<kip::Machine>&, kip::StopReason reason, std::vector<kip::InterpretResult>&)
+      {
+        EXPECT_EQ(reason, kip::StopReason::FINISHED);
+      });
+    }
+    scheduler.Wait();
+    const double perSecond = scripts / std::chrono::duration<double>(Clock::now() - begin).count();
+    if (threads == 1)
+      single = perSecond;
+    const kip::Scheduler::Stats stats = scheduler.GetStats();
+    std::cout << "Scheduler with " << threads << " threads: " << uint64_t(perSecond) << " scripts/s, " << perSecond / single << "x, " << stats.slices << " slices, " << stats.steals << " steals" << std::endl;
+  }
+}
+
+TEST_F(kipBenchmark, DISABLED_LaneThroughput)
+{
+  typedef std::chrono::steady_clock Clock;
+  std::vector<std::string> source = {
+    "STB 64 $10",
+    "STA $40 $30",
+    ">loop",
+    "ADB *$20 **$30 $20",
+    "XOR *$21 **$30 $21",
+    "MLB *$20 3 $22",
+    "AND *$22 $F0 $23",
+    "BOR *$23 *$21 $24",
+    "SBB *$24 *$20 $25",
+    "NOT *$25 $26",
+    "INA $30",
+    "DCB $10",
+    "JNE loop *$10 0",
+  };
+  kip::Instruction::Context context;
+  ASSERT_TRUE(kip::BuildContext(context, source).back());
+  const kip::Program script = kip::DecodeInstructions(kip::BuildInstructions(context, source), context);
+  const size_t count = 1024;
+  std::vector<std::array<unsigned char, 0x100>> memories(count);
+  std::vector<std::unique_ptr<kip::Machine>> machines;
+  std::vector<kip::Machine*> lanes;
+  for (std::array<unsigned char, 0x100>& memory : memories)
+  {
+    machines.push_back(std::make_unique<kip::Machine>());
+    machines.back()->memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+    machines.back()->memory.SetStackPointer((kip::Argument::Address)memory.size());
+    lanes.push_back(machines.back().get());
+  }
+
+  Clock::time_point begin = Clock::now();
+  for (kip::Machine* lane : lanes)
+    kip::InterpretProgram(script, *lane, 0);
+  const double separate = std::chrono::duration<double>(Clock::now() - begin).count();
+  kip::LaneReport report;
+  begin = Clock::now();
+  kip::InterpretLanes(script, lanes, report, 0);
+  const double lockstep = std::chrono::duration<double>(Clock::now() - begin).count();
+  uint64_t executed = 0;
+  for (kip::Machine* lane : lanes)
+    executed += lane->context.executed;
+  std::cout << count << " lanes: InterpretProgram " << uint64_t(executed / 2 / separate) << " instructions/s, InterpretLanes " << uint64_t(executed / 2 / lockstep) << " instructions/s" << std::endl;
+  std::cout << report.Describe().str << std::endl;
+}
+
+TEST_F(kipBenchmark, DISABLED_CompileCache)
+{
+  typedef std::chrono::steady_clock Clock;
+  const std::filesystem::path temporary = std::filesystem::temp_directory_path() / "kipBenchmarkCache";
+  std::filesystem::remove_all(temporary);
+  std::filesystem::create_directories(temporary);
+  const std::string filename = (temporary / "generated.kip").string();
+  {
+    std::ofstream file(filename, std::ios::binary);
+    for (const std::string& line : GenerateSource(8 << 20))
+      file << line << '\n';
+  }
+
+  for (const char* start : { "Cold", "Warm" })
+  {
+    kip::Instruction::Context context;
+    kip::CompiledFile compiled;
+    const Clock::time_point begin = Clock::now();
+    ASSERT_TRUE(kip::CompileFile(compiled, context, filename).back());
+    const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    std::cout << start << " start: " << seconds * 1000.0 << "ms" << (compiled.cached ? " from cache" : "") << std::endl;
+  }
+  std::filesystem::remove_all(temporary);
+}
+
+TEST_F(kipBenchmark, DISABLED_FlatMemory)
+{
+  ASSERT_TRUE(Load("fibonacci.kip"));
+  const double paged = Measure([this]() { return kip::InterpretProgram(program, machine, 0); });
+  machine.memory.UnmapMemory(memory.data());
+  if (!machine.memory.ReserveFlat())
+    GTEST_SKIP() << "Flat mode isn't available on this host";
+  ASSERT_NE(machine.memory.CommitMemory((kip::Argument::Address)memory.size(), 0x0000), nullptr);
+  const double flat = Measure([this]() { return kip::InterpretProgram(program, machine, 0); });
+  std::cout << "fibonacci.kip: InterpretProgram " << uint64_t(paged) << " instructions/s paged, " << uint64_t(flat) << " instructions/s flat" << std::endl;
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <string>
+#include <vector>
+
+class kipTestBuild : public testing::Test
+{
+public:
+  // Enough lines that every thread gets a full chunk
+  static std::vector<std::string> Source()
+  {
+    std::vector<std::string> lines;
+    for (unsigned i = 0; i < 8 * KIP_PARALLEL_BUILD_MIN_LINES; ++i)
+    {
+      switch (i % 5)
+      {
+      case 0: lines.push_back(">label" + std::to_string(i)); break;
+      case 1: lines.push_back("  STB " + std::to_string(i % 256) + " $" + std::to_string(i % 0x1000)); break;
+      case 2: lines.push_back("JNE label" + std::to_string(i - 2) + " **$10 :101 ; comment"); break;
+      case 3: lines.push_back("STS \"text " + std::to_string(i) + "\" #17"); break;
+      case 4: lines.push_back(""); break;
+      }
+    }
+    return lines;
+  }
+};
+
+TEST_F(kipTestBuild, ParallelMatchesSerial)
+{
+  // given
+  std::vector<std::string> serialLines = Source();
+  std::vector<std::string> parallelLines = serialLines;
+  kip::Instruction::Context context;
+  ASSERT_TRUE(kip::BuildContext(context, serialLines).back());
+  kip::Instruction::Context parallelContext;
+  ASSERT_TRUE(kip::BuildContext(parallelContext, parallelLines).back());
+
+  // when
+  const std::vector<kip::Instruction> serial = kip::BuildInstructions(context, serialLines, 1);
+  const std::vector<kip::Instruction> parallel = kip::BuildInstructions(parallelContext, parallelLines, 4);
+
+  // expect
+  ASSERT_EQ(serial.size(), serialLines.size());
+  ASSERT_EQ(parallel.size(), serial.size());
+  for (size_t i = 0; i < serial.size(); ++i)
+  {
+    ASSERT_EQ(parallel[i].id, serial[i].id) << i;
+    ASSERT_EQ(parallel[i].line, serial[i].line) << i;
+    ASSERT_EQ(parallel[i].arguments.size(), serial[i].arguments.size()) << i;
+    for (size_t a = 0; a < serial[i].arguments.size(); ++a)
+    {
+      EXPECT_EQ(parallel[i].arguments[a].data, serial[i].arguments[a].data);
+      EXPECT_EQ(parallel[i].arguments[a].dereferenceCount, serial[i].arguments[a].dereferenceCount);
+      EXPECT_EQ(parallel[i].arguments[a].type, serial[i].arguments[a].type);
+      EXPECT_EQ(parallel[i].arguments[a].stringLabel, serial[i].arguments[a].stringLabel);
+    }
+  }
+}
+
+TEST_F(kipTestBuild, ParallelReportsEarliestError)
+{
+  // given
+  std::vector<std::string> lines = Source();
+  lines[lines.size() / 2] = "STB 1 FIRST";
+  lines[lines.size() - 1] = "STB 1 SECOND";
+  kip::Instruction::Context context;
+  ASSERT_TRUE(kip::BuildContext(context, lines).back());
+
+  // when
+  std::string error;
+  try
+  {
+    kip::BuildInstructions(context, lines, 4);
+  }
+  catch (std::exception& e)
+  {
+    error = e.what();
+  }
+
+  // expect
+  EXPECT_NE(error.find("FIRST"), std::string::npos);
+}
+
+TEST_F(kipTestBuild, ParseErrorsGiveReasonAndLine)
+{
+  // given
+  std::vector<std::string> lines = { "STB 1 $0", "STB $ZZ $0" };
+  kip::Machine machine;
+
+  // when
+  const std::vector<kip::InterpretResult> result = kip::InterpretLines(lines, machine, 0);
+
+  // expect
+  EXPECT_FALSE(result.back());
+  EXPECT_EQ(result.back().str, "Exception was thrown while building instructions: Invalid number: $ZZ at line 2");
+}
+
+TEST_F(kipTestBuild, LabelValuesUseLiteralParsing)
+{
+  // given
+  std::vector<std::string> lines = { ">BIG $80000000", ">BAD zz" };
+  kip::Instruction::Context context;
+
+  // when
+  const std::vector<kip::InterpretResult> result = kip::BuildContext(context, lines);
+
+  // expect
+  EXPECT_EQ(context.labels["BIG"].data, 0x80000000u);
+  ASSERT_GE(result.size(), 2u);
+  EXPECT_FALSE(result.back());
+  EXPECT_EQ(result[result.size() - 2].str, "Compilation error: Invalid label value ZZ at line 2");
+}
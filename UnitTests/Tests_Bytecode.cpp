@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <cstdio>
+#include <stdexcept>
+
+class kipTestBytecode : public testing::Test
+{
+  void SetUp() override
+  {
+    for (unsigned i = 0; i < machines.size(); ++i)
+    {
+      memory[i].fill(0);
+      machines[i].memory.MapMemory(memory[i].data(), (kip::Argument::Address)memory[i].size(), 0x0000);
+      machines[i].memory.SetStackPointer((kip::Argument::Address)memory[i].size());
+    }
+  }
+
+public:
+  kip::Bytecode::Data Compile(std::vector<std::string> lines, const std::vector<kip::Bytecode::Metadata>& metadata = {})
+  {
+    kip::Instruction::Context context;
+    kip::BuildContext(context, lines);
+    return kip::CompileInstructionsToBytecode(kip::BuildInstructions(context, lines), context, metadata);
+  }
+
+  std::array<kip::Machine, 2> machines;
+  std::array<std::array<unsigned char, 0x0FFF>, 2> memory; // 4k of memory per machine
+};
+
+TEST_F(kipTestBytecode, CompiledBytecodeMatchesSource)
+{
+  // given
+  const std::vector<std::string> lines = {
+    ">greeting \"hi\"",
+    "JMP START",
+    ">func",
+    "POA $20",
+    "INB $11",
+    "JMP *$20",
+    ">start",
+    "STB 3 $10",
+    ">loop",
+    "CAL func",
+    "DCB $10",
+    "JGT loop *$10 0",
+    "STS greeting $30",
+  };
+  std::vector<std::string> source = lines;
+
+  // when
+  const std::vector<kip::InterpretResult> expected = kip::InterpretLines(source, machines[0], 0);
+  const std::vector<kip::InterpretResult> result = kip::InterpretBytecode(Compile(lines), machines[1], 0);
+
+  // expect
+  EXPECT_TRUE(expected.back());
+  EXPECT_TRUE(result.back());
+  EXPECT_EQ(memory[1][0x11], 3);
+  EXPECT_EQ(memory[1][0x30], 'h');
+  EXPECT_EQ(memory[0], memory[1]);
+  EXPECT_EQ(machines[0].context.executed, machines[1].context.executed);
+}
+
+TEST_F(kipTestBytecode, ArgumentCountsMatchWhatIsLoaded)
+{
+  // given
+  std::vector<std::string> lines = { "STB 1 $10 $5", "STB 2 $11" };
+
+  // when
+  const std::vector<kip::InterpretResult> expected = kip::InterpretLines(lines, machines[0], 0);
+  const std::vector<kip::InterpretResult> result = kip::InterpretBytecode(Compile(lines), machines[1], 0);
+
+  // expect
+  EXPECT_TRUE(expected.back());
+  EXPECT_TRUE(result.back()) << result.back().str;
+  EXPECT_EQ(memory[1][0x11], 2);
+  EXPECT_EQ(memory[0], memory[1]);
+  EXPECT_THROW(Compile({ "STB 1" }), std::invalid_argument);
+}
+
+TEST_F(kipTestBytecode, MetadataIsLoaded)
+{
+  // given
+  const kip::Bytecode::Data bc = Compile({ "STB 1 $10" }, { kip::Bytecode::Metadata::Author("kip"), kip::Bytecode::Metadata::Comment("test") });
+  kip::BytecodeProgram program;
+
+  // when
+  const std::vector<kip::InterpretResult> result = kip::LoadBytecode(program, machines[0].context, bc);
+
+  // expect
+  EXPECT_TRUE(result.back());
+  ASSERT_EQ(program.metadata.size(), 2);
+  EXPECT_EQ(program.metadata[0].data()[0], uint8_t(kip::Bytecode::Metadata::Type::AUTHOR));
+  EXPECT_EQ(program.metadata[1].data()[0], uint8_t(kip::Bytecode::Metadata::Type::COMMENT));
+  EXPECT_EQ(program.size(), 1);
+}
+
+TEST_F(kipTestBytecode, TruncatedBytecodeIsRejected)
+{
+  // given
+  kip::Bytecode::Data bc = Compile({ "STB 1 $10" });
+  bc.pop_back();
+
+  // when
+  const std::vector<kip::InterpretResult> result = kip::InterpretBytecode(bc, machines[0], 0);
+
+  // expect
+  EXPECT_FALSE(result.back());
+  EXPECT_EQ(memory[0][0x10], 0);
+}
+
+TEST_F(kipTestBytecode, HeaderVersionMatchesOffsets)
+{
+  // given
+  const kip::Bytecode::Header header(3, 7);
+
+  // expect
+  EXPECT_TRUE(header.IsValid());
+  EXPECT_EQ(header.data()[size_t(kip::Bytecode::Header::Offset::MAJOR_VERSION)], 3);
+  EXPECT_EQ(header.data()[size_t(kip::Bytecode::Header::Offset::MINOR_VERSION)], 7);
+  EXPECT_EQ(header.GetVersionMajor(), 3);
+  EXPECT_EQ(header.GetVersionMinor(), 7);
+}
+
+TEST_F(kipTestBytecode, MappedFileRunsInPlace)
+{
+  // given
+  const std::string filename = "kipTestBytecode.kbc";
+  ASSERT_TRUE(kip::SaveBytecodeFile(filename, Compile({ ">start", "STB 7 $10", "STS \"kbc\" $20" })));
+  kip::MappedFile file;
+  kip::BytecodeProgram program;
+
+  // when
+  const std::vector<kip::InterpretResult> loaded = kip::LoadBytecodeFile(program, machines[0].context, file, filename);
+  const std::vector<kip::InterpretResult> result = kip::InterpretBytecode(program, machines[0].memory, machines[0].context, 0);
+
+  // expect
+  EXPECT_TRUE(loaded.back());
+  EXPECT_TRUE(result.back());
+  EXPECT_EQ(program.image.data(), file.data());
+  EXPECT_EQ(memory[0][0x10], 7);
+  EXPECT_EQ(memory[0][0x20], 'k');
+  file.Close();
+  std::remove(filename.c_str());
+}
+
+TEST_F(kipTestBytecode, MissingFileIsReported)
+{
+  // when
+  const std::vector<kip::InterpretResult> result = kip::InterpretBytecodeFile("doesNotExist.kbc", machines[0], 0);
+
+  // expect
+  EXPECT_FALSE(result.back());
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+
+class kipTestCPY : public testing::Test
+{
+  void SetUp() override
+  {
+    for (size_t i = 0; i < memory.size(); ++i)
+      memory[i] = (unsigned char)i;
+    kip::MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+  }
+
+  void TearDown() override
+  {
+    kip::UnmapMemory(memory.data());
+  }
+
+public:
+  std::array<unsigned char, 0x1000> memory; // 4k of memory
+};
+
+TEST_F(kipTestCPY, CopyIntoOverlappingRange)
+{
+  // given
+  const std::string command = "CPY $100 $104 $10";
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine(command);
+
+  // expect
+  EXPECT_TRUE(result);
+  for (unsigned i = 0; i < 0x10; ++i)
+    EXPECT_EQ(memory[0x104 + i], (unsigned char)i);
+  EXPECT_EQ(memory[0x114], 0x14);
+}
+
+TEST_F(kipTestCPY, UnmappedSourceWritesNothing)
+{
+  // given
+  const std::string command = "CPY $FF8 $100 $10";
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine(command);
+
+  // expect
+  EXPECT_FALSE(result);
+  EXPECT_NE(result.str.find("4088"), std::string::npos) << result.str;
+  EXPECT_EQ(memory[0x100], 0x00);
+}
+
+TEST_F(kipTestCPY, UnmappedDestinationWritesNothing)
+{
+  // given
+  const std::string command = "CPY $100 $FF8 $10";
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine(command);
+
+  // expect
+  EXPECT_FALSE(result);
+  EXPECT_NE(result.str.find("4088"), std::string::npos) << result.str;
+  EXPECT_EQ(memory[0xFF8], 0xF8);
+}
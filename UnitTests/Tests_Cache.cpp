@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class kipTestCache : public testing::Test
+{
+  void SetUp() override
+  {
+    folder = std::filesystem::temp_directory_path() / "kipTestCache";
+    std::filesystem::remove_all(folder);
+    std::filesystem::create_directories(folder);
+    Write("lib.kip", ">value 7");
+    main = Write("main.kip", "<lib.kip\nSTB value $10\nSTS \"hi\" $20");
+  }
+
+  void TearDown() override
+  {
+    std::filesystem::remove_all(folder);
+  }
+
+public:
+  std::string Write(const std::string& filename, const std::string& text)
+  {
+    std::ofstream file(folder / filename, std::ios::binary);
+    file << text;
+    return (folder / filename).string();
+  }
+
+  // Compiles main and runs it on fresh memory
+  bool Run(bool& cached, const std::string& cacheFolder = "")
+  {
+    memory.fill(0);
+    kip::Machine machine;
+    machine.memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+    machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+    kip::CompiledFile compiled;
+    std::vector<kip::InterpretResult> r = kip::CompileFile(compiled, machine.context, main, cacheFolder);
+    cached = compiled.cached;
+    if (!r.back())
+      return false;
+    r = kip::InterpretBytecode(compiled.program, machine.memory, machine.context, 0);
+    return r.back();
+  }
+
+  std::filesystem::path folder;
+  std::string main;
+  std::array<unsigned char, 0x0FFF> memory; // 4k of memory
+};
+
+TEST_F(kipTestCache, SecondStartUsesTheCache)
+{
+  // given
+  bool first = true, second = false;
+
+  // when
+  ASSERT_TRUE(Run(first));
+  ASSERT_TRUE(Run(second));
+
+  // expect
+  EXPECT_FALSE(first);
+  EXPECT_TRUE(second);
+  EXPECT_TRUE(std::filesystem::exists(kip::BytecodeCache::GetPath(main)));
+  EXPECT_EQ(memory[0x10], 7);
+  EXPECT_EQ(memory[0x20], 'h');
+}
+
+TEST_F(kipTestCache, EditingAnImportRecompiles)
+{
+  // given
+  bool cached = true;
+  ASSERT_TRUE(Run(cached));
+  Write("lib.kip", ">value 9");
+
+  // when
+  ASSERT_TRUE(Run(cached));
+
+  // expect
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(memory[0x10], 9);
+}
+
+TEST_F(kipTestCache, EditingTheSourceRecompiles)
+{
+  // given
+  bool cached = true;
+  ASSERT_TRUE(Run(cached));
+  Write("main.kip", "<lib.kip\nSTB value $11");
+
+  // when
+  ASSERT_TRUE(Run(cached));
+
+  // expect
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(memory[0x10], 0);
+  EXPECT_EQ(memory[0x11], 7);
+}
+
+TEST_F(kipTestCache, OtherVersionIsIgnored)
+{
+  // given
+  bool cached = true;
+  ASSERT_TRUE(Run(cached));
+  const std::string path = kip::BytecodeCache::GetPath(main);
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(size_t(kip::BytecodeCache::Offset::MINOR_VERSION));
+    file.put(char(kip::versionMinor + 1));
+  }
+
+  // when
+  ASSERT_TRUE(Run(cached));
+
+  // expect
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(memory[0x10], 7);
+}
+
+TEST_F(kipTestCache, CacheFolderIsUsed)
+{
+  // given
+  const std::string cacheFolder = (folder / "cache").string();
+  bool first = true, second = false;
+
+  // when
+  ASSERT_TRUE(Run(first, cacheFolder));
+  ASSERT_TRUE(Run(second, cacheFolder));
+
+  // expect
+  EXPECT_FALSE(first);
+  EXPECT_TRUE(second);
+  EXPECT_FALSE(std::filesystem::exists(kip::BytecodeCache::GetPath(main)));
+  EXPECT_EQ(std::filesystem::path(kip::BytecodeCache::GetPath(main, cacheFolder)).parent_path(), std::filesystem::path(cacheFolder));
+  EXPECT_TRUE(std::filesystem::exists(kip::BytecodeCache::GetPath(main, cacheFolder)));
+}
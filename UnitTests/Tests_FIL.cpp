@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <vector>
+
+class kipTestFIL : public testing::Test
+{
+  void SetUp() override
+  {
+    memory.assign(0x10000, 0xAA);
+    kip::MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+  }
+
+  void TearDown() override
+  {
+    kip::UnmapMemory(memory.data());
+  }
+
+public:
+  std::vector<unsigned char> memory; // 64k of memory
+};
+
+TEST_F(kipTestFIL, FillWholeAddressSpace)
+{
+  // given
+  const std::string command = "FIL 0 $0 $FFFF";
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine(command);
+
+  // expect
+  EXPECT_TRUE(result);
+  EXPECT_EQ(memory[0x0000], 0);
+  EXPECT_EQ(memory[0xFFFE], 0);
+  EXPECT_EQ(memory[0xFFFF], 0xAA);
+}
+
+TEST_F(kipTestFIL, FillStopsAtFirstUnmappedByte)
+{
+  // given
+  const std::string command = "FIL 7 $FFF0 $20";
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine(command);
+
+  // expect
+  EXPECT_FALSE(result);
+  EXPECT_NE(result.str.find("65536"), std::string::npos) << result.str;
+  EXPECT_EQ(memory[0xFFEF], 0xAA);
+  EXPECT_EQ(memory[0xFFF0], 7);
+  EXPECT_EQ(memory[0xFFFF], 7);
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class kipTestImports : public testing::Test
+{
+  void SetUp() override
+  {
+    folder = std::filesystem::temp_directory_path() / "kipTestImports";
+    std::filesystem::remove_all(folder);
+    std::filesystem::create_directories(folder / "lib");
+  }
+
+  void TearDown() override
+  {
+    std::filesystem::remove_all(folder);
+  }
+
+public:
+  void Write(const std::string& filename, const std::string& text)
+  {
+    std::ofstream file(folder / filename);
+    file << text;
+  }
+
+  std::vector<kip::InterpretResult> Build(std::vector<std::string>& lines)
+  {
+    context.folder = folder.string();
+    return kip::BuildContextImports(context, lines);
+  }
+
+  std::filesystem::path folder;
+  kip::Instruction::Context context;
+};
+
+TEST_F(kipTestImports, SharedImportIsIncludedOnce)
+{
+  // given
+  Write("lib/common.kip", "STB 1 $0");
+  Write("lib/a.kip", "<common.kip\nSTB 2 $1");
+  Write("lib/b.kip", "<common.kip\nSTB 3 $2");
+  std::vector<std::string> lines = { "<lib/a.kip", "<lib/b.kip", "HLT" };
+
+  // when
+  const std::vector<kip::InterpretResult> results = Build(lines);
+
+  // expect
+  ASSERT_TRUE(results.back()) << results.back().str;
+  EXPECT_EQ(std::count(lines.begin(), lines.end(), "STB 1 $0"), 1);
+  EXPECT_EQ(std::count(lines.begin(), lines.end(), "STB 2 $1"), 1);
+  EXPECT_EQ(std::count(lines.begin(), lines.end(), "STB 3 $2"), 1);
+  EXPECT_EQ(lines.back(), "HLT");
+  EXPECT_EQ(context.imports.size(), 3);
+}
+
+TEST_F(kipTestImports, CycleIsReported)
+{
+  // given
+  Write("a.kip", "<b.kip");
+  Write("b.kip", "<a.kip");
+  std::vector<std::string> lines = { "<a.kip" };
+
+  // when
+  const std::vector<kip::InterpretResult> results = Build(lines);
+
+  // expect
+  EXPECT_FALSE(results.back());
+  EXPECT_NE(results.back().str.find("cycle"), std::string::npos);
+}
+
+TEST_F(kipTestImports, MissingImportIsReported)
+{
+  // given
+  std::vector<std::string> lines = { "<missing.kip" };
+
+  // when
+  const std::vector<kip::InterpretResult> results = Build(lines);
+
+  // expect
+  EXPECT_FALSE(results.back());
+}
+
+TEST_F(kipTestImports, ModuleCacheIsSharedBetweenBuilds)
+{
+  // given
+  Write("a.kip", "STB 1 $0");
+  kip::ModuleCache modules;
+  context.modules = &modules;
+  std::vector<std::string> first = { "<a.kip" };
+  std::vector<std::string> second = { "<a.kip" };
+
+  // when
+  const std::vector<kip::InterpretResult> firstResults = Build(first);
+  Write("a.kip", "STB 2 $0");
+  const std::vector<kip::InterpretResult> secondResults = Build(second);
+
+  // expect
+  EXPECT_TRUE(firstResults.back());
+  EXPECT_TRUE(secondResults.back());
+  EXPECT_EQ(second[0], "STB 1 $0");
+}
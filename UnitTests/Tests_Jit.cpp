@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+
+// Memory only reachable through functions, which the JIT must leave to the interpreter
+static std::array<unsigned char, 0x100> device;
+static unsigned deviceReads = 0;
+static unsigned deviceWrites = 0;
+
+static void ReadDevice(kip::Argument::Address offset, kip::Argument::Data* out, kip::Argument::Address count)
+{
+  ++deviceReads;
+  for (kip::Argument::Address i = 0; i < count; ++i)
+    out[i] = device[(offset + i) & 0xFF];
+}
+
+static void WriteDevice(kip::Argument::Address offset, kip::Argument::Data* in, kip::Argument::Address count)
+{
+  ++deviceWrites;
+  for (kip::Argument::Address i = 0; i < count; ++i)
+    device[(offset + i) & 0xFF] = in[i];
+}
+
+// Runs the same lines through InterpretInstructions and through the JIT, each on its own machine
+class kipTestJit : public testing::Test
+{
+  void SetUp() override
+  {
+    for (int m = 0; m < 2; ++m)
+    {
+      memory[m].fill(0);
+      machine[m].memory.MapMemory(memory[m].data(), (kip::Argument::Address)memory[m].size(), 0x0000);
+      machine[m].memory.SetStackPointer((kip::Argument::Address)memory[m].size());
+    }
+  }
+
+public:
+  void Run(std::vector<std::string> lines, uint8_t verbosity = 0)
+  {
+    kip::BuildContext(machine[0].context, lines);
+    const std::vector<kip::Instruction> inst = kip::BuildInstructions(machine[0].context, lines);
+    machine[1].context = machine[0].context;
+    program = kip::DecodeInstructions(inst, machine[1].context);
+    kip::CompileProgram(jit, program, machine[1].context, verbosity);
+
+    device.fill(0);
+    deviceReads = deviceWrites = 0;
+    expected = kip::InterpretInstructions(inst, machine[0], verbosity);
+    expectedDevice = device;
+    expectedReads = deviceReads;
+    expectedWrites = deviceWrites;
+
+    device.fill(0);
+    deviceReads = deviceWrites = 0;
+    results = kip::InterpretJitProgram(jit, machine[1]);
+  }
+
+  void ExpectSameAsInterpreter()
+  {
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+      EXPECT_EQ(results[i].success, expected[i].success);
+      EXPECT_EQ(results[i].str, expected[i].str);
+    }
+    EXPECT_EQ(memory[1], memory[0]);
+    EXPECT_EQ(device, expectedDevice);
+    EXPECT_EQ(deviceReads, expectedReads);
+    EXPECT_EQ(deviceWrites, expectedWrites);
+    EXPECT_EQ(machine[1].context.executed, machine[0].context.executed);
+    kip::Argument::Address stack[2] = {};
+    machine[0].memory.GetStackPointer(stack[0]);
+    machine[1].memory.GetStackPointer(stack[1]);
+    EXPECT_EQ(stack[1], stack[0]);
+  }
+
+  kip::Machine machine[2];
+  std::array<unsigned char, 0x2000> memory[2]; // Two whole pages, so the translation cache is used
+  kip::Program program;
+  kip::JitProgram jit;
+  std::vector<kip::InterpretResult> expected;
+  std::vector<kip::InterpretResult> results;
+  std::array<unsigned char, 0x100> expectedDevice;
+  unsigned expectedReads = 0;
+  unsigned expectedWrites = 0;
+};
+
+TEST_F(kipTestJit, ArithmeticMatchesInterpreter)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STB 200 $20",
+    "STA $11223344 $40",
+    ">loop",
+    "ADB *$20 7 $21",
+    "SBB *$21 *$20 $22",
+    "MLB *$20 3 $23",
+    "DVB *$20 7 $24",
+    "MDA *$20 7 $25",
+    "AND *$20 $5A $26",
+    "BOR *$20 $81 $27",
+    "XOR *$20 *$21 $28",
+    "NOT *$20 $29",
+    "BLS *$20 3 $2A",
+    "BRS *$20 2 $2B",
+    "ADA *$40 *$20 $44",
+    "SBA *$44 $1000 $48",
+    "MLA *$48 3 $4C",
+    "DVA *$4C 5 $50",
+    "INA $40",
+    "DCA $44",
+    "INB $2C",
+    "DCB $20",
+    "JNE loop *$20 0",
+    "HLT",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_GT(jit.compiled, 20);
+  EXPECT_EQ(jit.interpreted, 0);
+}
+
+TEST_F(kipTestJit, CallsAndReturnsMatchInterpreter)
+{
+  // given
+  std::vector<std::string> lines = {
+    "JMP START",
+    ">double",
+    "POA $100",
+    "POB $104",
+    "ADB *$104 *$104 $105",
+    "PUB *$105",
+    "JMP *$100",
+    ">START",
+    "STB 5 $10",
+    ">loop",
+    "PUB *$10",
+    "CAL double",
+    "POB $11",
+    "ADB *$12 *$11 $12",
+    "DCB $10",
+    "JGT loop *$10 0",
+    "JEQ end *$12 30",
+    "STB 1 $13",
+    ">end",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_EQ(memory[1][0x12], 30);
+}
+
+TEST_F(kipTestJit, UnsupportedInstructionsFallBack)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STB 3 $10",
+    ">loop",
+    "FIL *$10 $20 4",
+    "STS \"kip\" $30",
+    "CPY $30 $40 4",
+    "INB $24",
+    "DCB $10",
+    "JNE loop *$10 0",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_EQ(jit.interpreted, 3);
+  EXPECT_GT(jit.compiled, 0);
+}
+
+TEST_F(kipTestJit, FunctionMappedMemoryFallsBack)
+{
+  // given
+  for (int m = 0; m < 2; ++m)
+    ASSERT_TRUE(machine[m].memory.MapMemory(ReadDevice, WriteDevice, 0x100, 0x8000));
+  std::vector<std::string> lines = {
+    "STB 4 $10",
+    ">loop",
+    "STB *$10 $8000",
+    "ADB *$8000 1 $8001",
+    "INB $8002",
+    "STB *$8001 $11",
+    "DCB $10",
+    "JNE loop *$10 0",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_GT(deviceReads, 0);
+  EXPECT_EQ(jit.interpreted, 0);
+}
+
+TEST_F(kipTestJit, FailuresReportTheSame)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STB 3 $10",
+    ">loop",
+    "DCB $10",
+    "JNE loop *$10 0",
+    "STB 1 $11",
+    "STB 1 $9000",
+    "STB 1 $12",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  ASSERT_FALSE(results.empty());
+  EXPECT_FALSE(results.back());
+  EXPECT_EQ(memory[1][0x12], 0);
+}
+
+TEST_F(kipTestJit, AccessesAcrossPagesMatchInterpreter)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STA $FFE $10",
+    "STA $12345678 *$10",
+    "STA $10 $1FFC",
+    "STA *$1FFC $20",
+    "INA **$1FFC",
+    "PUA *$FFE",
+    "POA $30",
+    "STB 1 $2000",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_EQ(memory[1][0x30], 0x79);
+}
+
+TEST_F(kipTestJit, TracesMatchInterpreter)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STB 3 $10",
+    ">loop",
+    "PUB *$10",
+    "POB $11",
+    "ADB *$11 *$12 $12",
+    "DCB $10",
+    "JNE loop *$10 0",
+    "RDB $12",
+  };
+
+  // when
+  Run(lines, 120);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_GT(jit.compiled, 0);
+  EXPECT_GT(jit.interpreted, 0);
+}
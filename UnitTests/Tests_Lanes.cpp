@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <memory>
+
+// Runs lines over every lane with InterpretLanes, and over a copy of each lane's memory with InterpretProgram
+class kipTestLanes : public testing::Test
+{
+public:
+  // Every lane gets 0x100 bytes, with its own input at $40
+  void Create(size_t count)
+  {
+    for (int m = 0; m < 2; ++m)
+    {
+      machines[m].clear();
+      memory[m].assign(count, {});
+      for (size_t l = 0; l < count; ++l)
+      {
+        for (size_t i = 0; i < 0x10; ++i)
+          memory[m][l][0x40 + i] = (unsigned char)(l * 37 + i * 11);
+        machines[m].push_back(std::make_unique<kip::Machine>());
+        machines[m][l]->memory.MapMemory(memory[m][l].data(), (kip::Argument::Address)memory[m][l].size(), 0x0000);
+        machines[m][l]->memory.SetStackPointer((kip::Argument::Address)memory[m][l].size());
+      }
+    }
+  }
+
+  void Run(std::vector<std::string> lines, uint8_t verbosity = 0)
+  {
+    kip::Instruction::Context context;
+    kip::BuildContext(context, lines);
+    const kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+    std::vector<kip::Machine*> lanes;
+    for (std::unique_ptr<kip::Machine>& machine : machines[1])
+      lanes.push_back(machine.get());
+
+    expected.clear();
+    for (std::unique_ptr<kip::Machine>& machine : machines[0])
+      expected.push_back(kip::InterpretProgram(program, *machine, verbosity));
+    report = kip::LaneReport();
+    results = kip::InterpretLanes(program, lanes, report, verbosity);
+  }
+
+  void ExpectSameAsInterpreter()
+  {
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t l = 0; l < expected.size(); ++l)
+    {
+      ASSERT_EQ(results[l].size(), expected[l].size()) << "lane " << l;
+      for (size_t i = 0; i < expected[l].size(); ++i)
+      {
+        EXPECT_EQ(results[l][i].success, expected[l][i].success);
+        EXPECT_EQ(results[l][i].str, expected[l][i].str);
+      }
+      EXPECT_EQ(memory[1][l], memory[0][l]) << "lane " << l;
+      EXPECT_EQ(machines[1][l]->context.executed, machines[0][l]->context.executed);
+      EXPECT_EQ(machines[1][l]->context.line, machines[0][l]->context.line);
+    }
+  }
+
+  std::vector<std::unique_ptr<kip::Machine>> machines[2];
+  std::vector<std::array<unsigned char, 0x100>> memory[2];
+  std::vector<std::vector<kip::InterpretResult>> expected;
+  std::vector<std::vector<kip::InterpretResult>> results;
+  kip::LaneReport report;
+};
+
+// Adds and xors the 16 input bytes into $20 and $21
+static const std::vector<std::string> checksumLines = {
+  "STB 16 $10",
+  "STA $40 $30",
+  ">loop",
+  "ADB *$20 **$30 $20",
+  "XOR *$21 **$30 $21",
+  "MLB *$20 3 $22",
+  "AND *$22 $F0 $23",
+  "BOR *$23 *$21 $24",
+  "SBB *$24 *$20 $25",
+  "NOT *$25 $26",
+  "INA $30",
+  "DCB $10",
+  "JNE loop *$10 0",
+};
+
+TEST_F(kipTestLanes, ConvergedLanesRunInLockstep)
+{
+  // given
+  Create(37);
+
+  // when
+  Run(checksumLines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_EQ(report.splits, 0);
+  EXPECT_EQ(report.lockstep, 37 * 16 * 7);
+  EXPECT_NE(memory[1][0][0x20], memory[1][1][0x20]);
+}
+
+TEST_F(kipTestLanes, DivergedLanesMatchInterpreter)
+{
+  // given
+  Create(24);
+  std::vector<std::string> lines = {
+    "AND *$40 7 $10",
+    "JEQ skip *$10 0",
+    ">loop",
+    "ADB *$20 *$41 $20",
+    "JEQ odd *$10 3",
+    "XOR *$21 *$20 $21",
+    ">odd",
+    "DCB $10",
+    "JNE loop *$10 0",
+    ">skip",
+    "NOT *$20 $22",
+    "JLT end *$42 $80",
+    "HLT",
+    ">end",
+    "STB 1 $23",
+  };
+
+  for (uint8_t verbosity : { 0, 255 })
+  {
+    // when
+    Create(24);
+    Run(lines, verbosity);
+
+    // expect
+    ExpectSameAsInterpreter();
+    EXPECT_GT(report.splits, 0);
+    if (verbosity == 0)
+      EXPECT_GT(report.lockstep, 0);
+    else
+      EXPECT_EQ(report.lockstep, 0);
+  }
+}
+
+TEST_F(kipTestLanes, FailingLanesStopAlone)
+{
+  // given
+  Create(8);
+  for (int m = 0; m < 2; ++m)
+    memory[m][5][0x31] = 0x10; // Points its writes outside memory
+  std::vector<std::string> lines = {
+    "ADB *$40 1 *$30",
+    "XOR *$41 *$30 $31",
+    "STB 1 $32",
+  };
+
+  // when
+  Run(lines);
+
+  // expect
+  ExpectSameAsInterpreter();
+  EXPECT_FALSE(results[5].back());
+  EXPECT_TRUE(results[4].back());
+  EXPECT_EQ(memory[1][5][0x32], 0);
+  EXPECT_EQ(memory[1][4][0x32], 1);
+  EXPECT_EQ(report.scalar, 1 + 7); // The failure, then STB on the other lanes
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <thread>
+
+class kipTestMachine : public testing::Test
+{
+  void SetUp() override
+  {
+    for (unsigned i = 0; i < machines.size(); ++i)
+    {
+      memory[i].fill(0);
+      machines[i].memory.MapMemory(memory[i].data(), (kip::Argument::Address)memory[i].size(), 0x0000);
+      machines[i].memory.SetStackPointer((kip::Argument::Address)memory[i].size());
+    }
+  }
+
+public:
+  std::array<kip::Machine, 2> machines;
+  std::array<std::array<unsigned char, 0x0FFF>, 2> memory; // 4k of memory per machine
+};
+
+TEST_F(kipTestMachine, MachinesHaveSeparateAddressSpaces)
+{
+  // given
+  const std::string command = "STB 10 $0100";
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine(command, machines[0]);
+
+  // expect
+  EXPECT_TRUE(result);
+  EXPECT_EQ(memory[0][0x0100], 10);
+  EXPECT_EQ(memory[1][0x0100], 0);
+}
+
+TEST_F(kipTestMachine, MachinesHaveSeparateStackPointers)
+{
+  // given
+  kip::Argument::Address stack0 = 0;
+  kip::Argument::Address stack1 = 0;
+
+  // when
+  const kip::InterpretResult result = kip::InterpretLine("PUA $AABBCC", machines[1]);
+  machines[0].memory.GetStackPointer(stack0);
+  machines[1].memory.GetStackPointer(stack1);
+
+  // expect
+  EXPECT_TRUE(result);
+  EXPECT_EQ(stack0, memory[0].size());
+  EXPECT_EQ(stack1, memory[1].size() - 4);
+}
+
+TEST_F(kipTestMachine, MachinesRunConcurrently)
+{
+  // given
+  std::array<std::vector<std::string>, 2> lines;
+  for (unsigned i = 0; i < lines.size(); ++i)
+    for (unsigned j = 0; j < 200; ++j)
+      lines[i].push_back("STB " + std::to_string(i + 1) + " " + std::to_string(j));
+  std::array<std::vector<kip::InterpretResult>, 2> results;
+
+  // when
+  std::thread t0([&]() { results[0] = kip::InterpretLines(lines[0], machines[0], 0); });
+  std::thread t1([&]() { results[1] = kip::InterpretLines(lines[1], machines[1], 0); });
+  t0.join();
+  t1.join();
+
+  // expect
+  EXPECT_TRUE(results[0].back());
+  EXPECT_TRUE(results[1].back());
+  for (unsigned j = 0; j < 200; ++j)
+  {
+    EXPECT_EQ(memory[0][j], 1);
+    EXPECT_EQ(memory[1][j], 2);
+  }
+}
@@ -0,0 +1,427 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+class kipTestMemory : public testing::Test
+{
+  void TearDown() override
+  {
+    kip::UnmapMemory(ram.data());
+    kip::UnmapMemory(deviceA.data());
+    kip::UnmapMemory(deviceB.data());
+  }
+
+public:
+  std::array<unsigned char, 0x2000> ram;
+  std::array<unsigned char, 0x0010> deviceA;
+  std::array<unsigned char, 0x0010> deviceB;
+};
+
+TEST_F(kipTestMemory, SmallBlocksShareAPage)
+{
+  // given
+  kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x3000);
+  kip::MapMemory(deviceB.data(), (kip::Argument::Address)deviceB.size(), 0x3020);
+
+  // when
+  const bool writeA = kip::WriteByte(0x300F, 0xAA);
+  const bool writeB = kip::WriteByte(0x3020, 0xBB);
+  const bool writeGap = kip::WriteByte(0x3010, 0xCC);
+
+  // expect
+  EXPECT_TRUE(writeA);
+  EXPECT_TRUE(writeB);
+  EXPECT_FALSE(writeGap);
+  EXPECT_EQ(deviceA[0xF], 0xAA);
+  EXPECT_EQ(deviceB[0x0], 0xBB);
+}
+
+TEST_F(kipTestMemory, OverlappingMapIsRejected)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+
+  // when
+  const bool inside = kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x1000);
+  const bool straddling = kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x1FF8);
+  const bool after = kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x2000);
+
+  // expect
+  EXPECT_FALSE(inside);
+  EXPECT_FALSE(straddling);
+  EXPECT_TRUE(after);
+}
+
+TEST_F(kipTestMemory, WriteBytesSpansAdjacentBlocks)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x2000);
+  unsigned char bytes[] = { 1, 2, 3, 4 };
+
+  // when
+  const bool result = kip::WriteBytes(0x1FFE, bytes, sizeof(bytes));
+
+  // expect
+  EXPECT_TRUE(result);
+  EXPECT_EQ(ram[0x1FFE], 1);
+  EXPECT_EQ(ram[0x1FFF], 2);
+  EXPECT_EQ(deviceA[0x0], 3);
+  EXPECT_EQ(deviceA[0x1], 4);
+}
+
+TEST_F(kipTestMemory, UnmappedBlockIsNoLongerReachable)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  kip::UnmapMemory(ram.data());
+  kip::Argument::Data byte = 0;
+
+  // when
+  const bool result = kip::ReadByte(0x0100, byte);
+
+  // expect
+  EXPECT_FALSE(result);
+}
+
+// Records the spans a function-mapped block is handed
+static std::array<unsigned char, 0x40> device;
+static std::vector<kip::Argument::Address> deviceSpans;
+
+static void ReadDevice(kip::Argument::Address offset, kip::Argument::Data* out, kip::Argument::Address count)
+{
+  deviceSpans.push_back(count);
+  for (kip::Argument::Address i = 0; i < count; ++i)
+    out[i] = device[offset + i];
+}
+
+static void WriteDevice(kip::Argument::Address offset, kip::Argument::Data* in, kip::Argument::Address count)
+{
+  deviceSpans.push_back(count);
+  for (kip::Argument::Address i = 0; i < count; ++i)
+    device[offset + i] = in[i];
+}
+
+TEST_F(kipTestMemory, FillBytesSpansBlocksAndStopsAtGaps)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x2000);
+  ram.fill(0);
+  deviceA.fill(0);
+  kip::Argument::Address failed = 0;
+
+  // when
+  const bool spanning = kip::FillBytes(0x1FF0, 7, 0x18);
+  const bool gap = kip::GetDefaultMachine().memory.FillBytes(0x200C, 9, 0x10, failed);
+
+  // expect
+  EXPECT_TRUE(spanning);
+  EXPECT_EQ(ram[0x1FEF], 0);
+  EXPECT_EQ(ram[0x1FF0], 7);
+  EXPECT_EQ(ram[0x1FFF], 7);
+  EXPECT_EQ(deviceA[0x7], 7);
+  EXPECT_EQ(deviceA[0x8], 0);
+  EXPECT_FALSE(gap);
+  EXPECT_EQ(failed, 0x2010);
+  EXPECT_EQ(deviceA[0xC], 9);
+  EXPECT_EQ(deviceA[0xF], 9);
+}
+
+TEST_F(kipTestMemory, CopyBytesMayOverlap)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x2000);
+  for (size_t i = 0; i < ram.size(); ++i)
+    ram[i] = (unsigned char)i;
+  deviceA.fill(0xEE);
+
+  // when
+  const bool up = kip::CopyBytes(0x0102, 0x0100, 8);
+  const bool down = kip::CopyBytes(0x0200, 0x0202, 8);
+  const bool acrossBlocks = kip::CopyBytes(0x1FFC, 0x1FF8, 0x10); // Overlapping, and ending in deviceA
+
+  // expect
+  EXPECT_TRUE(up);
+  EXPECT_EQ(ram[0x0101], 0x01);
+  for (unsigned i = 0; i < 8; ++i)
+    EXPECT_EQ(ram[0x0102 + i], (unsigned char)(0x00 + i));
+  EXPECT_TRUE(down);
+  for (unsigned i = 0; i < 8; ++i)
+    EXPECT_EQ(ram[0x0200 + i], (unsigned char)(0x02 + i));
+  EXPECT_EQ(ram[0x0208], 0x08);
+  EXPECT_TRUE(acrossBlocks);
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_EQ(ram[0x1FFC + i], (unsigned char)(0xF8 + i));
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_EQ(deviceA[i], (unsigned char)(0xFC + i));
+  for (unsigned i = 4; i < 0x10; ++i)
+    EXPECT_EQ(deviceA[i], 0xEE);
+}
+
+TEST_F(kipTestMemory, CopyBytesWritesNothingUnlessBothRangesAreMapped)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  kip::MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x2000);
+  ram.fill(1);
+  deviceA.fill(0);
+
+  // when
+  const bool pastDestination = kip::CopyBytes(0x2008, 0x0100, 0x10);
+  const bool pastSource = kip::CopyBytes(0x0100, 0x2008, 0x10);
+
+  // expect
+  EXPECT_FALSE(pastDestination);
+  EXPECT_FALSE(pastSource);
+  EXPECT_EQ(deviceA[0x8], 0);
+  EXPECT_EQ(ram[0x0100], 1);
+  EXPECT_TRUE(kip::GetDefaultMachine().memory.CanRead(0x1FF0, 0x20));
+  EXPECT_FALSE(kip::GetDefaultMachine().memory.CanRead(0x1FF0, 0x21));
+}
+
+TEST_F(kipTestMemory, FunctionBlocksAreHandedWholeSpans)
+{
+  // given
+  kip::MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  ASSERT_TRUE(kip::MapMemory(ReadDevice, WriteDevice, (kip::Argument::Address)device.size(), 0x4000));
+  device.fill(0);
+  deviceSpans.clear();
+  ram.fill(3);
+
+  // when
+  const bool filled = kip::FillBytes(0x4000, 5, 0x20);
+  const bool copied = kip::CopyBytes(0x4010, 0x0000, 0x31); // One past the end of the device
+  kip::UnmapMemory(0x4000);
+
+  // expect
+  EXPECT_TRUE(filled);
+  EXPECT_FALSE(copied);
+  EXPECT_EQ(device[0x0F], 5);
+  EXPECT_EQ(device[0x10], 5);
+  EXPECT_EQ(deviceSpans, std::vector<kip::Argument::Address>({ 0x20 }));
+}
+
+// A device mapped with a context pointer, recording each call it gets
+struct SpanDevice
+{
+  std::array<unsigned char, 0x10000> data = {};
+  std::vector<std::pair<char, kip::Argument::Address>> calls;
+};
+
+static void ReadSpan(void* context, kip::Argument::Address offset, kip::Argument::Data* out, kip::Argument::Address count)
+{
+  SpanDevice& device = *static_cast<SpanDevice*>(context);
+  device.calls.push_back({ 'R', count });
+  std::memcpy(out, device.data.data() + offset, count);
+}
+
+static void WriteSpan(void* context, kip::Argument::Address offset, const kip::Argument::Data* in, kip::Argument::Address count)
+{
+  SpanDevice& device = *static_cast<SpanDevice*>(context);
+  device.calls.push_back({ 'W', count });
+  std::memcpy(device.data.data() + offset, in, count);
+}
+
+TEST_F(kipTestMemory, GuestInstructionsReachDevicesOncePerSpan)
+{
+  // given
+  kip::Machine machine;
+  SpanDevice device;
+  for (size_t i = 0; i < ram.size(); ++i)
+    ram[i] = (unsigned char)(i * 7);
+  machine.memory.MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  ASSERT_TRUE(machine.memory.MapMemory(ReadSpan, WriteSpan, &device, (kip::Argument::Address)device.data.size(), 0x4000));
+
+  // when
+  const bool stored = kip::InterpretLine("STS \"span\" $4000", machine);
+  const bool copied = kip::InterpretLine("CPY $0000 $4100 $200", machine);
+  const bool saved = kip::InterpretLine("SAV $4100 $200 \"kipTestMemory.bin\"", machine);
+  const bool loaded = kip::InterpretLine("BIN \"kipTestMemory.bin\" $4400", machine);
+  std::remove("kipTestMemory.bin");
+
+  // expect
+  EXPECT_TRUE(stored);
+  EXPECT_TRUE(copied);
+  EXPECT_TRUE(saved);
+  EXPECT_TRUE(loaded);
+  EXPECT_EQ(std::string((const char*)device.data.data()), "span");
+  for (unsigned i = 0; i < 0x200; ++i)
+  {
+    EXPECT_EQ(device.data[0x100 + i], ram[i]);
+    EXPECT_EQ(device.data[0x400 + i], ram[i]);
+  }
+  EXPECT_EQ(device.calls, (std::vector<std::pair<char, kip::Argument::Address>>({ { 'W', 5 }, { 'W', 0x200 }, { 'R', 0x200 }, { 'W', 0x200 } })));
+}
+
+TEST_F(kipTestMemory, BulkAccessesReachDevicesOncePerSpan)
+{
+  // given
+  kip::Machine machine;
+  SpanDevice device;
+  for (size_t i = 0; i < ram.size(); ++i)
+    ram[i] = (unsigned char)(i * 3);
+  machine.memory.MapMemory(ram.data(), (kip::Argument::Address)ram.size(), 0x0000);
+  ASSERT_TRUE(machine.memory.MapMemory(ReadSpan, WriteSpan, &device, (kip::Argument::Address)device.data.size(), 0x10000));
+
+  // when
+  const bool filled = machine.memory.FillBytes(0x10000, 9, 0x10000);
+  const bool copiedOut = machine.memory.CopyBytes(0x10000, 0x0000, 0x2000);
+  const bool copiedIn = machine.memory.CopyBytes(0x0001, 0x10000, 0x1FFF);
+
+  // expect
+  EXPECT_TRUE(filled);
+  EXPECT_TRUE(copiedOut);
+  EXPECT_TRUE(copiedIn);
+  EXPECT_EQ(device.data[0x2000], 9);
+  EXPECT_EQ(device.data[0xFFFF], 9);
+  EXPECT_EQ(device.data[0x1FFF], (unsigned char)(0x1FFF * 3));
+  EXPECT_EQ(ram[0x0000], 0);
+  for (unsigned i = 1; i < 0x2000; ++i)
+    EXPECT_EQ(ram[i], (unsigned char)((i - 1) * 3));
+  EXPECT_EQ(device.calls, (std::vector<std::pair<char, kip::Argument::Address>>({ { 'W', 0x10000 }, { 'W', 0x2000 }, { 'R', 0x1FFF } })));
+}
+
+TEST_F(kipTestMemory, FlatMemoryFaultsBackIntoTheBlockLookup)
+{
+  // given
+  kip::Machine machine;
+  kip::Memory& memory = machine.memory;
+  if (!memory.ReserveFlat())
+    GTEST_SKIP() << "Flat mode isn't available on this host";
+  kip::Argument::Data* committed = memory.CommitMemory(0x2000, 0x10000);
+  ASSERT_NE(committed, nullptr);
+  ASSERT_TRUE(memory.MapMemory(deviceA.data(), (kip::Argument::Address)deviceA.size(), 0x20000));
+  ASSERT_TRUE(memory.MapMemory(ReadDevice, WriteDevice, (kip::Argument::Address)device.size(), 0x30000));
+  const kip::Argument::Address address = 0x11223344;
+  kip::Argument::Address read = 0;
+
+  // when
+  const bool storedByte = kip::InterpretLine("STB 7 $10FFF", machine);
+  const bool storedAddress = memory.WriteBytes(0x11FFC, (kip::Argument::Data*)&address, sizeof(address));
+  const bool readAddress = memory.ReadBytes(0x11FFC, (kip::Argument::Data*)&read, sizeof(read));
+  const bool pastCommitted = memory.WriteBytes(0x11FFE, (kip::Argument::Data*)&address, sizeof(address));
+  const bool hostArray = kip::InterpretLine("STB 9 $20003", machine);
+  const bool function = kip::InterpretLine("STB 5 $30001", machine);
+  const kip::InterpretResult unmapped = kip::InterpretLine("STB 1 $12000", machine);
+  const bool topOfSpace = memory.ReadBytes(0xFFFFFFFE, (kip::Argument::Data*)&read, sizeof(read));
+
+  // expect
+  EXPECT_TRUE(memory.IsFlat());
+  EXPECT_FALSE(memory.ReserveFlat());
+  EXPECT_TRUE(storedByte);
+  EXPECT_EQ(committed[0x0FFF], 7);
+  EXPECT_TRUE(storedAddress);
+  EXPECT_TRUE(readAddress);
+  EXPECT_EQ(read, address);
+  EXPECT_FALSE(pastCommitted);
+  EXPECT_TRUE(hostArray);
+  EXPECT_EQ(deviceA[3], 9);
+  EXPECT_TRUE(function);
+  EXPECT_EQ(device[1], 5);
+  EXPECT_FALSE(unmapped);
+  EXPECT_NE(unmapped.str.find("not mapped"), std::string::npos);
+  EXPECT_FALSE(topOfSpace);
+  EXPECT_EQ(memory.CommitMemory(0x0100, 0x40000), nullptr); // Not whole pages
+  EXPECT_EQ(memory.CommitMemory(0x1000, 0x11000), nullptr); // Overlapping
+}
+
+TEST_F(kipTestMemory, FlatMemoryCopiesCommittedRangesDirectly)
+{
+  // given
+  kip::Memory memory;
+  if (!memory.ReserveFlat())
+    GTEST_SKIP() << "Flat mode isn't available on this host";
+  kip::Argument::Data* low = memory.CommitMemory(0x1000, 0x10000);
+  kip::Argument::Data* high = memory.CommitMemory(0x1000, 0x11000);
+  ASSERT_NE(low, nullptr);
+  ASSERT_NE(high, nullptr);
+  ASSERT_TRUE(memory.MapMemory(ReadDevice, WriteDevice, (kip::Argument::Address)device.size(), 0x12000));
+  const kip::Argument::Data written[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+  kip::Argument::Data read[16] = {};
+  device.fill(0);
+
+  // when
+  const bool acrossBlocks = memory.WriteBytes(0x10FF8, (kip::Argument::Data*)written, sizeof(written));
+  const bool readBack = memory.ReadBytes(0x10FF8, read, sizeof(read));
+  const bool intoDevice = memory.WriteBytes(0x11FF8, (kip::Argument::Data*)written, sizeof(written));
+
+  // expect
+  EXPECT_TRUE(acrossBlocks);
+  EXPECT_EQ(low[0xFFF], 8);
+  EXPECT_EQ(high[0x000], 9);
+  EXPECT_TRUE(readBack);
+  EXPECT_EQ(std::memcmp(read, written, sizeof(read)), 0);
+  EXPECT_TRUE(intoDevice);
+  EXPECT_EQ(high[0xFFF], 8);
+  EXPECT_EQ(device[0x0], 9);
+  EXPECT_EQ(device[0x7], 16);
+}
+
+TEST_F(kipTestMemory, UnmappedFlatMemoryIsReleased)
+{
+  // given
+  kip::Memory memory;
+  if (!memory.ReserveFlat())
+    GTEST_SKIP() << "Flat mode isn't available on this host";
+  memory.CommitMemory(0x1000, 0x5000)[0x10] = 3;
+  kip::Argument::Data byte = 0;
+
+  // when
+  const bool unmapped = memory.UnmapMemory(0x5000);
+  const bool readUnmapped = memory.ReadByte(0x5010, byte);
+  kip::Argument::Data* recommitted = memory.CommitMemory(0x1000, 0x5000);
+
+  // expect
+  EXPECT_TRUE(unmapped);
+  EXPECT_FALSE(readUnmapped);
+  ASSERT_NE(recommitted, nullptr);
+  EXPECT_EQ(recommitted[0x10], 0);
+}
+
+TEST_F(kipTestMemory, SparseMemoryAllocatesPagesOnFirstWrite)
+{
+  // given
+  kip::Machine machine;
+  kip::Memory& memory = machine.memory;
+  ASSERT_TRUE(memory.MapSparseMemory(0x01000000, 0x0000));
+  memory.SetStackPointer(0x01000000);
+  std::array<kip::Argument::Data, 0x10> bytes;
+  bytes.fill(0xAB);
+
+  // when
+  const bool zeroes = kip::InterpretLine("FIL 0 $0000 $100000", machine);
+  const size_t afterZeroes = memory.GetResidentPages();
+  const bool first = kip::InterpretLine("STB 1 $0000", machine);
+  const bool last = kip::InterpretLine("STB 2 $FFFF", machine);
+  const bool pushed = kip::InterpretLine("PUA $AABBCC", machine);
+  const bool spanning = memory.WriteBytes(0x7FF8, bytes.data(), (kip::Argument::Address)bytes.size());
+  const size_t written = memory.GetResidentPages();
+  kip::Argument::Data untouched = 0xFF;
+  std::array<kip::Argument::Data, 0x20> readBack;
+  memory.ReadByte(0x800000, untouched);
+  memory.ReadBytes(0x7FF0, readBack.data(), (kip::Argument::Address)readBack.size());
+  const size_t read = memory.GetResidentPages();
+  const bool copied = kip::InterpretLine("CPY $0000 $500000 1", machine);
+
+  // expect
+  EXPECT_TRUE(zeroes);
+  EXPECT_EQ(afterZeroes, 0);
+  EXPECT_TRUE(first);
+  EXPECT_TRUE(last);
+  EXPECT_TRUE(pushed);
+  EXPECT_TRUE(spanning);
+  EXPECT_EQ(written, 5); // $0000, $FFFF, the top of the stack, and both sides of $8000
+  EXPECT_EQ(untouched, 0);
+  EXPECT_EQ(read, written);
+  for (size_t i = 0; i < readBack.size(); ++i)
+    EXPECT_EQ(readBack[i], i >= 8 && i < 0x18 ? 0xAB : 0);
+  EXPECT_TRUE(copied);
+  EXPECT_EQ(memory.GetResidentPages(), written + 1);
+  EXPECT_TRUE(memory.UnmapMemory(kip::Argument::Address(0x0000)));
+  EXPECT_EQ(memory.GetResidentPages(), 0);
+}
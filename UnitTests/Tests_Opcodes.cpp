@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <string>
+
+TEST(kipTestOpcodes, EveryMnemonicIsFound)
+{
+  for (uint8_t id = 1; id < uint8_t(kip::Opcode::COUNT); ++id)
+  {
+    // given
+    const std::string mnemonic = kip::opcodeMnemonics[id];
+
+    // when
+    const uint8_t found = kip::GetInstructionIndex(mnemonic.data(), mnemonic.size());
+
+    // expect
+    EXPECT_EQ(found, id) << mnemonic;
+  }
+}
+
+TEST(kipTestOpcodes, NonMnemonicsAreRejected)
+{
+  // given
+  const std::string words[] = { "", "ST", "STBB", "stb", "ZZZ", "S B" };
+
+  for (const std::string& word : words)
+  {
+    // when
+    const uint8_t found = kip::GetInstructionIndex(word.data(), word.size());
+
+    // expect
+    EXPECT_EQ(found, 0) << word;
+  }
+}
+
+TEST(kipTestOpcodes, ParserUsesOpcodeIds)
+{
+  // given
+  const std::string command = "mlb 1 2 3";
+
+  // when
+  const kip::Instruction instruction(command);
+
+  // expect
+  EXPECT_EQ(instruction.id, uint8_t(kip::Opcode::MLB));
+}
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <string>
+#include <vector>
+
+class kipTestOptimizer : public testing::Test
+{
+  void SetUp() override
+  {
+    memory.fill(0);
+    machine.memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+    machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+  }
+
+public:
+  std::vector<kip::Instruction> Build(std::vector<std::string> lines)
+  {
+    machine.context = kip::Instruction::Context();
+    EXPECT_TRUE(kip::BuildContext(machine.context, lines).back());
+    return kip::BuildInstructions(machine.context, lines);
+  }
+
+  // Runs the lines with and without optimizing and checks that memory ends up the same
+  kip::OptimizationReport Compare(const std::vector<std::string>& lines)
+  {
+    std::vector<kip::Instruction> inst = Build(lines);
+    EXPECT_TRUE(kip::InterpretProgram(kip::DecodeInstructions(inst, machine.context), machine, 0).back());
+    const std::array<unsigned char, 0x0FFF> expected = memory;
+
+    SetUp();
+    inst = Build(lines);
+    const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+    EXPECT_EQ(inst.size(), lines.size());
+    EXPECT_TRUE(kip::InterpretProgram(kip::DecodeInstructions(inst, machine.context), machine, 0).back());
+    EXPECT_EQ(memory, expected);
+    return report;
+  }
+
+  kip::Machine machine;
+  std::array<unsigned char, 0x0FFF> memory; // 4k of memory
+};
+
+TEST_F(kipTestOptimizer, FoldsImmediateArithmetic)
+{
+  // given
+  std::vector<kip::Instruction> inst = Build({ "ADB 200 100 $10", "ADA $10000 $20 $20", "NOT 1 $30", "ADB *$0 1 $40" });
+
+  // when
+  const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+
+  // expect
+  EXPECT_EQ(report.folded, 3);
+  EXPECT_EQ(inst[0].id, uint8_t(kip::Opcode::STB));
+  EXPECT_EQ(inst[0].arguments[0].data, 44);
+  EXPECT_EQ(inst[1].id, uint8_t(kip::Opcode::STA));
+  EXPECT_EQ(inst[1].arguments[0].data, 0x10020);
+  EXPECT_EQ(inst[2].id, uint8_t(kip::Opcode::STB));
+  EXPECT_EQ(inst[2].arguments[0].data, 0xFE);
+  EXPECT_EQ(inst[3].id, uint8_t(kip::Opcode::ADB));
+}
+
+TEST_F(kipTestOptimizer, FoldsConstantBranches)
+{
+  // given
+  std::vector<kip::Instruction> inst = Build({ ">skip", "JEQ skip 1 1", "JEQ skip 1 2", "JEQ skip *$0 1" });
+
+  // when
+  const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+
+  // expect
+  EXPECT_EQ(report.folded, 2);
+  EXPECT_EQ(inst[1].id, uint8_t(kip::Opcode::JMP));
+  EXPECT_EQ(inst[2].id, 0);
+  EXPECT_EQ(inst[3].id, uint8_t(kip::Opcode::JEQ));
+}
+
+TEST_F(kipTestOptimizer, ReducesAddingOneToIncrement)
+{
+  // given
+  std::vector<kip::Instruction> inst = Build({ "ADB *$0 $1 $0", "SBB *$2 1 $2", "ADB 255 *$4 $4", "ADA **$8 1 *$8", "ADB *$0 2 $0" });
+
+  // when
+  const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+
+  // expect
+  EXPECT_EQ(report.reduced, 4);
+  EXPECT_EQ(inst[0].id, uint8_t(kip::Opcode::INB));
+  EXPECT_EQ(inst[1].id, uint8_t(kip::Opcode::DCB));
+  EXPECT_EQ(inst[2].id, uint8_t(kip::Opcode::DCB));
+  EXPECT_EQ(inst[3].id, uint8_t(kip::Opcode::INA));
+  EXPECT_EQ(inst[3].arguments[0].dereferenceCount, 1);
+  EXPECT_EQ(inst[4].id, uint8_t(kip::Opcode::ADB));
+}
+
+TEST_F(kipTestOptimizer, ThreadsJumpsToJumps)
+{
+  // given
+  std::vector<kip::Instruction> inst = Build({
+    "JMP first",
+    ">first",
+    "JMP second",
+    "STB 1 $0",
+    ">second",
+    "; nothing to run",
+    "STB 2 $1",
+  });
+
+  // when
+  const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+
+  // expect
+  EXPECT_GE(report.threaded, 2);
+  EXPECT_EQ(inst[0].arguments[0].data, 7); // Runs line 6 next
+  EXPECT_EQ(inst[2].arguments[0].data, 7);
+  EXPECT_EQ(machine.context.labels["FIRST"].data, 2);
+}
+
+TEST_F(kipTestOptimizer, RemovesOverwrittenStores)
+{
+  // given
+  std::vector<kip::Instruction> inst = Build({ "STB 1 $10", "STB 2 $10", "STA 1 $20", "STB 2 $20", "STB 3 $30", "ADB *$30 1 $30" });
+
+  // when
+  const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+
+  // expect
+  EXPECT_EQ(report.deadStores, 1);
+  EXPECT_EQ(report.before, 6);
+  EXPECT_EQ(report.after, 5);
+  EXPECT_EQ(inst[0].id, 0);
+  EXPECT_EQ(inst[2].id, uint8_t(kip::Opcode::STA));
+  EXPECT_EQ(inst[4].id, uint8_t(kip::Opcode::STB));
+}
+
+TEST_F(kipTestOptimizer, KeepsStoresWhoseOverwriteCanFail)
+{
+  // given
+  const std::vector<std::string> lines = { "STB 5 $10", "FIL *$FFFFFF00 $10 1", "STB 6 $20", "FIL 0 $1F 2" };
+  std::vector<kip::Instruction> inst = Build(lines);
+
+  // when
+  const kip::OptimizationReport report = kip::OptimizeInstructions(inst);
+  const std::vector<kip::InterpretResult> result = kip::InterpretProgram(kip::DecodeInstructions(inst, machine.context), machine, 0);
+
+  // expect
+  EXPECT_EQ(report.deadStores, 0);
+  EXPECT_FALSE(result.back());
+  EXPECT_EQ(memory[0x10], 5); // As left when the fill faults without optimizing
+}
+
+TEST_F(kipTestOptimizer, OptimizedProgramsBehaveTheSame)
+{
+  // given
+  const std::vector<std::string> loop = {
+    "STB 0 $10",
+    "STB 5 $10",
+    "ADB 2 3 $11",
+    ">loop",
+    "ADB *$12 $1 $12",
+    "JMP check",
+    ">check",
+    "JNE loop *$12 *$11",
+    "JEQ done 1 1",
+    "STB 99 $13",
+    ">done",
+    "HLT",
+  };
+
+  // when
+  const kip::OptimizationReport report = Compare(loop);
+
+  // expect
+  EXPECT_LT(report.after, report.before);
+  EXPECT_EQ(memory[0x12], 5);
+  EXPECT_EQ(memory[0x13], 0);
+}
@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+
+class kipTestProgram : public testing::Test
+{
+  void SetUp() override
+  {
+    memory.fill(0);
+    machine.memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+    machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+  }
+
+public:
+  kip::Machine machine;
+  std::array<unsigned char, 0x0FFF> memory; // 4k of memory
+};
+
+TEST_F(kipTestProgram, DecodeKeepsOneEntryPerLine)
+{
+  // given
+  std::vector<std::string> lines = { "STB 1 $10", "", "; comment", "STB 2 $11" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+
+  // when
+  const kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+
+  // expect
+  ASSERT_EQ(program.size(), lines.size());
+  EXPECT_EQ(program.operands.size(), lines.size() * kip::Program::MAX_OPERANDS);
+  EXPECT_NE(program.opcodes[0], 0);
+  EXPECT_EQ(program.opcodes[1], 0);
+  EXPECT_EQ(program.opcodes[2], 0);
+  EXPECT_EQ(program.GetOperands(3)[0].data, 2);
+  EXPECT_EQ(program.GetOperands(3)[1].data, 0x11);
+}
+
+TEST_F(kipTestProgram, DecodeInternsStrings)
+{
+  // given
+  std::vector<std::string> lines = { "STS \"hi\" $10", "STS \"hi\" $20", "STS \"yo\" $30" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+
+  // when
+  const kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+
+  // expect
+  ASSERT_EQ(program.strings.size(), 2);
+  EXPECT_EQ(program.GetOperands(0)[0].data, program.GetOperands(1)[0].data);
+  EXPECT_NE(program.GetOperands(0)[0].data, program.GetOperands(2)[0].data);
+}
+
+TEST_F(kipTestProgram, JumpsLandOnSourceLines)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STB 3 $10",
+    ">loop",
+    "DCB $10",
+    "INB $11",
+    "JGT loop *$10 0",
+  };
+
+  // when
+  const std::vector<kip::InterpretResult> results = kip::InterpretLines(lines, machine, 0);
+
+  // expect
+  ASSERT_FALSE(results.empty());
+  EXPECT_TRUE(results.back());
+  EXPECT_EQ(memory[0x10], 0);
+  EXPECT_EQ(memory[0x11], 3);
+}
+
+TEST_F(kipTestProgram, ProfileCountsDispatchesPerLine)
+{
+  // given
+  std::vector<std::string> lines = { "STB 3 $10", ">loop", "DCB $10", "JGT loop *$10 0" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+  const kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+  machine.context = context;
+  kip::ProgramProfile profile;
+
+  // when
+  const std::vector<kip::InterpretResult> results = kip::ProfileProgram(program, machine, profile);
+
+  // expect
+  ASSERT_TRUE(results.back());
+  ASSERT_EQ(profile.lines.size(), lines.size());
+  EXPECT_EQ(profile.lines[0], 1);
+  EXPECT_EQ(profile.lines[1], 3);
+  EXPECT_EQ(profile.lines[2], 3);
+  EXPECT_EQ(profile.lines[3], 3);
+}
+
+TEST_F(kipTestProgram, FusedProgramBehavesTheSame)
+{
+  // given
+  std::vector<std::string> lines = {
+    "STB 4 $10",
+    ">loop",
+    "PUB *$10",
+    "PUB 7",
+    "POB $11",
+    "POB $12",
+    "DCB $10",
+    "JNE loop *$10 0",
+    "HLT",
+  };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+  const kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+  machine.context = context;
+  kip::ProgramProfile profile;
+  ASSERT_TRUE(kip::ProfileProgram(program, machine, profile).back());
+  const std::array<unsigned char, 0x0FFF> expected = memory;
+  const std::vector<kip::InterpretResult> trace = kip::InterpretProgram(program, machine, 255);
+
+  // when
+  kip::Program fused = program;
+  const kip::FusionReport report = kip::FuseProgram(fused, &profile);
+  memory.fill(0);
+  machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+  const std::vector<kip::InterpretResult> fusedTrace = kip::InterpretProgram(fused, machine, 255);
+
+  // expect
+  ASSERT_EQ(report.fusions.size(), 3);
+  EXPECT_EQ(report.fusions[0].id, kip::Superinstruction::POB_POB);
+  EXPECT_EQ(report.fusions[0].fires, 4);
+  EXPECT_EQ(fused.opcodes[2], uint8_t(kip::Superinstruction::PUB_PUB));
+  EXPECT_EQ(fused.GetOpcode(2), uint8_t(kip::Opcode::PUB));
+  EXPECT_EQ(fused.opcodes[3], uint8_t(kip::Opcode::PUB));
+  EXPECT_EQ(memory, expected);
+  ASSERT_EQ(fusedTrace.size(), trace.size());
+  for (size_t i = 0; i < trace.size(); ++i)
+    EXPECT_EQ(fusedTrace[i].str, trace[i].str);
+}
+
+TEST_F(kipTestProgram, JumpIntoFusedPairRunsTheSecondLine)
+{
+  // given
+  std::vector<std::string> lines = { "JMP 3", "PUB 1", "PUB 2", "POB $10", "HLT" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+  kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+  machine.context = context;
+
+  // when
+  const kip::FusionReport report = kip::FuseProgram(program);
+  const std::vector<kip::InterpretResult> results = kip::InterpretProgram(program, machine, 0);
+
+  // expect
+  ASSERT_EQ(report.fusions.size(), 1);
+  EXPECT_EQ(report.fusions[0].sites, 1);
+  ASSERT_TRUE(results.back());
+  EXPECT_EQ(memory[0x10], 2);
+  EXPECT_EQ(machine.context.executed, 4);
+}
+
+TEST_F(kipTestProgram, ColdPairsAreNotFused)
+{
+  // given
+  std::vector<std::string> lines = { "PUB 1", "PUB 2", "STB 3 $10", ">loop", "PUB 1", "PUB 2", "DCB $10", "JNE loop *$10 0" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+  kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, lines), context);
+  machine.context = context;
+  kip::ProgramProfile profile;
+  ASSERT_TRUE(kip::ProfileProgram(program, machine, profile).back());
+
+  // when
+  kip::FuseProgram(program, &profile, 2);
+
+  // expect
+  EXPECT_EQ(program.opcodes[0], uint8_t(kip::Opcode::PUB));
+  EXPECT_EQ(program.opcodes[4], uint8_t(kip::Superinstruction::PUB_PUB));
+}
+
+TEST_F(kipTestProgram, UnresolvableOperandsFailTheInstruction)
+{
+  // given
+  std::vector<std::string> lines = { "STA $F000 $20", "STB **$20 $10", "STB 1 $11" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+  const std::vector<kip::Instruction> inst = kip::BuildInstructions(context, lines);
+  const kip::Bytecode::Data bc = kip::CompileInstructionsToBytecode(inst, context);
+
+  // when
+  std::vector<std::vector<kip::InterpretResult>> runs;
+  runs.push_back(kip::InterpretInstructions(inst, machine.memory, context, 0));
+  runs.push_back(kip::InterpretProgram(kip::DecodeInstructions(inst, context), machine, 0));
+  runs.push_back(kip::InterpretBytecode(bc, machine, 0));
+
+  // expect
+  for (const std::vector<kip::InterpretResult>& results : runs)
+  {
+    ASSERT_FALSE(results.empty());
+    EXPECT_FALSE(results.back());
+    EXPECT_NE(results.back().str.find("Could not read byte at address: 61440"), std::string::npos) << results.back().str;
+  }
+  EXPECT_EQ(memory[0x11], 0);
+}
+
+TEST_F(kipTestProgram, UnresolvableJumpTargetsFailTheJump)
+{
+  // given
+  std::vector<std::string> lines = { "STA $F000 $20", "JMP **$20", "STB 1 $11" };
+
+  // when
+  const std::vector<kip::InterpretResult> results = kip::InterpretLines(lines, machine, 0);
+
+  // expect
+  ASSERT_FALSE(results.empty());
+  EXPECT_FALSE(results.back());
+  EXPECT_NE(results.back().str.find("Could not dereference address: 61440"), std::string::npos) << results.back().str;
+  EXPECT_EQ(memory[0x11], 0);
+}
+
+TEST_F(kipTestProgram, RunForResumesWhereTheSliceEnded)
+{
+  // given
+  std::vector<std::string> lines = { "STB 10 $10", ">loop", "PUB *$10", "POB $11", "ADB *$12 *$11 $12", "DCB $10", "JNE loop *$10 0" };
+  kip::Instruction::Context context;
+  kip::BuildContext(context, lines);
+  const std::vector<kip::Instruction> inst = kip::BuildInstructions(context, lines);
+  const kip::Program program = kip::DecodeInstructions(inst, context);
+  kip::StartProgram(program, machine.context);
+
+  // when
+  std::vector<kip::InterpretResult> results;
+  std::vector<kip::StopReason> reasons;
+  do
+    reasons.push_back(kip::RunProgramFor(program, machine, 7, results));
+  while (reasons.back() == kip::StopReason::BUDGET);
+
+  // expect
+  EXPECT_EQ(reasons.back(), kip::StopReason::FINISHED);
+  EXPECT_EQ(machine.context.executed, 51);
+  EXPECT_EQ(reasons.size(), 8);
+  EXPECT_TRUE(results.empty());
+  EXPECT_EQ(memory[0x12], 55);
+  kip::Argument::Address stack = 0;
+  machine.memory.GetStackPointer(stack);
+  EXPECT_EQ(stack, memory.size());
+}
+
+TEST_F(kipTestProgram, RunForReportsWhyItStopped)
+{
+  // given
+  std::vector<std::vector<std::string>> sources = { { "STB 1 $10", "HLT", "STB 1 $11" }, { "STB 1 $10", "STB 1 $9000", "STB 1 $11" } };
+  std::vector<kip::StopReason> reasons;
+  std::vector<std::vector<kip::InterpretResult>> results(sources.size());
+
+  // when
+  for (size_t s = 0; s < sources.size(); ++s)
+  {
+    kip::Instruction::Context context;
+    kip::BuildContext(context, sources[s]);
+    const kip::Program program = kip::DecodeInstructions(kip::BuildInstructions(context, sources[s]), context);
+    kip::StartProgram(program, machine.context);
+    EXPECT_EQ(kip::RunProgramFor(program, machine, 1, results[s], 255), kip::StopReason::BUDGET);
+    reasons.push_back(kip::RunProgramFor(program, machine, 100, results[s], 255));
+  }
+
+  // expect
+  EXPECT_EQ(reasons[0], kip::StopReason::HALTED);
+  EXPECT_EQ(reasons[1], kip::StopReason::FAULT);
+  ASSERT_FALSE(results[1].empty());
+  EXPECT_FALSE(results[1].back());
+  EXPECT_EQ(memory[0x10], 1);
+  EXPECT_EQ(memory[0x11], 0);
+}
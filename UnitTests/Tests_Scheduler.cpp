@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <atomic>
+#include <memory>
+
+// Sums *$10 down to 1 into $12
+static const std::vector<std::string> summingLines = {
+  ">loop",
+  "ADB *$12 *$10 $12",
+  "DCB $10",
+  "JNE loop *$10 0",
+};
+
+class kipTestScheduler : public testing::Test
+{
+public:
+  std::shared_ptr<const kip::Program> Build(std::vector<std::string> lines)
+  {
+    kip::Instruction::Context context;
+    kip::BuildContext(context, lines);
+    return std::make_shared<const kip::Program>(kip::DecodeInstructions(kip::BuildInstructions(context, lines), context));
+  }
+
+  // A machine on the given memory, with n to be summed
+  std::unique_ptr<kip::Machine> Create(std::array<unsigned char, 0x100>& memory, unsigned char n)
+  {
+    memory.fill(0);
+    memory[0x10] = n;
+    std::unique_ptr<kip::Machine> machine = std::make_unique<kip::Machine>();
+    machine->memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+    machine->memory.SetStackPointer((kip::Argument::Address)memory.size());
+    return machine;
+  }
+
+  std::vector<std::array<unsigned char, 0x100>> memory;
+};
+
+TEST_F(kipTestScheduler, EveryMachineRunsToCompletion)
+{
+  // given
+  const std::shared_ptr<const kip::Program> program = Build(summingLines);
+  memory.resize(64);
+  std::vector<kip::StopReason> reasons(memory.size(), kip::StopReason::BUDGET);
+  std::vector<std::string> last(memory.size());
+  kip::Scheduler scheduler(4, 16);
+
+  // when
+  for (size_t m = 0; m < memory.size(); ++m)
+  {
+    scheduler.Submit(program, Create(memory[m], (unsigned char)(m % 20 + 1)), [&, m](std::unique_ptr<kip::Machine>&, kip::StopReason reason, std::vector<kip::InterpretResult>& results)
+    {
+      reasons[m] = reason;
+      last[m] = results.back().str;
+    });
+  }
+  scheduler.Wait();
+
+  // expect
+  for (size_t m = 0; m < memory.size(); ++m)
+  {
+    const unsigned n = m % 20 + 1;
+    EXPECT_EQ(reasons[m], kip::StopReason::FINISHED);
+    EXPECT_EQ(last[m], "Executed successfully");
+    EXPECT_EQ(memory[m][0x12], n * (n + 1) / 2);
+  }
+  const kip::Scheduler::Stats stats = scheduler.GetStats();
+  EXPECT_EQ(stats.submitted, memory.size());
+  EXPECT_EQ(stats.completed, memory.size());
+  EXPECT_GT(stats.slices, memory.size());
+}
+
+TEST_F(kipTestScheduler, CompletionsReportHaltsAndFaults)
+{
+  // given
+  const std::shared_ptr<const kip::Program> halting = Build({ "STB 1 $11", "HLT", "STB 1 $12" });
+  const std::shared_ptr<const kip::Program> faulting = Build({ "STB 1 $11", "STB 1 $9000", "STB 1 $12" });
+  memory.resize(2);
+  std::vector<kip::StopReason> reasons(2, kip::StopReason::BUDGET);
+  std::vector<bool> succeeded(2, false);
+  kip::Scheduler scheduler(2, 1);
+
+  // when
+  scheduler.Submit(halting, Create(memory[0], 0), [&](std::unique_ptr<kip::Machine>&, kip::StopReason reason, std::vector<kip::InterpretResult>& results)
+  {
+    reasons[0] = reason;
+    succeeded[0] = results.back().success;
+  });
+  scheduler.Submit(faulting, Create(memory[1], 0), [&](std::unique_ptr<kip::Machine>&, kip::StopReason reason, std::vector<kip::InterpretResult>& results)
+  {
+    reasons[1] = reason;
+    succeeded[1] = results.back().success;
+  });
+  scheduler.Wait();
+
+  // expect
+  EXPECT_EQ(reasons[0], kip::StopReason::HALTED);
+  EXPECT_TRUE(succeeded[0]);
+  EXPECT_EQ(reasons[1], kip::StopReason::FAULT);
+  EXPECT_FALSE(succeeded[1]);
+  EXPECT_EQ(memory[0][0x11], 1);
+  EXPECT_EQ(memory[0][0x12], 0);
+  EXPECT_EQ(memory[1][0x12], 0);
+}
+
+TEST_F(kipTestScheduler, WorkSubmittedFromACompletionIsStolen)
+{
+  // given
+  const std::shared_ptr<const kip::Program> program = Build({
+    "STB 255 $10",
+    ">outer",
+    "STB 255 $11",
+    ">inner",
+    "DCB $11",
+    "JNE inner *$11 0",
+    "DCB $10",
+    "JNE outer *$10 0",
+  });
+  memory.resize(33);
+  std::atomic<unsigned> finished{0};
+  kip::Scheduler scheduler(4, 1000);
+  const kip::Scheduler::Completion count = [&](std::unique_ptr<kip::Machine>&, kip::StopReason reason, std::vector<kip::InterpretResult>&)
+  {
+    if (reason == kip::StopReason::FINISHED)
+      ++finished;
+  };
+
+  // when
+  scheduler.Submit(program, Create(memory[0], 0), [&](std::unique_ptr<kip::Machine>& machine, kip::StopReason reason, std::vector<kip::InterpretResult>& results)
+  {
+    count(machine, reason, results);
+    for (size_t m = 1; m < memory.size(); ++m)
+      scheduler.Submit(program, Create(memory[m], 0), count);
+  });
+  scheduler.Wait();
+
+  // expect
+  EXPECT_EQ(finished, memory.size());
+  if (scheduler.ThreadCount() > 1)
+  {
+    EXPECT_GT(scheduler.GetStats().steals, 0);
+  }
+}
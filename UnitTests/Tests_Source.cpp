@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class kipTestSource : public testing::Test
+{
+  void SetUp() override
+  {
+    folder = std::filesystem::temp_directory_path() / "kipTestSource";
+    std::filesystem::remove_all(folder);
+    std::filesystem::create_directories(folder);
+    memory.fill(0);
+    machine.memory.MapMemory(memory.data(), (kip::Argument::Address)memory.size(), 0x0000);
+    machine.memory.SetStackPointer((kip::Argument::Address)memory.size());
+  }
+
+  void TearDown() override
+  {
+    std::filesystem::remove_all(folder);
+  }
+
+public:
+  std::string Write(const std::string& filename, const std::string& text)
+  {
+    std::ofstream file(folder / filename, std::ios::binary);
+    file << text;
+    return (folder / filename).string();
+  }
+
+  std::filesystem::path folder;
+  kip::Machine machine;
+  std::array<unsigned char, 0x0FFF> memory; // 4k of memory
+};
+
+TEST_F(kipTestSource, LongLinesAreNotTruncated)
+{
+  // given
+  const std::string comment = "; " + std::string(5000, 'x');
+  const std::string filename = Write("long.kip", "STB 1 $0 " + comment + "\nHLT");
+
+  // when
+  kip::SourceFile file;
+  const kip::InterpretResult r = file.Open(filename);
+  std::vector<std::string> lines;
+  kip::LoadFile(filename, lines);
+
+  // expect
+  ASSERT_TRUE(r) << r.str;
+  ASSERT_EQ(file.lines.size(), 2);
+  EXPECT_EQ(file.lines[0], "STB 1 $0 " + comment);
+  ASSERT_EQ(lines.size(), 2);
+  EXPECT_EQ(lines[0], "STB 1 $0 " + comment);
+}
+
+TEST_F(kipTestSource, LineEndingsAreStripped)
+{
+  // given
+  const std::string filename = Write("crlf.kip", "STB 1 $0\r\nSTB 2 $1\r\n");
+
+  // when
+  kip::SourceFile file;
+  const kip::InterpretResult r = file.Open(filename);
+
+  // expect
+  ASSERT_TRUE(r) << r.str;
+  ASSERT_EQ(file.lines.size(), 3);
+  EXPECT_EQ(file.lines[0], "STB 1 $0");
+  EXPECT_EQ(file.lines[1], "STB 2 $1");
+  EXPECT_EQ(file.lines[2], "");
+}
+
+TEST_F(kipTestSource, EmptyFileHasOneLine)
+{
+  // given
+  const std::string filename = Write("empty.kip", "");
+
+  // when
+  kip::SourceFile file;
+  const kip::InterpretResult r = file.Open(filename);
+
+  // expect
+  ASSERT_TRUE(r) << r.str;
+  ASSERT_EQ(file.lines.size(), 1);
+  EXPECT_EQ(file.lines[0], "");
+}
+
+TEST_F(kipTestSource, MissingFileFails)
+{
+  // given
+  kip::SourceFile file;
+
+  // when
+  const kip::InterpretResult r = file.Open((folder / "missing.kip").string());
+
+  // expect
+  EXPECT_FALSE(r);
+}
+
+TEST_F(kipTestSource, InterpretFileMatchesInterpretLines)
+{
+  // given
+  Write("lib.kip", ">value 7\nSTB value $20");
+  const std::string filename = Write("main.kip",
+    "  <lib.kip\n"
+    ">greeting \"hi\" ; comment\n"
+    "STS greeting $10\n"
+    ">loop\n"
+    "DCB $20\n"
+    "INB $21\n"
+    "JGT loop *$20 0\n");
+  std::vector<std::string> lines;
+  ASSERT_TRUE(kip::LoadFile(filename, lines));
+
+  // when
+  const std::vector<kip::InterpretResult> fromFile = kip::InterpretFile(filename, machine, 0);
+  kip::Machine other;
+  std::array<unsigned char, 0x0FFF> expected = {};
+  other.memory.MapMemory(expected.data(), (kip::Argument::Address)expected.size(), 0x0000);
+  other.memory.SetStackPointer((kip::Argument::Address)expected.size());
+  other.context.folder = folder.string();
+  const std::vector<kip::InterpretResult> fromLines = kip::InterpretLines(lines, other, 0);
+
+  // expect
+  ASSERT_FALSE(fromFile.empty());
+  ASSERT_TRUE(fromFile.back()) << fromFile.back().str;
+  ASSERT_TRUE(fromLines.back()) << fromLines.back().str;
+  EXPECT_EQ(memory, expected);
+  EXPECT_EQ(memory[0x10], 'h');
+  EXPECT_EQ(memory[0x21], 7);
+}
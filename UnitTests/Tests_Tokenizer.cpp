@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <string>
+#include <vector>
+
+static std::vector<std::string> Tokens(std::string_view line)
+{
+  std::vector<std::string> r;
+  kip::Tokenizer tokens(line);
+  std::string_view token;
+  while (tokens.Next(token))
+    r.push_back(std::string(token));
+  return r;
+}
+
+TEST(kipTestTokenizer, SplitsOnSpaces)
+{
+  // when
+  const std::vector<std::string> tokens = Tokens("  STB   *$10 20 ");
+
+  // expect
+  EXPECT_EQ(tokens, std::vector<std::string>({ "STB", "*$10", "20" }));
+}
+
+TEST(kipTestTokenizer, StringLiteralsKeepSpacesAndQuotes)
+{
+  // when
+  const std::vector<std::string> tokens = Tokens("STS \"a b c\" $0");
+
+  // expect
+  EXPECT_EQ(tokens, std::vector<std::string>({ "STS", "\"a b c\"", "$0" }));
+}
+
+TEST(kipTestTokenizer, CommentsEndTheLine)
+{
+  // when
+  const std::vector<std::string> tokens = Tokens("RDB $0| comment ; more");
+
+  // expect
+  EXPECT_EQ(tokens, std::vector<std::string>({ "RDB", "$0" }));
+}
+
+TEST(kipTestTokenizer, ParsesLiterals)
+{
+  // given
+  kip::Argument::AddressOrData hex = 0, binary = 0, octal = 0, decimal = 0, negative = 0, large = 0;
+
+  // expect
+  EXPECT_TRUE(kip::ParseLiteral("$aBcD", hex));
+  EXPECT_TRUE(kip::ParseLiteral(":1010", binary));
+  EXPECT_TRUE(kip::ParseLiteral("#17", octal));
+  EXPECT_TRUE(kip::ParseLiteral("42", decimal));
+  EXPECT_TRUE(kip::ParseLiteral("-1", negative));
+  EXPECT_TRUE(kip::ParseLiteral("$FFFFFFFF", large));
+  EXPECT_EQ(hex, 0xABCD);
+  EXPECT_EQ(binary, 10);
+  EXPECT_EQ(octal, 15);
+  EXPECT_EQ(decimal, 42);
+  EXPECT_EQ(negative, 0xFFFFFFFF);
+  EXPECT_EQ(large, 0xFFFFFFFF);
+}
+
+TEST(kipTestTokenizer, RejectsInvalidLiterals)
+{
+  // given
+  kip::Argument::AddressOrData value = 0;
+
+  // expect
+  EXPECT_FALSE(kip::ParseLiteral("", value));
+  EXPECT_FALSE(kip::ParseLiteral("$", value));
+  EXPECT_FALSE(kip::ParseLiteral("$G1", value));
+  EXPECT_FALSE(kip::ParseLiteral(":102", value));
+  EXPECT_FALSE(kip::ParseLiteral("12abc", value));
+  EXPECT_FALSE(kip::ParseLiteral("$100000000", value));
+}
+
+TEST(kipTestTokenizer, InvalidArgumentIsReported)
+{
+  // given
+  std::vector<std::string> lines = { "STB 1 NOWHERE" };
+
+  // when
+  const std::vector<kip::InterpretResult> results = kip::InterpretLines(lines, 0);
+
+  // expect
+  EXPECT_FALSE(results.back());
+}
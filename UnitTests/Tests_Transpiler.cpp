@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include "kip.h"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <sstream>
+
+// Checked in from TranspileInstructions(cpp, inst, context, "TranspiledDoubling") on doublingLines
+std::vector<kip::InterpretResult> TranspiledDoubling(kip::Memory& memory, kip::Instruction::Context& context, uint8_t verbosity);
+
+static const std::vector<std::string> doublingLines = {
+  "JMP START",
+  ">double",
+  "POA $100",
+  "POB $104",
+  "ADB *$104 *$104 $105",
+  "PUB *$105",
+  "JMP *$100 ; return",
+  ">START",
+  "STS \"kip\" $20",
+  "FIL 7 $30 4",
+  "STB 5 $10",
+  ">loop",
+  "PUB *$10",
+  "CAL double",
+  "POB $11",
+  "ADB *$12 *$11 $12",
+  "DCB $10",
+  "JGT loop *$10 0",
+  "INA $40",
+  "RDB $12",
+  "HLT",
+};
+
+// Runs doublingLines through InterpretInstructions and through the transpiled function, each on its own machine
+class kipTestTranspiler : public testing::Test
+{
+  void SetUp() override
+  {
+    Reset();
+  }
+
+public:
+  void Reset()
+  {
+    for (int m = 0; m < 2; ++m)
+    {
+      memory[m].fill(0);
+      machine[m].memory.MapMemory(memory[m].data(), (kip::Argument::Address)memory[m].size(), 0x0000);
+      machine[m].memory.SetStackPointer((kip::Argument::Address)memory[m].size());
+    }
+  }
+
+  std::vector<kip::Instruction> Build(kip::Instruction::Context& context)
+  {
+    std::vector<std::string> lines = doublingLines;
+    kip::BuildContext(context, lines);
+    return kip::BuildInstructions(context, lines);
+  }
+
+  kip::Machine machine[2];
+  std::array<unsigned char, 0x1000> memory[2];
+};
+
+TEST_F(kipTestTranspiler, TranspiledFunctionMatchesInterpreter)
+{
+  for (uint8_t verbosity : { 0, 120, 255 })
+  {
+    // given
+    Reset();
+    const std::vector<kip::Instruction> inst = Build(machine[0].context);
+
+    // when
+    const std::vector<kip::InterpretResult> expected = kip::InterpretInstructions(inst, machine[0], verbosity);
+    const std::vector<kip::InterpretResult> results = TranspiledDoubling(machine[1].memory, machine[1].context, verbosity);
+
+    // expect
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+      EXPECT_EQ(results[i].success, expected[i].success);
+      EXPECT_EQ(results[i].str, expected[i].str);
+    }
+    EXPECT_EQ(memory[1], memory[0]);
+    EXPECT_EQ(machine[1].context.executed, machine[0].context.executed);
+    EXPECT_EQ(machine[1].context.line, machine[0].context.line);
+    EXPECT_EQ(memory[1][0x12], 30);
+  }
+}
+
+TEST_F(kipTestTranspiler, CheckedInFunctionIsUpToDate)
+{
+  // given
+  kip::Instruction::Context context;
+  const std::vector<kip::Instruction> inst = Build(context);
+  std::ifstream file(std::string(__FILE__).substr(0, std::string(__FILE__).find_last_of("/\\") + 1) + "Transpiled_Doubling.cpp", std::ios::binary);
+  ASSERT_TRUE(file.is_open());
+  std::stringstream checkedIn;
+  checkedIn << file.rdbuf();
+  std::string expected = checkedIn.str();
+  expected.erase(std::remove(expected.begin(), expected.end(), '\r'), expected.end());
+
+  // when
+  std::string cpp;
+  const std::vector<kip::InterpretResult> r = kip::TranspileInstructions(cpp, inst, context, "TranspiledDoubling");
+
+  // expect
+  ASSERT_TRUE(r.back());
+  EXPECT_EQ(cpp, expected);
+}
+
+TEST_F(kipTestTranspiler, JumpsToLabelsBecomeGotos)
+{
+  // given
+  kip::Instruction::Context context;
+  const std::vector<kip::Instruction> inst = Build(context);
+
+  // when
+  std::string cpp;
+  kip::TranspileInstructions(cpp, inst, context, "Doubling");
+
+  // expect
+  EXPECT_NE(cpp.find("std::vector<kip::InterpretResult> Doubling(kip::Memory& memory, kip::Instruction::Context& context, uint8_t verbosity)"), std::string::npos);
+  EXPECT_NE(cpp.find("goto L11;"), std::string::npos);     // JGT loop
+  EXPECT_NE(cpp.find("goto L1;"), std::string::npos);      // CAL double
+  EXPECT_NE(cpp.find("goto dispatch; }"), std::string::npos); // JMP *$100
+}
+
+TEST_F(kipTestTranspiler, NamesMustBeIdentifiers)
+{
+  // given
+  kip::Instruction::Context context;
+  const std::vector<kip::Instruction> inst = Build(context);
+
+  // when
+  std::string cpp;
+  const std::vector<kip::InterpretResult> r = kip::TranspileInstructions(cpp, inst, context, "2 doubling");
+
+  // expect
+  ASSERT_FALSE(r.empty());
+  EXPECT_FALSE(r.back());
+  EXPECT_TRUE(cpp.empty());
+}
+
+TEST_F(kipTestTranspiler, DecodedBytecodeRunsLikeBytecode)
+{
+  // given
+  const std::vector<kip::Instruction> inst = Build(machine[0].context);
+  const kip::Bytecode::Data bc = kip::CompileInstructionsToBytecode(inst, machine[0].context);
+  kip::BytecodeProgram bytecode;
+  ASSERT_TRUE(kip::LoadBytecode(bytecode, machine[1].context, bc).back());
+
+  // when
+  const kip::Program program = kip::DecodeBytecode(bytecode);
+  const std::vector<kip::InterpretResult> expected = kip::InterpretBytecode(bytecode, machine[0].memory, machine[0].context, 255);
+  const std::vector<kip::InterpretResult> results = kip::InterpretProgram(program, machine[1].memory, machine[1].context, 255);
+
+  // expect
+  ASSERT_EQ(results.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); ++i)
+    EXPECT_EQ(results[i].str, expected[i].str);
+  EXPECT_EQ(memory[1], memory[0]);
+  std::string cpp;
+  EXPECT_TRUE(kip::TranspileBytecode(cpp, bc, "DoublingBytecode").back());
+  EXPECT_NE(cpp.find("\"STS\","), std::string::npos);
+}
@@ -0,0 +1,337 @@
+// Generated from 21 lines of kip by TranspileProgram; regenerate rather than editing
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "kip.h"
+
+namespace
+{
+  // Operands resolved only through DATA blocks, without side effects; false sends the line to StepProgram
+  inline bool KipAddr(const kip::Memory& memory, uint32_t data, uint8_t dereferences, uint32_t& out)
+  {
+    for (; dereferences > 0; --dereferences)
+    {
+      const kip::Argument::Data* p = memory.Translate(data, 4);
+      if (!p)
+        return false;
+      std::memcpy(&data, p, 4);
+    }
+    out = data;
+    return true;
+  }
+
+  inline bool KipByte(const kip::Memory& memory, uint32_t data, uint8_t dereferences, uint32_t& out)
+  {
+    const kip::Argument::Data* p = KipAddr(memory, data, dereferences - 1, data) ? memory.Translate(data, 1) : nullptr;
+    if (!p)
+      return false;
+    out = *p;
+    return true;
+  }
+}
+
+std::vector<kip::InterpretResult> TranspiledDoubling(kip::Memory& memory, kip::Instruction::Context& context, uint8_t verbosity)
+{
+  static const kip::Program program = []
+  {
+    [[maybe_unused]] const kip::Argument::Type N = kip::Argument::Type::INVALID, D = kip::Argument::Type::DATA, S = kip::Argument::Type::STRING;
+    kip::Program decoded;
+    decoded.opcodes = {
+      17, 0, 10, 9, 24, 6, 17, 0, 3, 4, 1, 0, 6, 23, 9, 24, 35, 20, 34, 14, 22,
+    };
+    decoded.operands = {
+      { 8u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 0u, 0, N }, { 0u, 0, N }, { 0u, 0, N },
+      { 256u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 260u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 260u, 1, D }, { 260u, 1, D }, { 261u, 0, D },
+      { 261u, 1, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 256u, 1, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 0u, 0, N }, { 0u, 0, N }, { 0u, 0, N },
+      { 0u, 0, S }, { 32u, 0, D }, { 0u, 0, N },
+      { 7u, 0, D }, { 48u, 0, D }, { 4u, 0, D },
+      { 5u, 0, D }, { 16u, 0, D }, { 0u, 0, N },
+      { 0u, 0, N }, { 0u, 0, N }, { 0u, 0, N },
+      { 16u, 1, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 2u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 17u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 18u, 1, D }, { 17u, 1, D }, { 18u, 0, D },
+      { 16u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 12u, 0, D }, { 16u, 1, D }, { 0u, 0, D },
+      { 64u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 18u, 0, D }, { 0u, 0, N }, { 0u, 0, N },
+      { 0u, 0, N }, { 0u, 0, N }, { 0u, 0, N },
+    };
+    decoded.strings = {
+      "kip",
+    };
+    decoded.sourceMap = {
+      "JMP START",
+      "",
+      "POA $100",
+      "POB $104",
+      "ADB *$104 *$104 $105",
+      "PUB *$105",
+      "JMP *$100 ",
+      "",
+      "STS \"kip\" $20",
+      "FIL 7 $30 4",
+      "STB 5 $10",
+      "",
+      "PUB *$10",
+      "CAL double",
+      "POB $11",
+      "ADB *$12 *$11 $12",
+      "DCB $10",
+      "JGT loop *$10 0",
+      "INA $40",
+      "RDB $12",
+      "HLT",
+    };
+    decoded.start = 8u;
+    return decoded;
+  }();
+  bool traced[256] = {};
+  for (uint8_t id = 0; id < uint8_t(kip::Opcode::COUNT); ++id)
+    traced[id] = kip::IsTraced(id, verbosity);
+  [[maybe_unused]] kip::Argument::Address& sp = memory.RawStackPointer();
+  std::vector<kip::InterpretResult> r;
+  [[maybe_unused]] uint32_t a = 0, b = 0, c = 0, v = 0;
+  [[maybe_unused]] kip::Argument::Data* p = nullptr;
+  [[maybe_unused]] kip::Argument::Data* q = nullptr;
+  try
+  {
+    context.line = program.start;
+  dispatch:
+    switch (context.line)
+    {
+    case 0: goto L0;
+    case 1: goto L1;
+    case 2: goto L2;
+    case 3: goto L3;
+    case 4: goto L4;
+    case 5: goto L5;
+    case 6: goto L6;
+    case 7: goto L7;
+    case 8: goto L8;
+    case 9: goto L9;
+    case 10: goto L10;
+    case 11: goto L11;
+    case 12: goto L12;
+    case 13: goto L13;
+    case 14: goto L14;
+    case 15: goto L15;
+    case 16: goto L16;
+    case 17: goto L17;
+    case 18: goto L18;
+    case 19: goto L19;
+    case 20: goto L20;
+    default: goto finished;
+    }
+  L0: // JMP START
+    if (traced[17])
+    {
+      if (!kip::StepProgram(program, 0, memory, context, verbosity, r))
+        goto finished;
+      goto dispatch;
+    }
+    else
+    {
+      ++context.executed;
+      goto L7;
+    }
+  L1:
+  L2: // POA $100
+    if (traced[10] || !(q = memory.Translate(sp, 4)) || !(p = memory.Translate(256u, 4)))
+    {
+      if (!kip::StepProgram(program, 2, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      std::memmove(p, q, 4);
+      sp += 4;
+      ++context.executed;
+    }
+  L3: // POB $104
+    if (traced[9] || !(q = memory.Translate(sp, 1)) || !(p = memory.Translate(260u, 1)))
+    {
+      if (!kip::StepProgram(program, 3, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = *q;
+      sp += 1;
+      ++context.executed;
+    }
+  L4: // ADB *$104 *$104 $105
+    if (traced[24] || !KipByte(memory, 260u, 1, a) || !KipByte(memory, 260u, 1, b) || !(p = memory.Translate(261u, 1)))
+    {
+      if (!kip::StepProgram(program, 4, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = kip::Argument::Data(a + b);
+      ++context.executed;
+    }
+  L5: // PUB *$105
+    if (traced[6] || !KipByte(memory, 261u, 1, a) || !(p = memory.Translate(sp - 1, 1)))
+    {
+      if (!kip::StepProgram(program, 5, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = kip::Argument::Data(a);
+      sp -= 1;
+      ++context.executed;
+    }
+  L6: // JMP *$100
+    if (traced[17] || !KipAddr(memory, 256u, 1, a))
+    {
+      if (!kip::StepProgram(program, 6, memory, context, verbosity, r))
+        goto finished;
+      goto dispatch;
+    }
+    else
+    {
+      ++context.executed;
+      { context.line = a - 1; goto dispatch; }
+    }
+  L7:
+  L8: // STS "kip" $20
+    if (!kip::StepProgram(program, 8, memory, context, verbosity, r))
+      goto finished;
+  L9: // FIL 7 $30 4
+    if (!kip::StepProgram(program, 9, memory, context, verbosity, r))
+      goto finished;
+  L10: // STB 5 $10
+    if (traced[1] || !(p = memory.Translate(16u, 1)))
+    {
+      if (!kip::StepProgram(program, 10, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = kip::Argument::Data(5u);
+      ++context.executed;
+    }
+  L11:
+  L12: // PUB *$10
+    if (traced[6] || !KipByte(memory, 16u, 1, a) || !(p = memory.Translate(sp - 1, 1)))
+    {
+      if (!kip::StepProgram(program, 12, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = kip::Argument::Data(a);
+      sp -= 1;
+      ++context.executed;
+    }
+  L13: // CAL double
+    if (traced[23] || !(p = memory.Translate(sp - 4, 4)))
+    {
+      if (!kip::StepProgram(program, 13, memory, context, verbosity, r))
+        goto finished;
+      goto dispatch;
+    }
+    else
+    {
+      v = 15u;
+      std::memcpy(p, &v, 4);
+      sp -= 4;
+      ++context.executed;
+      goto L1;
+    }
+  L14: // POB $11
+    if (traced[9] || !(q = memory.Translate(sp, 1)) || !(p = memory.Translate(17u, 1)))
+    {
+      if (!kip::StepProgram(program, 14, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = *q;
+      sp += 1;
+      ++context.executed;
+    }
+  L15: // ADB *$12 *$11 $12
+    if (traced[24] || !KipByte(memory, 18u, 1, a) || !KipByte(memory, 17u, 1, b) || !(p = memory.Translate(18u, 1)))
+    {
+      if (!kip::StepProgram(program, 15, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      *p = kip::Argument::Data(a + b);
+      ++context.executed;
+    }
+  L16: // DCB $10
+    if (traced[35] || !(p = memory.Translate(16u, 1)))
+    {
+      if (!kip::StepProgram(program, 16, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      --*p;
+      ++context.executed;
+    }
+  L17: // JGT loop *$10 0
+    if (traced[20] || !KipByte(memory, 16u, 1, b))
+    {
+      if (!kip::StepProgram(program, 17, memory, context, verbosity, r))
+        goto finished;
+      goto dispatch;
+    }
+    else
+    {
+      ++context.executed;
+      if (b > 0u)
+        goto L11;
+    }
+  L18: // INA $40
+    if (traced[34] || !(p = memory.Translate(64u, 4)))
+    {
+      if (!kip::StepProgram(program, 18, memory, context, verbosity, r))
+        goto finished;
+    }
+    else
+    {
+      std::memcpy(&v, p, 4);
+      ++v;
+      std::memcpy(p, &v, 4);
+      ++context.executed;
+    }
+  L19: // RDB $12
+    if (!kip::StepProgram(program, 19, memory, context, verbosity, r))
+      goto finished;
+  L20: // HLT
+    if (traced[22])
+    {
+      if (!kip::StepProgram(program, 20, memory, context, verbosity, r))
+        goto finished;
+      goto dispatch;
+    }
+    else
+    {
+      ++context.executed;
+      context.line = uint32_t(-1);
+      goto finished;
+    }
+    context.line = 21u;
+  finished:;
+  }
+  catch (const std::exception& e)
+  {
+    r.push_back(kip::InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
+    return r;
+  }
+  if (r.size() == 0 || r.back().success)
+    r.push_back(kip::InterpretResult(true, "Executed successfully"));
+  return r;
+}
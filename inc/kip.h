@@ -3,7 +3,20 @@
 #include "kipUniversal.h"
 #include "kipHelloWorld.h"
 #include "kipMemory.h"
+#include "kipMachine.h"
+#include "kipOpcodes.h"
 #include "kipInstruction.h"
+#include "kipTokenizer.h"
+#include "kipFile.h"
+#include "kipImports.h"
+#include "kipSource.h"
+#include "kipCache.h"
+#include "kipOptimizer.h"
+#include "kipProgram.h"
+#include "kipJit.h"
+#include "kipTranspiler.h"
+#include "kipScheduler.h"
+#include "kipLanes.h"
 #include "kipVersion.h"
 
 namespace kip
@@ -15,6 +15,23 @@ namespace Bytecode
 {
   typedef std::vector<uint8_t> Data;
 
+  // Read-only window onto bytecode that is owned elsewhere
+  class DLLMODE View
+  {
+  public:
+    View();
+    View(const Data& data);
+    View(const uint8_t* data, size_t size);
+
+    const uint8_t* data() const;
+    size_t size() const;
+    const uint8_t& operator[](size_t i) const;
+
+  private:
+    const uint8_t* ptr;
+    size_t length;
+  };
+
   enum class DataType
   {
     INVALID = 0x00,
@@ -34,7 +51,7 @@ namespace Bytecode
     const uint8_t* data() const;
     size_type size() const;
 
-    static Metadata Decode(const Bytecode::Data& bc, uint32_t& offset);
+    static Metadata Decode(const Bytecode::View& bc, uint32_t& offset);
     static Metadata Comment(const std::string& comment);
     static Metadata Author(const std::string& author);
     static Metadata Timestamp();
@@ -81,6 +98,10 @@ namespace Bytecode
 
     const uint8_t* data() const;
     size_type size() const;
+    bool IsValid() const;
+    uint8_t GetVersionMajor() const;
+    uint8_t GetVersionMinor() const;
+    uint32_t GetMetadataCount() const;
     data_type::iterator begin();
     data_type::iterator end();
 
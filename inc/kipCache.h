@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipBytecode.h"
+#include "kipFile.h"
+#include "kipInstruction.h"
+#include "kipProgram.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  class Machine;
+
+  // Bytecode compiled from a source file, reused from disk while the source and its imports are unchanged
+  // Cache files (.kipc) are a short record followed by the bytecode, and are run in place like .kbc files
+  class DLLMODE CompiledFile
+  {
+  public:
+    CompiledFile();
+    CompiledFile(const CompiledFile&) = delete;
+    CompiledFile& operator=(const CompiledFile&) = delete;
+
+    BytecodeProgram program; // Points into file or data, whichever was used
+    MappedFile file;         // Cache file the program was loaded from
+    Bytecode::Data data;     // Bytecode compiled because the cache was missing or stale
+    bool cached = false;     // Loaded from the cache without parsing the source
+  };
+
+namespace BytecodeCache
+{
+  enum class Offset
+  {
+    IDENTIFIER = 0x00,
+    MINOR_VERSION = 0x04,
+    MAJOR_VERSION = 0x05,
+    HASH = 0x08,
+    IMPORT_COUNT = 0x10,
+    IMPORTS_START = 0x14, // Canonical path of each import, null terminated, then the bytecode
+  };
+
+  // Hash of the version, the source and every import it was compiled with
+  DLLMODE bool HashSources(uint64_t& hash, const std::string& filename, const std::vector<std::string>& imports);
+  // Cache file for a source, next to it or in cacheFolder when one is given
+  DLLMODE std::string GetPath(const std::string& filename, const std::string& cacheFolder = "");
+}
+
+  DLLMODE std::vector<InterpretResult> CompileFile(CompiledFile& compiled, Instruction::Context& context, const std::string& filename, const std::string& cacheFolder = "");
+  DLLMODE std::vector<InterpretResult> InterpretCompiledFile(const std::string& filename, Machine& machine, const std::string& cacheFolder = "", uint8_t verbosity = 255);
+}
+
+#pragma warning(pop)
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "kipUniversal.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // Read-only memory mapping of a whole file
+  // Pages are loaded by the OS on first touch and shared between processes mapping the same file
+  class DLLMODE MappedFile
+  {
+  public:
+    MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool Open(const std::string& filename);
+    void Close();
+    bool IsOpen() const;
+
+    const uint8_t* data() const;
+    size_t size() const;
+
+  private:
+    const uint8_t* view = nullptr;
+    size_t length = 0;
+    void* fileHandle = nullptr;    // Only used on Windows
+    void* mappingHandle = nullptr; // Only used on Windows
+  };
+}
+
+#pragma warning(pop)
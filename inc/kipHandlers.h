@@ -0,0 +1,1061 @@
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+#include "kipMemory.h"
+#include "kipOpcodes.h"
+#include "kipProgram.h"
+
+// Internal to the interpreter: shared handler bodies for every way instructions can be executed
+// Not included by kip.h
+
+namespace kip
+{
+  // How a successful InstructionResult's operands are turned into text
+  enum class ResultFormat : uint8_t
+  {
+    NONE,
+    STORE,        // address<=value
+    STORE_SIGNED, // address<=value, value printed as signed
+    STORE_STRING, // address<=string argument
+    PUSH_STRING,  // address<="string argument"
+    POP_STRING,   // address<="string read back from address"
+    FILL,         // [start, end)<=value
+    COPY,         // [destination,destination+count)<=[source, source+count)
+    LOAD_FILE,    // [start,end)<={file}
+    SAVE_FILE,    // [start,end)=>{file}
+    READ,         // address=>value
+    READ_STRING,  // string argument
+    JUMP,         // pc<=line
+    HALT,
+    CALL,         // stack<=return;  pc <= line
+  };
+
+  struct InstructionInfo
+  {
+    const char* const string;
+    const uint8_t argumentCount;
+    InstructionResult(Instruction::* function)(Memory&, Instruction::Context*) const;
+    uint8_t verbosity; // Lower numbers are higher priority
+    ResultFormat format;
+  };
+
+  extern const InstructionInfo instructionTable[];
+  extern const uint8_t instructionCount;
+
+  inline Resolved<Argument::Address> ResolveAddr(const Memory& memory, Argument::AddressOrData data, uint8_t dereferenceCount)
+  {
+    Argument::Address d = data;
+    for (uint8_t i = dereferenceCount; i > 0; --i)
+      if (!memory.ReadBytes(d, (Argument::Data*)(&d), sizeof(d)))
+        return { 0, OperandFault::DEREFERENCE, d };
+    return { d, OperandFault::NONE, 0 };
+  }
+
+  inline Resolved<Argument::Data> ResolveByte(const Memory& memory, Argument::AddressOrData data, uint8_t dereferenceCount)
+  {
+    if (dereferenceCount == 0)
+      return { Argument::Data(data), OperandFault::NONE, 0 };
+    Resolved<Argument::Address> d = ResolveAddr(memory, data, dereferenceCount - 1);
+    if (!d)
+      return { 0, d.fault, d.address };
+    Argument::Data r = 0;
+    if (!memory.ReadByte(d.value, r))
+      return { 0, OperandFault::BYTE, d.value };
+    return { r, OperandFault::NONE, 0 };
+  }
+
+  inline Resolved<std::string> ResolveString(const Memory& memory, Argument::AddressOrData data, uint8_t dereferenceCount)
+  {
+    Resolved<Argument::Address> addr = ResolveAddr(memory, data, dereferenceCount);
+    if (!addr)
+      return { std::string(), addr.fault, addr.address };
+    std::string r;
+    if (!memory.ReadString(addr.value, r))
+      return { std::string(), OperandFault::STRING, addr.value };
+    return { r, OperandFault::NONE, 0 };
+  }
+
+  // What every kind of operand access shares: handlers unpack operands with a branch per operand
+  // and, when one can't be resolved, return Fault() instead of their usual result
+  class OperandAccess
+  {
+  public:
+    InstructionResult Fault() const
+    {
+      return InstructionResult(InstructionResult::Status::OPERAND_NOT_RESOLVED, Argument::AddressOrData(fault), address);
+    }
+
+  protected:
+    template <typename T>
+    bool Unpack(const Resolved<T>& r, T& out) const
+    {
+      if (!r)
+      {
+        fault = r.fault;
+        address = r.address;
+        return false;
+      }
+      out = r.value;
+      return true;
+    }
+
+    mutable OperandFault fault = OperandFault::NONE;
+    mutable Argument::Address address = 0;
+  };
+
+  // Operand access for instructions parsed into Argument lists
+  class ArgumentOperands : public OperandAccess
+  {
+  public:
+    ArgumentOperands(const std::vector<Argument>& arguments, const Memory& memory)
+      : arguments(arguments), memory(memory)
+    {
+    }
+
+    bool Addr(uint8_t i, Argument::Address& out) const { return Unpack(arguments[i].GetAddr(memory), out); }
+    bool Byte(uint8_t i, Argument::Data& out) const { return Unpack(arguments[i].GetByte(memory), out); }
+    bool String(uint8_t i, std::string& out) const { return Unpack(arguments[i].GetString(memory), out); }
+
+    const std::vector<Argument>& arguments;
+    const Memory& memory;
+  };
+
+  // Operand access for instructions decoded into a Program
+  class ProgramOperands : public OperandAccess
+  {
+  public:
+    ProgramOperands(const Program& program, uint32_t index, const Memory& memory)
+      : operands(program.GetOperands(index)), program(program), memory(memory)
+    {
+    }
+
+    bool Addr(uint8_t i, Argument::Address& out) const { return Unpack(ResolveAddr(memory, operands[i].data, operands[i].dereferenceCount), out); }
+    bool Byte(uint8_t i, Argument::Data& out) const { return Unpack(ResolveByte(memory, operands[i].data, operands[i].dereferenceCount), out); }
+    bool String(uint8_t i, std::string& out) const
+    {
+      if (operands[i].type == Argument::Type::STRING)
+      {
+        if (operands[i].dereferenceCount > 0)
+          return Unpack(Resolved<std::string>{ std::string(), OperandFault::STRING_DEREFERENCED, 0 }, out);
+        out = program.strings[operands[i].data];
+        return true;
+      }
+      return Unpack(ResolveString(memory, operands[i].data, operands[i].dereferenceCount), out);
+    }
+
+    const Operand* operands;
+    const Program& program;
+    const Memory& memory;
+  };
+
+  // Operand access for instruction records read in place from bytecode
+  class BytecodeOperands : public OperandAccess
+  {
+  public:
+    // record points at the instruction id, which has already been validated by the loader
+    BytecodeOperands(const uint8_t* record, const Memory& memory)
+      : memory(memory)
+    {
+      const uint8_t* p = record + 1;
+      uint8_t count = instructionTable[record[0] - uint8_t(Bytecode::DataType::INSTRUCTIONS_START)].argumentCount;
+      for (uint8_t i = 0; i < count && i < Program::MAX_OPERANDS; ++i)
+      {
+        operands[i] = p;
+        if (Argument::Type(p[0]) == Argument::Type::STRING)
+          p += std::strlen((const char*)p + 1) + 2;
+        else
+          p += 6;
+      }
+    }
+
+    bool Addr(uint8_t i, Argument::Address& out) const { return Unpack(ResolveAddr(memory, Data(i), Dereferences(i)), out); }
+    bool Byte(uint8_t i, Argument::Data& out) const { return Unpack(ResolveByte(memory, Data(i), Dereferences(i)), out); }
+    bool String(uint8_t i, std::string& out) const
+    {
+      if (Argument::Type(operands[i][0]) == Argument::Type::STRING)
+      {
+        out = std::string((const char*)operands[i] + 1);
+        return true;
+      }
+      return Unpack(ResolveString(memory, Data(i), Dereferences(i)), out);
+    }
+
+    const uint8_t* operands[Program::MAX_OPERANDS] = {};
+    const Memory& memory;
+
+  private:
+    // DATA operands are type, dereference count, then a big-endian value
+    Argument::AddressOrData Data(uint8_t i) const
+    {
+      if (Argument::Type(operands[i][0]) != Argument::Type::DATA)
+        return 0;
+      const uint8_t* p = operands[i] + 2;
+      return (Argument::AddressOrData(p[0]) << 24) | (Argument::AddressOrData(p[1]) << 16) | (Argument::AddressOrData(p[2]) << 8) | Argument::AddressOrData(p[3]);
+    }
+    uint8_t Dereferences(uint8_t i) const
+    {
+      return Argument::Type(operands[i][0]) == Argument::Type::DATA ? operands[i][1] : 0;
+    }
+  };
+
+  // Appends the trace line for the instruction at index
+  // Returns false if the instruction failed and execution should stop
+  bool ReportInstruction(std::vector<InterpretResult>& r, uint32_t index, unsigned lnWidth, const std::string& source, const InstructionResult& ir, const InterpretResult& description);
+
+  // String operand of an instruction that already ran, which resolved it once
+  template <typename Operands>
+  std::string DescribeString(const Operands& a, uint8_t i)
+  {
+    std::string s;
+    a.String(i, s);
+    return s;
+  }
+
+  template <typename Operands>
+  InterpretResult Describe(uint8_t id, const InstructionResult& result, const Operands& a)
+  {
+    const Argument::AddressOrData* o = result.operands;
+    switch (result.status)
+    {
+    case InstructionResult::Status::OK:
+      break;
+    case InstructionResult::Status::ADDRESS_NOT_MAPPED:
+      return InterpretResult(false, "Address " + std::to_string(o[0]) + " not mapped");
+    case InstructionResult::Status::RANGE_NOT_MAPPED:
+      return InterpretResult(false, "An address in [" + std::to_string(o[0]) + ", " + std::to_string(o[1]) + ") is unmapped");
+    case InstructionResult::Status::STACK_NOT_MAPPED:
+      return InterpretResult(false, "Stack pointer is not mapped");
+    case InstructionResult::Status::STACK_NOT_MAPPED_POST_READ:
+      return InterpretResult(false, "Stack pointer is not mapped post-read (" + std::to_string(o[0]) + ")");
+    case InstructionResult::Status::STACK_NOT_MAPPED_POST_WRITE:
+      return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(o[0]) + ")");
+    case InstructionResult::Status::STACK_NOT_MAPPED_POST_INCREMENT:
+      return InterpretResult(false, "Stack pointer is not mapped post-increment (" + std::to_string(o[0]) + ")");
+    case InstructionResult::Status::STACK_NOT_MAPPED_POST_DECREMENT:
+      return InterpretResult(false, "Stack pointer is not mapped post-decrement (" + std::to_string(o[0]) + ")");
+    case InstructionResult::Status::NO_CONTEXT:
+      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
+    case InstructionResult::Status::FILE_NOT_OPENED:
+      if (instructionTable[id].format == ResultFormat::SAVE_FILE)
+        return InterpretResult(false, "Could not open external file: " + DescribeString(a, 2));
+      return InterpretResult(false, "Could not open external file: " + DescribeString(a, 0));
+    case InstructionResult::Status::OPERAND_NOT_RESOLVED:
+      switch (OperandFault(o[0]))
+      {
+      case OperandFault::DEREFERENCE:
+        return InterpretResult(false, "Could not dereference address: " + std::to_string(o[1]));
+      case OperandFault::BYTE:
+        return InterpretResult(false, "Could not read byte at address: " + std::to_string(o[1]));
+      case OperandFault::STRING:
+        return InterpretResult(false, "Could not read string at address: " + std::to_string(o[1]));
+      case OperandFault::STRING_DEREFERENCED:
+        return InterpretResult(false, "String argument can't be dereferenced!");
+      default:
+        return InterpretResult(false, "Unknown failure");
+      }
+    default:
+      return InterpretResult(false, "Unknown failure");
+    }
+
+    std::string str;
+    switch (instructionTable[id].format)
+    {
+    case ResultFormat::STORE:
+      str = std::to_string(unsigned(o[0])) + "<=" + std::to_string(unsigned(o[1]));
+      break;
+    case ResultFormat::STORE_SIGNED:
+      str = std::to_string(unsigned(o[0])) + "<=" + std::to_string(int(o[1]));
+      break;
+    case ResultFormat::STORE_STRING:
+      str = std::to_string(unsigned(o[0])) + "<=" + DescribeString(a, 0);
+      break;
+    case ResultFormat::PUSH_STRING:
+      str = std::to_string(unsigned(o[0])) + "<=\"" + DescribeString(a, 0) + "\"";
+      break;
+    case ResultFormat::POP_STRING:
+    {
+      std::string popped;
+      a.memory.ReadString(o[0], popped);
+      if (popped.size() > 0)
+        popped.pop_back(); // ReadString includes the terminator
+      str = std::to_string(unsigned(o[0])) + "<=\"" + popped + "\"";
+      break;
+    }
+    case ResultFormat::FILL:
+      str = "[" + std::to_string(unsigned(o[0])) + ", " + std::to_string(unsigned(o[1])) + ")<=" + std::to_string(unsigned(o[2]));
+      break;
+    case ResultFormat::COPY:
+      str = "[" + std::to_string(unsigned(o[1])) + "," + std::to_string(unsigned(o[1] + o[2])) + ")<=[" + std::to_string(unsigned(o[0])) + ", " + std::to_string(unsigned(o[0] + o[2])) + ")";
+      break;
+    case ResultFormat::LOAD_FILE:
+      str = "[" + std::to_string(unsigned(o[0])) + "," + std::to_string(unsigned(o[1])) + ")<={" + DescribeString(a, 0) + "}";
+      break;
+    case ResultFormat::SAVE_FILE:
+      str = "[" + std::to_string(unsigned(o[0])) + "," + std::to_string(unsigned(o[1])) + ")=>{" + DescribeString(a, 2) + "}";
+      break;
+    case ResultFormat::READ:
+      str = std::to_string(unsigned(o[0])) + "=>" + std::to_string(int(o[1]));
+      break;
+    case ResultFormat::READ_STRING:
+      str = DescribeString(a, 0);
+      break;
+    case ResultFormat::JUMP:
+      str = "pc<=" + std::to_string(o[0]);
+      break;
+    case ResultFormat::HALT:
+      str = "Halted program";
+      break;
+    case ResultFormat::CALL:
+      str = std::to_string(unsigned(o[0])) + "<=" + std::to_string(int(o[1])) + ";  pc <= " + std::to_string(o[2]);
+      break;
+    default:
+      break;
+    }
+    return InterpretResult(true, str);
+  }
+
+namespace Handlers
+{
+  using Status = InstructionResult::Status;
+
+  /////////////////////////////
+  // Storage                 //
+  /////////////////////////////
+
+  template <typename Operands>
+  InstructionResult STB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Address B;
+    if (!a.Byte(0, A) || !a.Addr(1, B))
+      return a.Fault();
+    if (memory.WriteByte(B, A))
+      return InstructionResult(Status::OK, B, A);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, B);
+  }
+
+  template <typename Operands>
+  InstructionResult STA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    if (!a.Addr(0, A) || !a.Addr(1, B))
+      return a.Fault();
+    if (memory.WriteBytes(B, (uint8_t*)(&A), 4))
+      return InstructionResult(Status::OK, B, A);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, B);
+  }
+
+  template <typename Operands>
+  InstructionResult STS(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    std::string       A;
+    Argument::Address B;
+    if (!a.String(0, A) || !a.Addr(1, B))
+      return a.Fault();
+    if (memory.WriteBytes(B, (uint8_t*)(A.data()), uint32_t(A.length() + 1)))
+      return InstructionResult(Status::OK, B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, B);
+  }
+
+  template <typename Operands>
+  InstructionResult FIL(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    Argument::Address failed;
+    if (B + C >= B && !memory.FillBytes(B, A, C, failed)) // Ranges past the end of the address space fill nothing
+      return InstructionResult(Status::ADDRESS_NOT_MAPPED, failed);
+    return InstructionResult(Status::OK, B, B + C, A);
+  }
+
+  template <typename Operands>
+  InstructionResult CPY(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (!memory.CopyBytes(B, A, C))
+    {
+      if (!memory.CanRead(A, C))
+        return InstructionResult(Status::RANGE_NOT_MAPPED, A, A + C);
+      return InstructionResult(Status::RANGE_NOT_MAPPED, B, B + C);
+    }
+    return InstructionResult(Status::OK, A, B, C);
+  }
+
+  template <typename Operands>
+  InstructionResult PUB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    Argument::Data    A;
+    if (!a.Byte(0, A))
+      return a.Fault();
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    if (!memory.WriteByte(s - 1, A))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_WRITE, s - 1);
+    if (!memory.SetStackPointer(s - 1))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_DECREMENT, s - 1);
+    return InstructionResult(Status::OK, s - 1, A);
+  }
+
+  template <typename Operands>
+  InstructionResult PUA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    if (!memory.WriteBytes(s - 4, (uint8_t*)(&A), 4))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_WRITE, s - 4);
+    if (!memory.SetStackPointer(s - 4))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_DECREMENT, s - 4);
+    return InstructionResult(Status::OK, s - 4, A);
+  }
+
+  template <typename Operands>
+  InstructionResult PUS(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    std::string A;
+    if (!a.String(0, A))
+      return a.Fault();
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    Argument::Address size = Argument::Address(A.size());
+    if (!memory.WriteByte(s, 0))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_WRITE, s - 4);
+    if (!memory.WriteBytes(s - size, (uint8_t*)(A.data()), size))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_WRITE, s - 4);
+    if (!memory.SetStackPointer(s - size))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_DECREMENT, s - 4);
+    return InstructionResult(Status::OK, s - size);
+  }
+
+  template <typename Operands>
+  InstructionResult POB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Data    v = 0;
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    if (!memory.ReadByte(s, v))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_READ, s);
+    if (!memory.WriteByte(A, v))
+      return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+    if (!memory.SetStackPointer(s + 1))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_INCREMENT, s + 1);
+    return InstructionResult(Status::OK, A, v);
+  }
+
+  template <typename Operands>
+  InstructionResult POA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Address v = 0;
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    if (!memory.ReadBytes(s, (uint8_t*)(&v), 4))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_READ, s);
+    if (!memory.WriteBytes(A, (uint8_t*)(&v), 4))
+      return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+    if (!memory.SetStackPointer(s + 4))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_INCREMENT, s + 4);
+    return InstructionResult(Status::OK, A, v);
+  }
+
+  template <typename Operands>
+  InstructionResult POS(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    std::string       str;
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    Argument::Data c = '\0';
+    do
+    {
+      if (!memory.ReadByte(s++, c))
+        return InstructionResult(Status::STACK_NOT_MAPPED_POST_WRITE, s - 4);
+      if (c)
+        str += char(c);
+    } while (c);
+    if (!memory.SetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_DECREMENT, s - 4);
+    if (!memory.WriteString(A, str))
+      return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+    return InstructionResult(Status::OK, A);
+  }
+
+  template <typename Operands>
+  InstructionResult BIN(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    std::string       A;
+    Argument::Address B;
+    if (!a.String(0, A) || !a.Addr(1, B))
+      return a.Fault();
+    std::string       path;
+    if (context && A.size() > 1 && A[0] == '.' && (A[1] == '/' || A[1] == '\\'))
+      path = context->folder + A.substr(1);
+    else
+      path = A;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+      return InstructionResult(Status::FILE_NOT_OPENED);
+    // Chunks as large as CopyBytes uses, so a mapped device sees few, long spans
+    const std::streamsize bufferSize = 4096;
+    char buffer[bufferSize] = { 0 };
+    Argument::Address addr = B;
+    while (!file.eof())
+    {
+      file.read(buffer, bufferSize);
+      Argument::Address size = Argument::Address(file.gcount());
+      if (!memory.WriteBytes(addr, (Argument::Data*)(buffer), size))
+        return InstructionResult(Status::RANGE_NOT_MAPPED, addr, addr + size);
+      addr += size;
+    }
+    file.close();
+    return InstructionResult(Status::OK, B, addr);
+  }
+
+  template <typename Operands>
+  InstructionResult SAV(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    std::string C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.String(2, C))
+      return a.Fault();
+    std::string path;
+    if (context && C.size() > 1 && C[0] == '.' && (C[1] == '/' || C[1] == '\\'))
+      path = context->folder + C.substr(1);
+    else
+      path = C;
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+      return InstructionResult(Status::FILE_NOT_OPENED);
+    const std::streamsize bufferSize = 4096;
+    char buffer[bufferSize] = { 0 };
+    Argument::Address addr = A;
+    Argument::Address size = B;
+    while (size > 0)
+    {
+      Argument::Address chunkSize = size > bufferSize ? bufferSize : size;
+      if (!memory.ReadBytes(addr, (Argument::Data*)(buffer), chunkSize))
+        return InstructionResult(Status::RANGE_NOT_MAPPED, addr, addr + size);
+      file.write(buffer, chunkSize);
+      addr += chunkSize;
+      size -= chunkSize;
+    }
+    file.close();
+    return InstructionResult(Status::OK, A, addr);
+  }
+
+  /////////////////////////////
+  // Debugging               //
+  /////////////////////////////
+
+  template <typename Operands>
+  InstructionResult RDB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Data    out;
+    if (memory.ReadByte(A, out))
+      return InstructionResult(Status::OK, A, out);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+  }
+
+  template <typename Operands>
+  InstructionResult RDA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Address out;
+    if (memory.ReadBytes(A, (Argument::Data*)(&out), sizeof(out)))
+      return InstructionResult(Status::OK, A, out);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+  }
+
+  template <typename Operands>
+  InstructionResult RDS(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    return InstructionResult(Status::OK);
+  } 
+
+  /////////////////////////////
+  // Control Flow            //
+  /////////////////////////////
+
+  template <typename Operands>
+  InstructionResult JMP(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    context->line = A - 1;
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult JEQ(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    Argument::Data    B;
+    Argument::Data    C;
+    if (!a.Addr(0, A) || !a.Byte(1, B) || !a.Byte(2, C))
+      return a.Fault();
+    if (B == C)
+    {
+      context->line = A - 1;
+    }
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult JNE(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    Argument::Data    B;
+    Argument::Data    C;
+    if (!a.Addr(0, A) || !a.Byte(1, B) || !a.Byte(2, C))
+      return a.Fault();
+    if (B != C)
+    {
+      context->line = A - 1;
+    }
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult JGT(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    Argument::Data    B;
+    Argument::Data    C;
+    if (!a.Addr(0, A) || !a.Byte(1, B) || !a.Byte(2, C))
+      return a.Fault();
+    if (B > C)
+    {
+      context->line = A - 1;
+    }
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult JLT(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    Argument::Data    B;
+    Argument::Data    C;
+    if (!a.Addr(0, A) || !a.Byte(1, B) || !a.Byte(2, C))
+      return a.Fault();
+    if (B < C)
+    {
+      context->line = A - 1;
+    }
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult JGE(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    Argument::Data    B;
+    Argument::Data    C;
+    if (!a.Addr(0, A) || !a.Byte(1, B) || !a.Byte(2, C))
+      return a.Fault();
+    if (B >= C)
+    {
+      context->line = A - 1;
+    }
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult JLE(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address A;
+    Argument::Data    B;
+    Argument::Data    C;
+    if (!a.Addr(0, A) || !a.Byte(1, B) || !a.Byte(2, C))
+      return a.Fault();
+    if (B <= C)
+    {
+      context->line = A - 1;
+    }
+    return InstructionResult(Status::OK, context->line);
+  }
+
+  template <typename Operands>
+  InstructionResult HLT(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    context->line = uint32_t(-1);
+    return InstructionResult(Status::OK);
+  }
+
+  template <typename Operands>
+  InstructionResult CAL(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address s = 0;
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    if (!context)
+      return InstructionResult(Status::NO_CONTEXT);
+    Argument::Address next = context->line + 1;
+    if (!memory.GetStackPointer(s))
+      return InstructionResult(Status::STACK_NOT_MAPPED);
+    if (!memory.WriteBytes(s - 4, (uint8_t*)(&next), 4))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_WRITE, s - 4);
+    if (!memory.SetStackPointer(s - 4))
+      return InstructionResult(Status::STACK_NOT_MAPPED_POST_DECREMENT, s - 4);
+    context->line = A - 1;
+    return InstructionResult(Status::OK, s - 4, next, context->line);
+  }
+
+  /////////////////////////////
+  // Arithmetic              //
+  /////////////////////////////
+
+  template <typename Operands>
+  InstructionResult ADB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A + B))
+      return InstructionResult(Status::OK, C, A + B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult ADA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    Argument::Address v = A + B;
+    if (memory.WriteBytes(C, (uint8_t*)&v, sizeof(v)))
+      return InstructionResult(Status::OK, C, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult SBB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A - B))
+      return InstructionResult(Status::OK, C, A - B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult SBA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    Argument::Address v = A - B;
+    if (memory.WriteBytes(C, (uint8_t*)&v, sizeof(v)))
+      return InstructionResult(Status::OK, C, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult MLB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A * B))
+      return InstructionResult(Status::OK, C, A * B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult MLA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    Argument::Address v = A * B;
+    if (memory.WriteBytes(C, (uint8_t*)&v, sizeof(v)))
+      return InstructionResult(Status::OK, C, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult DVB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data  A;
+    Argument::Data  B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A / B))
+      return InstructionResult(Status::OK, C, A / B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult DVA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    Argument::Address v = A / B;
+    if (memory.WriteBytes(C, (uint8_t*)&v, sizeof(v)))
+      return InstructionResult(Status::OK, C, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult MDB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A % B))
+      return InstructionResult(Status::OK, C, A % B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult MDA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    Argument::Address B;
+    Argument::Address C;
+    if (!a.Addr(0, A) || !a.Addr(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    Argument::Address v = A % B;
+    if (memory.WriteBytes(C, (Argument::Data*)&v, sizeof(v)))
+      return InstructionResult(Status::OK, C, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  /////////////////////////////
+  // Increment/decrement     //
+  /////////////////////////////
+
+  template <typename Operands>
+  InstructionResult INB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Data    v;
+    if (memory.ReadByte(A, v) && memory.WriteByte(A, ++v))
+      return InstructionResult(Status::OK, A, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+  }
+
+  template <typename Operands>
+  InstructionResult INA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Address v;
+    if (memory.ReadBytes(A, (Argument::Data*)(&v), sizeof(v)) && memory.WriteBytes(A, (Argument::Data*)(&++v), sizeof(v)))
+      return InstructionResult(Status::OK, A, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+  }
+
+  template <typename Operands>
+  InstructionResult DCB(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Data    v;
+    if (memory.ReadByte(A, v) && memory.WriteByte(A, --v))
+      return InstructionResult(Status::OK, A, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+  }
+
+  template <typename Operands>
+  InstructionResult DCA(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Address A;
+    if (!a.Addr(0, A))
+      return a.Fault();
+    Argument::Address v;
+    if (memory.ReadBytes(A, (Argument::Data*)(&v), sizeof(v)) && memory.WriteBytes(A, (Argument::Data*)(&--v), sizeof(v)))
+      return InstructionResult(Status::OK, A, v);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, A);
+  }
+
+  /////////////////////////////
+  // Bit manipulation        //
+  /////////////////////////////
+
+  template <typename Operands>
+  InstructionResult BLS(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A << B))
+      return InstructionResult(Status::OK, C, A << B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult BRS(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, A >> B))
+      return InstructionResult(Status::OK, C, A >> B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult ROL(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    B %= 8;
+    uint16_t r = uint16_t(A) << B;
+    r = (r & 0x0F) | ((r & 0xF0) >> 8);
+    if (memory.WriteByte(C, Argument::Data(r)))
+      return InstructionResult(Status::OK, C, r);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult ROR(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    B %= 8;
+    Argument::Data r = 0;
+    r |= (A >> B) & 0xF;
+    r |= A << (8 - B);
+    if (memory.WriteByte(C, Argument::Data(r)))
+      return InstructionResult(Status::OK, C, r);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult AND(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, Argument::Data(A & B)))
+      return InstructionResult(Status::OK, C, A & B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult BOR(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, Argument::Data(A | B)))
+      return InstructionResult(Status::OK, C, A | B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult XOR(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Data    B;
+    Argument::Address C;
+    if (!a.Byte(0, A) || !a.Byte(1, B) || !a.Addr(2, C))
+      return a.Fault();
+    if (memory.WriteByte(C, Argument::Data(A ^ B)))
+      return InstructionResult(Status::OK, C, A ^ B);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, C);
+  }
+
+  template <typename Operands>
+  InstructionResult NOT(Memory& memory, Instruction::Context* context, const Operands& a)
+  {
+    Argument::Data    A;
+    Argument::Address B;
+    if (!a.Byte(0, A) || !a.Addr(1, B))
+      return a.Fault();
+    if (memory.WriteByte(B, Argument::Data(~A)))
+      return InstructionResult(Status::OK, B, ~A);
+    return InstructionResult(Status::ADDRESS_NOT_MAPPED, B);
+  }
+}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // Lines of imported files, keyed by canonical path
+  // May be shared by any number of builds, including ones running on other threads
+  class DLLMODE ModuleCache
+  {
+  public:
+    ModuleCache();
+    ModuleCache(const ModuleCache&) = delete;
+    ModuleCache& operator=(const ModuleCache&) = delete;
+
+    // Loads the file the first time it's asked for and returns the cached lines after that
+    InterpretResult Load(const std::string& canonicalPath, std::vector<std::string>& lines);
+    void Clear();
+
+  private:
+    std::map<std::string, std::vector<std::string>> modules;
+    std::mutex mutex;
+  };
+
+  // Canonical form of folder/filename, or an empty string if the file doesn't exist
+  DLLMODE std::string CanonicalImportPath(const std::string& folder, const std::string& filename);
+}
+
+#pragma warning(pop)
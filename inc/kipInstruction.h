@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 #include "kipUniversal.h"
@@ -8,12 +9,16 @@
 
 #define KIP_VERBOSITY_RESERVE_SMALL uint8_t(100)
 #define KIP_VERBOSITY_RESERVE_LARGE uint8_t(200)
+#define KIP_PARALLEL_BUILD_MIN_LINES size_t(4096)
 
 #pragma warning(push)
 #pragma warning(disable:4251)
 
 namespace kip
 {
+  class Memory;
+  class ModuleCache;
+
   class DLLMODE InterpretResult
   {
   public:
@@ -24,6 +29,28 @@ namespace kip
     const std::string str;
   };
 
+  // Why an operand couldn't be resolved
+  enum class OperandFault : uint8_t
+  {
+    NONE,
+    DEREFERENCE,         // An address on the way to the operand isn't readable
+    BYTE,                // The byte at the resolved address isn't readable
+    STRING,              // The string at the resolved address isn't readable
+    STRING_DEREFERENCED, // String literals have no address to read through
+  };
+
+  // An operand's value, or the fault and address that stopped its resolution
+  // Resolution never throws, so an instruction with a bad operand fails like any other
+  template <typename T>
+  struct Resolved
+  {
+    T value;
+    OperandFault fault;
+    uint32_t address; // Where resolution stopped, when it failed
+
+    explicit operator bool() const { return fault == OperandFault::NONE; }
+  };
+
   class DLLMODE Argument
   {
   public:
@@ -35,14 +62,17 @@ namespace kip
     using AddressOrData = uint32_t;
     using Data = uint8_t;
 
-    Address GetAddr() const;
-    Data GetByte() const;
-    const std::string GetString() const;
+    Resolved<Address> GetAddr() const;
+    Resolved<Data> GetByte() const;
+    Resolved<std::string> GetString() const;
+    Resolved<Address> GetAddr(const Memory& memory) const;
+    Resolved<Data> GetByte(const Memory& memory) const;
+    Resolved<std::string> GetString(const Memory& memory) const;
 
     AddressOrData data = 0;
     uint8_t dereferenceCount = 0;
     std::string stringLabel = "";
-    enum class Type {
+    enum class Type : uint8_t {
       INVALID,
       DATA,
       STRING,
@@ -50,106 +80,153 @@ namespace kip
     } type;
   };
 
+  // Outcome of executing a single instruction
+  // Holds only a status and raw operands so that nothing is allocated unless the result is described
+  class DLLMODE InstructionResult
+  {
+  public:
+    enum class Status : uint8_t
+    {
+      OK,
+      ADDRESS_NOT_MAPPED,              // Operands: address
+      RANGE_NOT_MAPPED,                // Operands: start, end
+      STACK_NOT_MAPPED,
+      STACK_NOT_MAPPED_POST_READ,      // Operands: stack pointer
+      STACK_NOT_MAPPED_POST_WRITE,     // Operands: stack pointer
+      STACK_NOT_MAPPED_POST_INCREMENT, // Operands: stack pointer
+      STACK_NOT_MAPPED_POST_DECREMENT, // Operands: stack pointer
+      NO_CONTEXT,
+      FILE_NOT_OPENED,
+      OPERAND_NOT_RESOLVED,            // Operands: OperandFault, address
+    };
+
+    InstructionResult(Status status, Argument::AddressOrData a = 0, Argument::AddressOrData b = 0, Argument::AddressOrData c = 0);
+    operator bool() const;
+
+    Status status;
+    Argument::AddressOrData operands[3];
+  };
+
   class DLLMODE Instruction
   {
   public:
     // Map of label to line
     struct DLLMODE Context
     {
-      std::map<std::string, Argument> labels;
+      typedef std::map<std::string, Argument, std::less<>> Labels; // Transparent so labels can be found by string_view
+      Labels labels;
       std::string folder;
+      std::vector<std::string> imports; // Canonical path of every imported file, in the order they were included
+      ModuleCache* modules = nullptr;   // Optional cache of imported files to share between builds
       uint32_t line = 0;
+      uint64_t executed = 0; // Number of instructions run with this context
     };
 
     Instruction();
     Instruction(std::string line);
     Instruction(std::string line, Context& context);
+    Instruction(std::string line, const Context* context);
+
+    // Formats the result of running this instruction as text
+    InterpretResult Describe(const InstructionResult& result, const Memory& memory) const;
 
     // Instructions
 
     // Storage
-    InterpretResult STB(Context* context) const;
-    InterpretResult STA(Context* context) const;
-    InterpretResult STS(Context* context) const;
-    InterpretResult FIL(Context* context) const;
-    InterpretResult CPY(Context* context) const;
-    InterpretResult PUB(Context* context) const;
-    InterpretResult PUA(Context* context) const;
-    InterpretResult PUS(Context* context) const;
-    InterpretResult POB(Context* context) const;
-    InterpretResult POA(Context* context) const;
-    InterpretResult POS(Context* context) const;
-    InterpretResult BIN(Context* context) const;
-    InterpretResult SAV(Context* context) const;
+    InstructionResult STB(Memory& memory, Context* context) const;
+    InstructionResult STA(Memory& memory, Context* context) const;
+    InstructionResult STS(Memory& memory, Context* context) const;
+    InstructionResult FIL(Memory& memory, Context* context) const;
+    InstructionResult CPY(Memory& memory, Context* context) const;
+    InstructionResult PUB(Memory& memory, Context* context) const;
+    InstructionResult PUA(Memory& memory, Context* context) const;
+    InstructionResult PUS(Memory& memory, Context* context) const;
+    InstructionResult POB(Memory& memory, Context* context) const;
+    InstructionResult POA(Memory& memory, Context* context) const;
+    InstructionResult POS(Memory& memory, Context* context) const;
+    InstructionResult BIN(Memory& memory, Context* context) const;
+    InstructionResult SAV(Memory& memory, Context* context) const;
 
     // Debugging
-    InterpretResult RDB(Context* context) const;
-    InterpretResult RDA(Context* context) const;
-    InterpretResult RDS(Context* context) const;
+    InstructionResult RDB(Memory& memory, Context* context) const;
+    InstructionResult RDA(Memory& memory, Context* context) const;
+    InstructionResult RDS(Memory& memory, Context* context) const;
 
     // Control Flow
-    InterpretResult JMP(Context* context) const;
-    InterpretResult JEQ(Context* context) const;
-    InterpretResult JNE(Context* context) const;
-    InterpretResult JGT(Context* context) const;
-    InterpretResult JLT(Context* context) const;
-    InterpretResult JGE(Context* context) const;
-    InterpretResult JLE(Context* context) const;
-    InterpretResult HLT(Context* context) const;
-    InterpretResult CAL(Context* context) const;
+    InstructionResult JMP(Memory& memory, Context* context) const;
+    InstructionResult JEQ(Memory& memory, Context* context) const;
+    InstructionResult JNE(Memory& memory, Context* context) const;
+    InstructionResult JGT(Memory& memory, Context* context) const;
+    InstructionResult JLT(Memory& memory, Context* context) const;
+    InstructionResult JGE(Memory& memory, Context* context) const;
+    InstructionResult JLE(Memory& memory, Context* context) const;
+    InstructionResult HLT(Memory& memory, Context* context) const;
+    InstructionResult CAL(Memory& memory, Context* context) const;
 
     // Arithmetic
-    InterpretResult ADB(Context* context) const;
-    InterpretResult ADA(Context* context) const;
-    InterpretResult SBB(Context* context) const;
-    InterpretResult SBA(Context* context) const;
-    InterpretResult MLB(Context* context) const;
-    InterpretResult MLA(Context* context) const;
-    InterpretResult DVB(Context* context) const;
-    InterpretResult DVA(Context* context) const;
-    InterpretResult MDB(Context* context) const;
-    InterpretResult MDA(Context* context) const;
+    InstructionResult ADB(Memory& memory, Context* context) const;
+    InstructionResult ADA(Memory& memory, Context* context) const;
+    InstructionResult SBB(Memory& memory, Context* context) const;
+    InstructionResult SBA(Memory& memory, Context* context) const;
+    InstructionResult MLB(Memory& memory, Context* context) const;
+    InstructionResult MLA(Memory& memory, Context* context) const;
+    InstructionResult DVB(Memory& memory, Context* context) const;
+    InstructionResult DVA(Memory& memory, Context* context) const;
+    InstructionResult MDB(Memory& memory, Context* context) const;
+    InstructionResult MDA(Memory& memory, Context* context) const;
 
     // Increment/decrement
-    InterpretResult INB(Context* context) const;
-    InterpretResult INA(Context* context) const;
-    InterpretResult DCB(Context* context) const;
-    InterpretResult DCA(Context* context) const;
+    InstructionResult INB(Memory& memory, Context* context) const;
+    InstructionResult INA(Memory& memory, Context* context) const;
+    InstructionResult DCB(Memory& memory, Context* context) const;
+    InstructionResult DCA(Memory& memory, Context* context) const;
     
     // Bit manipulation
-    InterpretResult BLS(Context* context) const;
-    InterpretResult BRS(Context* context) const;
-    InterpretResult ROL(Context* context) const;
-    InterpretResult ROR(Context* context) const;
-    InterpretResult AND(Context* context) const;
-    InterpretResult BOR(Context* context) const;
-    InterpretResult XOR(Context* context) const;
-    InterpretResult NOT(Context* context) const;
-
-    const std::string line;
+    InstructionResult BLS(Memory& memory, Context* context) const;
+    InstructionResult BRS(Memory& memory, Context* context) const;
+    InstructionResult ROL(Memory& memory, Context* context) const;
+    InstructionResult ROR(Memory& memory, Context* context) const;
+    InstructionResult AND(Memory& memory, Context* context) const;
+    InstructionResult BOR(Memory& memory, Context* context) const;
+    InstructionResult XOR(Memory& memory, Context* context) const;
+    InstructionResult NOT(Memory& memory, Context* context) const;
+
+    std::string line;
     uint8_t id;
     std::vector<Argument> arguments;
   };
 
   DLLMODE std::string RemoveComments(std::string line);
   DLLMODE InterpretResult InterpretLine(std::string line);
+  DLLMODE InterpretResult InterpretLine(std::string line, Memory& memory, Instruction::Context* context);
   DLLMODE InterpretResult LoadFile(std::string filename, std::vector<std::string>& lines);
   DLLMODE std::vector<InterpretResult> BuildContext(Instruction::Context& context, std::vector<std::string>& lines);
   DLLMODE std::vector<InterpretResult> BuildContextImports(Instruction::Context& context, std::vector<std::string>& lines);
   DLLMODE std::vector<InterpretResult> BuildContextLabels(Instruction::Context& context, std::vector<std::string>& lines);
+  DLLMODE std::vector<InterpretResult> BuildContextLabels(Instruction::Context& context, const std::vector<std::string_view>& lines);
   DLLMODE std::vector<Instruction> BuildInstructions(Instruction::Context& context, std::vector<std::string>& lines);
+  // Splits lines across threadCount threads, or one per core if threadCount is 0
+  DLLMODE std::vector<Instruction> BuildInstructions(Instruction::Context& context, std::vector<std::string>& lines, unsigned threadCount);
+  DLLMODE std::vector<Instruction> BuildInstructions(Instruction::Context& context, const std::vector<std::string_view>& lines, unsigned threadCount = 0);
   DLLMODE std::vector<InterpretResult> InterpretLines(std::vector<std::string> &lines, uint8_t verbosity = 255);
   DLLMODE std::vector<InterpretResult> InterpretLines(std::vector<std::string> &lines, std::string folder, uint8_t verbosity = 255);
+  DLLMODE std::vector<InterpretResult> InterpretLines(std::vector<std::string> &lines, Memory& memory, Instruction::Context& context, uint8_t verbosity = 255);
   DLLMODE std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction> &inst, uint8_t verbosity = 255);
   DLLMODE std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction> &inst, Instruction::Context &context, uint8_t verbosity = 255);
+  DLLMODE std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction> &inst, Memory& memory, Instruction::Context &context, uint8_t verbosity = 255);
 
   DLLMODE Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context);
   DLLMODE Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context, Bytecode::Header& header);
-  DLLMODE Bytecode::Header BuildHeaderFromBytecode(const Bytecode::Data& inst, std::vector<InterpretResult>& r, uint32_t& offset);
-  DLLMODE Instruction::Context BuildContextFromBytecode(const Bytecode::Data& inst, std::vector<InterpretResult>& r, const uint32_t& offset);
-  DLLMODE std::vector<InterpretResult> BuildContextImportsFromBytecode(Instruction::Context& context, const Bytecode::Data& inst, uint32_t offset);
-  DLLMODE std::vector<InterpretResult> BuildContextLabelsFromBytecode(Instruction::Context& context, const Bytecode::Data& inst, uint32_t offset);
-  DLLMODE std::vector<InterpretResult> InterpretBytecode(const Bytecode::Data& inst, uint8_t verbosity = 255);
+  DLLMODE Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context, const std::vector<Bytecode::Metadata>& metadata);
+  DLLMODE Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context, Bytecode::Header& header, const std::vector<Bytecode::Metadata>& metadata);
+  DLLMODE Bytecode::Header BuildHeaderFromBytecode(const Bytecode::View& inst, std::vector<InterpretResult>& r, uint32_t& offset);
+  DLLMODE std::vector<Bytecode::Metadata> BuildMetadataFromBytecode(const Bytecode::Header& header, const Bytecode::View& inst, std::vector<InterpretResult>& r, uint32_t& offset);
+  DLLMODE Instruction::Context BuildContextFromBytecode(const Bytecode::View& inst, std::vector<InterpretResult>& r, const uint32_t& offset);
+  DLLMODE std::vector<InterpretResult> BuildContextImportsFromBytecode(Instruction::Context& context, const Bytecode::View& inst, uint32_t offset);
+  DLLMODE std::vector<InterpretResult> BuildContextLabelsFromBytecode(Instruction::Context& context, const Bytecode::View& inst, uint32_t offset);
+  // Byte offset of every instruction record, indexed by line
+  DLLMODE std::vector<InterpretResult> BuildLineOffsetsFromBytecode(std::vector<uint32_t>& lines, const Bytecode::View& inst, uint32_t offset);
+  DLLMODE std::vector<InterpretResult> InterpretBytecode(const Bytecode::View& inst, uint8_t verbosity = 255);
 }
 
 #pragma warning(pop)
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+#include "kipProgram.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  class Machine;
+
+  // Native x86-64 code for the basic blocks of a Program
+  // Blocks start at labels, jump targets and after control flow, and end at JMP, Jxx, CAL and HLT
+  // Lines that can't be compiled, and accesses outside DATA blocks, are handed back to the interpreter
+  class DLLMODE JitProgram
+  {
+  public:
+    static const uint32_t NO_ENTRY = uint32_t(-1);
+
+    JitProgram();
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+    ~JitProgram();
+
+    void Release();
+
+    const Program* program = nullptr; // Must outlive this
+    std::vector<uint32_t> entries;    // Offset into code of the block starting at each line, or NO_ENTRY
+    uint8_t* code = nullptr;          // Executable pages, owned
+    size_t codeSize = 0;
+    uint8_t verbosity = 0;            // Instructions traced at this verbosity are left to the interpreter
+    uint32_t blocks = 0;              // Blocks compiled
+    uint32_t compiled = 0;            // Instructions compiled into them
+    uint32_t interpreted = 0;         // Instructions always left to the interpreter
+  };
+
+  // True when this build can generate code for the host
+  DLLMODE bool IsJitSupported();
+  // Labels in context mark where blocks may be entered; verbosity is the one the program will be run with
+  DLLMODE std::vector<InterpretResult> CompileProgram(JitProgram& jit, const Program& program, const Instruction::Context& context, uint8_t verbosity = 0);
+  // Runs compiled blocks natively and everything else through the interpreter, tracing at the compiled verbosity
+  // Without compiled code, runs jit.program through InterpretProgram
+  DLLMODE std::vector<InterpretResult> InterpretJitProgram(const JitProgram& jit, Memory& memory, Instruction::Context& context);
+  DLLMODE std::vector<InterpretResult> InterpretJitProgram(const JitProgram& jit, Machine& machine);
+}
+
+#pragma warning(pop)
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+#include "kipProgram.h"
+
+// Lanes InterpretLanes steps together; more amortize dispatch better, fewer keep their memory in cache
+#define KIP_LANE_WIDTH size_t(64)
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  class Machine;
+
+  // How InterpretLanes spent its time
+  class DLLMODE LaneReport
+  {
+  public:
+    InterpretResult Describe() const;
+
+    uint64_t groups = 0;   // Lines dispatched once for every lane waiting on them
+    uint64_t lockstep = 0; // Lane instructions run by the byte kernels
+    uint64_t scalar = 0;   // Lane instructions run one lane at a time
+    uint64_t splits = 0;   // Groups that ran with only some of the live lanes
+  };
+
+  // Runs one program over many machines, called lanes, in lockstep, KIP_LANE_WIDTH lanes at a time
+  // Each step takes the lanes at the lowest line, so lanes that branch apart wait for each other and merge again
+  // where their paths meet. ADB, SBB, MLB, AND, BOR, XOR and NOT over DATA blocks run across the group in one
+  // kernel; everything else, and any lane whose operands can't take the fast path, runs through StepProgram.
+  // Each lane's results, memory and context end up as InterpretProgram would leave them, as long as lanes
+  // don't share DATA blocks
+  DLLMODE std::vector<std::vector<InterpretResult>> InterpretLanes(const Program& program, const std::vector<Machine*>& lanes, uint8_t verbosity = 0);
+  DLLMODE std::vector<std::vector<InterpretResult>> InterpretLanes(const Program& program, const std::vector<Machine*>& lanes, LaneReport& report, uint8_t verbosity = 0);
+}
+
+#pragma warning(pop)
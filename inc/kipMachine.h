@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+#include "kipMemory.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // Everything needed to run one kip program: an address space, its stack pointer and a context
+  // Independent machines share no mutable state, so each may be run on its own thread
+  class DLLMODE Machine
+  {
+  public:
+    Machine();
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    Memory memory;
+    Instruction::Context context;
+  };
+
+  // Machine used by the free memory functions and the overloads which don't take a machine
+  DLLMODE Machine& GetDefaultMachine();
+
+  DLLMODE InterpretResult InterpretLine(std::string line, Machine& machine);
+  DLLMODE std::vector<InterpretResult> InterpretLines(std::vector<std::string>& lines, Machine& machine, uint8_t verbosity = 255);
+  DLLMODE std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction>& inst, Machine& machine, uint8_t verbosity = 255);
+}
+
+#pragma warning(pop)
@@ -2,17 +2,132 @@
 
 #include "pch.h"
 
+#include <array>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "kipUniversal.h"
 #include "kipInstruction.h"
 
+#pragma warning(push)
+#pragma warning(disable:4251)
+
 namespace kip
 {
-  DLLMODE bool MapMemory(Argument::Data* start, Argument::Address size, Argument::Address mappedStart);
   typedef void (*MemoryReadFunction)(Argument::Address offset, Argument::Data* out, Argument::Address count);
   typedef void (*MemoryWriteFunction)(Argument::Address offset, Argument::Data* in, Argument::Address count);
+  // Device callbacks, handed each contiguous span of an access in one call along with the context they were mapped with
+  typedef void (*MemorySpanReadFunction)(void* context, Argument::Address offset, Argument::Data* out, Argument::Address count);
+  typedef void (*MemorySpanWriteFunction)(void* context, Argument::Address offset, const Argument::Data* in, Argument::Address count);
+
+  // A single guest address space along with its stack pointer
+  // Separate instances share no state and may be used from separate threads
+  class DLLMODE Memory
+  {
+  public:
+    Memory();
+    ~Memory();
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+
+    // Flat mode, opted into before anything is mapped, reserves the whole 4GiB guest space on 64-bit x86 Linux
+    // and Windows hosts, and returns false elsewhere. Blocks from CommitMemory live inside the reservation, so
+    // ReadByte, WriteByte, ReadBytes and WriteBytes reach them at base + address once a bit per page says they're
+    // committed. Other pages go straight to the block lookup, so FUNC blocks, host arrays, sparse blocks and
+    // unmapped addresses behave and cost as before; an access that runs off the end of committed pages faults
+    // back into the lookup
+    bool ReserveFlat();
+    bool IsFlat() const;
+    // Zeroed memory owned by this instance, in flat mode only; start and size must be multiples of 4KiB
+    Argument::Data* CommitMemory(Argument::Address size, Argument::Address mappedStart);
+
+    bool MapMemory(Argument::Data* start, Argument::Address size, Argument::Address mappedStart);
+    bool MapMemory(MemoryReadFunction readFunc, MemoryWriteFunction writeFunc, Argument::Address size, Argument::Address mappedStart);
+    bool MapMemory(MemorySpanReadFunction readSpan, MemorySpanWriteFunction writeSpan, void* context, Argument::Address size, Argument::Address mappedStart);
+    // Zeroed memory owned by this instance, which allocates a 4KiB page the first time something nonzero is written
+    // to it; untouched pages read as zero
+    bool MapSparseMemory(Argument::Address size, Argument::Address mappedStart);
+    bool UnmapMemory(Argument::Data* start);
+    bool UnmapMemory(Argument::Address mappedStart);
+    bool WriteByte(Argument::Address address, Argument::Data byte);
+    bool ReadByte(Argument::Address address, Argument::Data& byte) const;
+    bool WriteBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count);
+    bool ReadBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count) const;
+    bool WriteString(Argument::Address address, const std::string& string);
+    bool ReadString(Argument::Address address, std::string& string) const;
+    // Bulk forms of WriteByte and of ReadBytes followed by WriteBytes, which find each block once per span
+    // FillBytes fills up to the first byte it can't write, and reports it in failed
+    // CopyBytes moves as if through a temporary buffer, so the ranges may overlap, and writes nothing unless the
+    // whole source can be read and the whole destination written
+    bool FillBytes(Argument::Address address, Argument::Data byte, Argument::Address count);
+    bool FillBytes(Argument::Address address, Argument::Data byte, Argument::Address count, Argument::Address& failed);
+    bool CopyBytes(Argument::Address to, Argument::Address from, Argument::Address count);
+    bool CanRead(Argument::Address address, Argument::Address count) const;  // Checks mappings only, without calling functions
+    bool CanWrite(Argument::Address address, Argument::Address count) const;
+    bool SetStackPointer(Argument::Address address);
+    bool GetStackPointer(Argument::Address& address) const;
+
+    // Fast path for generated code, which checks what it needs itself
+    Argument::Data* Translate(Argument::Address address, Argument::Address count) const; // Host pointer to count bytes in one DATA block, or nullptr
+    Argument::Address& RawStackPointer(); // Unchecked; only move it next to an access that succeeded, which keeps it mapped
+    uint32_t GetGeneration() const;       // Changes whenever memory is mapped or unmapped, so translations can be cached
+
+    size_t GetResidentPages() const; // Pages allocated so far by sparse blocks
+
+  private:
+    struct SparsePages;
+
+    struct Block {
+      Argument::Address mappedAddr;
+      Argument::Data* realAddr;
+      Argument::Address size;
+      MemoryReadFunction readFunc;
+      MemoryWriteFunction writeFunc;
+      MemorySpanReadFunction readSpan;
+      MemorySpanWriteFunction writeSpan;
+      void* context;
+      bool committed; // Pages of the flat reservation, released when the block is unmapped
+      enum class Type {
+        DATA,
+        FUNC,
+        SPARSE
+      } type;
+      std::shared_ptr<SparsePages> sparse;
+
+      // FUNC and SPARSE blocks only
+      bool CanRead() const;
+      bool CanWrite() const;
+      void Read(Argument::Address offset, Argument::Data* out, Argument::Address count) const;
+      void Write(Argument::Address offset, const Argument::Data* in, Argument::Address count) const;
+    };
+
+    // Two-level page table over the 32-bit address space (1024 tables of 1024 4KiB pages)
+    // Each entry holds the index of the first block in blocks which overlaps that page
+    typedef std::array<uint32_t, 1024> PageTable;
+    typedef std::array<std::unique_ptr<PageTable>, 1024> PageDirectory;
+
+    bool MapMemory(Block newBlock);
+    void RebuildPageTable();
+    const Block* FindBlock(Argument::Address address) const;
+    bool IsMappedOrEnd(Argument::Address address) const;
+    bool IsRangeMapped(Argument::Address address, Argument::Address count, bool write) const;
+    bool IsCommitted(Argument::Address address, Argument::Address count) const;
+    void Release(const Block& block);
+
+    std::vector<Block> blocks; // Sorted by mappedAddr
+    PageDirectory pageDirectory;
+    Argument::Address stackPointer = 0;
+    uint32_t generation = 0;
+    Argument::Data* flat = nullptr; // Base of the reservation in flat mode
+    std::vector<uint64_t> committedPages; // Flat mode only: a bit for each page inside a committed block
+  };
+
+  // Shims which operate on the default machine's memory
+  DLLMODE bool MapMemory(Argument::Data* start, Argument::Address size, Argument::Address mappedStart);
   DLLMODE bool MapMemory(MemoryReadFunction readFunc, MemoryWriteFunction writeFunc, Argument::Address size, Argument::Address mappedStart);
+  DLLMODE bool MapMemory(MemorySpanReadFunction readSpan, MemorySpanWriteFunction writeSpan, void* context, Argument::Address size, Argument::Address mappedStart);
+  DLLMODE bool MapSparseMemory(Argument::Address size, Argument::Address mappedStart);
   DLLMODE bool UnmapMemory(Argument::Data* start);
   DLLMODE bool UnmapMemory(Argument::Address mappedStart);
   DLLMODE bool WriteByte(Argument::Address address, Argument::Data byte);
@@ -21,6 +136,10 @@ namespace kip
   DLLMODE bool ReadBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count);
   DLLMODE bool WriteString(Argument::Address address, const std::string& string);
   DLLMODE bool ReadString(Argument::Address address, std::string& string);
+  DLLMODE bool FillBytes(Argument::Address address, Argument::Data byte, Argument::Address count);
+  DLLMODE bool CopyBytes(Argument::Address to, Argument::Address from, Argument::Address count);
   DLLMODE bool SetStackPointer(Argument::Address address);
   DLLMODE bool GetStackPointer(Argument::Address& address);
 }
+
+#pragma warning(pop)
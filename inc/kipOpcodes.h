@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Every executable instruction, in instruction id order, as X(mnemonic, handler)
+// New instructions go at the end so that compiled bytecode keeps its meaning
+#define KIP_OPCODES(X) \
+  X(STB, STB) \
+  X(STA, STA) \
+  X(STS, STS) \
+  X(FIL, FIL) \
+  X(CPY, CPY) \
+  X(PUB, PUB) \
+  X(PUA, PUA) \
+  X(PUS, PUS) \
+  X(POB, POB) \
+  X(POA, POA) \
+  X(POS, POS) \
+  X(BIN, BIN) \
+  X(SAV, SAV) \
+  X(RDB, RDB) \
+  X(RDA, RDA) \
+  X(RDS, RDS) \
+  X(JMP, JMP) \
+  X(JEQ, JEQ) \
+  X(JNE, JNE) \
+  X(JGT, JGT) \
+  X(JLT, JLT) \
+  X(HLT, HLT) \
+  X(CAL, CAL) \
+  X(ADB, ADB) \
+  X(ADA, ADA) \
+  X(SBB, SBB) \
+  X(SBA, SBA) \
+  X(MLB, MLB) \
+  X(MLA, MLA) \
+  X(DVB, DVB) \
+  X(DVA, DVA) \
+  X(MDA, MDB) \
+  X(INB, INB) \
+  X(INA, INA) \
+  X(DCB, DCB) \
+  X(DCA, DCA) \
+  X(BLS, BLS) \
+  X(BRS, BRS) \
+  X(ROL, ROL) \
+  X(ROR, ROR) \
+  X(AND, AND) \
+  X(BOR, BOR) \
+  X(XOR, XOR) \
+  X(NOT, NOT)
+
+// Pairs of consecutive instructions that a decoded Program can run in one dispatch, as X(name, first, second)
+// Only the second may change control flow. Covers what profiles of the examples spend their dispatches on:
+// stack frames around calls and returns, and the update-then-branch at the end of loops
+#define KIP_SUPERINSTRUCTIONS(X) \
+  X(POA_POB, POA, POB) \
+  X(POA_POA, POA, POA) \
+  X(POB_POA, POB, POA) \
+  X(POB_POB, POB, POB) \
+  X(PUA_PUA, PUA, PUA) \
+  X(PUA_PUB, PUA, PUB) \
+  X(PUB_PUA, PUB, PUA) \
+  X(PUB_PUB, PUB, PUB) \
+  X(PUA_CAL, PUA, CAL) \
+  X(PUB_CAL, PUB, CAL) \
+  X(DCB_PUB, DCB, PUB) \
+  X(INA_PUA, INA, PUA) \
+  X(ADA_PUA, ADA, PUA) \
+  X(ADA_ADA, ADA, ADA) \
+  X(SBB_SBB, SBB, SBB) \
+  X(SBB_ADB, SBB, ADB) \
+  X(ADB_INB, ADB, INB) \
+  X(STB_JMP, STB, JMP) \
+  X(ADB_JMP, ADB, JMP) \
+  X(INB_JNE, INB, JNE) \
+  X(DCB_JNE, DCB, JNE) \
+  X(INB_JLT, INB, JLT) \
+  X(DCB_JGT, DCB, JGT) \
+  X(ADB_DCB, ADB, DCB)
+
+namespace kip
+{
+  // Instruction ids as named constants
+  enum class Opcode : uint8_t
+  {
+    NOP,
+#define KIP_OPCODE_ENUM(name, handler) name,
+    KIP_OPCODES(KIP_OPCODE_ENUM)
+#undef KIP_OPCODE_ENUM
+    COUNT
+  };
+
+  // Mnemonic of each instruction id; id 0 has none
+  constexpr const char opcodeMnemonics[][4] = {
+    "",
+#define KIP_OPCODE_MNEMONIC(name, handler) #name,
+    KIP_OPCODES(KIP_OPCODE_MNEMONIC)
+#undef KIP_OPCODE_MNEMONIC
+  };
+
+  // Superinstruction ids, which follow the instruction ids and are never written to bytecode
+  enum class Superinstruction : uint8_t
+  {
+    BEFORE_FIRST = uint8_t(Opcode::COUNT) - 1,
+#define KIP_SUPERINSTRUCTION_ENUM(name, first, second) name,
+    KIP_SUPERINSTRUCTIONS(KIP_SUPERINSTRUCTION_ENUM)
+#undef KIP_SUPERINSTRUCTION_ENUM
+    END
+  };
+
+  constexpr uint8_t superinstructionCount = uint8_t(Superinstruction::END) - uint8_t(Opcode::COUNT);
+
+  // Name and member instruction ids of each superinstruction, indexed from 0
+  struct SuperinstructionInfo
+  {
+    const char* name;
+    Opcode first;
+    Opcode second;
+  };
+
+  constexpr SuperinstructionInfo superinstructions[] = {
+#define KIP_SUPERINSTRUCTION_INFO(name, first, second) { #name, Opcode::first, Opcode::second },
+    KIP_SUPERINSTRUCTIONS(KIP_SUPERINSTRUCTION_INFO)
+#undef KIP_SUPERINSTRUCTION_INFO
+  };
+
+namespace OpcodeHash
+{
+  // Mnemonics are three letters, so they pack into 24 bits
+  constexpr uint32_t Pack(const char* mnemonic)
+  {
+    return (uint32_t(uint8_t(mnemonic[0])) << 16) | (uint32_t(uint8_t(mnemonic[1])) << 8) | uint32_t(uint8_t(mnemonic[2]));
+  }
+
+  // Multiplicative hash; MULTIPLIER was searched for so that no two mnemonics share a slot
+  const uint32_t BITS = 7;
+  const uint32_t SIZE = 1u << BITS;
+  const uint32_t MULTIPLIER = 0xE1AF2B;
+
+  constexpr uint32_t Slot(uint32_t packed)
+  {
+    return uint32_t(packed * MULTIPLIER) >> (32 - BITS);
+  }
+
+  // Slot to instruction id, 0 for unused slots
+  struct Table
+  {
+    uint8_t ids[SIZE];
+    bool perfect;
+
+    constexpr Table()
+      : ids(), perfect(true)
+    {
+      for (uint8_t id = 1; id < uint8_t(Opcode::COUNT); ++id)
+      {
+        uint32_t slot = Slot(Pack(opcodeMnemonics[id]));
+        if (ids[slot] != 0)
+          perfect = false;
+        ids[slot] = id;
+      }
+    }
+  };
+
+  constexpr Table table;
+  static_assert(table.perfect, "Two mnemonics hash to the same slot; search for a new OpcodeHash::MULTIPLIER");
+}
+
+  // Instruction id of an upper case mnemonic, or 0 if it isn't one
+  constexpr uint8_t GetInstructionIndex(const char* mnemonic, size_t length)
+  {
+    if (length != 3)
+      return 0;
+    uint32_t packed = OpcodeHash::Pack(mnemonic);
+    uint8_t id = OpcodeHash::table.ids[OpcodeHash::Slot(packed)];
+    return OpcodeHash::Pack(opcodeMnemonics[id]) == packed ? id : 0;
+  }
+
+  static_assert(GetInstructionIndex("STB", 3) == uint8_t(Opcode::STB), "Opcode lookup is broken");
+}
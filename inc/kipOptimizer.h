@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // What OptimizeInstructions changed
+  // Instructions are never added or moved, so every line number and label keeps its meaning; removed ones become id 0
+  struct DLLMODE OptimizationReport
+  {
+    uint32_t before = 0;     // Executable instructions before optimizing
+    uint32_t after = 0;      // Executable instructions after optimizing
+    uint32_t folded = 0;     // Arithmetic and branches on immediates evaluated ahead of time
+    uint32_t reduced = 0;    // Adds and subtracts of 1 turned into increments and decrements
+    uint32_t threaded = 0;   // Jumps sent straight to their final destination
+    uint32_t deadStores = 0; // Stores overwritten by the next instruction before anything could read them
+
+    InterpretResult Describe() const;
+  };
+
+  // Peephole optimizer for built instructions, to run before they're decoded, compiled or interpreted
+  // Tracing an optimized program shows the instructions that actually ran
+  DLLMODE OptimizationReport OptimizeInstructions(std::vector<Instruction>& inst);
+}
+
+#pragma warning(pop)
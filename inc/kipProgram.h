@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipBytecode.h"
+#include "kipFile.h"
+#include "kipInstruction.h"
+#include "kipOpcodes.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  class Machine;
+
+  // Fixed-size operand record
+  // For STRING operands, data is an index into Program::strings
+  struct Operand
+  {
+    Argument::AddressOrData data;
+    uint8_t dereferenceCount;
+    Argument::Type type;
+  };
+
+  // Dense execution image of a list of instructions, stored as parallel arrays
+  // Index i of each array describes source line i, so labels and jumps keep their meaning
+  class DLLMODE Program
+  {
+  public:
+    static const uint8_t MAX_OPERANDS = 3;
+
+    uint32_t size() const;
+    const Operand* GetOperands(uint32_t index) const;
+    uint8_t GetOpcode(uint32_t index) const; // Instruction id of a line, even where a superinstruction starts
+
+    std::vector<uint8_t> opcodes;       // 0 for lines with nothing to execute; FuseProgram may store superinstruction ids
+    std::vector<Operand> operands;      // MAX_OPERANDS per line, unused ones are zeroed
+    std::vector<std::string> strings;   // Interned string literals
+    std::vector<std::string> sourceMap; // Source text of each line, only read when tracing
+    uint32_t start = 0;                 // Line of the START label, if any
+  };
+
+  // Dispatches that started at each line during ProfileProgram
+  class DLLMODE ProgramProfile
+  {
+  public:
+    std::vector<uint64_t> lines;
+  };
+
+  // Superinstructions FuseProgram substituted
+  class DLLMODE FusionReport
+  {
+  public:
+    struct Fusion
+    {
+      Superinstruction id;
+      uint32_t sites; // Lines where it starts
+      uint64_t fires; // Dispatches it would have saved in the profiled run
+    };
+
+    std::vector<InterpretResult> Describe() const; // One line per superinstruction that fired
+
+    std::vector<Fusion> fusions;
+  };
+
+  // Bytecode prepared to run in place
+  // Instruction records are read straight out of image, which must outlive this
+  class DLLMODE BytecodeProgram
+  {
+  public:
+    uint32_t size() const;
+
+    Bytecode::Header header;
+    std::vector<Bytecode::Metadata> metadata;
+    Bytecode::View image;
+    std::vector<uint32_t> lines; // Byte offset of each line's instruction record, so jumps land without scanning
+    uint32_t start = 0;          // Line of the START label, if any
+  };
+
+  // Why RunProgramFor returned
+  enum class StopReason : uint8_t
+  {
+    BUDGET,   // Ran the instructions it was given; call again to carry on
+    HALTED,   // Ran HLT
+    FINISHED, // Ran off the end of the program
+    FAULT,    // An instruction failed, and is the last result; execution has moved past it
+  };
+
+  DLLMODE Program DecodeInstructions(const std::vector<Instruction>& inst, Instruction::Context& context);
+  DLLMODE Program DecodeBytecode(const BytecodeProgram& program); // Traces show mnemonics, as InterpretBytecode's do
+  DLLMODE std::vector<InterpretResult> InterpretProgram(const Program& program, Memory& memory, Instruction::Context& context, uint8_t verbosity = 255);
+  DLLMODE std::vector<InterpretResult> InterpretProgram(const Program& program, Machine& machine, uint8_t verbosity = 255);
+  // Resumable execution, for hosts that give many programs a slice of time each
+  // StartProgram points context at the START line; each RunProgramFor then continues from context.line, leaving
+  // it, the stack pointer and memory where the slice ended. Results are appended to r and no final
+  // "Executed successfully" is added. A budget of 1 steps one instruction; lines without one are free
+  DLLMODE void StartProgram(const Program& program, Instruction::Context& context);
+  DLLMODE StopReason RunProgramFor(const Program& program, Memory& memory, Instruction::Context& context, uint64_t maxInstructions, std::vector<InterpretResult>& r, uint8_t verbosity = 0);
+  DLLMODE StopReason RunProgramFor(const Program& program, Machine& machine, uint64_t maxInstructions, std::vector<InterpretResult>& r, uint8_t verbosity = 0);
+  // Runs the single line at index exactly as InterpretProgram would, leaving context.line at the next line to run
+  // Returns false if the instruction failed and execution should stop
+  DLLMODE bool StepProgram(const Program& program, uint32_t index, Memory& memory, Instruction::Context& context, uint8_t verbosity, std::vector<InterpretResult>& r);
+  DLLMODE bool IsTraced(uint8_t id, uint8_t verbosity); // Whether a successful instruction is described at this verbosity
+  DLLMODE std::vector<InterpretResult> ProfileProgram(const Program& program, Machine& machine, ProgramProfile& profile, uint8_t verbosity = 0);
+  // Substitutes superinstructions for pairs of lines; with a profile, only pairs that ran at least threshold times
+  // Each fused line keeps its second instruction, so jumps into the middle of a pair still work
+  DLLMODE FusionReport FuseProgram(Program& program, const ProgramProfile* profile = nullptr, uint64_t threshold = 1);
+  DLLMODE std::vector<InterpretResult> LoadBytecode(BytecodeProgram& program, Instruction::Context& context, const Bytecode::View& bc);
+  DLLMODE std::vector<InterpretResult> InterpretBytecode(const BytecodeProgram& program, Memory& memory, Instruction::Context& context, uint8_t verbosity = 255);
+  DLLMODE std::vector<InterpretResult> InterpretBytecode(const Bytecode::View& bc, Machine& machine, uint8_t verbosity = 255);
+
+  // Compiled bytecode files (.kbc) are mapped rather than read, and run in place
+  // file must stay open for as long as program is used
+  DLLMODE InterpretResult SaveBytecodeFile(const std::string& filename, const Bytecode::View& bc);
+  DLLMODE std::vector<InterpretResult> LoadBytecodeFile(BytecodeProgram& program, Instruction::Context& context, MappedFile& file, const std::string& filename);
+  DLLMODE std::vector<InterpretResult> InterpretBytecodeFile(const std::string& filename, Machine& machine, uint8_t verbosity = 255);
+}
+
+#pragma warning(pop)
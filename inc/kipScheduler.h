@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+#include "kipMachine.h"
+#include "kipProgram.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // Runs many machines on a pool of threads, a slice of instructions at a time
+  // Each thread keeps its own queue of machines, takes from the front and puts a machine that used up its slice
+  // on the back; a thread with nothing to run steals from the back of another's queue, and sleeps when none has work
+  class DLLMODE Scheduler
+  {
+  public:
+    // Called on the thread that finished the machine, with everything RunProgramFor reported; the last result is
+    // "Executed successfully" unless the program failed. The machine is destroyed afterwards unless moved out
+    // Completions may Submit more work, but must not throw or Wait
+    typedef std::function<void(std::unique_ptr<Machine>& machine, StopReason reason, std::vector<InterpretResult>& results)> Completion;
+
+    struct Stats
+    {
+      uint64_t submitted = 0;
+      uint64_t completed = 0;
+      uint64_t slices = 0; // RunProgramFor calls
+      uint64_t steals = 0; // Machines taken from another thread's queue
+    };
+
+    // threadCount 0 uses every core; slice is the instruction budget a machine gets before the next one runs
+    explicit Scheduler(unsigned threadCount = 0, uint64_t slice = 10000);
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+    // Machines that haven't finished are abandoned, without their completions
+    ~Scheduler();
+
+    // Takes the machine and runs program on it from its START line; program is shared by every machine running it
+    // Safe to call from any thread, including from a completion
+    void Submit(std::shared_ptr<const Program> program, std::unique_ptr<Machine> machine, Completion done, uint8_t verbosity = 0);
+    // Blocks until every submitted machine, and anything their completions submitted, has finished
+    void Wait();
+
+    unsigned ThreadCount() const;
+    Stats GetStats() const;
+
+  private:
+    struct Job;
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<std::unique_ptr<Job>> jobs;
+    };
+
+    void Work(unsigned self);
+    void Push(unsigned queue, std::unique_ptr<Job> job, bool requeue);
+    std::unique_ptr<Job> Pop(unsigned self);
+    void Finish(std::unique_ptr<Job> job, StopReason reason);
+
+    const uint64_t slice;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> queued{0};      // Jobs in queues
+    std::atomic<uint64_t> outstanding{0}; // Jobs submitted and not yet finished
+    std::atomic<unsigned> sleeping{0};
+    std::atomic<unsigned> next{0};        // Queue for the next submission from outside the pool
+    std::atomic<bool> stopping{false};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::mutex doneMutex;
+    std::condition_variable done;
+    std::atomic<uint64_t> submitted{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> slices{0};
+    std::atomic<uint64_t> steals{0};
+  };
+}
+
+#pragma warning(pop)
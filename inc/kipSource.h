@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipFile.h"
+#include "kipInstruction.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  class Machine;
+
+  // One source file split into lines that point straight into the file's contents
+  // The file is mapped when possible and read through a large buffer otherwise
+  class DLLMODE SourceFile
+  {
+  public:
+    SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    InterpretResult Open(const std::string& filename);
+
+    std::string filename;
+    std::string_view text;               // Whole file as it was read, which lines point into
+    std::vector<std::string_view> lines; // Without line endings; valid until this is destroyed or reopened
+
+  private:
+    void SplitLines(std::string_view text);
+
+    MappedFile mapping;
+    std::string buffer; // Only used when the file couldn't be mapped
+  };
+
+  // A program's source and every file it imports, kept open so their lines can be viewed in place
+  class DLLMODE Source
+  {
+  public:
+    InterpretResult Open(const std::string& filename);
+    SourceFile& Add(); // Keeps another file open for as long as this source
+    const SourceFile* Find(const std::string& filename) const; // An open file, or nullptr
+
+    std::vector<std::string_view> lines;
+    std::string folder; // Folder of the opened file, which imports are relative to
+
+  private:
+    std::vector<std::unique_ptr<SourceFile>> files;
+  };
+
+  DLLMODE std::vector<InterpretResult> BuildContext(Instruction::Context& context, Source& source);
+  DLLMODE std::vector<InterpretResult> BuildContextImports(Instruction::Context& context, Source& source);
+  DLLMODE std::vector<InterpretResult> InterpretFile(const std::string& filename, Machine& machine, uint8_t verbosity = 255);
+}
+
+#pragma warning(pop)
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string_view>
+#include "kipUniversal.h"
+#include "kipInstruction.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // Splits one line of kip source into tokens in a single pass, without copying it
+  // Tokens are separated by spaces, string literals keep their quotes and may contain spaces,
+  // and a comment character outside of a string literal ends the line
+  class DLLMODE Tokenizer
+  {
+  public:
+    Tokenizer(std::string_view line);
+
+    // Returns false once there are no tokens left
+    bool Next(std::string_view& token);
+
+  private:
+    std::string_view rest;
+  };
+
+  DLLMODE bool IsCommentCharacter(char c);
+
+  // Parses a $hex, :binary, #octal or decimal literal
+  // Returns false if the whole token isn't a valid literal
+  DLLMODE bool ParseLiteral(std::string_view token, Argument::AddressOrData& value);
+}
+
+#pragma warning(pop)
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "kipUniversal.h"
+#include "kipBytecode.h"
+#include "kipInstruction.h"
+#include "kipProgram.h"
+
+#pragma warning(push)
+#pragma warning(disable:4251)
+
+namespace kip
+{
+  // Ahead-of-time translation of a program into one C++ function, to be compiled into the host and linked against kip:
+  //   std::vector<kip::InterpretResult> name(kip::Memory& memory, kip::Instruction::Context& context, uint8_t verbosity);
+  // Results, traces and memory match InterpretProgram at any verbosity. Every line is a goto target and jumps to
+  // labels go straight to them; accesses within DATA blocks are made inline, and anything else, including every
+  // traced instruction, is handed to StepProgram
+  DLLMODE std::vector<InterpretResult> TranspileProgram(std::string& cpp, const Program& program, const std::string& name);
+  DLLMODE std::vector<InterpretResult> TranspileInstructions(std::string& cpp, const std::vector<Instruction>& inst, Instruction::Context& context, const std::string& name);
+  DLLMODE std::vector<InterpretResult> TranspileBytecode(std::string& cpp, const Bytecode::View& bc, const std::string& name); // Traces show mnemonics
+  // Builds a source file and its imports, and saves the function to output
+  DLLMODE std::vector<InterpretResult> TranspileFile(const std::string& filename, const std::string& output, const std::string& name);
+}
+
+#pragma warning(pop)
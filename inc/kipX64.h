@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Internal to the JIT: just enough of an x86-64 assembler to emit basic blocks
+// Not included by kip.h
+
+namespace kip
+{
+namespace X64
+{
+  enum class Reg : uint8_t
+  {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+  };
+
+  // Condition codes, as the low nibble of Jcc
+  enum class Cond : uint8_t
+  {
+    B = 0x2,  // Unsigned <
+    AE = 0x3, // Unsigned >=
+    E = 0x4,
+    NE = 0x5,
+    BE = 0x6, // Unsigned <=
+    A = 0x7,  // Unsigned >
+  };
+
+  // Integer arguments of a call, in the host's calling convention
+#ifdef _WIN32
+  const Reg ARG0 = Reg::RCX;
+  const Reg ARG1 = Reg::RDX;
+  const Reg ARG2 = Reg::R8;
+  const uint8_t SHADOW_SPACE = 32;
+#else
+  const Reg ARG0 = Reg::RDI;
+  const Reg ARG1 = Reg::RSI;
+  const Reg ARG2 = Reg::RDX;
+  const uint8_t SHADOW_SPACE = 0;
+#endif
+
+  // Position in the code that jumps can target before it's known
+  struct Label
+  {
+    uint32_t id = uint32_t(-1);
+  };
+
+  // Appends machine code to a buffer
+  // Every operation is on 32-bit registers unless its name ends in 64; memory operands are [base + disp]
+  class Emitter
+  {
+  public:
+    Label NewLabel();
+    void Bind(Label label);
+    bool IsBound(Label label) const;
+    uint32_t Offset(Label label) const;
+
+    // Resolves every jump to its label, returning false if one was never bound
+    bool Finish();
+    const std::vector<uint8_t>& code() const;
+
+    void MovImm(Reg dst, uint32_t imm);
+    void MovImm64(Reg dst, uint64_t imm);
+    void Mov(Reg dst, Reg src);
+    void Mov64(Reg dst, Reg src);
+    void Load(Reg dst, Reg base, int32_t disp);
+    void Load64(Reg dst, Reg base, int32_t disp);
+    void LoadByte(Reg dst, Reg base, int32_t disp); // Zero extended
+    void Store(Reg base, int32_t disp, Reg src);
+    void StoreByte(Reg base, int32_t disp, Reg src);
+    void StoreImm(Reg base, int32_t disp, uint32_t imm);
+    void AddImm64(Reg base, int32_t disp, int32_t imm); // To a 64-bit value in memory
+
+    void Add(Reg dst, Reg src);
+    void Add64(Reg dst, Reg src);
+    void Add64(Reg dst, Reg base, int32_t disp);
+    void Sub(Reg dst, Reg src);
+    void And(Reg dst, Reg src);
+    void Or(Reg dst, Reg src);
+    void Xor(Reg dst, Reg src);
+    void Imul(Reg dst, Reg src);
+    void Div(Reg src); // edx:eax / src, unsigned
+    void Not(Reg dst);
+    void AddImm(Reg dst, int32_t imm);
+    void AndImm(Reg dst, uint32_t imm);
+    void ShlImm(Reg dst, uint8_t imm);
+    void ShrImm(Reg dst, uint8_t imm);
+    void ShlCl(Reg dst);
+    void ShrCl(Reg dst);
+    void Cmp(Reg a, Reg b);
+    void CmpImm(Reg a, uint32_t imm);
+    void Cmp(Reg base, int32_t disp, Reg b);
+    void Test64(Reg a, Reg b);
+
+    void Push(Reg src);
+    void Pop(Reg dst);
+    void AddRsp(int32_t imm);
+    void Call(Reg target);
+    void Jmp(Reg target);
+    void Jmp(Label target);
+    void Jcc(Cond cond, Label target);
+    void Ret();
+
+  private:
+    struct Fixup
+    {
+      uint32_t at;    // Offset of the rel32 to patch
+      uint32_t label;
+    };
+
+    void Byte(uint8_t b);
+    void Dword(uint32_t d);
+    void Rex(bool w, Reg reg, Reg base, bool byteRegister = false);
+    void ModRm(Reg reg, Reg rm);                 // Register direct
+    void ModRm(Reg reg, Reg base, int32_t disp); // Memory at [base + disp]
+    void Op(uint8_t opcode, Reg reg, Reg rm, bool w = false);
+    void Op(uint8_t opcode, Reg reg, Reg base, int32_t disp, bool w = false, bool byteRegister = false);
+    void Group(uint8_t opcode, uint8_t extension, Reg rm, bool w = false);
+    void Jump(Label target);
+
+    std::vector<uint8_t> buffer;
+    std::vector<uint32_t> labels; // Offset of each label, or uint32_t(-1) until bound
+    std::vector<Fixup> fixups;
+  };
+
+  // Pages of memory the host may execute, written once and then made read-only
+  // Returns nullptr if the host refuses to provide them
+  uint8_t* AllocateCode(const std::vector<uint8_t>& code);
+  void FreeCode(uint8_t* code, size_t size);
+}
+}
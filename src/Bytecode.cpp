@@ -1,4 +1,5 @@
 #include "pch.h"
+#include <cstring>
 #include <ctime>
 #include "kipBytecode.h"
 #include "kipVersion.h"
@@ -7,6 +8,38 @@ namespace kip
 {
 namespace Bytecode
 {
+  View::View()
+    : ptr(nullptr), length(0)
+  {
+  }
+
+  View::View(const Data& data)
+    : ptr(data.data()), length(data.size())
+  {
+  }
+
+  View::View(const uint8_t* data, size_t size)
+    : ptr(data), length(size)
+  {
+  }
+
+  const uint8_t* View::data() const
+  {
+    return ptr;
+  }
+
+  size_t View::size() const
+  {
+    return length;
+  }
+
+  const uint8_t& View::operator[](size_t i) const
+  {
+    return ptr[i];
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
   Metadata::Metadata()
   {
   }
@@ -26,19 +59,32 @@ namespace Bytecode
     return rawData.size();
   }
 
-  Metadata Metadata::Decode(const Bytecode::Data& bc, uint32_t& offset)
+  Metadata Metadata::Decode(const Bytecode::View& bc, uint32_t& offset)
   {
     Metadata block;
-    block.rawData.push_back(bc[offset++]);
-    char c = '\0';
+    block.rawData.push_back(offset < bc.size() ? bc[offset++] : uint8_t(Metadata::Type::INVALID));
+    bool terminated = false;
     switch (Metadata::Type(block.rawData[0]))
     {
     case Metadata::Type::COMMENT:
     case Metadata::Type::AUTHOR:
-      while (c = bc[offset++])
-        block.rawData.push_back(c);
+      while (offset < bc.size() && !terminated)
+      {
+        char c = bc[offset++];
+        if (c)
+          block.rawData.push_back(c);
+        else
+          terminated = true;
+      }
+      if (!terminated) // Ran off the end before the terminator
+        block.rawData.assign(1, uint8_t(Metadata::Type::INVALID));
       break;
     case Metadata::Type::TIMESTAMP:
+      if (bc.size() - offset < 7)
+      {
+        block.rawData.assign(1, uint8_t(Metadata::Type::INVALID));
+        break;
+      }
       block.rawData.resize(8);
       std::memcpy(block.data() + 1, bc.data() + offset, 7);
       offset += 7;
@@ -107,8 +153,8 @@ namespace Bytecode
     rawData[1] = 'I';
     rawData[2] = 'P';
     rawData[3] = 0x00;
-    rawData[4] = versionMajor;
-    rawData[5] = versionMinor;
+    rawData[uint8_t(Offset::MAJOR_VERSION)] = versionMajor;
+    rawData[uint8_t(Offset::MINOR_VERSION)] = versionMinor;
     for (uint8_t i = uint8_t(Offset::RESERVED_START); i <= uint8_t(Offset::RESERVED_END); ++i)
       rawData[i] = 0x00;
     for (uint8_t i = uint8_t(Offset::METADATA_BLOCK_COUNT); i < uint8_t(Offset::HEADER_END); ++i)
@@ -139,6 +185,28 @@ namespace Bytecode
     return Header::size_type(Offset::HEADER_END);
   }
 
+  bool Header::IsValid() const
+  {
+    return rawData[0] == 'K' && rawData[1] == 'I' && rawData[2] == 'P' && rawData[3] == 0x00;
+  }
+
+  uint8_t Header::GetVersionMajor() const
+  {
+    return rawData[uint8_t(Offset::MAJOR_VERSION)];
+  }
+
+  uint8_t Header::GetVersionMinor() const
+  {
+    return rawData[uint8_t(Offset::MINOR_VERSION)];
+  }
+
+  uint32_t Header::GetMetadataCount() const
+  {
+    uint32_t count = 0;
+    std::memcpy(&count, &rawData[uint8_t(Offset::METADATA_BLOCK_COUNT)], sizeof(count));
+    return count;
+  }
+
   Header::data_type::iterator Header::begin()
   {
     return rawData.begin();
@@ -0,0 +1,265 @@
+#include "pch.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "kipCache.h"
+#include "kipMachine.h"
+#include "kipSource.h"
+#include "kipVersion.h"
+
+namespace kip
+{
+  CompiledFile::CompiledFile()
+  {
+  }
+
+namespace BytecodeCache
+{
+  static const uint64_t FNV_OFFSET = 0xCBF29CE484222325ull;
+  static const uint64_t FNV_PRIME = 0x100000001B3ull;
+
+  static void Hash(uint64_t& hash, const uint8_t* data, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ data[i]) * FNV_PRIME;
+  }
+
+  static void Hash(uint64_t& hash, uint64_t value)
+  {
+    for (unsigned i = 0; i < 8; ++i)
+      hash = (hash ^ uint8_t(value >> (i * 8))) * FNV_PRIME;
+  }
+
+  static void HashText(uint64_t& hash, const uint8_t* data, size_t size)
+  {
+    Hash(hash, size);
+    Hash(hash, data, size);
+  }
+
+  static bool HashFile(uint64_t& hash, const std::string& filename)
+  {
+    MappedFile file;
+    if (file.Open(filename))
+    {
+      HashText(hash, file.data(), file.size());
+      return true;
+    }
+    std::error_code error;
+    if (std::filesystem::file_size(filename, error) != 0 || error) // Empty files can't be mapped
+      return false;
+    HashText(hash, nullptr, 0);
+    return true;
+  }
+
+  static bool HashFile(uint64_t& hash, const Source& source, const std::string& filename)
+  {
+    const SourceFile* file = source.Find(filename);
+    if (!file)
+      return false;
+    HashText(hash, (const uint8_t*)file->text.data(), file->text.size());
+    return true;
+  }
+
+  // Hashes each file through fileHash, in the order Load checks them
+  template <typename FileHash>
+  static bool HashSources(uint64_t& hash, const std::string& filename, const std::vector<std::string>& imports, FileHash fileHash)
+  {
+    hash = FNV_OFFSET;
+    Hash(hash, (uint64_t(versionMajor) << 8) | versionMinor);
+    if (!fileHash(hash, filename))
+      return false;
+    for (const std::string& path : imports)
+    {
+      Hash(hash, (const uint8_t*)path.data(), path.size() + 1);
+      if (!fileHash(hash, path))
+        return false;
+    }
+    return true;
+  }
+
+  bool HashSources(uint64_t& hash, const std::string& filename, const std::vector<std::string>& imports)
+  {
+    return HashSources(hash, filename, imports, [](uint64_t& h, const std::string& path) { return HashFile(h, path); });
+  }
+
+  // Hashes the text the source was built from, so edits made while compiling can't be saved under the new hash
+  static bool HashSources(uint64_t& hash, const Source& source, const std::string& filename, const std::vector<std::string>& imports)
+  {
+    return HashSources(hash, filename, imports, [&source](uint64_t& h, const std::string& path) { return HashFile(h, source, path); });
+  }
+
+  std::string GetPath(const std::string& filename, const std::string& cacheFolder)
+  {
+    std::filesystem::path path(filename);
+    if (cacheFolder.size() == 0)
+      return path.replace_extension(".kipc").string();
+
+    // Sources from different folders can share a name, so the folder is part of the cache name
+    std::error_code error;
+    std::filesystem::path full = std::filesystem::absolute(path, error);
+    std::string key = (error ? path : full).string();
+    uint64_t hash = FNV_OFFSET;
+    Hash(hash, (const uint8_t*)key.data(), key.size());
+    char suffix[18];
+    snprintf(suffix, sizeof(suffix), "-%016llx", (unsigned long long)hash);
+    return (std::filesystem::path(cacheFolder) / (path.stem().string() + suffix + ".kipc")).string();
+  }
+
+  // Reads the record at the start of a cache file, returning the offset of the bytecode or 0 if the record is malformed
+  static uint32_t ReadRecord(const Bytecode::View& cache, uint64_t& hash, std::vector<std::string>& imports)
+  {
+    if (cache.size() < size_t(Offset::IMPORTS_START)
+      || cache[0] != 'K' || cache[1] != 'I' || cache[2] != 'P' || cache[3] != 'C')
+      return 0;
+    hash = 0;
+    for (unsigned i = 0; i < 8; ++i)
+      hash |= uint64_t(cache[size_t(Offset::HASH) + i]) << (i * 8);
+    uint32_t count = 0;
+    for (unsigned i = 0; i < 4; ++i)
+      count |= uint32_t(cache[size_t(Offset::IMPORT_COUNT) + i]) << (i * 8);
+    size_t offset = size_t(Offset::IMPORTS_START);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      size_t end = offset;
+      while (end < cache.size() && cache[end] != 0)
+        ++end;
+      if (end == cache.size())
+        return 0;
+      imports.push_back(std::string((const char*)cache.data() + offset, end - offset));
+      offset = end + 1;
+    }
+    return uint32_t(offset);
+  }
+
+  static InterpretResult Save(const std::string& path, uint64_t hash, const std::vector<std::string>& imports, const Bytecode::View& bc)
+  {
+    Bytecode::Data record(size_t(Offset::IMPORTS_START), 0);
+    record[0] = 'K';
+    record[1] = 'I';
+    record[2] = 'P';
+    record[3] = 'C';
+    record[size_t(Offset::MINOR_VERSION)] = versionMinor;
+    record[size_t(Offset::MAJOR_VERSION)] = versionMajor;
+    for (unsigned i = 0; i < 8; ++i)
+      record[size_t(Offset::HASH) + i] = uint8_t(hash >> (i * 8));
+    for (unsigned i = 0; i < 4; ++i)
+      record[size_t(Offset::IMPORT_COUNT) + i] = uint8_t(imports.size() >> (i * 8));
+    for (const std::string& import : imports)
+      record.insert(record.end(), import.c_str(), import.c_str() + import.size() + 1);
+
+    // Written aside and renamed so nothing ever maps a half written cache
+    std::error_code error;
+    std::filesystem::path folder = std::filesystem::path(path).parent_path();
+    if (!folder.empty())
+      std::filesystem::create_directories(folder, error);
+    std::string temporary = path + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary);
+      if (!file.is_open())
+        return InterpretResult(false, "Could not open file " + temporary + " for writing");
+      file.write((const char*)record.data(), record.size());
+      file.write((const char*)bc.data(), bc.size());
+      if (!file)
+        return InterpretResult(false, "Could not write bytecode cache to " + temporary);
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+      std::filesystem::remove(temporary, error);
+      return InterpretResult(false, "Could not replace bytecode cache " + path);
+    }
+    return InterpretResult(true, "Saved bytecode cache to " + path);
+  }
+
+  // Loads the cache for filename if it was compiled from exactly the current sources
+  static bool Load(CompiledFile& compiled, Instruction::Context& context, const std::string& filename, const std::string& path, std::vector<InterpretResult>& r)
+  {
+    if (!compiled.file.Open(path))
+      return false;
+    Bytecode::View cache(compiled.file.data(), compiled.file.size());
+    uint64_t stored = 0, current = 0;
+    std::vector<std::string> imports;
+    uint32_t offset = ReadRecord(cache, stored, imports);
+    if (offset == 0
+      || cache[size_t(Offset::MAJOR_VERSION)] != versionMajor || cache[size_t(Offset::MINOR_VERSION)] != versionMinor
+      || !HashSources(current, filename, imports) || current != stored)
+    {
+      compiled.file.Close();
+      return false;
+    }
+
+    std::vector<InterpretResult> lr = LoadBytecode(compiled.program, context, Bytecode::View(cache.data() + offset, cache.size() - offset));
+    if (!lr.back())
+    {
+      compiled.file.Close();
+      return false;
+    }
+    context.imports = imports;
+    r.push_back(InterpretResult(true, "Loaded " + filename + " from bytecode cache " + path));
+    return true;
+  }
+}
+
+  std::vector<InterpretResult> CompileFile(CompiledFile& compiled, Instruction::Context& context, const std::string& filename, const std::string& cacheFolder)
+  {
+    std::vector<InterpretResult> r;
+    std::string path = BytecodeCache::GetPath(filename, cacheFolder);
+    compiled.data.clear();
+    compiled.cached = false;
+    context.folder = std::filesystem::path(filename).parent_path().string();
+    if (BytecodeCache::Load(compiled, context, filename, path, r))
+    {
+      compiled.cached = true;
+      return r;
+    }
+
+    Source source;
+    r.push_back(source.Open(filename));
+    if (!r.back())
+      return r;
+    for (InterpretResult sr : BuildContext(context, source))
+    {
+      r.push_back(sr);
+      if (!sr.success)
+        return r;
+    }
+    try
+    {
+      compiled.data = CompileInstructionsToBytecode(BuildInstructions(context, source.lines), context);
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while building instructions: " + std::string(e.what())));
+      return r;
+    }
+
+    std::vector<std::string> imports = context.imports;
+    uint64_t hash = 0;
+    if (BytecodeCache::HashSources(hash, source, filename, imports))
+    {
+      InterpretResult saved = BytecodeCache::Save(path, hash, imports, compiled.data);
+      if (saved) // An unsaved cache only costs the next start a compile, so it isn't an error
+        r.push_back(saved);
+      else
+        r.push_back(InterpretResult(true, "Bytecode cache not saved: " + saved.str));
+    }
+
+    for (InterpretResult sr : LoadBytecode(compiled.program, context, compiled.data))
+      r.push_back(sr);
+    context.imports = imports;
+    return r;
+  }
+
+  std::vector<InterpretResult> InterpretCompiledFile(const std::string& filename, Machine& machine, const std::string& cacheFolder, uint8_t verbosity)
+  {
+    CompiledFile compiled;
+    std::vector<InterpretResult> r = CompileFile(compiled, machine.context, filename, cacheFolder);
+    if (!r.back())
+      return r;
+    return InterpretBytecode(compiled.program, machine.memory, machine.context, verbosity);
+  }
+}
@@ -0,0 +1,104 @@
+#include "pch.h"
+
+#include "kipFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace kip
+{
+  MappedFile::MappedFile()
+  {
+  }
+
+  MappedFile::~MappedFile()
+  {
+    Close();
+  }
+
+  bool MappedFile::Open(const std::string& filename)
+  {
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+      return false; // Could not open file
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+      CloseHandle(file);
+      return false; // Empty files can't be mapped
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+      CloseHandle(file);
+      return false; // Could not create mapping
+    }
+    const void* v = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (v == NULL)
+    {
+      CloseHandle(mapping);
+      CloseHandle(file);
+      return false; // Could not map view
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    view = (const uint8_t*)v;
+    length = size_t(fileSize.QuadPart);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false; // Could not open file
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      close(fd);
+      return false; // Empty files can't be mapped
+    }
+    void* v = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (v == MAP_FAILED)
+      return false; // Could not map file
+    view = (const uint8_t*)v;
+    length = size_t(st.st_size);
+#endif
+    return true;
+  }
+
+  void MappedFile::Close()
+  {
+    if (!view)
+      return;
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    munmap((void*)view, length);
+#endif
+    view = nullptr;
+    length = 0;
+  }
+
+  bool MappedFile::IsOpen() const
+  {
+    return view != nullptr;
+  }
+
+  const uint8_t* MappedFile::data() const
+  {
+    return view;
+  }
+
+  size_t MappedFile::size() const
+  {
+    return length;
+  }
+}
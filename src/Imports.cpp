@@ -0,0 +1,177 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kipImports.h"
+#include "kipSource.h"
+
+namespace kip
+{
+  ModuleCache::ModuleCache()
+  {
+  }
+
+  InterpretResult ModuleCache::Load(const std::string& canonicalPath, std::vector<std::string>& lines)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::vector<std::string>>::iterator module = modules.find(canonicalPath);
+    if (module != modules.end())
+    {
+      lines = module->second;
+      return InterpretResult(true, "Loaded " + canonicalPath + " from cache");
+    }
+    std::vector<std::string> newlines;
+    InterpretResult r = LoadFile(canonicalPath, newlines);
+    if (r)
+    {
+      lines = newlines;
+      modules[canonicalPath] = std::move(newlines);
+    }
+    return r;
+  }
+
+  void ModuleCache::Clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    modules.clear();
+  }
+
+  std::string CanonicalImportPath(const std::string& folder, const std::string& filename)
+  {
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::canonical(std::filesystem::path(folder) / filename, error);
+    if (error)
+      return "";
+    return path.string();
+  }
+
+  // State of one BuildContextImports call
+  template <typename Line>
+  struct ImportGraph
+  {
+    Instruction::Context& context;
+    std::vector<InterpretResult>& results;
+    std::function<InterpretResult(const std::string&, std::vector<Line>&)> load;
+    std::vector<std::string> stack; // Files currently being expanded, to catch cycles
+    std::set<std::string> done;     // Files already expanded, which later imports skip
+  };
+
+  static void TrimLeft(std::string& line)
+  {
+    size_t p = line.find_first_not_of(' ');
+    if (p != std::string::npos && p != 0)
+      line.erase(0, p);
+  }
+
+  static void TrimLeft(std::string_view& line)
+  {
+    size_t p = line.find_first_not_of(' ');
+    if (p != std::string_view::npos && p != 0)
+      line.remove_prefix(p);
+  }
+
+  // Appends lines to out with every import replaced by the imported file's lines
+  // Imported lines go before the (now empty) import line so line numbers match a plain paste
+  template <typename Line>
+  static bool ExpandImports(ImportGraph<Line>& graph, std::vector<Line>& lines, const std::string& folder, std::vector<Line>& out)
+  {
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+      Line& line = lines[i];
+      TrimLeft(line);
+      if (line.size() == 0 || line[0] != '<')
+      {
+        out.push_back(std::move(line));
+        continue;
+      }
+
+      std::string filename(line.substr(1));
+      size_t p = filename.find_first_not_of(' ');
+      filename.erase(0, p == std::string::npos ? filename.size() : p);
+      filename.erase(filename.find_last_not_of(" \r") + 1);
+      if (filename.size() == 0)
+      {
+        graph.results.push_back(InterpretResult(false, "Compilation error: No import filename at line " + std::to_string(i + 1)));
+        return false;
+      }
+      std::string path = CanonicalImportPath(folder, filename);
+      if (path.size() == 0)
+      {
+        graph.results.push_back(InterpretResult(false, "Could not open file " + (std::filesystem::path(folder) / filename).string()));
+        return false;
+      }
+      if (std::find(graph.stack.begin(), graph.stack.end(), path) != graph.stack.end())
+      {
+        std::string cycle;
+        for (std::vector<std::string>::iterator it = std::find(graph.stack.begin(), graph.stack.end(), path); it != graph.stack.end(); ++it)
+          cycle += *it + " -> ";
+        graph.results.push_back(InterpretResult(false, "Compilation error: Import cycle " + cycle + path));
+        return false;
+      }
+      if (graph.done.count(path) == 0) // Each file is only included once
+      {
+        std::vector<Line> imported;
+        graph.results.push_back(graph.load(path, imported));
+        if (!graph.results.back())
+          return false;
+        graph.stack.push_back(path);
+        if (!ExpandImports(graph, imported, std::filesystem::path(path).parent_path().string(), out))
+          return false;
+        graph.stack.pop_back();
+        graph.done.insert(path);
+        graph.context.imports.push_back(path);
+      }
+      out.push_back(Line());
+    }
+    return true;
+  }
+
+  std::vector<InterpretResult> BuildContextImports(Instruction::Context& context, std::vector<std::string>& lines)
+  {
+    std::vector<InterpretResult> results;
+    ModuleCache localModules;
+    ModuleCache& modules = context.modules ? *context.modules : localModules;
+    ImportGraph<std::string> graph = { context, results,
+      [&modules](const std::string& path, std::vector<std::string>& imported) { return modules.Load(path, imported); }, {}, {} };
+    context.imports.clear();
+
+    std::vector<std::string> out;
+    out.reserve(lines.size());
+    if (!ExpandImports(graph, lines, context.folder, out))
+      return results;
+    lines = std::move(out);
+
+    results.push_back(InterpretResult(true, "Imported files successfully"));
+    return results;
+  }
+
+  std::vector<InterpretResult> BuildContextImports(Instruction::Context& context, Source& source)
+  {
+    std::vector<InterpretResult> results;
+    // Imported files stay open in the source so their lines can be viewed like the importer's
+    ImportGraph<std::string_view> graph = { context, results,
+      [&source](const std::string& path, std::vector<std::string_view>& imported)
+      {
+        SourceFile& file = source.Add();
+        InterpretResult r = file.Open(path);
+        imported = file.lines;
+        return r;
+      }, {}, {} };
+    context.imports.clear();
+
+    std::vector<std::string_view> out;
+    out.reserve(source.lines.size());
+    if (!ExpandImports(graph, source.lines, context.folder, out))
+      return results;
+    source.lines = std::move(out);
+
+    results.push_back(InterpretResult(true, "Imported files successfully"));
+    return results;
+  }
+}
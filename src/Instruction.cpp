@@ -5,685 +5,317 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
 
 #include "kipInstruction.h"
 #include "kipMemory.h"
+#include "kipMachine.h"
+#include "kipHandlers.h"
+#include "kipTokenizer.h"
+#include "kipSource.h"
 
 namespace kip
 {
-  const struct {
-    const char* const string;
-    const uint8_t argumentCount;
-    InterpretResult(Instruction::* function)(Instruction::Context*) const;
-    uint8_t verbosity; // Lower numbers are higher priority
-  } instructionTable[] = {
-    { "", 0, nullptr, 255 },
+  const InstructionInfo instructionTable[] = {
+    { "", 0, nullptr, 255, ResultFormat::NONE },
 
     // Storage
-    { "STB", 2, &Instruction::STB, 200 },
-    { "STA", 2, &Instruction::STA, 200 },
-    { "STS", 2, &Instruction::STS, 200 },
-    { "FIL", 3, &Instruction::FIL, 150 },
-    { "CPY", 3, &Instruction::CPY, 130 },
-    { "PUB", 1, &Instruction::PUB, 120 },
-    { "PUA", 1, &Instruction::PUA, 120 },
-    { "PUS", 1, &Instruction::PUS, 120 },
-    { "POB", 1, &Instruction::POB, 120 },
-    { "POA", 1, &Instruction::POA, 120 },
-    { "POS", 1, &Instruction::POS, 120 },
-    { "BIN", 2, &Instruction::BIN, 120 },
-    { "SAV", 3, &Instruction::SAV, 120 },
+    { "STB", 2, &Instruction::STB, 200, ResultFormat::STORE },
+    { "STA", 2, &Instruction::STA, 200, ResultFormat::STORE },
+    { "STS", 2, &Instruction::STS, 200, ResultFormat::STORE_STRING },
+    { "FIL", 3, &Instruction::FIL, 150, ResultFormat::FILL },
+    { "CPY", 3, &Instruction::CPY, 130, ResultFormat::COPY },
+    { "PUB", 1, &Instruction::PUB, 120, ResultFormat::STORE },
+    { "PUA", 1, &Instruction::PUA, 120, ResultFormat::STORE },
+    { "PUS", 1, &Instruction::PUS, 120, ResultFormat::PUSH_STRING },
+    { "POB", 1, &Instruction::POB, 120, ResultFormat::STORE },
+    { "POA", 1, &Instruction::POA, 120, ResultFormat::STORE },
+    { "POS", 1, &Instruction::POS, 120, ResultFormat::POP_STRING },
+    { "BIN", 2, &Instruction::BIN, 120, ResultFormat::LOAD_FILE },
+    { "SAV", 3, &Instruction::SAV, 120, ResultFormat::SAVE_FILE },
 
     // Debugging
-    { "RDB", 1, &Instruction::RDB, 0   },
-    { "RDA", 1, &Instruction::RDA, 0   },
-    { "RDS", 1, &Instruction::RDS, 0   },
+    { "RDB", 1, &Instruction::RDB, 0, ResultFormat::READ },
+    { "RDA", 1, &Instruction::RDA, 0, ResultFormat::READ },
+    { "RDS", 1, &Instruction::RDS, 0, ResultFormat::READ_STRING },
 
     // Control Flow
-    { "JMP", 1, &Instruction::JMP, 100 },
-    { "JEQ", 3, &Instruction::JEQ, 100 },
-    { "JNE", 3, &Instruction::JNE, 100 },
-    { "JGT", 3, &Instruction::JGT, 100 },
-    { "JLT", 3, &Instruction::JLT, 100 },
-    { "HLT", 0, &Instruction::HLT, 10  },
-    { "CAL", 1, &Instruction::CAL, 80  },
+    { "JMP", 1, &Instruction::JMP, 100, ResultFormat::JUMP },
+    { "JEQ", 3, &Instruction::JEQ, 100, ResultFormat::JUMP },
+    { "JNE", 3, &Instruction::JNE, 100, ResultFormat::JUMP },
+    { "JGT", 3, &Instruction::JGT, 100, ResultFormat::JUMP },
+    { "JLT", 3, &Instruction::JLT, 100, ResultFormat::JUMP },
+    { "HLT", 0, &Instruction::HLT, 10, ResultFormat::HALT },
+    { "CAL", 1, &Instruction::CAL, 80, ResultFormat::CALL },
 
     // Arithmetic
-    { "ADB", 3, &Instruction::ADB, 150 },
-    { "ADA", 3, &Instruction::ADA, 150 },
-    { "SBB", 3, &Instruction::SBB, 150 },
-    { "SBA", 3, &Instruction::SBA, 150 },
-    { "MLB", 3, &Instruction::MLB, 150 },
-    { "MLA", 3, &Instruction::MLA, 150 },
-    { "DVB", 3, &Instruction::DVB, 150 },
-    { "DVA", 3, &Instruction::DVA, 150 },
-    { "MDA", 3, &Instruction::MDB, 150 },
+    { "ADB", 3, &Instruction::ADB, 150, ResultFormat::STORE },
+    { "ADA", 3, &Instruction::ADA, 150, ResultFormat::STORE },
+    { "SBB", 3, &Instruction::SBB, 150, ResultFormat::STORE },
+    { "SBA", 3, &Instruction::SBA, 150, ResultFormat::STORE },
+    { "MLB", 3, &Instruction::MLB, 150, ResultFormat::STORE_SIGNED },
+    { "MLA", 3, &Instruction::MLA, 150, ResultFormat::STORE },
+    { "DVB", 3, &Instruction::DVB, 150, ResultFormat::STORE_SIGNED },
+    { "DVA", 3, &Instruction::DVA, 150, ResultFormat::STORE },
+    { "MDA", 3, &Instruction::MDB, 150, ResultFormat::STORE_SIGNED },
 
     // Increment/decrement
-    { "INB", 1, &Instruction::INB, 150 },
-    { "INA", 1, &Instruction::INA, 150 },
-    { "DCB", 1, &Instruction::DCB, 150 },
-    { "DCA", 1, &Instruction::DCA, 150 },
+    { "INB", 1, &Instruction::INB, 150, ResultFormat::STORE },
+    { "INA", 1, &Instruction::INA, 150, ResultFormat::STORE },
+    { "DCB", 1, &Instruction::DCB, 150, ResultFormat::STORE },
+    { "DCA", 1, &Instruction::DCA, 150, ResultFormat::STORE },
     
     // Bit manipulation
-    { "BLS", 3, &Instruction::BLS, 150 },
-    { "BRS", 3, &Instruction::BRS, 150 },
-    { "ROL", 3, &Instruction::ROL, 150 },
-    { "ROR", 3, &Instruction::ROR, 150 },
-    { "AND", 3, &Instruction::AND, 150 },
-    { "BOR", 3, &Instruction::BOR, 150 },
-    { "XOR", 3, &Instruction::XOR, 150 },
-    { "NOT", 2, &Instruction::NOT, 150 },
+    { "BLS", 3, &Instruction::BLS, 150, ResultFormat::STORE_SIGNED },
+    { "BRS", 3, &Instruction::BRS, 150, ResultFormat::STORE_SIGNED },
+    { "ROL", 3, &Instruction::ROL, 150, ResultFormat::STORE },
+    { "ROR", 3, &Instruction::ROR, 150, ResultFormat::STORE },
+    { "AND", 3, &Instruction::AND, 150, ResultFormat::STORE_SIGNED },
+    { "BOR", 3, &Instruction::BOR, 150, ResultFormat::STORE_SIGNED },
+    { "XOR", 3, &Instruction::XOR, 150, ResultFormat::STORE_SIGNED },
+    { "NOT", 2, &Instruction::NOT, 150, ResultFormat::STORE_SIGNED },
   };
+  const uint8_t instructionCount = uint8_t(sizeof(instructionTable) / sizeof(*instructionTable));
+  static_assert(sizeof(instructionTable) / sizeof(*instructionTable) == size_t(Opcode::COUNT), "KIP_OPCODES must list every instruction in instructionTable");
 
-  uint8_t GetInstructionIndex(std::string instruction)
+  //////////////////////////////////////////////////////////////
+  // Handler bodies live in kipHandlers.h so that they can be shared between execution paths
+
+  InstructionResult Instruction::STB(Memory& memory, Context* context) const
   {
-    for (uint8_t i = 1; i < sizeof(instructionTable) / sizeof(*instructionTable); ++i)
-      if (instruction == instructionTable[i].string)
-        return i;
-    return 0;
+    return Handlers::STB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  //////////////////////////////////////////////////////////////
-  // Storage                 //
-  /////////////////////////////
+  InstructionResult Instruction::STA(Memory& memory, Context* context) const
+  {
+    return Handlers::STA(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  InterpretResult Instruction::STB(Context* context) const
+  InstructionResult Instruction::STS(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Address B = arguments[1].GetAddr();
-    if (WriteByte(B, A))
-      return InterpretResult(true, std::to_string(unsigned(B)) + "<=" + std::to_string(unsigned(A)));
-    return InterpretResult(false, "Address " + std::to_string(B) + " not mapped");
+    return Handlers::STS(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::STA(Context* context) const
+  InstructionResult Instruction::FIL(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    if (WriteBytes(B, (uint8_t*)(&A), 4))
-      return InterpretResult(true, std::to_string(unsigned(B)) + "<=" + std::to_string(unsigned(A)));
-    return InterpretResult(false, "Address " + std::to_string(B) + " not mapped");
+    return Handlers::FIL(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::STS(Context* context) const
+  InstructionResult Instruction::CPY(Memory& memory, Context* context) const
   {
-    std::string       A = arguments[0].GetString();
-    Argument::Address B = arguments[1].GetAddr();
-    if (WriteBytes(B, (uint8_t*)(A.data()), uint32_t(A.length() + 1)))
-      return InterpretResult(true, std::to_string(unsigned(B)) + "<=" + A);
-    return InterpretResult(false, "Address " + std::to_string(B) + " not mapped");
+    return Handlers::CPY(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::FIL(Context* context) const
+  InstructionResult Instruction::PUB(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    for (uint32_t i = B; i < B + C; ++i)
-      if (!WriteByte(i, A))
-        return InterpretResult(false, "Address " + std::to_string(i) + " not mapped");
-    return InterpretResult(true, "[" + std::to_string(unsigned(B)) + ", " + std::to_string(unsigned(B + C)) + ")<=" + std::to_string(unsigned(A)));
+    return Handlers::PUB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::CPY(Context* context) const
+  InstructionResult Instruction::PUA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    if (C > 0)
-    {
-      Bytecode::Data v;
-      v.resize(C);
-      if (!ReadBytes(A, v.data(), C))
-        return InterpretResult(false, "An address in [" + std::to_string(unsigned(A)) + ", " + std::to_string(unsigned(A + C)) + ") is unmapped");
-      if (!WriteBytes(B, v.data(), C))
-        return InterpretResult(false, "An address in [" + std::to_string(unsigned(B)) + ", " + std::to_string(unsigned(B + C)) + ") is unmapped");
-    }
-    return InterpretResult(true, "[" + std::to_string(unsigned(B)) + "," + std::to_string(unsigned(B + C)) + ")<=[" + std::to_string(unsigned(A)) + ", " + std::to_string(unsigned(A + C)) + ")");
-  }
-
-  InterpretResult Instruction::PUB(Context* context) const
-  {
-    Argument::Address s = 0;
-    Argument::Data    A = arguments[0].GetByte();
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    if (!WriteByte(s - 1, A))
-      return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(s - 1) + ")");
-    if (!SetStackPointer(s - 1))
-      return InterpretResult(false, "Stack pointer is not mapped post-decrement (" + std::to_string(s - 1) + ")");
-    return InterpretResult(true, std::to_string(unsigned(s - 1)) + "<=" + std::to_string(unsigned(A)));
-  }
-
-  InterpretResult Instruction::PUA(Context* context) const
-  {
-    Argument::Address s = 0;
-    Argument::Address A = arguments[0].GetAddr();
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    if (!WriteBytes(s - 4, (uint8_t*)(&A), 4))
-      return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(s - 4) + ")");
-    if (!SetStackPointer(s - 4))
-      return InterpretResult(false, "Stack pointer is not mapped post-decrement (" + std::to_string(s - 4) + ")");
-    return InterpretResult(true, std::to_string(unsigned(s - 4)) + "<=" + std::to_string(unsigned(A)));
-  }
-
-  InterpretResult Instruction::PUS(Context* context) const
-  {
-    Argument::Address s = 0;
-    std::string A = arguments[0].GetString();
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    Argument::Address size = Argument::Address(A.size());
-    if (!WriteByte(s, 0))
-      return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(s - 4) + ")");
-    if (!WriteBytes(s - size, (uint8_t*)(A.data()), size))
-      return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(s - 4) + ")");
-    if (!SetStackPointer(s - size))
-      return InterpretResult(false, "Stack pointer is not mapped post-decrement (" + std::to_string(s - 4) + ")");
-    return InterpretResult(true, std::to_string(unsigned(s - size)) + "<=\"" + A + "\"");
-  }
-
-  InterpretResult Instruction::POB(Context* context) const
-  {
-    Argument::Address s = 0;
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    v = 0;
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    if (!ReadByte(s, v))
-      return InterpretResult(false, "Stack pointer is not mapped post-read (" + std::to_string(s) + ")");
-    if (!WriteByte(A, v))
-      return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
-    if (!SetStackPointer(s + 1))
-      return InterpretResult(false, "Stack pointer is not mapped post-increment (" + std::to_string(s + 1) + ")");
-    return InterpretResult(true, std::to_string(unsigned(A)) + "<=" + std::to_string(unsigned(v)));
-  }
-
-  InterpretResult Instruction::POA(Context* context) const
-  {
-    Argument::Address s = 0;
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address v = 0;
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    if (!ReadBytes(s, (uint8_t*)(&v), 4))
-      return InterpretResult(false, "Stack pointer is not mapped post-read (" + std::to_string(s) + ")");
-    if (!WriteBytes(A, (uint8_t*)(&v), 4))
-      return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
-    if (!SetStackPointer(s + 4))
-      return InterpretResult(false, "Stack pointer is not mapped post-increment (" + std::to_string(s + 4) + ")");
-    return InterpretResult(true, std::to_string(unsigned(A)) + "<=" + std::to_string(unsigned(v)));
-  }
-
-  InterpretResult Instruction::POS(Context* context) const
-  {
-    Argument::Address s = 0;
-    Argument::Address A = arguments[0].GetAddr();
-    std::string       str;
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    Argument::Data c = '\0';
-    do
-    {
-      if (!ReadByte(s++, c))
-        return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(s - 4) + ")");
-      if (c)
-        str += char(c);
-    } while (c);
-    if (!SetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped post-decrement (" + std::to_string(s - 4) + ")");
-    if (!WriteString(A, str))
-      return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
-    return InterpretResult(true, std::to_string(unsigned(A)) + "<=\"" + str + "\"");
-  }
-
-  InterpretResult Instruction::BIN(Context* context) const
-  {
-    std::string       A = arguments[0].GetString();
-    Argument::Address B = arguments[1].GetAddr();
-    std::string       path;
-    if (context && A.size() > 1 && A[0] == '.' && (A[1] == '/' || A[1] == '\\'))
-      path = context->folder + A.substr(1);
-    else
-      path = A;
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open())
-      return InterpretResult(false, "Could not open external file: " + A);
-    const std::streamsize bufferSize = 128;
-    char buffer[bufferSize] = { 0 };
-    std::streamsize size = 0;
-    Argument::Address addr = B;
-    while (!file.eof())
-    {
-      file.read(buffer, bufferSize);
-      Argument::Address size = Argument::Address(file.gcount());
-      if (size > 0)
-        size %= bufferSize;
-      if (!WriteBytes(addr, (Argument::Data*)(buffer), size))
-        return InterpretResult(false, "An address in [" + std::to_string(unsigned(addr)) + ", " + std::to_string(unsigned(addr + size)) + ") is unmapped");
-      addr += size;
-    }
-    file.close();
-    return InterpretResult(true, "[" + std::to_string(unsigned(B)) + "," + std::to_string(unsigned(addr)) + ")<={" + A + "}");
+    return Handlers::PUA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::SAV(Context* context) const
+  InstructionResult Instruction::PUS(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    std::string C = arguments[2].GetString();
-    std::string path;
-    if (context && C.size() > 1 && C[0] == '.' && (C[1] == '/' || C[1] == '\\'))
-      path = context->folder + C.substr(1);
-    else
-      path = C;
-    std::ofstream file(path, std::ios::binary);
-    if (!file.is_open())
-      return InterpretResult(false, "Could not open external file: " + C);
-    const std::streamsize bufferSize = 128;
-    char buffer[bufferSize] = { 0 };
-    Argument::Address addr = A;
-    Argument::Address size = B;
-    while (size > 0)
-    {
-      Argument::Address chunkSize = size > bufferSize ? bufferSize : size;
-      if (!ReadBytes(addr, (Argument::Data*)(buffer), chunkSize))
-        return InterpretResult(false, "An address in [" + std::to_string(unsigned(addr)) + ", " + std::to_string(unsigned(addr + size)) + ") is unmapped");
-      file.write(buffer, chunkSize);
-      addr += chunkSize;
-      size -= chunkSize;
-    }
-    file.close();
-    return InterpretResult(true, "[" + std::to_string(unsigned(A)) + "," + std::to_string(unsigned(addr)) + ")=>{" + C + "}");
+    return Handlers::PUS(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  /////////////////////////////
-  // Debugging               //
-  /////////////////////////////
+  InstructionResult Instruction::POB(Memory& memory, Context* context) const
+  {
+    return Handlers::POB(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  InterpretResult Instruction::RDB(Context* context) const
+  InstructionResult Instruction::POA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    out;
-    if (ReadByte(A, out))
-      return InterpretResult(true, std::to_string(unsigned(A)) + "=>" + std::to_string(int(out)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::POA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::RDA(Context* context) const
+  InstructionResult Instruction::POS(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address out;
-    if (ReadBytes(A, (Argument::Data*)(&out), sizeof(out)))
-      return InterpretResult(true, std::to_string(unsigned(A)) + "=>" + std::to_string(int(out)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::POS(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::RDS(Context* context) const
+  InstructionResult Instruction::BIN(Memory& memory, Context* context) const
   {
-    return InterpretResult(true, arguments[0].GetString());
-  } 
+    return Handlers::BIN(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  /////////////////////////////
-  // Control Flow            //
-  /////////////////////////////
+  InstructionResult Instruction::SAV(Memory& memory, Context* context) const
+  {
+    return Handlers::SAV(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  InterpretResult Instruction::JMP(Context* context) const
+  InstructionResult Instruction::RDB(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    context->line = arguments[0].GetAddr() - 1;
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::RDB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::JEQ(Context* context) const
+  InstructionResult Instruction::RDA(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Data    C = arguments[2].GetByte();
-    if (B == C)
-    {
-      context->line = A - 1;
-    }
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::RDA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::JNE(Context* context) const
+  InstructionResult Instruction::RDS(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Data    C = arguments[2].GetByte();
-    if (B != C)
-    {
-      context->line = A - 1;
-    }
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::RDS(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::JGT(Context* context) const
+  InstructionResult Instruction::JMP(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Data    C = arguments[2].GetByte();
-    if (B > C)
-    {
-      context->line = A - 1;
-    }
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::JMP(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::JLT(Context* context) const
+  InstructionResult Instruction::JEQ(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Data    C = arguments[2].GetByte();
-    if (B < C)
-    {
-      context->line = A - 1;
-    }
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::JEQ(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::JGE(Context* context) const
+  InstructionResult Instruction::JNE(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Data    C = arguments[2].GetByte();
-    if (B >= C)
-    {
-      context->line = A - 1;
-    }
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::JNE(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::JLE(Context* context) const
+  InstructionResult Instruction::JGT(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Data    C = arguments[2].GetByte();
-    if (B <= C)
-    {
-      context->line = A - 1;
-    }
-    return InterpretResult(true, "pc<=" + std::to_string(context->line));
+    return Handlers::JGT(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::HLT(Context* context) const
+  InstructionResult Instruction::JLT(Memory& memory, Context* context) const
   {
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    context->line = uint32_t(-1);
-    return InterpretResult(true, "Halted program");
+    return Handlers::JLT(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::CAL(Context* context) const
+  InstructionResult Instruction::JGE(Memory& memory, Context* context) const
   {
-    Argument::Address s = 0;
-    Argument::Address A = arguments[0].GetAddr();
-    if (!context)
-      return InterpretResult(false, std::string(instructionTable[id].string) + " cannot be run without context");
-    Argument::Address next = context->line + 1;
-    if (!GetStackPointer(s))
-      return InterpretResult(false, "Stack pointer is not mapped");
-    if (!WriteBytes(s - 4, (uint8_t*)(&next), 4))
-      return InterpretResult(false, "Stack pointer is not mapped post-write (" + std::to_string(s - 4) + ")");
-    if (!SetStackPointer(s - 4))
-      return InterpretResult(false, "Stack pointer is not mapped post-decrement (" + std::to_string(s - 4) + ")");
-    context->line = A - 1;
-    return InterpretResult(true, std::to_string(unsigned(s - 4)) + "<=" + std::to_string(int(next)) + ";  pc <= " + std::to_string(context->line));
+    return Handlers::JGE(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  /////////////////////////////
-  // Arithmetic              //
-  /////////////////////////////
+  InstructionResult Instruction::JLE(Memory& memory, Context* context) const
+  {
+    return Handlers::JLE(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  InterpretResult Instruction::ADB(Context* context) const
+  InstructionResult Instruction::HLT(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A + B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(A + B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::HLT(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::ADA(Context* context) const
+  InstructionResult Instruction::CAL(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    Argument::Address v = A + B;
-    if (WriteBytes(C, (uint8_t*)&v, sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::CAL(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::SBB(Context* context) const
+  InstructionResult Instruction::ADB(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A - B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(A - B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::ADB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::SBA(Context* context) const
+  InstructionResult Instruction::ADA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    Argument::Address v = A - B;
-    if (WriteBytes(C, (uint8_t*)&v, sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::ADA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::MLB(Context* context) const
+  InstructionResult Instruction::SBB(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A * B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A * B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::SBB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::MLA(Context* context) const
+  InstructionResult Instruction::SBA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    Argument::Address v = A * B;
-    if (WriteBytes(C, (uint8_t*)&v, sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::SBA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::DVB(Context* context) const
+  InstructionResult Instruction::MLB(Memory& memory, Context* context) const
   {
-    Argument::Data  A = arguments[0].GetByte();
-    Argument::Data  B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A / B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A / B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::MLB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::DVA(Context* context) const
+  InstructionResult Instruction::MLA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    Argument::Address v = A / B;
-    if (WriteBytes(C, (uint8_t*)&v, sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::MLA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::MDB(Context* context) const
+  InstructionResult Instruction::DVB(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A % B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A % B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::DVB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::MDA(Context* context) const
+  InstructionResult Instruction::DVA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address B = arguments[1].GetAddr();
-    Argument::Address C = arguments[2].GetAddr();
-    Argument::Address v = A % B;
-    if (WriteBytes(C, (Argument::Data*)&v, sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::DVA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  /////////////////////////////
-  // Increment/decrement     //
-  /////////////////////////////
+  InstructionResult Instruction::MDB(Memory& memory, Context* context) const
+  {
+    return Handlers::MDB(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  InterpretResult Instruction::INB(Context* context) const
+  InstructionResult Instruction::MDA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    v;
-    if (ReadByte(A, v) && WriteByte(A, ++v))
-      return InterpretResult(true, std::to_string(unsigned(A)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::MDA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::INA(Context* context) const
+  InstructionResult Instruction::INB(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address v;
-    if (ReadBytes(A, (Argument::Data*)(&v), sizeof(v)) && WriteBytes(A, (Argument::Data*)(&++v), sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(A)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::INB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::DCB(Context* context) const
+  InstructionResult Instruction::INA(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Data    v;
-    if (ReadByte(A, v) && WriteByte(A, --v))
-      return InterpretResult(true, std::to_string(unsigned(A)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::INA(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::DCA(Context* context) const
+  InstructionResult Instruction::DCB(Memory& memory, Context* context) const
   {
-    Argument::Address A = arguments[0].GetAddr();
-    Argument::Address v;
-    if (ReadBytes(A, (Argument::Data*)(&v), sizeof(v)) && WriteBytes(A, (Argument::Data*)(&--v), sizeof(v)))
-      return InterpretResult(true, std::to_string(unsigned(A)) + "<=" + std::to_string(unsigned(v)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::DCB(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  /////////////////////////////
-  // Bit manipulation        //
-  /////////////////////////////
+  InstructionResult Instruction::DCA(Memory& memory, Context* context) const
+  {
+    return Handlers::DCA(memory, context, ArgumentOperands(arguments, memory));
+  }
 
-  InterpretResult Instruction::BLS(Context* context) const
+  InstructionResult Instruction::BLS(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A << B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A << B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::BLS(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::BRS(Context* context) const
+  InstructionResult Instruction::BRS(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, A >> B))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A >> B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::BRS(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::ROL(Context* context) const
+  InstructionResult Instruction::ROL(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    B %= 8;
-    uint16_t r = uint16_t(A) << B;
-    r = (r & 0x0F) | ((r & 0xF0) >> 8);
-    if (WriteByte(C, Argument::Data(r)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(r)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::ROL(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::ROR(Context* context) const
+  InstructionResult Instruction::ROR(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    B %= 8;
-    Argument::Data r = 0;
-    r |= (A >> B) & 0xF;
-    r |= A << (8 - B);
-    if (WriteByte(C, Argument::Data(r)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(unsigned(r)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::ROR(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::AND(Context* context) const
+  InstructionResult Instruction::AND(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, Argument::Data(A & B)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A & B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::AND(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::BOR(Context* context) const
+  InstructionResult Instruction::BOR(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, Argument::Data(A | B)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A | B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::BOR(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::XOR(Context* context) const
+  InstructionResult Instruction::XOR(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Data    B = arguments[1].GetByte();
-    Argument::Address C = arguments[2].GetAddr();
-    if (WriteByte(C, Argument::Data(A ^ B)))
-      return InterpretResult(true, std::to_string(unsigned(C)) + "<=" + std::to_string(int(A ^ B)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::XOR(memory, context, ArgumentOperands(arguments, memory));
   }
 
-  InterpretResult Instruction::NOT(Context* context) const
+  InstructionResult Instruction::NOT(Memory& memory, Context* context) const
   {
-    Argument::Data    A = arguments[0].GetByte();
-    Argument::Address B = arguments[1].GetAddr();
-    if (WriteByte(B, Argument::Data(~A)))
-      return InterpretResult(true, std::to_string(unsigned(B)) + "<=" + std::to_string(int(~A)));
-    return InterpretResult(false, "Address " + std::to_string(A) + " not mapped");
+    return Handlers::NOT(memory, context, ArgumentOperands(arguments, memory));
   }
 
   //////////////////////////////////////////////////////////////
@@ -703,45 +335,40 @@ namespace kip
   {
   }
 
-  Argument::Address Argument::GetAddr() const
+  Resolved<Argument::Address> Argument::GetAddr() const
   {
-    Argument::Address d = data;
-    for (uint8_t i = dereferenceCount; i > 0; --i)
-      if (!ReadBytes(d, (Argument::Data*)(&d), sizeof(d)))
-        throw "Could not dereference address: " + std::to_string(d);
-    return d;
+    return GetAddr(GetDefaultMachine().memory);
   }
 
-  Argument::Data Argument::GetByte() const
+  Resolved<Argument::Data> Argument::GetByte() const
   {
-    if (dereferenceCount == 0)
-      return data;
-    Argument::AddressOrData d = data;
-    for (uint8_t i = dereferenceCount; i > 1; --i)
-      if (!ReadBytes(d, (Argument::Data*)(&d), sizeof(d)))
-        throw "Could not dereference address: " + std::to_string(d);
-    Argument::Data r = 0;
-    if (!ReadByte(d, r))
-      throw "Could not read byte at address: " + std::to_string(d);
-    return r;
+    return GetByte(GetDefaultMachine().memory);
+  }
+
+  Resolved<std::string> Argument::GetString() const
+  {
+    return GetString(GetDefaultMachine().memory);
+  }
+
+  Resolved<Argument::Address> Argument::GetAddr(const Memory& memory) const
+  {
+    return ResolveAddr(memory, data, dereferenceCount);
   }
 
-  const std::string Argument::GetString() const
+  Resolved<Argument::Data> Argument::GetByte(const Memory& memory) const
+  {
+    return ResolveByte(memory, data, dereferenceCount);
+  }
+
+  Resolved<std::string> Argument::GetString(const Memory& memory) const
   {
     if (type == Type::STRING)
     {
       if (dereferenceCount > 0)
-        throw "String argument can't be dereferenced!";
-      return stringLabel;
+        return { std::string(), OperandFault::STRING_DEREFERENCED, 0 };
+      return { stringLabel, OperandFault::NONE, 0 };
     }
-    Argument::Address addr = data;
-    for (uint8_t i = dereferenceCount; i > 0; --i)
-      if (!ReadBytes(addr, (Argument::Data*)(&addr), sizeof(addr)))
-        throw "Could not dereference address: " + std::to_string(addr);
-    std::string r;
-    if (!ReadString(addr, r))
-      throw "Could not read string at address: " + std::to_string(addr);
-    return r;
+    return ResolveString(memory, data, dereferenceCount);
   }
 
   Instruction::Instruction()
@@ -749,105 +376,86 @@ namespace kip
   {
   }
 
-  Instruction::Instruction(std::string line)
-    : line(line), id(0)
+  // Reads one argument token, looking labels up in context if there is one
+  static Argument ParseArgument(std::string_view token, const Instruction::Context* context)
   {
-    std::vector<std::string> split;
-    while (line.size() > 0)
+    Argument A(0);
+    while (!token.empty() && token[0] == '*') // Dereferences
     {
-      char commentChars[] = { ';', '|', '?', '}' };
-      size_t comment = line.size();
-      for (unsigned i = 0; i < 4; ++i)
-        comment = std::min(comment, line.find_first_of(commentChars[i]));
-      line = line.substr(0, comment);
-      std::string newPart = line.substr(0, line.find(' '));
-      line = line.substr(std::min(newPart.size() + 1, line.size()));
-      if (newPart.size() > 0)
-      {
-        for (unsigned i = 0; i < newPart.size(); ++i)
-          newPart[i] = std::toupper(newPart[i]);
-        split.push_back(newPart);
-      }
+      ++A.dereferenceCount;
+      token.remove_prefix(1);
+    }
+    if (token.empty())
+      throw std::invalid_argument("Dereferenced nothing");
+    if (token[0] == '\"') // String literal
+    {
+      if (token.size() < 2 || token.back() != '\"')
+        throw std::invalid_argument("String literal argument did not have ending \"");
+      A.stringLabel.assign(token.data() + 1, token.size() - 2);
+      A.type = Argument::Type::STRING;
+      return A;
+    }
+    if (token[0] == '$' || token[0] == ':' || token[0] == '#') // Hex, binary or octal value
+    {
+      if (!ParseLiteral(token, A.data))
+        throw std::invalid_argument("Invalid number: " + std::string(token));
+      return A;
     }
-    if (split.size() > 0)
+    if (context) // Label
     {
-      id = GetInstructionIndex(split[0]);
-      for (unsigned i = 1; i < split.size(); ++i)
+      // Labels are stored upper case; short names are converted on the stack
+      char upper[64];
+      std::string longName;
+      std::string_view name;
+      if (token.size() <= sizeof(upper))
       {
-        Argument A;
-        while (split[i][0] == '*') // Dereferences
-        {
-          ++A.dereferenceCount;
-          split[i] = split[i].substr(1);
-        }
-        if (split[i][0] == '$') // Hex value
-          A.data = std::stoi(split[i].substr(1), nullptr, 16);
-        else if (split[i][0] == ':') // Binary value
-          A.data = std::stoi(split[i].substr(1), nullptr, 2);
-        else if (split[i][0] == '#') // Octal
-          A.data = std::stoi(split[i].substr(1), nullptr, 8);
-        else // Decimal value
-          A.data = std::stoi(split[i], nullptr, 10);
-        arguments.push_back(A);
+        for (size_t i = 0; i < token.size(); ++i)
+          upper[i] = std::toupper(token[i]);
+        name = std::string_view(upper, token.size());
+      }
+      else
+      {
+        longName = token;
+        for (char& c : longName)
+          c = std::toupper(c);
+        name = longName;
       }
+      Instruction::Context::Labels::const_iterator label = context->labels.find(name);
+      if (label != context->labels.end())
+        return label->second;
     }
+    if (!ParseLiteral(token, A.data)) // Decimal value
+      throw std::invalid_argument("Unknown label or invalid number: " + std::string(token));
+    return A;
+  }
+
+  Instruction::Instruction(std::string line)
+    : Instruction(std::move(line), nullptr)
+  {
   }
 
   Instruction::Instruction(std::string line, Context& context)
-    : line(line), id(0)
+    : Instruction(std::move(line), &context)
   {
-    std::vector<std::string> split;
-    while (line.size() > 0)
-    {
-      line = RemoveComments(line);
-      std::string newPart;
-      if (line[0] == '\"')
-        newPart = line.substr(0, line.find('\"', 1) + 1);
-      else
-        newPart = line.substr(0, line.find(' '));
-      line = line.substr(std::min(newPart.size() + 1, line.size()));
-      if (newPart.size() > 0)
-      {
-        if (newPart[0] != '\"')
-          for (unsigned i = 0; i < newPart.size(); ++i)
-            newPart[i] = std::toupper(newPart[i]);
-        split.push_back(newPart);
-      }
-    }
-    if (split.size() > 0)
+  }
+
+  Instruction::Instruction(std::string line, const Context* context)
+    : line(std::move(line)), id(0)
+  {
+    Tokenizer tokens(this->line);
+    std::string_view token;
+    if (!tokens.Next(token))
+      return;
+    if (token.size() == 3)
     {
-      id = GetInstructionIndex(split[0]);
-      for (unsigned i = 1; i < split.size(); ++i)
-      {
-        Argument A(0);
-        while (split[i][0] == '*') // Dereferences
-        {
-          ++A.dereferenceCount;
-          split[i] = split[i].substr(1);
-        }
-        if (split[i][0] == '$') // Hex value
-          A.data = std::stoul(split[i].substr(1), nullptr, 16);
-        else if (split[i][0] == ':') // Binary value
-          A.data = std::stoi(split[i].substr(1), nullptr, 2);
-        else if (split[i][0] == '#') // Octal
-          A.data = std::stoi(split[i].substr(1), nullptr, 8);
-        else if (split[i][0] == '\"') // String literal
-        {
-          if (split[i].back() != '\"')
-            throw "String literal argument did not have ending \"";
-          A.stringLabel = split[i].substr(1, split[i].size() - 2);
-          A.type = Argument::Type::STRING;
-        }
-        else if (context.labels.find(split[i]) != context.labels.end()) // Label
-          A = context.labels[split[i]];
-        else // Decimal value
-          A.data = std::stoi(split[i], nullptr, 10);
-        arguments.push_back(A);
-      }
+      const char mnemonic[3] = { char(std::toupper(token[0])), char(std::toupper(token[1])), char(std::toupper(token[2])) };
+      id = GetInstructionIndex(mnemonic, 3);
     }
+    arguments.reserve(3);
+    while (tokens.Next(token))
+      arguments.push_back(ParseArgument(token, context));
   }
 
-
   InterpretResult::InterpretResult(bool success, std::string str)
     : success(success), str(str)
   {
@@ -858,6 +466,21 @@ namespace kip
     return success;
   }
 
+  InstructionResult::InstructionResult(Status status, Argument::AddressOrData a, Argument::AddressOrData b, Argument::AddressOrData c)
+    : status(status), operands{ a, b, c }
+  {
+  }
+
+  InstructionResult::operator bool() const
+  {
+    return status == Status::OK;
+  }
+
+  InterpretResult Instruction::Describe(const InstructionResult& result, const Memory& memory) const
+  {
+    return kip::Describe(id, result, ArgumentOperands(arguments, memory));
+  }
+
   std::string RemoveComments(std::string line)
   {
     char commentChars[] = { ';', '|', '?', '}' };
@@ -868,32 +491,33 @@ namespace kip
   }
 
   InterpretResult InterpretLine(std::string line)
+  {
+    return InterpretLine(line, GetDefaultMachine().memory, nullptr);
+  }
+
+  InterpretResult InterpretLine(std::string line, Memory& memory, Instruction::Context* context)
   {
     Instruction inst(line);
     if (inst.id)
     {
       if (inst.arguments.size() != instructionTable[inst.id].argumentCount)
         return InterpretResult(false, line.substr(0, line.find(' ')) + " requires " + std::to_string(instructionTable[inst.id].argumentCount) + " arguments.");
-      return (inst.*(instructionTable[inst.id].function))(nullptr);
+      return inst.Describe((inst.*(instructionTable[inst.id].function))(memory, context), memory);
     }
     return InterpretResult(false, "Unknown instruction: " + line.substr(0, line.find(' ')));
   }
 
   InterpretResult LoadFile(std::string filename, std::vector<std::string>& lines)
   {
-    std::ifstream file(filename);
-    if (file.is_open())
+    SourceFile file;
+    InterpretResult r = file.Open(filename);
+    if (r)
     {
-      char line[2048];
-      while (!file.eof())
-      {
-        file.getline(line, 2048);
-        lines.push_back(line);
-      }
-      file.close();
-      return InterpretResult(true, "Loaded " + filename);
+      lines.reserve(lines.size() + file.lines.size());
+      for (std::string_view line : file.lines)
+        lines.push_back(std::string(line));
     }
-    return InterpretResult(false, "Could not open file " + filename);
+    return r;
   }
 
   std::vector<InterpretResult> BuildContext(Instruction::Context& context, std::vector<std::string>& lines)
@@ -920,7 +544,7 @@ namespace kip
         }
       }
     }
-    catch (std::exception e)
+    catch (const std::exception& e)
     {
       results.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
       return results;
@@ -929,117 +553,94 @@ namespace kip
     return results;
   }
 
-  std::vector<InterpretResult> BuildContextImports(Instruction::Context& context, std::vector<std::string>& lines)
+  // Drops the comment and leading spaces from a line of source
+  static std::string_view StripLine(std::string_view line)
   {
-    std::vector<InterpretResult> results;
+    line = line.substr(0, line.find_first_of(";|?}"));
+    size_t p = line.find_first_not_of(' ');
+    line.remove_prefix(p == std::string_view::npos ? line.size() : p);
+    return line;
+  }
+
+  std::vector<InterpretResult> BuildContextLabels(Instruction::Context& context, std::vector<std::string>& lines)
+  {
+    std::vector<std::string_view> views(lines.begin(), lines.end());
+    std::vector<InterpretResult> results = BuildContextLabels(context, views);
 
-    int i = 1;
-    for (std::vector<std::string>::iterator it = lines.begin(); it != lines.end(); ++it, ++i)
+    // Leave only the text instructions are built from
+    for (std::string& line : lines)
     {
-      std::string& line = *it;
+      line.erase(std::min(line.size(), line.find_first_of(";|?}")));
       size_t p = line.find_first_not_of(' ');
-      if (p != -1 && p != 0)
-        line = line.substr(p);
-      if (line.size() > 0 && line[0] == '<')
-      {
-        line = line.substr(1);
-        p = line.find_first_not_of(' ');
-        if (p != -1 && p != 0)
-          line = line.substr(p);
-        if (line.size() == 0)
-        {
-          results.push_back(InterpretResult(false, "Compilation error: No import filename at line " + std::to_string(i)));
-          return results;
-        }
-        std::vector<std::string> newlines;
-        results.push_back(LoadFile(context.folder + "\\" + line, newlines));
-        if (!results.back().success)
-          return results;
-        line = "";
-        if (newlines.size() > 0)
-        {
-          lines.insert(it, newlines.begin(), newlines.end());
-          it = lines.begin();
-          i = 0;
-        }
-      }
+      if (p != std::string::npos && p != 0)
+        line.erase(0, p);
+      if (line.size() > 0 && line[0] == '>')
+        line.clear();
     }
-
-    results.push_back(InterpretResult(true, "Imported files successfully"));
     return results;
   }
 
-  std::vector<InterpretResult> BuildContextLabels(Instruction::Context& context, std::vector<std::string>& lines)
+  std::vector<InterpretResult> BuildContextLabels(Instruction::Context& context, const std::vector<std::string_view>& lines)
   {
     std::vector<InterpretResult> results;
     context.labels.clear();
 
     for (uint32_t i = 0; i < lines.size(); ++i)
     {
-      std::string& line = lines[i];
-      line = RemoveComments(line);
+      std::string_view view = StripLine(lines[i]);
+      if (view.size() == 0 || view[0] != '>')
+        continue;
+      std::string line(view.substr(1));
+      bool toUpper = true;
+      for (unsigned i = 0; i < line.size(); ++i)
+        if (line[i] == '\"')
+          toUpper = !toUpper;
+        else if (toUpper)
+          line[i] = std::toupper(line[i]);
       size_t p = line.find_first_not_of(' ');
-      if (p != -1 && p != 0)
+      if (p == std::string::npos)
+      {
+        results.push_back(InterpretResult(false, "Compilation error: No label name at line " + std::to_string(i + 1)));
+        return results;
+      }
+      line = line.substr(p);
+      std::string label = line.substr(0, line.find_first_of(' '));
+      line = line.substr(label.size());
+      p = line.find_first_not_of(' ');
+      if (p == std::string::npos)
+        line = "";
+      else if (p != 0)
         line = line.substr(p);
-      if (line.size() > 0 && line[0] == '>')
+      context.labels[label] = i + 1;
+      if (line.size() > 0)
       {
-        bool toUpper = true;
-        for (unsigned i = 0; i < line.size(); ++i)
-          if (line[i] == '\"')
-            toUpper = !toUpper;
-          else if (toUpper)
-            line[i] = std::toupper(line[i]);
-        line = line.substr(1);
-        p = line.find_first_not_of(' ');
-        if (p != -1 && p != 0)
-          line = line.substr(p);
-        if (line.size() == 0)
+        if (line[0] == '\"') // String
         {
-          results.push_back(InterpretResult(false, "Compilation error: No label name at line " + std::to_string(i)));
-          return results;
-        }
-        std::string label = line.substr(0, line.find_first_of(' '));
-        line = line.substr(label.size());
-        p = line.find_first_not_of(' ');
-        if (p == -1)
-          line = "";
-        else if (p != 0)
-          line = line.substr(p);
-        int v = i + 1;
-        context.labels[label] = v;
-        if (line.size() > 0)
-        {
-          if (line[0] == '\"') // String
+          line = line.substr(1);
+          p = line.find_last_of('\"');
+          if (line.size() == 0)
           {
-            line = line.substr(1);
-            p = line.find_last_of('\"');
-            if (line.size() == 0)
-            {
-              results.push_back(InterpretResult(false, "Compilation error: No closing quotation for string literal label at line " + std::to_string(i)));
-              return results;
-            }
-            line = line.substr(0, p);
-            context.labels[label] = Argument(line);
+            results.push_back(InterpretResult(false, "Compilation error: No closing quotation for string literal label at line " + std::to_string(i + 1)));
+            return results;
           }
+          line = line.substr(0, p);
+          context.labels[label] = Argument(line);
+        }
+        else
+        {
+          if (context.labels.find(line) != context.labels.end()) // Label
+            context.labels[label] = context.labels[line];
           else
           {
-            if (context.labels.find(line) != context.labels.end()) // Label
-              context.labels[label] = context.labels[line];
-            else
+            Argument::AddressOrData value;
+            if (!ParseLiteral(line, value))
             {
-              if (line[0] == '$') // Hex value
-                v = std::stoi(line.substr(1), nullptr, 16);
-              else if (line[0] == ':') // Binary value
-                v = std::stoi(line.substr(1), nullptr, 2);
-              else if (line[0] == '#') // Octal
-                v = std::stoi(line.substr(1), nullptr, 8);
-              else // Decimal value
-                v = std::stoi(line, nullptr, 10);
-              context.labels[label] = v;
+              results.push_back(InterpretResult(false, "Compilation error: Invalid label value " + line + " at line " + std::to_string(i + 1)));
+              return results;
             }
+            context.labels[label] = value;
           }
         }
-        line = "";
       }
     }
 
@@ -1047,21 +648,98 @@ namespace kip
     return results;
   }
 
-  std::vector<Instruction> BuildInstructions(Instruction::Context& context, std::vector<std::string>& lines)
+  // Text of a line ready to be parsed as an instruction
+  static const std::string& PrepareLine(std::string& line)
   {
-    std::vector<Instruction> instructions;
-    instructions.resize(lines.size());
-    for (uint32_t i = 0; i < lines.size(); ++i)
+    size_t p = line.find_first_not_of(' ');
+    if (p != std::string::npos && p != 0)
+      line.erase(0, p);
+    return line;
+  }
+
+  static std::string PrepareLine(std::string_view line)
+  {
+    line = StripLine(line);
+    if (line.size() > 0 && (line[0] == '>' || line[0] == '<')) // Handled while building context
+      return std::string();
+    return std::string(line);
+  }
+
+  // Parses lines [begin, end) into the matching, already allocated, slots of instructions
+  template <typename Lines>
+  static void BuildInstructionRange(const Instruction::Context& context, Lines& lines, std::vector<Instruction>& instructions, size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
     {
-      std::string& line = lines[i];
-      size_t p = line.find_first_not_of(' ');
-      if (p != -1 && p != 0)
-        line = line.substr(p);
-      instructions.push_back(Instruction(line, context));
+      try
+      {
+        instructions[i] = Instruction(PrepareLine(lines[i]), &context);
+      }
+      catch (const std::invalid_argument& e)
+      {
+        throw std::invalid_argument(std::string(e.what()) + " at line " + std::to_string(i + 1));
+      }
+    }
+  }
+
+  template <typename Lines>
+  static std::vector<Instruction> BuildInstructionsInParallel(const Instruction::Context& context, Lines& lines, unsigned threadCount)
+  {
+    if (threadCount == 0)
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    // Not worth starting threads for small sources
+    threadCount = unsigned(std::min<size_t>(threadCount, lines.size() / KIP_PARALLEL_BUILD_MIN_LINES));
+
+    std::vector<Instruction> instructions(lines.size());
+    if (threadCount <= 1)
+    {
+      BuildInstructionRange(context, lines, instructions, 0, lines.size());
+      return instructions;
+    }
+
+    // Labels are complete by now, so every line can be parsed independently
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(threadCount);
+    const size_t chunk = (lines.size() + threadCount - 1) / threadCount;
+    for (unsigned t = 0; t < threadCount; ++t)
+    {
+      threads.push_back(std::thread([&, t]()
+        {
+          try
+          {
+            BuildInstructionRange(context, lines, instructions, t * chunk, std::min(lines.size(), (t + 1) * chunk));
+          }
+          catch (...)
+          {
+            errors[t] = std::current_exception();
+          }
+        }));
     }
+    for (std::thread& thread : threads)
+      thread.join();
+    // Report the same error the serial path would have: the one from the earliest line
+    for (std::exception_ptr& error : errors)
+      if (error)
+        std::rethrow_exception(error);
     return instructions;
   }
 
+  std::vector<Instruction> BuildInstructions(Instruction::Context& context, std::vector<std::string>& lines)
+  {
+    return BuildInstructionsInParallel(context, lines, 0);
+  }
+
+  std::vector<Instruction> BuildInstructions(Instruction::Context& context, std::vector<std::string>& lines, unsigned threadCount)
+  {
+    return BuildInstructionsInParallel(context, lines, threadCount);
+  }
+
+  std::vector<Instruction> BuildInstructions(Instruction::Context& context, const std::vector<std::string_view>& lines, unsigned threadCount)
+  {
+    return BuildInstructionsInParallel(context, lines, threadCount);
+  }
+
+
   std::vector<InterpretResult> InterpretLines(std::vector<std::string> &lines, uint8_t verbosity)
   {
     return InterpretLines(lines, "", verbosity);
@@ -1071,22 +749,27 @@ namespace kip
   {
     Instruction::Context context;
     context.folder = folder;
+    return InterpretLines(lines, GetDefaultMachine().memory, context, verbosity);
+  }
+
+  std::vector<InterpretResult> InterpretLines(std::vector<std::string> &lines, Memory& memory, Instruction::Context& context, uint8_t verbosity)
+  {
     std::vector<InterpretResult> bcr = BuildContext(context, lines);
     if (!bcr.back().success)
       return bcr;
     
-    std::vector<Instruction> instructions;
+    Program program;
     try
     {
-      instructions = BuildInstructions(context, lines);
+      program = DecodeInstructions(BuildInstructions(context, lines), context);
     }
-    catch (std::exception e)
+    catch (const std::exception& e)
     {
       std::vector<InterpretResult> results;
       results.push_back(InterpretResult(false, "Exception was thrown while building instructions: " + std::string(e.what())));
       return results;
     }
-    return InterpretInstructions(instructions, context, verbosity);
+    return InterpretProgram(program, memory, context, verbosity);
   }
 
   std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction> &inst, uint8_t verbosity)
@@ -1096,6 +779,11 @@ namespace kip
   }
 
   std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction> &inst, Instruction::Context &context, uint8_t verbosity)
+  {
+    return InterpretInstructions(inst, GetDefaultMachine().memory, context, verbosity);
+  }
+
+  std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction> &inst, Memory& memory, Instruction::Context &context, uint8_t verbosity)
   {
     std::vector<InterpretResult> r;
     if (verbosity > KIP_VERBOSITY_RESERVE_LARGE)
@@ -1107,7 +795,7 @@ namespace kip
       ++lnWidth;
     context.line = 0;
     if (context.labels.find("START") != context.labels.end())
-      context.line = context.labels["START"].GetAddr();
+      context.line = context.labels["START"].GetAddr(memory).value;
     try
     {
       while (context.line < inst.size())
@@ -1115,28 +803,31 @@ namespace kip
         const Instruction& c = inst[context.line++];
         if (c.id == 0)
           continue;
-        std::string ln = "";
-        unsigned pad = lnWidth;
-        for (unsigned c = context.line; c > 0 && pad > 0; c /= 10)
-          --pad;
-        ln.resize(pad, ' ');
-        ln += std::to_string(context.line) + ": ";
-
-        InterpretResult ir = (c.*(instructionTable[c.id].function))(&context);
-        if (!ir.success)
-        {
-          r.push_back(InterpretResult(ir.success, ln + c.line + " -> " + ir.str));
-          break;
-        }
-        else if (verbosity >= instructionTable[c.id].verbosity)
+        uint32_t lineNumber = context.line;
+
+        InstructionResult ir = (c.*(instructionTable[c.id].function))(memory, &context);
+        ++context.executed;
+        if (!ir || verbosity >= instructionTable[c.id].verbosity)
         {
-          std::string newstr = ln + c.line + " -> " + ir.str;
+          // Only build text when it's going to be reported
+          std::string ln = "";
+          unsigned pad = lnWidth;
+          for (unsigned c = lineNumber; c > 0 && pad > 0; c /= 10)
+            --pad;
+          ln.resize(pad, ' ');
+          ln += std::to_string(lineNumber) + ": ";
+          std::string newstr = ln + c.line + " -> " + c.Describe(ir, memory).str;
+          if (!ir)
+          {
+            r.push_back(InterpretResult(false, newstr));
+            break;
+          }
           if (r.size() == 0 || r.back().str != newstr)
-            r.push_back(InterpretResult(ir.success, ln + c.line + " -> " + ir.str));
+            r.push_back(InterpretResult(true, newstr));
         }
       }
     }
-    catch (std::exception e)
+    catch (const std::exception& e)
     {
       r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
       return r;
@@ -1153,11 +844,24 @@ namespace kip
   }
 
   Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context, Bytecode::Header& header)
+  {
+    return CompileInstructionsToBytecode(inst, context, header, std::vector<Bytecode::Metadata>());
+  }
+
+  Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context, const std::vector<Bytecode::Metadata>& metadata)
+  {
+    Bytecode::Header header(metadata);
+    return CompileInstructionsToBytecode(inst, context, header, metadata);
+  }
+
+  Bytecode::Data CompileInstructionsToBytecode(const std::vector<Instruction>& inst, Instruction::Context& context, Bytecode::Header& header, const std::vector<Bytecode::Metadata>& metadata)
   {
     Bytecode::Data bc;
     bc.resize(header.size());
     std::copy(header.begin(), header.end(), bc.begin());
-    for (std::map<std::string, Argument>::iterator label = context.labels.begin(); label != context.labels.end(); ++label)
+    for (const Bytecode::Metadata& block : metadata)
+      bc.insert(bc.end(), block.data(), block.data() + block.size());
+    for (Instruction::Context::Labels::iterator label = context.labels.begin(); label != context.labels.end(); ++label)
     {
       switch (label->second.type)
       {
@@ -1185,8 +889,15 @@ namespace kip
         || id > uint8_t(Bytecode::DataType::INSTRUCTIONS_END))
         throw "Attempted to compile instruction id to a value outside of the valid range";
       bc.push_back(id);
-      for (const Argument& a : i.arguments)
+      if (i.id == 0) // Nothing to run, so arguments aren't kept
+        continue;
+      // Exactly as many arguments as loading reads; extras are ignored when interpreting, so they're dropped
+      const uint8_t argumentCount = instructionTable[i.id].argumentCount;
+      if (i.arguments.size() < argumentCount)
+        throw std::invalid_argument(std::string(instructionTable[i.id].string) + " requires " + std::to_string(argumentCount) + " arguments: " + i.line);
+      for (uint8_t n = 0; n < argumentCount; ++n)
       {
+        const Argument& a = i.arguments[n];
         bc.push_back(uint8_t(a.type));
         switch (a.type)
         {
@@ -1207,26 +918,103 @@ namespace kip
     return bc;
   }
 
-  Bytecode::Header BuildHeaderFromBytecode(const Bytecode::Data& inst, std::vector<InterpretResult>& r, uint32_t& offset)
+  // Moves offset past a NUL terminated string
+  // Returns false if the string runs past the end of the bytecode
+  static bool SkipBytecodeString(const Bytecode::View& bc, uint32_t& offset)
+  {
+    while (offset < bc.size() && bc[offset])
+      ++offset;
+    if (offset >= bc.size())
+      return false;
+    ++offset;
+    return true;
+  }
+
+  // Moves offset past the record starting at offset
+  // Returns false if the record is malformed or runs past the end of the bytecode
+  static bool SkipBytecodeRecord(const Bytecode::View& bc, uint32_t& offset)
+  {
+    uint8_t id = bc[offset++];
+    if (id >= uint8_t(Bytecode::DataType::INSTRUCTIONS_START) && id <= uint8_t(Bytecode::DataType::INSTRUCTIONS_END))
+    {
+      id -= uint8_t(Bytecode::DataType::INSTRUCTIONS_START);
+      if (id >= instructionCount)
+        return false;
+      for (uint8_t a = 0; a < instructionTable[id].argumentCount; ++a)
+      {
+        if (offset >= bc.size())
+          return false;
+        switch (Argument::Type(bc[offset++]))
+        {
+        case Argument::Type::DATA:
+          if (bc.size() - offset < 5)
+            return false;
+          offset += 5;
+          break;
+        case Argument::Type::STRING:
+          if (!SkipBytecodeString(bc, offset))
+            return false;
+          break;
+        default:
+          return false;
+        }
+      }
+      return true;
+    }
+    switch (Bytecode::DataType(id))
+    {
+    case Bytecode::DataType::LABEL_DATA:
+      if (!SkipBytecodeString(bc, offset) || bc.size() - offset < 4)
+        return false;
+      offset += 4;
+      return true;
+    case Bytecode::DataType::LABEL_STRING:
+      return SkipBytecodeString(bc, offset) && SkipBytecodeString(bc, offset);
+    default:
+      return false;
+    }
+  }
+
+  Bytecode::Header BuildHeaderFromBytecode(const Bytecode::View& inst, std::vector<InterpretResult>& r, uint32_t& offset)
   {
     Bytecode::Header header;
-    if (inst.size() - offset < sizeof(header))
+    if (inst.size() < offset || inst.size() - offset < header.size())
       r.push_back(InterpretResult(false, "Bytecode too short to contain a header."));
     else
     {
-      memcpy(&header, inst.data() + offset, sizeof(header));
-      offset += sizeof(header);
-      r.push_back(InterpretResult(true, "Loaded header from bytecode."));
+      std::copy(inst.data() + offset, inst.data() + offset + header.size(), header.begin());
+      offset += uint32_t(header.size());
+      if (header.IsValid())
+        r.push_back(InterpretResult(true, "Loaded header from bytecode."));
+      else
+        r.push_back(InterpretResult(false, "Bytecode does not start with a kip header."));
     }
     return header;
   }
 
-  Instruction::Context BuildContextFromBytecode(const Bytecode::Data& inst, std::vector<InterpretResult>& r, const uint32_t& offset)
+  std::vector<Bytecode::Metadata> BuildMetadataFromBytecode(const Bytecode::Header& header, const Bytecode::View& inst, std::vector<InterpretResult>& r, uint32_t& offset)
+  {
+    std::vector<Bytecode::Metadata> md;
+    for (uint32_t i = 0; i < header.GetMetadataCount(); ++i)
+    {
+      md.push_back(Bytecode::Metadata::Decode(inst, offset));
+      Bytecode::Metadata::Type type = Bytecode::Metadata::Type(md.back().data()[0]);
+      if (type == Bytecode::Metadata::Type::INVALID || type >= Bytecode::Metadata::Type::COUNT)
+      {
+        r.push_back(InterpretResult(false, "Malformed metadata block " + std::to_string(i) + " in bytecode."));
+        md.pop_back();
+        return md;
+      }
+    }
+    r.push_back(InterpretResult(true, "Loaded " + std::to_string(md.size()) + " metadata blocks from bytecode."));
+    return md;
+  }
+
+  Instruction::Context BuildContextFromBytecode(const Bytecode::View& inst, std::vector<InterpretResult>& r, const uint32_t& offset)
   {
     Instruction::Context context;
     try
     {
-      uint32_t i = offset;
       for (InterpretResult sr : BuildContextImportsFromBytecode(context, inst, offset))
       {
         r.push_back(sr);
@@ -1246,7 +1034,7 @@ namespace kip
         }
       }
     }
-    catch (std::exception e)
+    catch (const std::exception& e)
     {
       r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
       return context;
@@ -1255,74 +1043,78 @@ namespace kip
     return context;
   }
 
-  std::vector<InterpretResult> BuildContextImportsFromBytecode(Instruction::Context& context, const Bytecode::Data& inst, uint32_t offset)
+  std::vector<InterpretResult> BuildContextImportsFromBytecode(Instruction::Context& context, const Bytecode::View& inst, uint32_t offset)
   {
     std::vector<InterpretResult> r;
+    // Imports are pasted into the source before compiling, so compiled bytecode never refers to other files
+    context.imports.clear();
+    while (offset < inst.size())
+    {
+      if (inst[offset] == uint8_t(Bytecode::DataType::IMPORT))
+      {
+        r.push_back(InterpretResult(false, "Bytecode import records are not supported (offset " + std::to_string(offset) + ")"));
+        return r;
+      }
+      if (!SkipBytecodeRecord(inst, offset))
+        break; // Reported by label parsing
+    }
+    r.push_back(InterpretResult(true, "Imported files successfully"));
     return r;
   }
 
-  std::vector<InterpretResult> BuildContextLabelsFromBytecode(Instruction::Context& context, const Bytecode::Data& inst, uint32_t offset)
+  std::vector<InterpretResult> BuildContextLabelsFromBytecode(Instruction::Context& context, const Bytecode::View& inst, uint32_t offset)
   {
     std::vector<InterpretResult> r;
+    context.labels.clear();
     while (offset < inst.size())
     {
-      uint8_t id = inst[offset];
-      if (id >= uint8_t(Bytecode::DataType::INSTRUCTIONS_START) && id <= uint8_t(Bytecode::DataType::INSTRUCTIONS_END))
+      uint32_t record = offset;
+      if (!SkipBytecodeRecord(inst, offset))
       {
-        // Skip current instruction
-        offset += instructionTable[id - uint8_t(Bytecode::DataType::INSTRUCTIONS_START)].argumentCount * sizeof(uint32_t);
+        r.push_back(InterpretResult(false, "Malformed bytecode record at offset " + std::to_string(record)));
+        return r;
+      }
+      uint8_t id = inst[record++];
+      if (id == uint8_t(Bytecode::DataType::LABEL_DATA))
+      {
+        std::string label((const char*)inst.data() + record);
+        record += uint32_t(label.size()) + 1;
+        context.labels[label] = Argument(
+          (Argument::AddressOrData(inst[record]) << 24) | (Argument::AddressOrData(inst[record + 1]) << 16)
+          | (Argument::AddressOrData(inst[record + 2]) << 8) | Argument::AddressOrData(inst[record + 3]));
+      }
+      else if (id == uint8_t(Bytecode::DataType::LABEL_STRING))
+      {
+        std::string label((const char*)inst.data() + record);
+        record += uint32_t(label.size()) + 1;
+        context.labels[label] = Argument(std::string((const char*)inst.data() + record));
       }
-      ++offset;
     }
+    r.push_back(InterpretResult(true, "Built context labels successfully"));
     return r;
   }
 
-  std::vector<InterpretResult> InterpretBytecode(const Bytecode::Data& bc, uint8_t verbosity)
+  std::vector<InterpretResult> BuildLineOffsetsFromBytecode(std::vector<uint32_t>& lines, const Bytecode::View& inst, uint32_t offset)
   {
     std::vector<InterpretResult> r;
-    uint32_t i = 0;
-    Bytecode::Header header = BuildHeaderFromBytecode(bc, r, i);
-    std::vector<Bytecode::Metadata> md;
-    Instruction::Context context = BuildContextFromBytecode(bc, r, i);
-    if (verbosity > KIP_VERBOSITY_RESERVE_LARGE)
-      r.reserve(100000);
-    else if (verbosity > KIP_VERBOSITY_RESERVE_SMALL)
-      r.reserve(5000);
-    unsigned lnWidth = 0;
-    for (size_t c = bc.size() + 1; c > 0; c /= 10)
-      ++lnWidth;
-    context.line = 0;
-    if (context.labels.find("START") != context.labels.end())
-      context.line = context.labels["START"].GetAddr();
-    try
+    lines.clear();
+    while (offset < inst.size())
     {
-      while (i < bc.size())
+      uint32_t record = offset;
+      if (!SkipBytecodeRecord(inst, offset))
       {
-        uint8_t id = bc[i++];
-        if (id >= uint8_t(Bytecode::DataType::INSTRUCTIONS_START) && id <= uint8_t(Bytecode::DataType::INSTRUCTIONS_END))
-        {
-        }
-        else if (id == uint8_t(Bytecode::DataType::LABEL_DATA))
-        {
-          i += 4;
-        }
-        else if (id == uint8_t(Bytecode::DataType::LABEL_STRING))
-        {
-          i += 4;
-        }
-        else if (id == uint8_t(Bytecode::DataType::IMPORT))
-        {
-          i += 4;
-        }
+        r.push_back(InterpretResult(false, "Malformed bytecode record at offset " + std::to_string(record)));
+        return r;
       }
+      if (inst[record] >= uint8_t(Bytecode::DataType::INSTRUCTIONS_START) && inst[record] <= uint8_t(Bytecode::DataType::INSTRUCTIONS_END))
+        lines.push_back(record);
     }
-    catch (std::exception e)
-    {
-      r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
-      return r;
-    }
-    if (r.size() == 0 || r.back().success)
-      r.push_back(InterpretResult(true, "Executed successfully"));
+    r.push_back(InterpretResult(true, "Located " + std::to_string(lines.size()) + " lines in bytecode"));
     return r;
   }
+
+  std::vector<InterpretResult> InterpretBytecode(const Bytecode::View& bc, uint8_t verbosity)
+  {
+    return InterpretBytecode(bc, GetDefaultMachine(), verbosity);
+  }
 }
@@ -0,0 +1,725 @@
+#include "pch.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "kipJit.h"
+#include "kipMachine.h"
+#include "kipHandlers.h"
+#include "kipX64.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define KIP_JIT
+#endif
+
+namespace kip
+{
+  const uint32_t JitProgram::NO_ENTRY;
+
+  JitProgram::JitProgram()
+  {
+  }
+
+  JitProgram::~JitProgram()
+  {
+    Release();
+  }
+
+  void JitProgram::Release()
+  {
+    X64::FreeCode(code, codeSize);
+    code = nullptr;
+    codeSize = 0;
+    entries.clear();
+    blocks = 0;
+    compiled = 0;
+    interpreted = 0;
+  }
+
+  bool IsJitSupported()
+  {
+#ifdef KIP_JIT
+    return true;
+#else
+    return false;
+#endif
+  }
+
+namespace Jit
+{
+  const uint32_t PAGE_BITS = 12;
+  const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+  const uint32_t TLB_SIZE = 256;
+  const uint32_t NO_PAGE = uint32_t(-1);
+
+  // How generated code hands control back
+  enum class Exit : uint32_t
+  {
+    DISPATCH, // Carry on from State::line
+    STEP,     // Interpret State::line, which the generated code couldn't finish
+  };
+
+  struct TlbEntry
+  {
+    uint32_t page;        // Guest page number, or NO_PAGE
+    uint32_t unused;
+    Argument::Data* base; // Host address of the start of the page
+  };
+
+  // Everything generated code touches besides guest memory
+  struct State
+  {
+    uint32_t line;              // Next line to run once generated code returns
+    uint32_t generation;        // Memory generation the TLB was filled under
+    uint64_t executed;          // Instructions run natively since the last return
+    Argument::Address* stack;   // Memory's stack pointer
+    Memory* memory;
+    const uint8_t* code;        // JitProgram::code, for jumps to computed lines
+    const uint32_t* entries;    // JitProgram::entries
+    uint32_t size;              // Lines in the program
+    uint32_t unused;
+    TlbEntry tlb[TLB_SIZE];     // Only pages that lie entirely inside one DATA block
+  };
+
+  static_assert(sizeof(TlbEntry) == 16, "Generated code indexes the TLB by shifting the page number by 4");
+
+  const int32_t LINE = int32_t(offsetof(State, line));
+  const int32_t EXECUTED = int32_t(offsetof(State, executed));
+  const int32_t STACK = int32_t(offsetof(State, stack));
+  const int32_t CODE = int32_t(offsetof(State, code));
+  const int32_t ENTRIES = int32_t(offsetof(State, entries));
+  const int32_t SIZE = int32_t(offsetof(State, size));
+  const int32_t TLB = int32_t(offsetof(State, tlb));
+
+  // Generated code starts at offset 0 with a prologue taking the state and the block to jump to
+  typedef uint32_t (*Entry)(State* state, const uint8_t* block);
+
+  static void Flush(State& state)
+  {
+    state.generation = state.memory->GetGeneration();
+    for (TlbEntry& entry : state.tlb)
+      entry = { NO_PAGE, 0, nullptr };
+  }
+
+  // Called by generated code when the TLB misses, or the access crosses a page
+  static Argument::Data* Translate(State* state, Argument::Address address, Argument::Address count)
+  {
+    Argument::Data* host = state->memory->Translate(address, count);
+    if (!host)
+      return nullptr; // The interpreter will go through the slow path, or report the failure
+    Argument::Address page = address >> PAGE_BITS;
+    Argument::Data* base = state->memory->Translate(page << PAGE_BITS, PAGE_SIZE);
+    if (base)
+      state->tlb[page & (TLB_SIZE - 1)] = { page, 0, base };
+    return host;
+  }
+
+  static bool IsControlFlow(uint8_t id)
+  {
+    switch (Opcode(id))
+    {
+    case Opcode::JMP:
+    case Opcode::JEQ:
+    case Opcode::JNE:
+    case Opcode::JGT:
+    case Opcode::JLT:
+    case Opcode::HLT:
+    case Opcode::CAL:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+#ifdef KIP_JIT
+  using X64::Reg;
+  using X64::Cond;
+  using X64::Label;
+
+  // rbx holds the State and r15 the stack pointer's address for as long as generated code runs
+  // r12-r14 hold operands across calls to Translate, which may clobber everything else
+  class Compiler
+  {
+  public:
+    Compiler(const Program& program, const bool* traced)
+      : program(program), traced(traced)
+    {
+    }
+
+    bool IsCompilable(uint32_t line) const
+    {
+      uint8_t id = program.GetOpcode(line);
+      if (id == 0)
+        return true; // Nothing to run
+      if (traced[id])
+        return false; // Only the interpreter can describe it
+      const Operand* o = program.GetOperands(line);
+      for (uint8_t i = 0; i < instructionTable[id].argumentCount && i < Program::MAX_OPERANDS; ++i)
+        if (o[i].type == Argument::Type::STRING)
+          return false;
+      switch (Opcode(id))
+      {
+      case Opcode::STB: case Opcode::STA:
+      case Opcode::PUB: case Opcode::PUA: case Opcode::POB: case Opcode::POA:
+      case Opcode::JMP: case Opcode::JEQ: case Opcode::JNE: case Opcode::JGT: case Opcode::JLT:
+      case Opcode::HLT: case Opcode::CAL:
+      case Opcode::ADB: case Opcode::ADA: case Opcode::SBB: case Opcode::SBA:
+      case Opcode::MLB: case Opcode::MLA: case Opcode::DVB: case Opcode::DVA: case Opcode::MDA:
+      case Opcode::INB: case Opcode::INA: case Opcode::DCB: case Opcode::DCA:
+      case Opcode::BLS: case Opcode::BRS:
+      case Opcode::AND: case Opcode::BOR: case Opcode::XOR: case Opcode::NOT:
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    // Splits the program into blocks and generates each of them
+    bool Compile(const Instruction::Context& context, JitProgram& jit)
+    {
+      const uint32_t size = program.size();
+      std::vector<bool> leaders(size, false);
+      if (program.start < size)
+        leaders[program.start] = true;
+      for (const Instruction::Context::Labels::value_type& label : context.labels)
+        if (label.second.type == Argument::Type::DATA && label.second.dereferenceCount == 0 && label.second.data >= 1 && label.second.data <= size)
+          leaders[label.second.data - 1] = true;
+      for (uint32_t line = 0; line < size; ++line)
+      {
+        uint8_t id = program.GetOpcode(line);
+        if (!IsControlFlow(id))
+          continue;
+        if (line + 1 < size)
+          leaders[line + 1] = true;
+        const Operand& target = program.GetOperands(line)[0];
+        if (id != uint8_t(Opcode::HLT) && target.dereferenceCount == 0 && target.data >= 1 && target.data <= size)
+          leaders[target.data - 1] = true;
+      }
+
+      // Every compilable line belongs to exactly one block, which only a jump to its first line enters
+      struct Block
+      {
+        uint32_t start;
+        uint32_t end;
+      };
+      std::vector<Block> blocks;
+      entries.assign(size, Label());
+      for (uint32_t line = 0; line < size;)
+      {
+        if (!IsCompilable(line))
+        {
+          ++jit.interpreted;
+          ++line;
+          continue;
+        }
+        Block block = { line, line };
+        while (block.end < size && IsCompilable(block.end) && (block.end == block.start || !leaders[block.end]))
+          if (IsControlFlow(program.GetOpcode(block.end++)))
+            break;
+        entries[block.start] = e.NewLabel();
+        blocks.push_back(block);
+        line = block.end;
+      }
+
+      epilogue = e.NewLabel();
+      EmitPrologue();
+      for (const Block& block : blocks)
+      {
+        e.Bind(entries[block.start]);
+        executed = 0;
+        bool ended = false;
+        for (uint32_t line = block.start; line < block.end; ++line)
+        {
+          uint8_t id = program.GetOpcode(line);
+          if (id == 0)
+            continue;
+          exit = e.NewLabel();
+          exits.push_back({ exit, line, executed });
+          ended = EmitInstruction(line, id);
+          ++jit.compiled;
+        }
+        if (!ended)
+        {
+          CommitExecuted(0);
+          Goto(block.end);
+        }
+        EmitExits();
+      }
+      if (!e.Finish())
+        return false;
+
+      jit.code = X64::AllocateCode(e.code());
+      if (!jit.code)
+        return false;
+      jit.codeSize = e.code().size();
+      jit.entries.assign(size, JitProgram::NO_ENTRY);
+      for (const Block& block : blocks)
+        jit.entries[block.start] = e.Offset(entries[block.start]);
+      jit.blocks = uint32_t(blocks.size());
+      return true;
+    }
+
+  private:
+    struct SideExit
+    {
+      Label label;
+      uint32_t line;
+      uint32_t executed; // Instructions of the block that finished before it
+    };
+
+    void EmitPrologue()
+    {
+      e.Push(Reg::RBX);
+      e.Push(Reg::R12);
+      e.Push(Reg::R13);
+      e.Push(Reg::R14);
+      e.Push(Reg::R15);
+      if (X64::SHADOW_SPACE > 0) // Five pushes and the return address keep the stack aligned for calls
+        e.AddRsp(-int32_t(X64::SHADOW_SPACE));
+      e.Mov64(Reg::RBX, X64::ARG0);
+      e.Load64(Reg::R15, Reg::RBX, STACK);
+      e.Jmp(X64::ARG1);
+
+      e.Bind(epilogue);
+      if (X64::SHADOW_SPACE > 0)
+        e.AddRsp(int32_t(X64::SHADOW_SPACE));
+      e.Pop(Reg::R15);
+      e.Pop(Reg::R14);
+      e.Pop(Reg::R13);
+      e.Pop(Reg::R12);
+      e.Pop(Reg::RBX);
+      e.Ret();
+    }
+
+    // Leaves State::line for the interpreter to run, with the instructions before it counted
+    void EmitExits()
+    {
+      for (const SideExit& side : exits)
+      {
+        e.Bind(side.label);
+        e.StoreImm(Reg::RBX, LINE, side.line);
+        if (side.executed > 0)
+          e.AddImm64(Reg::RBX, EXECUTED, int32_t(side.executed));
+        e.MovImm(Reg::RAX, uint32_t(Exit::STEP));
+        e.Jmp(epilogue);
+      }
+      exits.clear();
+    }
+
+    void CommitExecuted(uint32_t extra)
+    {
+      if (executed + extra > 0)
+        e.AddImm64(Reg::RBX, EXECUTED, int32_t(executed + extra));
+    }
+
+    // Continues at line, straight into its block when it has one
+    void Goto(uint32_t line)
+    {
+      if (line < entries.size() && entries[line].id != uint32_t(-1))
+      {
+        e.Jmp(entries[line]);
+        return;
+      }
+      e.StoreImm(Reg::RBX, LINE, line);
+      e.MovImm(Reg::RAX, uint32_t(Exit::DISPATCH));
+      e.Jmp(epilogue);
+    }
+
+    // Continues at the line before the address in eax, as jumps do
+    // Returns from calls land here, so it looks the block up rather than going back to the dispatch loop
+    void GotoComputed()
+    {
+      Label dispatch = e.NewLabel();
+      e.AddImm(Reg::RAX, -1);
+      e.Cmp(Reg::RBX, SIZE, Reg::RAX);
+      e.Jcc(Cond::BE, dispatch);
+      e.Mov(Reg::RDX, Reg::RAX);
+      e.ShlImm(Reg::RDX, 2);
+      e.Add64(Reg::RDX, Reg::RBX, ENTRIES);
+      e.Load(Reg::RCX, Reg::RDX, 0);
+      e.CmpImm(Reg::RCX, JitProgram::NO_ENTRY);
+      e.Jcc(Cond::E, dispatch);
+      e.Add64(Reg::RCX, Reg::RBX, CODE);
+      e.Jmp(Reg::RCX);
+      e.Bind(dispatch);
+      e.Store(Reg::RBX, LINE, Reg::RAX);
+      e.MovImm(Reg::RAX, uint32_t(Exit::DISPATCH));
+      e.Jmp(epilogue);
+    }
+
+    // Turns the guest address in eax into a host pointer in rax to count bytes, or takes the side exit
+    void Translate(uint8_t count)
+    {
+      Label slow = e.NewLabel();
+      Label done = e.NewLabel();
+      e.Mov(Reg::RCX, Reg::RAX);
+      e.ShrImm(Reg::RCX, PAGE_BITS);
+      e.Mov(Reg::RDX, Reg::RCX);
+      e.AndImm(Reg::RDX, TLB_SIZE - 1);
+      e.ShlImm(Reg::RDX, 4);
+      e.Add64(Reg::RDX, Reg::RBX);
+      e.Cmp(Reg::RDX, TLB + int32_t(offsetof(TlbEntry, page)), Reg::RCX);
+      e.Jcc(Cond::NE, slow);
+      if (count > 1)
+      {
+        e.Mov(Reg::RCX, Reg::RAX);
+        e.AndImm(Reg::RCX, PAGE_SIZE - 1);
+        e.CmpImm(Reg::RCX, PAGE_SIZE - count);
+        e.Jcc(Cond::A, slow);
+      }
+      e.AndImm(Reg::RAX, PAGE_SIZE - 1);
+      e.Add64(Reg::RAX, Reg::RDX, TLB + int32_t(offsetof(TlbEntry, base)));
+      e.Jmp(done);
+
+      e.Bind(slow);
+      e.Mov(X64::ARG1, Reg::RAX);
+      e.Mov64(X64::ARG0, Reg::RBX);
+      e.MovImm(X64::ARG2, count);
+      e.MovImm64(Reg::RAX, uint64_t(&Jit::Translate));
+      e.Call(Reg::RAX);
+      e.Test64(Reg::RAX, Reg::RAX);
+      e.Jcc(Cond::E, exit);
+      e.Bind(done);
+    }
+
+    // Resolves an operand the way ResolveAddr does, into eax
+    void Addr(const Operand& o)
+    {
+      e.MovImm(Reg::RAX, o.data);
+      for (uint8_t i = 0; i < o.dereferenceCount; ++i)
+      {
+        Translate(4);
+        e.Load(Reg::RAX, Reg::RAX, 0);
+      }
+    }
+
+    // Resolves an operand the way ResolveByte does, into eax
+    void Byte(const Operand& o)
+    {
+      if (o.dereferenceCount == 0)
+      {
+        e.MovImm(Reg::RAX, o.data & 0xFF);
+        return;
+      }
+      e.MovImm(Reg::RAX, o.data);
+      for (uint8_t i = 1; i < o.dereferenceCount; ++i)
+      {
+        Translate(4);
+        e.Load(Reg::RAX, Reg::RAX, 0);
+      }
+      Translate(1);
+      e.LoadByte(Reg::RAX, Reg::RAX, 0);
+    }
+
+    // Stores r14 to the address operand o resolves to, as a byte or an address
+    void StoreResult(const Operand& o, bool byte)
+    {
+      Addr(o);
+      Translate(byte ? 1 : 4);
+      if (byte)
+        e.StoreByte(Reg::RAX, 0, Reg::R14);
+      else
+        e.Store(Reg::RAX, 0, Reg::R14);
+    }
+
+    // Three operand arithmetic: r12 and r13 in, r14 out
+    void Arithmetic(Opcode op, const Operand* o, bool byte)
+    {
+      if (byte)
+        Byte(o[0]);
+      else
+        Addr(o[0]);
+      e.Mov(Reg::R12, Reg::RAX);
+      if (byte)
+        Byte(o[1]);
+      else
+        Addr(o[1]);
+      e.Mov(Reg::R13, Reg::RAX);
+      e.Mov(Reg::R14, Reg::R12);
+      switch (op)
+      {
+      case Opcode::ADB: case Opcode::ADA: e.Add(Reg::R14, Reg::R13); break;
+      case Opcode::SBB: case Opcode::SBA: e.Sub(Reg::R14, Reg::R13); break;
+      case Opcode::MLB: case Opcode::MLA: e.Imul(Reg::R14, Reg::R13); break;
+      case Opcode::AND: e.And(Reg::R14, Reg::R13); break;
+      case Opcode::BOR: e.Or(Reg::R14, Reg::R13); break;
+      case Opcode::XOR: e.Xor(Reg::R14, Reg::R13); break;
+      case Opcode::BLS:
+        e.Mov(Reg::RCX, Reg::R13);
+        e.ShlCl(Reg::R14);
+        break;
+      case Opcode::BRS:
+        e.Mov(Reg::RCX, Reg::R13);
+        e.ShrCl(Reg::R14);
+        break;
+      case Opcode::DVB: case Opcode::DVA: case Opcode::MDA:
+        // The interpreter faults on a zero divisor, so leave that to it
+        e.CmpImm(Reg::R13, 0);
+        e.Jcc(Cond::E, exit);
+        e.Mov(Reg::RAX, Reg::R12);
+        e.MovImm(Reg::RDX, 0);
+        e.Div(Reg::R13);
+        e.Mov(Reg::R14, op == Opcode::MDA ? Reg::RDX : Reg::RAX);
+        break;
+      default:
+        break;
+      }
+      StoreResult(o[2], byte);
+    }
+
+    // Returns true if the instruction ended the block
+    bool EmitInstruction(uint32_t line, uint8_t id)
+    {
+      const Operand* o = program.GetOperands(line);
+      Opcode op = Opcode(id);
+      switch (op)
+      {
+      case Opcode::STB:
+      case Opcode::STA:
+        if (op == Opcode::STB)
+          Byte(o[0]);
+        else
+          Addr(o[0]);
+        e.Mov(Reg::R14, Reg::RAX);
+        StoreResult(o[1], op == Opcode::STB);
+        break;
+      case Opcode::ADB: case Opcode::SBB: case Opcode::MLB: case Opcode::DVB: case Opcode::MDA:
+      case Opcode::BLS: case Opcode::BRS: case Opcode::AND: case Opcode::BOR: case Opcode::XOR:
+        Arithmetic(op, o, true);
+        break;
+      case Opcode::ADA: case Opcode::SBA: case Opcode::MLA: case Opcode::DVA:
+        Arithmetic(op, o, false);
+        break;
+      case Opcode::NOT:
+        Byte(o[0]);
+        e.Mov(Reg::R14, Reg::RAX);
+        e.Not(Reg::R14);
+        StoreResult(o[1], true);
+        break;
+      case Opcode::INB: case Opcode::DCB: case Opcode::INA: case Opcode::DCA:
+      {
+        bool byte = op == Opcode::INB || op == Opcode::DCB;
+        Addr(o[0]);
+        Translate(byte ? 1 : 4);
+        if (byte)
+          e.LoadByte(Reg::RCX, Reg::RAX, 0);
+        else
+          e.Load(Reg::RCX, Reg::RAX, 0);
+        e.AddImm(Reg::RCX, op == Opcode::INB || op == Opcode::INA ? 1 : -1);
+        if (byte)
+          e.StoreByte(Reg::RAX, 0, Reg::RCX);
+        else
+          e.Store(Reg::RAX, 0, Reg::RCX);
+        break;
+      }
+      case Opcode::PUB:
+      case Opcode::PUA:
+      {
+        // A successful write just below the stack pointer proves it was mapped, or the end of a block
+        uint8_t count = op == Opcode::PUB ? 1 : 4;
+        if (op == Opcode::PUB)
+          Byte(o[0]);
+        else
+          Addr(o[0]);
+        e.Mov(Reg::R14, Reg::RAX);
+        e.Load(Reg::RAX, Reg::R15, 0);
+        e.AddImm(Reg::RAX, -int32_t(count));
+        e.Mov(Reg::R13, Reg::RAX);
+        Translate(count);
+        if (count == 1)
+          e.StoreByte(Reg::RAX, 0, Reg::R14);
+        else
+          e.Store(Reg::RAX, 0, Reg::R14);
+        e.Store(Reg::R15, 0, Reg::R13);
+        break;
+      }
+      case Opcode::POB:
+      case Opcode::POA:
+      {
+        uint8_t count = op == Opcode::POB ? 1 : 4;
+        Addr(o[0]);
+        e.Mov(Reg::R12, Reg::RAX);
+        e.Load(Reg::RAX, Reg::R15, 0);
+        Translate(count);
+        if (count == 1)
+          e.LoadByte(Reg::R14, Reg::RAX, 0);
+        else
+          e.Load(Reg::R14, Reg::RAX, 0);
+        e.Mov(Reg::RAX, Reg::R12);
+        Translate(count);
+        if (count == 1)
+          e.StoreByte(Reg::RAX, 0, Reg::R14);
+        else
+          e.Store(Reg::RAX, 0, Reg::R14);
+        e.Load(Reg::RAX, Reg::R15, 0);
+        e.AddImm(Reg::RAX, count);
+        e.Store(Reg::R15, 0, Reg::RAX);
+        break;
+      }
+      case Opcode::JMP:
+        if (o[0].dereferenceCount == 0)
+        {
+          CommitExecuted(1);
+          Goto(o[0].data - 1);
+          return true;
+        }
+        Addr(o[0]);
+        CommitExecuted(1);
+        GotoComputed();
+        return true;
+      case Opcode::JEQ: case Opcode::JNE: case Opcode::JGT: case Opcode::JLT:
+      {
+        Addr(o[0]);
+        e.Mov(Reg::R12, Reg::RAX);
+        Byte(o[1]);
+        e.Mov(Reg::R13, Reg::RAX);
+        Byte(o[2]);
+        e.Mov(Reg::R14, Reg::RAX);
+        CommitExecuted(1);
+        Label taken = e.NewLabel();
+        Cond cond = op == Opcode::JEQ ? Cond::E : op == Opcode::JNE ? Cond::NE : op == Opcode::JGT ? Cond::A : Cond::B;
+        e.Cmp(Reg::R13, Reg::R14);
+        e.Jcc(cond, taken);
+        Goto(line + 1);
+        e.Bind(taken);
+        if (o[0].dereferenceCount == 0)
+          Goto(o[0].data - 1);
+        else
+        {
+          e.Mov(Reg::RAX, Reg::R12);
+          GotoComputed();
+        }
+        return true;
+      }
+      case Opcode::HLT:
+        CommitExecuted(1);
+        e.StoreImm(Reg::RBX, LINE, uint32_t(-1));
+        e.MovImm(Reg::RAX, uint32_t(Exit::DISPATCH));
+        e.Jmp(epilogue);
+        return true;
+      case Opcode::CAL:
+        // Pushes the line after this one, counting from 1 like labels
+        Addr(o[0]);
+        e.Mov(Reg::R12, Reg::RAX);
+        e.Load(Reg::RAX, Reg::R15, 0);
+        e.AddImm(Reg::RAX, -4);
+        e.Mov(Reg::R13, Reg::RAX);
+        Translate(4);
+        e.MovImm(Reg::RCX, line + 2);
+        e.Store(Reg::RAX, 0, Reg::RCX);
+        e.Store(Reg::R15, 0, Reg::R13);
+        CommitExecuted(1);
+        if (o[0].dereferenceCount == 0)
+          Goto(o[0].data - 1);
+        else
+        {
+          e.Mov(Reg::RAX, Reg::R12);
+          GotoComputed();
+        }
+        return true;
+      default:
+        break;
+      }
+      ++executed;
+      return false;
+    }
+
+    const Program& program;
+    const bool* traced;
+    X64::Emitter e;
+    std::vector<Label> entries; // Label of the block starting at each line, if any
+    std::vector<SideExit> exits;
+    Label epilogue;
+    Label exit;                 // Side exit of the instruction being generated
+    uint32_t executed = 0;      // Instructions of the current block generated so far
+  };
+#endif
+}
+
+  std::vector<InterpretResult> CompileProgram(JitProgram& jit, const Program& program, const Instruction::Context& context, uint8_t verbosity)
+  {
+    std::vector<InterpretResult> r;
+    jit.Release();
+    jit.program = &program;
+    jit.verbosity = verbosity;
+#ifdef KIP_JIT
+    bool traced[256] = {};
+    for (uint8_t id = 0; id < instructionCount; ++id)
+      traced[id] = verbosity >= instructionTable[id].verbosity;
+    Jit::Compiler compiler(program, traced);
+    if (!compiler.Compile(context, jit))
+    {
+      jit.Release();
+      r.push_back(InterpretResult(false, "Could not generate native code; the program will be interpreted"));
+      return r;
+    }
+    r.push_back(InterpretResult(true, "Compiled " + std::to_string(jit.compiled) + " instructions in " + std::to_string(jit.blocks) + " blocks to "
+      + std::to_string(jit.codeSize) + " bytes; " + std::to_string(jit.interpreted) + " left to the interpreter"));
+#else
+    r.push_back(InterpretResult(false, "The JIT doesn't support this platform; the program will be interpreted"));
+#endif
+    return r;
+  }
+
+  std::vector<InterpretResult> InterpretJitProgram(const JitProgram& jit, Memory& memory, Instruction::Context& context)
+  {
+    if (!jit.program)
+      return { InterpretResult(false, "JIT program has not been compiled") };
+    const Program& program = *jit.program;
+    if (!jit.code)
+      return InterpretProgram(program, memory, context, jit.verbosity);
+
+    std::vector<InterpretResult> r;
+    if (jit.verbosity > KIP_VERBOSITY_RESERVE_LARGE)
+      r.reserve(100000);
+    else if (jit.verbosity > KIP_VERBOSITY_RESERVE_SMALL)
+      r.reserve(5000);
+    Jit::State state = {};
+    state.stack = &memory.RawStackPointer();
+    state.memory = &memory;
+    state.code = jit.code;
+    state.entries = jit.entries.data();
+    state.size = program.size();
+    Jit::Flush(state);
+    const Jit::Entry enter = (Jit::Entry)jit.code;
+    const uint32_t size = program.size();
+    context.line = program.start;
+    try
+    {
+      while (context.line < size)
+      {
+        uint32_t index = context.line;
+        if (jit.entries[index] != JitProgram::NO_ENTRY)
+        {
+          Jit::Exit exit = Jit::Exit(enter(&state, jit.code + jit.entries[index]));
+          context.line = state.line;
+          context.executed += state.executed;
+          state.executed = 0;
+          if (exit == Jit::Exit::DISPATCH)
+            continue;
+          index = context.line;
+        }
+
+        // Lines without code, and instructions generated code gave up on, run exactly as InterpretProgram runs them
+        if (!StepProgram(program, index, memory, context, jit.verbosity, r))
+          break;
+        if (memory.GetGeneration() != state.generation)
+          Jit::Flush(state); // A memory function mapped or unmapped something
+      }
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
+      return r;
+    }
+    if (r.size() == 0 || r.back().success)
+      r.push_back(InterpretResult(true, "Executed successfully"));
+    return r;
+  }
+
+  std::vector<InterpretResult> InterpretJitProgram(const JitProgram& jit, Machine& machine)
+  {
+    return InterpretJitProgram(jit, machine.memory, machine.context);
+  }
+}
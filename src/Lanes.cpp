@@ -0,0 +1,272 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "kipLanes.h"
+#include "kipMachine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define KIP_LANES_SSE2
+#endif
+
+namespace kip
+{
+  InterpretResult LaneReport::Describe() const
+  {
+    return InterpretResult(true, "Dispatched " + std::to_string(groups) + " groups: " + std::to_string(lockstep)
+      + " lane instructions in lockstep, " + std::to_string(scalar) + " one lane at a time, " + std::to_string(splits) + " groups split");
+  }
+
+  // Byte kernels over the operands gathered from every lane in a group
+  typedef void (*LaneKernel)(const Argument::Data* a, const Argument::Data* b, Argument::Data* out, size_t n);
+
+#ifdef KIP_LANES_SSE2
+#define KIP_LANE_LOAD(v, p) const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+#define KIP_LANE_LOOP(loads, vector, scalar) \
+  { \
+    size_t i = 0; \
+    for (; i + 16 <= n; i += 16) \
+    { \
+      loads \
+      _mm_storeu_si128((__m128i*)(out + i), vector); \
+    } \
+    for (; i < n; ++i) \
+      out[i] = Argument::Data(scalar); \
+  }
+#else
+#define KIP_LANE_LOOP(loads, vector, scalar) \
+  { \
+    for (size_t i = 0; i < n; ++i) \
+      out[i] = Argument::Data(scalar); \
+  }
+#endif
+#define KIP_LANE_KERNEL(name, vector, scalar) \
+  static void name(const Argument::Data* a, const Argument::Data* b, Argument::Data* out, size_t n) \
+  KIP_LANE_LOOP(KIP_LANE_LOAD(x, a) KIP_LANE_LOAD(y, b), vector, scalar)
+// Unary kernels only load a
+#define KIP_UNARY_LANE_KERNEL(name, vector, scalar) \
+  static void name(const Argument::Data* a, const Argument::Data*, Argument::Data* out, size_t n) \
+  KIP_LANE_LOOP(KIP_LANE_LOAD(x, a), vector, scalar)
+
+  KIP_LANE_KERNEL(AddKernel, _mm_add_epi8(x, y), a[i] + b[i])
+  KIP_LANE_KERNEL(SubtractKernel, _mm_sub_epi8(x, y), a[i] - b[i])
+  KIP_LANE_KERNEL(AndKernel, _mm_and_si128(x, y), a[i] & b[i])
+  KIP_LANE_KERNEL(OrKernel, _mm_or_si128(x, y), a[i] | b[i])
+  KIP_LANE_KERNEL(XorKernel, _mm_xor_si128(x, y), a[i] ^ b[i])
+  KIP_UNARY_LANE_KERNEL(NotKernel, _mm_xor_si128(x, _mm_set1_epi8(-1)), ~a[i])
+#undef KIP_UNARY_LANE_KERNEL
+#undef KIP_LANE_KERNEL
+#undef KIP_LANE_LOOP
+#undef KIP_LANE_LOAD
+
+  // SSE2 has no byte multiply; this loop is left to the compiler
+  static void MultiplyKernel(const Argument::Data* a, const Argument::Data* b, Argument::Data* out, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i)
+      out[i] = Argument::Data(a[i] * b[i]);
+  }
+
+  // Kernel for each instruction, and how many byte operands come before its destination
+  static LaneKernel GetKernel(uint8_t id, uint8_t& inputs)
+  {
+    inputs = 2;
+    switch (Opcode(id))
+    {
+    case Opcode::ADB: return AddKernel;
+    case Opcode::SBB: return SubtractKernel;
+    case Opcode::MLB: return MultiplyKernel;
+    case Opcode::AND: return AndKernel;
+    case Opcode::BOR: return OrKernel;
+    case Opcode::XOR: return XorKernel;
+    case Opcode::NOT: inputs = 1; return NotKernel;
+    default: return nullptr;
+    }
+  }
+
+  // Host addresses of recently used 256-byte windows of a lane's memory, direct mapped
+  // Only windows that lie entirely inside one DATA block are kept, and they're flushed when the lane is remapped
+  struct LaneWindows
+  {
+    static const Argument::Address BITS = 8;
+    static const Argument::Address SIZE = 1 << BITS;
+    static const uint32_t WAYS = 4;
+    static const uint32_t NO_WINDOW = uint32_t(-1);
+
+    void Flush(uint32_t newGeneration)
+    {
+      generation = newGeneration;
+      for (uint32_t& w : windows)
+        w = NO_WINDOW;
+    }
+
+    uint32_t generation;
+    uint32_t windows[WAYS];
+    Argument::Data* bases[WAYS];
+  };
+
+  static Argument::Data* Translate(const Memory& memory, LaneWindows& w, Argument::Address address, Argument::Address count)
+  {
+    const uint32_t window = address >> LaneWindows::BITS;
+    const Argument::Address offset = address & (LaneWindows::SIZE - 1);
+    if (w.windows[window % LaneWindows::WAYS] == window && offset + count <= LaneWindows::SIZE)
+      return w.bases[window % LaneWindows::WAYS] + offset;
+    Argument::Data* host = memory.Translate(address, count);
+    if (host && offset + count <= LaneWindows::SIZE && memory.Translate(address - offset, LaneWindows::SIZE))
+    {
+      w.windows[window % LaneWindows::WAYS] = window;
+      w.bases[window % LaneWindows::WAYS] = host - offset;
+    }
+    return host;
+  }
+
+  // Follows dereferences through DATA blocks only, so nothing with side effects is touched before a lane
+  // is known to take the fast path; nullptr sends the lane to StepProgram
+  static Argument::Data* Locate(const Memory& memory, LaneWindows& w, Argument::Address address, uint8_t dereferenceCount)
+  {
+    for (uint8_t i = dereferenceCount; i > 0; --i)
+    {
+      const Argument::Data* p = Translate(memory, w, address, sizeof(address));
+      if (p == nullptr)
+        return nullptr;
+      std::memcpy(&address, p, sizeof(address));
+    }
+    return Translate(memory, w, address, 1);
+  }
+
+  static bool StepLane(const Program& program, uint32_t index, Machine& machine, uint8_t verbosity, std::vector<InterpretResult>& r)
+  {
+    try
+    {
+      return StepProgram(program, index, machine.memory, machine.context, verbosity, r);
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
+      return false;
+    }
+  }
+
+  // Runs count lanes together until every one has stopped
+  static void RunLanes(const Program& program, Machine* const* lanes, std::vector<InterpretResult>* r, uint32_t count, LaneReport& report, uint8_t verbosity)
+  {
+    std::vector<uint32_t> live;
+    std::vector<bool> failed(count, false);
+    std::vector<LaneWindows> windows(count);
+    for (uint32_t l = 0; l < count; ++l)
+    {
+      StartProgram(program, lanes[l]->context);
+      live.push_back(l);
+      windows[l].Flush(lanes[l]->memory.GetGeneration());
+    }
+
+    const uint32_t size = program.size();
+    std::vector<uint32_t> group;
+    std::vector<uint32_t> scalar;
+    std::vector<Argument::Data> a(count);
+    std::vector<Argument::Data> b(count);
+    std::vector<Argument::Data> out(count);
+    std::vector<Argument::Data*> destinations(count);
+    while (true)
+    {
+      // Lanes that halted, faulted or ran off the end drop out
+      size_t kept = 0;
+      for (uint32_t l : live)
+        if (!failed[l] && lanes[l]->context.line < size)
+          live[kept++] = l;
+      live.resize(kept);
+      if (live.empty())
+        break;
+
+      uint32_t index = size;
+      for (uint32_t l : live)
+        index = std::min(index, lanes[l]->context.line);
+      group.clear();
+      for (uint32_t l : live)
+        if (lanes[l]->context.line == index)
+          group.push_back(l);
+      ++report.groups;
+      if (group.size() < live.size())
+        ++report.splits;
+
+      const uint8_t id = program.GetOpcode(index);
+      uint8_t inputs = 0;
+      const LaneKernel kernel = IsTraced(id, verbosity) ? nullptr : GetKernel(id, inputs);
+      scalar.clear();
+      if (kernel == nullptr)
+        scalar = group;
+      else
+      {
+        // Gather every lane's operands, leaving out lanes that need the full handler
+        const Operand* operands = program.GetOperands(index);
+        size_t n = 0;
+        for (uint32_t l : group)
+        {
+          const Memory& memory = lanes[l]->memory;
+          Argument::Data* p[Program::MAX_OPERANDS] = {};
+          Argument::Data in[2] = {};
+          uint8_t i = 0;
+          for (; i <= inputs; ++i)
+          {
+            const Operand& o = operands[i];
+            if (i < inputs && o.dereferenceCount == 0)
+            {
+              in[i] = Argument::Data(o.data);
+              continue;
+            }
+            p[i] = Locate(memory, windows[l], o.data, i < inputs ? o.dereferenceCount - 1 : o.dereferenceCount);
+            if (p[i] == nullptr)
+              break;
+            if (i < inputs)
+              in[i] = *p[i];
+          }
+          if (i <= inputs)
+          {
+            scalar.push_back(l);
+            continue;
+          }
+          a[n] = in[0];
+          b[n] = in[1];
+          destinations[n++] = p[inputs];
+          lanes[l]->context.line = index + 1;
+          ++lanes[l]->context.executed;
+        }
+        kernel(a.data(), b.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i)
+          *destinations[i] = out[i];
+        report.lockstep += n;
+      }
+
+      for (uint32_t l : scalar)
+      {
+        if (!StepLane(program, index, *lanes[l], verbosity, r[l]))
+          failed[l] = true;
+        else if (lanes[l]->memory.GetGeneration() != windows[l].generation)
+          windows[l].Flush(lanes[l]->memory.GetGeneration());
+        if (id != 0)
+          ++report.scalar;
+      }
+    }
+  }
+
+  std::vector<std::vector<InterpretResult>> InterpretLanes(const Program& program, const std::vector<Machine*>& lanes, uint8_t verbosity)
+  {
+    LaneReport report;
+    return InterpretLanes(program, lanes, report, verbosity);
+  }
+
+  std::vector<std::vector<InterpretResult>> InterpretLanes(const Program& program, const std::vector<Machine*>& lanes, LaneReport& report, uint8_t verbosity)
+  {
+    std::vector<std::vector<InterpretResult>> r(lanes.size());
+    // Lanes run KIP_LANE_WIDTH at a time, so the memory of every lane in a group stays in cache between lines
+    for (size_t first = 0; first < lanes.size(); first += KIP_LANE_WIDTH)
+      RunLanes(program, lanes.data() + first, r.data() + first, uint32_t(std::min(KIP_LANE_WIDTH, lanes.size() - first)), report, verbosity);
+    for (std::vector<InterpretResult>& results : r)
+      if (results.size() == 0 || results.back().success)
+        results.push_back(InterpretResult(true, "Executed successfully"));
+    return r;
+  }
+}
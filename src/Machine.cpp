@@ -0,0 +1,34 @@
+#include "pch.h"
+
+#include <string>
+#include <vector>
+
+#include "kipMachine.h"
+
+namespace kip
+{
+  Machine::Machine()
+  {
+  }
+
+  Machine& GetDefaultMachine()
+  {
+    static Machine defaultMachine;
+    return defaultMachine;
+  }
+
+  InterpretResult InterpretLine(std::string line, Machine& machine)
+  {
+    return InterpretLine(line, machine.memory, &machine.context);
+  }
+
+  std::vector<InterpretResult> InterpretLines(std::vector<std::string>& lines, Machine& machine, uint8_t verbosity)
+  {
+    return InterpretLines(lines, machine.memory, machine.context, verbosity);
+  }
+
+  std::vector<InterpretResult> InterpretInstructions(const std::vector<Instruction>& inst, Machine& machine, uint8_t verbosity)
+  {
+    return InterpretInstructions(inst, machine.memory, machine.context, verbosity);
+  }
+}
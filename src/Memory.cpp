@@ -1,229 +1,598 @@
 #include "pch.h"
 
 #include <algorithm>
-#include <list>
-#include <tuple>
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "kipMemory.h"
+#include "kipMachine.h"
+#include "kipX64.h"
+
+#if (defined(_WIN32) && defined(_M_X64)) || (defined(__linux__) && defined(__x86_64__))
+#define KIP_FLAT_MEMORY
+#endif
+
+#if defined(KIP_FLAT_MEMORY) && !defined(_WIN32)
+#include <csignal>
+#include <sys/mman.h>
+#include <ucontext.h>
+#endif
 
 namespace kip
 {
-  struct MemoryBlock {
-    Argument::Address mappedAddr;
-    Argument::Data* realAddr;
-    Argument::Address size;
-    MemoryReadFunction readFunc;
-    MemoryWriteFunction writeFunc;
-    enum class Type {
-      DATA,
-      FUNC
-    } type;
+  constexpr uint32_t PAGE_BITS = 12;
+  constexpr uint32_t PAGE_TABLE_BITS = 10;
+  constexpr uint32_t PAGE_TABLE_SIZE = 1 << PAGE_TABLE_BITS;
+  constexpr uint32_t NO_BLOCK = uint32_t(-1);
+
+  // Size of the flat reservation: the guest space, plus a page that is never committed so an access that starts
+  // near the top of the space can't run into whatever the host mapped next
+  constexpr uint64_t FLAT_SIZE = (uint64_t(1) << 32) + (uint64_t(1) << PAGE_BITS);
+
+#ifdef KIP_FLAT_MEMORY
+  // Loads and stores into the flat reservation, generated rather than compiled so the host fault handler can tell
+  // a fault inside one from any other by its instruction address. Each returns true, or false from recovery when
+  // its access faulted, having changed nothing
+  struct FlatAccess
+  {
+    bool (*loadByte)(const Argument::Data* at, Argument::Data* out);
+    bool (*storeByte)(Argument::Data* at, Argument::Data byte);
+    bool (*load)(const Argument::Data* at, Argument::Address* out);
+    bool (*store)(Argument::Data* at, Argument::Address value);
+    uintptr_t sites[4]; // The access instruction of each
+    uintptr_t recovery;
   };
-  typedef std::list<MemoryBlock> MemoryMap;
-  MemoryMap memoryMap;
-  Argument::Address stackPointer;
 
-  bool MapMemory(MemoryBlock newBlock)
+  static FlatAccess flatAccess;
+
+  static bool IsFlatAccessFault(uintptr_t pc)
   {
-    if (newBlock.mappedAddr + newBlock.size <= newBlock.mappedAddr)
-      return false; // Couldn't map. End position somehow before start position
-    MemoryMap::iterator it = memoryMap.begin();
-    if (it == memoryMap.end())
+    return std::find(std::begin(flatAccess.sites), std::end(flatAccess.sites), pc) != std::end(flatAccess.sites);
+  }
+
+#ifdef _WIN32
+  static LONG CALLBACK OnFlatAccessFault(EXCEPTION_POINTERS* info)
+  {
+    if (info->ExceptionRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || !IsFlatAccessFault(uintptr_t(info->ContextRecord->Rip)))
+      return EXCEPTION_CONTINUE_SEARCH;
+    info->ContextRecord->Rip = flatAccess.recovery;
+    return EXCEPTION_CONTINUE_EXECUTION;
+  }
+#else
+  static struct sigaction previousFaultHandler;
+
+  static void OnFlatAccessFault(int signal, siginfo_t* info, void* context)
+  {
+    greg_t& pc = static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_RIP];
+    if (IsFlatAccessFault(uintptr_t(pc)))
     {
-      memoryMap.push_front(newBlock);
-      return true; // Mapped to new first block
+      pc = greg_t(flatAccess.recovery);
+      return;
     }
-    if (newBlock.mappedAddr + newBlock.size < it->mappedAddr)
+    // Someone else's fault
+    if (previousFaultHandler.sa_flags & SA_SIGINFO)
+      previousFaultHandler.sa_sigaction(signal, info, context);
+    else if (previousFaultHandler.sa_handler != SIG_DFL && previousFaultHandler.sa_handler != SIG_IGN)
+      previousFaultHandler.sa_handler(signal);
+    else
+      std::signal(signal, SIG_DFL); // Returning runs the faulting instruction again, which now ends the process
+  }
+#endif
+
+  static bool GenerateFlatAccess()
+  {
+    using namespace X64;
+    Emitter e;
+    Label sites[4] = { e.NewLabel(), e.NewLabel(), e.NewLabel(), e.NewLabel() };
+    Label recovery = e.NewLabel();
+    const uint32_t entries = 4;
+    uint32_t starts[entries];
+    for (uint32_t i = 0; i < entries; ++i)
     {
-      memoryMap.push_front(newBlock);
-      return true; // Mapped to new first block
+      starts[i] = uint32_t(e.code().size());
+      e.Bind(sites[i]);
+      if (i == 0)
+      {
+        e.LoadByte(Reg::RAX, ARG0, 0);
+        e.StoreByte(ARG1, 0, Reg::RAX);
+      }
+      else if (i == 1)
+        e.StoreByte(ARG0, 0, ARG1);
+      else if (i == 2)
+      {
+        e.Load(Reg::RAX, ARG0, 0);
+        e.Store(ARG1, 0, Reg::RAX);
+      }
+      else
+        e.Store(ARG0, 0, ARG1);
+      e.MovImm(Reg::RAX, 1);
+      e.Ret();
+    }
+    e.Bind(recovery);
+    e.Xor(Reg::RAX, Reg::RAX);
+    e.Ret();
+    if (!e.Finish())
+      return false;
+    uint8_t* code = AllocateCode(e.code());
+    if (!code)
+      return false;
+    flatAccess.loadByte = (bool (*)(const Argument::Data*, Argument::Data*))(code + starts[0]);
+    flatAccess.storeByte = (bool (*)(Argument::Data*, Argument::Data))(code + starts[1]);
+    flatAccess.load = (bool (*)(const Argument::Data*, Argument::Address*))(code + starts[2]);
+    flatAccess.store = (bool (*)(Argument::Data*, Argument::Address))(code + starts[3]);
+    for (uint32_t i = 0; i < entries; ++i)
+      flatAccess.sites[i] = uintptr_t(code + e.Offset(sites[i]));
+    flatAccess.recovery = uintptr_t(code + e.Offset(recovery));
+#ifdef _WIN32
+    return AddVectoredExceptionHandler(1, OnFlatAccessFault) != NULL;
+#else
+    struct sigaction action = {};
+    action.sa_sigaction = OnFlatAccessFault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGSEGV, &action, &previousFaultHandler) == 0;
+#endif
+  }
+
+  // Generated and installed once per process, by the first memory to opt into flat mode
+  static bool PrepareFlatAccess()
+  {
+    static const bool prepared = GenerateFlatAccess();
+    return prepared;
+  }
+#endif
+
+  // Pages of a SPARSE block by offset within it, in two levels like the page table so an untouched block costs
+  // one directory however large it is
+  struct Memory::SparsePages
+  {
+    static const Argument::Address PAGE_SIZE = 1 << PAGE_BITS;
+    typedef std::array<Argument::Data, PAGE_SIZE> Page;
+    typedef std::array<std::unique_ptr<Page>, PAGE_TABLE_SIZE> Table;
+
+    Page* Find(Argument::Address offset) const
+    {
+      const Table* table = tables[offset >> (PAGE_BITS + PAGE_TABLE_BITS)].get();
+      return table ? (*table)[(offset >> PAGE_BITS) & (PAGE_TABLE_SIZE - 1)].get() : nullptr;
     }
-    while (it != memoryMap.end())
+
+    Page& Allocate(Argument::Address offset)
     {
-      if (newBlock.mappedAddr < it->mappedAddr + it->size && newBlock.mappedAddr >= it->mappedAddr)
-        return false; // Couldn't map. Start position has already been mapped
-      if (newBlock.mappedAddr + newBlock.size < it->mappedAddr + it->size && newBlock.mappedAddr + newBlock.size >= it->mappedAddr)
-        return false; // Couldn't map. End position has already been mapped
-      if (newBlock.mappedAddr < it->mappedAddr && newBlock.mappedAddr + newBlock.size >= it->mappedAddr + it->size)
-        return false; // Couldn't map. New block contains existing block
-      ++it;
-      if (it != memoryMap.end() && it->mappedAddr >= newBlock.mappedAddr + newBlock.size)
+      std::unique_ptr<Table>& table = tables[offset >> (PAGE_BITS + PAGE_TABLE_BITS)];
+      if (!table)
+        table.reset(new Table);
+      std::unique_ptr<Page>& page = (*table)[(offset >> PAGE_BITS) & (PAGE_TABLE_SIZE - 1)];
+      if (!page)
       {
-        memoryMap.insert(it, newBlock);
-        return true; // Mapped to new middle block
+        page.reset(new Page());
+        ++resident;
       }
+      return *page;
     }
-    memoryMap.push_back(newBlock);
-    return true; // Mapped to new end block
+
+    void Read(Argument::Address offset, Argument::Data* out, Argument::Address count) const
+    {
+      while (count > 0)
+      {
+        const Argument::Address within = offset & (PAGE_SIZE - 1);
+        const Argument::Address span = std::min(count, PAGE_SIZE - within);
+        if (const Page* page = Find(offset))
+          std::memcpy(out, page->data() + within, span);
+        else
+          std::memset(out, 0, span);
+        offset += span;
+        out += span;
+        count -= span;
+      }
+    }
+
+    void Write(Argument::Address offset, const Argument::Data* in, Argument::Address count)
+    {
+      while (count > 0)
+      {
+        const Argument::Address within = offset & (PAGE_SIZE - 1);
+        const Argument::Address span = std::min(count, PAGE_SIZE - within);
+        Page* page = Find(offset);
+        // Zeroes written to an untouched page leave it untouched
+        if (page || std::any_of(in, in + span, [](Argument::Data b) { return b != 0; }))
+          std::memcpy((page ? *page : Allocate(offset)).data() + within, in, span);
+        offset += span;
+        in += span;
+        count -= span;
+      }
+    }
+
+    void Fill(Argument::Address offset, Argument::Data byte, Argument::Address count)
+    {
+      while (count > 0)
+      {
+        const Argument::Address within = offset & (PAGE_SIZE - 1);
+        const Argument::Address span = std::min(count, PAGE_SIZE - within);
+        Page* page = Find(offset);
+        if (page || byte != 0)
+          std::memset((page ? *page : Allocate(offset)).data() + within, byte, span);
+        offset += span;
+        count -= span;
+      }
+    }
+
+    std::array<std::unique_ptr<Table>, PAGE_TABLE_SIZE> tables;
+    size_t resident = 0;
+  };
+
+  Memory::Memory()
+  {
   }
 
-  bool MapMemory(Argument::Data* start, Argument::Address size, Argument::Address mappedStart)
+  Memory::~Memory()
   {
-    return MapMemory({ mappedStart, start, size, nullptr, nullptr, MemoryBlock::Type::DATA });
+#ifdef KIP_FLAT_MEMORY
+    if (!flat)
+      return;
+#ifdef _WIN32
+    VirtualFree(flat, 0, MEM_RELEASE);
+#else
+    munmap(flat, FLAT_SIZE);
+#endif
+#endif
   }
 
-  bool MapMemory(MemoryReadFunction readFunc, MemoryWriteFunction writeFunc, Argument::Address size, Argument::Address mappedStart)
+  bool Memory::ReserveFlat()
+  {
+#ifdef KIP_FLAT_MEMORY
+    if (flat || !blocks.empty() || !PrepareFlatAccess())
+      return false;
+#ifdef _WIN32
+    void* reservation = VirtualAlloc(NULL, FLAT_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+    if (reservation == NULL)
+      return false;
+#else
+    void* reservation = mmap(nullptr, FLAT_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED)
+      return false;
+#endif
+    flat = (Argument::Data*)reservation;
+    committedPages.assign(size_t(1) << (32 - PAGE_BITS - 6), 0);
+    return true;
+#else
+    return false; // No fault handling for this host
+#endif
+  }
+
+  bool Memory::IsFlat() const
   {
-    return MapMemory({ mappedStart, nullptr, size, readFunc, writeFunc, MemoryBlock::Type::FUNC });
+    return flat != nullptr;
   }
 
-  bool UnmapMemory(Argument::Address mappedStart)
+  Argument::Data* Memory::CommitMemory(Argument::Address size, Argument::Address mappedStart)
+  {
+    const Argument::Address pageMask = (1 << PAGE_BITS) - 1;
+    if (!flat || size == 0 || (size & pageMask) || (mappedStart & pageMask))
+      return nullptr;
+    Argument::Data* start = flat + mappedStart;
+    if (!MapMemory({ mappedStart, start, size, nullptr, nullptr, nullptr, nullptr, nullptr, true, Block::Type::DATA, nullptr }))
+      return nullptr;
+#ifdef KIP_FLAT_MEMORY
+#ifdef _WIN32
+    const bool committed = VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    const bool committed = mprotect(start, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    if (!committed)
+    {
+      UnmapMemory(mappedStart);
+      return nullptr;
+    }
+#endif
+    return start;
+  }
+
+  void Memory::Release(const Block& block)
+  {
+#ifdef KIP_FLAT_MEMORY
+    if (!block.committed)
+      return;
+    // Hands the pages back to the host, so committing them again starts from zeroes
+#ifdef _WIN32
+    VirtualFree(block.realAddr, block.size, MEM_DECOMMIT);
+#else
+    mmap(block.realAddr, block.size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+#endif
+  }
+
+  void Memory::RebuildPageTable()
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+    ++generation;
+    for (std::unique_ptr<PageTable>& table : pageDirectory)
+      table.reset();
+    std::fill(committedPages.begin(), committedPages.end(), 0);
+    for (uint32_t i = 0; i < blocks.size(); ++i)
+    {
+      const Block& block = blocks[i];
+      uint32_t firstPage = block.mappedAddr >> PAGE_BITS;
+      uint32_t lastPage = (block.mappedAddr + block.size - 1) >> PAGE_BITS;
+      for (uint32_t page = firstPage; page <= lastPage; ++page)
+      {
+        std::unique_ptr<PageTable>& table = pageDirectory[page >> PAGE_TABLE_BITS];
+        if (!table)
+        {
+          table.reset(new PageTable);
+          table->fill(NO_BLOCK);
+        }
+        uint32_t& entry = (*table)[page & (PAGE_TABLE_SIZE - 1)];
+        if (entry == NO_BLOCK)
+          entry = i; // Blocks are sorted, so the first one to touch a page is the lowest
+        if (block.committed)
+          committedPages[page >> 6] |= uint64_t(1) << (page & 63); // Committed blocks are whole pages
+      }
+    }
+  }
+
+  const Memory::Block* Memory::FindBlock(Argument::Address address) const
+  {
+    const PageTable* table = pageDirectory[address >> (PAGE_BITS + PAGE_TABLE_BITS)].get();
+    if (!table)
+      return nullptr; // No pages mapped in this region
+    // Usually the first block covers the whole page, but small blocks can share one
+    for (uint32_t i = (*table)[(address >> PAGE_BITS) & (PAGE_TABLE_SIZE - 1)]; i < blocks.size() && blocks[i].mappedAddr <= address; ++i)
+      if (address - blocks[i].mappedAddr < blocks[i].size)
+        return &blocks[i];
+    return nullptr;
+  }
+
+  bool Memory::IsCommitted(Argument::Address address, Argument::Address count) const
+  {
+    const Argument::Address last = address + (count - 1);
+    if (committedPages.empty() || last < address)
+      return false; // Not flat, or wraps past the top of the space
+    for (uint32_t page = address >> PAGE_BITS; page <= (last >> PAGE_BITS); ++page)
+      if (!((committedPages[page >> 6] >> (page & 63)) & 1))
+        return false;
+    return true;
+  }
+
+  bool Memory::IsMappedOrEnd(Argument::Address address) const
+  {
+    // The stack pointer may rest one past the end of a block since pushes pre-decrement
+    if (FindBlock(address))
+      return true;
+    const Block* block = FindBlock(address - 1);
+    return block && block->mappedAddr + block->size == address;
+  }
+
+  bool Memory::MapMemory(Block newBlock)
+  {
+    if (newBlock.mappedAddr + newBlock.size <= newBlock.mappedAddr)
+      return false; // Couldn't map. End position somehow before start position
+    std::vector<Block>::iterator it = std::upper_bound(blocks.begin(), blocks.end(), newBlock.mappedAddr,
+      [](Argument::Address address, const Block& block) { return address < block.mappedAddr; });
+    if (it != blocks.begin() && std::prev(it)->mappedAddr + std::prev(it)->size > newBlock.mappedAddr)
+      return false; // Couldn't map. Start position has already been mapped
+    if (it != blocks.end() && newBlock.mappedAddr + newBlock.size > it->mappedAddr)
+      return false; // Couldn't map. End position has already been mapped
+    blocks.insert(it, newBlock);
+    RebuildPageTable();
+    return true;
+  }
+
+  bool Memory::MapMemory(Argument::Data* start, Argument::Address size, Argument::Address mappedStart)
+  {
+    return MapMemory({ mappedStart, start, size, nullptr, nullptr, nullptr, nullptr, nullptr, false, Block::Type::DATA, nullptr });
+  }
+
+  bool Memory::MapMemory(MemoryReadFunction readFunc, MemoryWriteFunction writeFunc, Argument::Address size, Argument::Address mappedStart)
+  {
+    return MapMemory({ mappedStart, nullptr, size, readFunc, writeFunc, nullptr, nullptr, nullptr, false, Block::Type::FUNC, nullptr });
+  }
+
+  bool Memory::MapMemory(MemorySpanReadFunction readSpan, MemorySpanWriteFunction writeSpan, void* context, Argument::Address size, Argument::Address mappedStart)
+  {
+    return MapMemory({ mappedStart, nullptr, size, nullptr, nullptr, readSpan, writeSpan, context, false, Block::Type::FUNC, nullptr });
+  }
+
+  bool Memory::MapSparseMemory(Argument::Address size, Argument::Address mappedStart)
+  {
+    return MapMemory({ mappedStart, nullptr, size, nullptr, nullptr, nullptr, nullptr, nullptr, false, Block::Type::SPARSE, std::make_shared<SparsePages>() });
+  }
+
+  bool Memory::Block::CanRead() const
+  {
+    return sparse || readFunc || readSpan;
+  }
+
+  bool Memory::Block::CanWrite() const
+  {
+    return sparse || writeFunc || writeSpan;
+  }
+
+  void Memory::Block::Read(Argument::Address offset, Argument::Data* out, Argument::Address count) const
+  {
+    if (sparse)
+      sparse->Read(offset, out, count);
+    else if (readSpan)
+      readSpan(context, offset, out, count);
+    else
+      readFunc(offset, out, count);
+  }
+
+  void Memory::Block::Write(Argument::Address offset, const Argument::Data* in, Argument::Address count) const
+  {
+    if (sparse)
+      sparse->Write(offset, in, count);
+    else if (writeSpan)
+      writeSpan(context, offset, in, count);
+    else
+      writeFunc(offset, const_cast<Argument::Data*>(in), count); // Older callbacks take a mutable buffer but only read it
+  }
+
+  bool Memory::UnmapMemory(Argument::Address mappedStart)
+  {
+    for (std::vector<Block>::iterator it = blocks.begin(); it != blocks.end(); ++it)
     {
       if (it->mappedAddr == mappedStart)
       {
-        memoryMap.erase(it);
+        Release(*it);
+        blocks.erase(it);
+        RebuildPageTable();
         return true; // Unmapped memory
       }
       if (it->mappedAddr > mappedStart)
-      {
         return false; // Memory was not mapped
-      }
-      ++it;
     }
     return false; // Memory was not mapped
   }
 
-  bool UnmapMemory(Argument::Data* start)
+  bool Memory::UnmapMemory(Argument::Data* start)
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+    for (std::vector<Block>::iterator it = blocks.begin(); it != blocks.end(); ++it)
     {
-      if (it->realAddr == start)
+      if (it->type == Block::Type::DATA && it->realAddr == start)
       {
-        memoryMap.erase(it);
+        Release(*it);
+        blocks.erase(it);
+        RebuildPageTable();
         return true; // Unmapped memory
       }
-      if (it->realAddr > start)
-        return false; // Memory was not mapped
-      ++it;
     }
     return false; // Memory was not mapped
   }
 
-  bool WriteByte(Argument::Address address, Argument::Data byte)
+  bool Memory::WriteByte(Argument::Address address, Argument::Data byte)
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+#ifdef KIP_FLAT_MEMORY
+    if (IsCommitted(address, 1) && flatAccess.storeByte(flat + address, byte))
+      return true; // Committed memory
+#endif
+    const Block* block = FindBlock(address);
+    if (!block)
+      return false; // Requested address was not mapped
+    Argument::Address offset = address - block->mappedAddr;
+    if (block->type == Block::Type::DATA)
+      block->realAddr[offset] = byte;
+    else
     {
-      if (it->mappedAddr <= address && it->mappedAddr + it->size > address)
-      {
-        Argument::Address offset = address - it->mappedAddr;
-        if (it->type == MemoryBlock::Type::DATA)
-          it->realAddr[offset] = byte;
-        else if (it->type == MemoryBlock::Type::FUNC)
-        {
-          if (it->writeFunc)
-            it->writeFunc(offset, &byte, 1);
-          else
-            return false; // Memory is read-only
-        }
-        return true; // Memory found
-      }
-      if (it->mappedAddr > address)
-        return false; // Memory was not mapped
-      ++it;
+      if (block->CanWrite())
+        block->Write(offset, &byte, 1);
+      else
+        return false; // Memory is read-only
     }
-    return false; // Requested address was not mapped
+    return true; // Memory found
   }
 
-  bool ReadByte(Argument::Address address, Argument::Data& byte)
+  bool Memory::ReadByte(Argument::Address address, Argument::Data& byte) const
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+#ifdef KIP_FLAT_MEMORY
+    if (IsCommitted(address, 1) && flatAccess.loadByte(flat + address, &byte))
+      return true; // Committed memory
+#endif
+    const Block* block = FindBlock(address);
+    if (!block)
+      return false; // Requested address was not mapped
+    Argument::Address offset = address - block->mappedAddr;
+    if (block->type == Block::Type::DATA)
+      byte = block->realAddr[offset];
+    else
     {
-      if (it->mappedAddr <= address && it->mappedAddr + it->size > address)
-      {
-        Argument::Address offset = address - it->mappedAddr;
-        if (it->type == MemoryBlock::Type::DATA)
-          byte = it->realAddr[offset];
-        else if (it->type == MemoryBlock::Type::FUNC)
-        {
-          if (it->readFunc)
-            it->readFunc(offset, &byte, 1);
-          else
-            return false; // Memory is write-only
-        }
-        return true; // Memory found
-      }
-      if (it->mappedAddr > address)
-        return false; // Memory was not mapped
-      ++it;
+      if (block->CanRead())
+        block->Read(offset, &byte, 1);
+      else
+        return false; // Memory is write-only
     }
-    return false; // Requested address was not mapped
+    return true; // Memory found
   }
 
-  bool WriteBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count)
+  bool Memory::WriteBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count)
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+#ifdef KIP_FLAT_MEMORY
+    // Address-sized accesses only check their first page, and fault back here if they run off the end of it
+    if (count == sizeof(Argument::Address) && IsCommitted(address, 1))
     {
-      if (it->mappedAddr <= address && it->mappedAddr + it->size > address)
+      Argument::Address value;
+      std::memcpy(&value, bytes, sizeof(value));
+      if (flatAccess.store(flat + address, value))
+        return true; // Committed memory
+    }
+    else if (count > 0 && IsCommitted(address, count))
+    {
+      std::memcpy(flat + address, bytes, count);
+      return true; // Committed memory
+    }
+#endif
+    while (count > 0)
+    {
+      const Block* block = FindBlock(address);
+      if (!block)
+        return false; // Requested address was not mapped
+      Argument::Address offset = address - block->mappedAddr;
+      Argument::Address toCopy = std::min(count, block->size - offset);
+      if (block->type == Block::Type::DATA)
+        std::memcpy(block->realAddr + offset, bytes, toCopy);
+      else
       {
-        Argument::Address offset = address - it->mappedAddr;
-        Argument::Address toCopy = std::min(count, it->size - offset);
-        if (it->type == MemoryBlock::Type::DATA)
-          std::memcpy(it->realAddr + offset, bytes, toCopy);
-        else if (it->type == MemoryBlock::Type::FUNC)
-        {
-          if (it->writeFunc)
-            it->writeFunc(offset, bytes, 1);
-          else
-            return false; // Memory is read-only
-        }
-        count -= toCopy;
-        address += toCopy;
-        bytes += toCopy;
-        if (count == 0)
-          return true; // Coppied all data
+        if (block->CanWrite())
+          block->Write(offset, bytes, toCopy);
+        else
+          return false; // Memory is read-only
       }
-      if (it->mappedAddr > address)
-        return false; // Memory was not mapped
-      ++it;
+      count -= toCopy;
+      address += toCopy;
+      bytes += toCopy;
     }
-    return false; // Requested address was not mapped
+    return true; // Coppied all data
   }
 
-  bool ReadBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count)
+  bool Memory::ReadBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count) const
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+#ifdef KIP_FLAT_MEMORY
+    if (count == sizeof(Argument::Address) && IsCommitted(address, 1))
     {
-      if (it->mappedAddr <= address && it->mappedAddr + it->size > address)
+      Argument::Address value;
+      if (flatAccess.load(flat + address, &value))
       {
-        Argument::Address offset = address - it->mappedAddr;
-        Argument::Address toCopy = std::min(count, it->size - offset);
-        if (it->type == MemoryBlock::Type::DATA)
-          std::memcpy(bytes, it->realAddr + offset, toCopy);
-        else if (it->type == MemoryBlock::Type::FUNC)
-        {
-          if (it->readFunc)
-            it->readFunc(offset, bytes, 1);
-          else
-            return false; // Memory is write-only
-        }
-        count -= toCopy;
-        address += toCopy;
-        bytes += toCopy;
-        if (count == 0)
-          return true; // Coppied all data
+        std::memcpy(bytes, &value, sizeof(value));
+        return true; // Committed memory
       }
-      if (it->mappedAddr > address)
-        return false; // Memory was not mapped
-      ++it;
     }
-    return false; // Requested address was not mapped
+    else if (count > 0 && IsCommitted(address, count))
+    {
+      std::memcpy(bytes, flat + address, count);
+      return true; // Committed memory
+    }
+#endif
+    while (count > 0)
+    {
+      const Block* block = FindBlock(address);
+      if (!block)
+        return false; // Requested address was not mapped
+      Argument::Address offset = address - block->mappedAddr;
+      Argument::Address toCopy = std::min(count, block->size - offset);
+      if (block->type == Block::Type::DATA)
+        std::memcpy(bytes, block->realAddr + offset, toCopy);
+      else
+      {
+        if (block->CanRead())
+          block->Read(offset, bytes, toCopy);
+        else
+          return false; // Memory is write-only
+      }
+      count -= toCopy;
+      address += toCopy;
+      bytes += toCopy;
+    }
+    return true; // Coppied all data
   }
 
-  bool WriteString(Argument::Address address, const std::string& string)
+  bool Memory::WriteString(Argument::Address address, const std::string& string)
   {
     return WriteBytes(address, (Argument::Data*)(string.data()), Argument::Address(string.length() + 1));
   }
 
-  bool ReadString(Argument::Address address, std::string& string)
+  bool Memory::ReadString(Argument::Address address, std::string& string) const
   {
     string.clear();
     Argument::Data c = '\0';
@@ -236,37 +605,242 @@ namespace kip
     return true;
   }
 
-  bool SetStackPointer(Argument::Address address)
+  bool Memory::FillBytes(Argument::Address address, Argument::Data byte, Argument::Address count)
+  {
+    Argument::Address failed;
+    return FillBytes(address, byte, count, failed);
+  }
+
+  bool Memory::FillBytes(Argument::Address address, Argument::Data byte, Argument::Address count, Argument::Address& failed)
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+    std::vector<Argument::Data> pattern; // Grown to the largest FUNC span so far, so each block gets one call
+    while (count > 0)
     {
-      if (it->mappedAddr <= address && it->mappedAddr + it->size >= address)
+      const Block* block = FindBlock(address);
+      if (!block || (block->type == Block::Type::FUNC && !block->CanWrite()))
       {
-        stackPointer = address;
-        return true; // Memory is mapped
+        failed = address;
+        return false; // Requested address was not mapped, or is read-only
       }
-      if (it->mappedAddr > address)
-        return false; // Memory was not mapped
-      ++it;
+      Argument::Address offset = address - block->mappedAddr;
+      Argument::Address toFill = std::min(count, block->size - offset);
+      if (block->type == Block::Type::DATA)
+        std::memset(block->realAddr + offset, byte, toFill);
+      else if (block->type == Block::Type::SPARSE)
+        block->sparse->Fill(offset, byte, toFill);
+      else
+      {
+        if (pattern.size() < toFill)
+          pattern.resize(toFill, byte);
+        block->Write(offset, pattern.data(), toFill);
+      }
+      count -= toFill;
+      address += toFill;
     }
-    return false; // Requested address was not mapped
+    return true;
   }
 
-  bool GetStackPointer(Argument::Address& address)
+  bool Memory::CopyBytes(Argument::Address to, Argument::Address from, Argument::Address count)
   {
-    MemoryMap::iterator it = memoryMap.begin();
-    while (it != memoryMap.end())
+    if (!CanRead(from, count) || !CanWrite(to, count))
+      return false;
+    // Each span lies in one block on both sides, and spans go last first when that keeps overlapping source bytes
+    // from being overwritten before they're read
+    const bool backwards = to - from < count;
+    Argument::Data buffer[4096];
+    while (count > 0)
     {
-      if (it->mappedAddr <= stackPointer && it->mappedAddr + it->size >= stackPointer)
+      const Argument::Address last = count - 1;
+      const Block* source = FindBlock(backwards ? from + last : from);
+      const Block* destination = FindBlock(backwards ? to + last : to);
+      Argument::Address span;
+      if (backwards)
+        span = std::min({ count, from + last - source->mappedAddr + 1, to + last - destination->mappedAddr + 1 });
+      else
+        span = std::min({ count, source->size - (from - source->mappedAddr), destination->size - (to - destination->mappedAddr) });
+      const Argument::Address start = backwards ? count - span : 0;
+      const Argument::Address fromOffset = from + start - source->mappedAddr;
+      const Argument::Address toOffset = to + start - destination->mappedAddr;
+
+      // Host memory on either side is handed straight to the other block, so devices get the whole span at once
+      if (source->type == Block::Type::DATA && destination->type == Block::Type::DATA)
+        std::memmove(destination->realAddr + toOffset, source->realAddr + fromOffset, span);
+      else if (source->type == Block::Type::DATA)
+        destination->Write(toOffset, source->realAddr + fromOffset, span);
+      else if (destination->type == Block::Type::DATA)
+        source->Read(fromOffset, destination->realAddr + toOffset, span);
+      else
       {
-        address = stackPointer;
-        return true; // Memory is mapped
+        // Neither side is host memory, so they meet through the buffer a chunk at a time
+        for (Argument::Address done = 0; done < span;)
+        {
+          const Argument::Address chunk = std::min<Argument::Address>(span - done, sizeof(buffer));
+          const Argument::Address offset = backwards ? span - done - chunk : done;
+          source->Read(fromOffset + offset, buffer, chunk);
+          destination->Write(toOffset + offset, buffer, chunk);
+          done += chunk;
+        }
       }
-      if (it->mappedAddr > address)
-        return false; // Memory was not mapped
-      ++it;
+
+      count -= span;
+      if (!backwards)
+      {
+        from += span;
+        to += span;
+      }
+    }
+    return true;
+  }
+
+  bool Memory::CanRead(Argument::Address address, Argument::Address count) const
+  {
+    return IsRangeMapped(address, count, false);
+  }
+
+  bool Memory::CanWrite(Argument::Address address, Argument::Address count) const
+  {
+    return IsRangeMapped(address, count, true);
+  }
+
+  bool Memory::IsRangeMapped(Argument::Address address, Argument::Address count, bool write) const
+  {
+    while (count > 0)
+    {
+      const Block* block = FindBlock(address);
+      if (!block || (block->type == Block::Type::FUNC && !(write ? block->CanWrite() : block->CanRead())))
+        return false;
+      Argument::Address span = std::min(count, block->size - (address - block->mappedAddr));
+      count -= span;
+      address += span;
     }
-    return false; // Requested address was not mapped
+    return true;
+  }
+
+  bool Memory::SetStackPointer(Argument::Address address)
+  {
+    if (!IsMappedOrEnd(address))
+      return false; // Requested address was not mapped
+    stackPointer = address;
+    return true; // Memory is mapped
+  }
+
+  bool Memory::GetStackPointer(Argument::Address& address) const
+  {
+    if (!IsMappedOrEnd(stackPointer))
+      return false; // Stack pointer is no longer mapped
+    address = stackPointer;
+    return true; // Memory is mapped
+  }
+
+  Argument::Data* Memory::Translate(Argument::Address address, Argument::Address count) const
+  {
+    const Block* block = FindBlock(address);
+    if (!block || block->type != Block::Type::DATA)
+      return nullptr; // Unmapped, or only reachable through functions
+    Argument::Address offset = address - block->mappedAddr;
+    if (count > block->size - offset)
+      return nullptr; // Runs past the end of the block
+    return block->realAddr + offset;
+  }
+
+  Argument::Address& Memory::RawStackPointer()
+  {
+    return stackPointer;
+  }
+
+  uint32_t Memory::GetGeneration() const
+  {
+    return generation;
+  }
+
+  size_t Memory::GetResidentPages() const
+  {
+    size_t pages = 0;
+    for (const Block& block : blocks)
+      if (block.sparse)
+        pages += block.sparse->resident;
+    return pages;
+  }
+
+  /////////////////////////////
+
+  bool MapMemory(Argument::Data* start, Argument::Address size, Argument::Address mappedStart)
+  {
+    return GetDefaultMachine().memory.MapMemory(start, size, mappedStart);
+  }
+
+  bool MapMemory(MemoryReadFunction readFunc, MemoryWriteFunction writeFunc, Argument::Address size, Argument::Address mappedStart)
+  {
+    return GetDefaultMachine().memory.MapMemory(readFunc, writeFunc, size, mappedStart);
+  }
+
+  bool MapMemory(MemorySpanReadFunction readSpan, MemorySpanWriteFunction writeSpan, void* context, Argument::Address size, Argument::Address mappedStart)
+  {
+    return GetDefaultMachine().memory.MapMemory(readSpan, writeSpan, context, size, mappedStart);
+  }
+
+  bool MapSparseMemory(Argument::Address size, Argument::Address mappedStart)
+  {
+    return GetDefaultMachine().memory.MapSparseMemory(size, mappedStart);
+  }
+
+  bool UnmapMemory(Argument::Data* start)
+  {
+    return GetDefaultMachine().memory.UnmapMemory(start);
+  }
+
+  bool UnmapMemory(Argument::Address mappedStart)
+  {
+    return GetDefaultMachine().memory.UnmapMemory(mappedStart);
+  }
+
+  bool WriteByte(Argument::Address address, Argument::Data byte)
+  {
+    return GetDefaultMachine().memory.WriteByte(address, byte);
+  }
+
+  bool ReadByte(Argument::Address address, Argument::Data& byte)
+  {
+    return GetDefaultMachine().memory.ReadByte(address, byte);
+  }
+
+  bool WriteBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count)
+  {
+    return GetDefaultMachine().memory.WriteBytes(address, bytes, count);
+  }
+
+  bool ReadBytes(Argument::Address address, Argument::Data* bytes, Argument::Address count)
+  {
+    return GetDefaultMachine().memory.ReadBytes(address, bytes, count);
+  }
+
+  bool WriteString(Argument::Address address, const std::string& string)
+  {
+    return GetDefaultMachine().memory.WriteString(address, string);
+  }
+
+  bool ReadString(Argument::Address address, std::string& string)
+  {
+    return GetDefaultMachine().memory.ReadString(address, string);
+  }
+
+  bool FillBytes(Argument::Address address, Argument::Data byte, Argument::Address count)
+  {
+    return GetDefaultMachine().memory.FillBytes(address, byte, count);
+  }
+
+  bool CopyBytes(Argument::Address to, Argument::Address from, Argument::Address count)
+  {
+    return GetDefaultMachine().memory.CopyBytes(to, from, count);
+  }
+
+  bool SetStackPointer(Argument::Address address)
+  {
+    return GetDefaultMachine().memory.SetStackPointer(address);
+  }
+
+  bool GetStackPointer(Argument::Address& address)
+  {
+    return GetDefaultMachine().memory.GetStackPointer(address);
   }
 }
@@ -0,0 +1,355 @@
+#include "pch.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kipOptimizer.h"
+#include "kipHandlers.h"
+
+namespace kip
+{
+  InterpretResult OptimizationReport::Describe() const
+  {
+    return InterpretResult(true, "Optimized " + std::to_string(before) + " instructions to " + std::to_string(after)
+      + ": " + std::to_string(folded) + " folded, " + std::to_string(reduced) + " reduced, "
+      + std::to_string(threaded) + " jumps threaded, " + std::to_string(deadStores) + " dead stores removed");
+  }
+
+  static bool IsWellFormed(const Instruction& c)
+  {
+    return c.id != 0 && c.id < uint8_t(Opcode::COUNT) && c.arguments.size() >= instructionTable[c.id].argumentCount;
+  }
+
+  static bool IsImmediate(const Argument& a)
+  {
+    return a.type == Argument::Type::DATA && a.dereferenceCount == 0;
+  }
+
+  static void Replace(Instruction& c, Opcode id, std::vector<Argument> arguments)
+  {
+    c.id = uint8_t(id);
+    c.arguments = std::move(arguments);
+  }
+
+  static void Remove(Instruction& c)
+  {
+    c.id = 0;
+    c.arguments.clear();
+  }
+
+  // Index of the first instruction run when execution reaches line, or inst.size() if the program ends first
+  static size_t NextExecuted(const std::vector<Instruction>& inst, size_t line)
+  {
+    while (line < inst.size() && inst[line].id == 0)
+      ++line;
+    return line < inst.size() ? line : inst.size();
+  }
+
+  // Jumps set the line to their target - 1, which is the next line run
+  static size_t JumpDestination(const std::vector<Instruction>& inst, Argument::Address target)
+  {
+    return NextExecuted(inst, target == 0 ? inst.size() : size_t(target) - 1);
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Constant folding
+
+  static bool FoldByte(Opcode id, Argument::Data A, Argument::Data B, Argument::Data& r)
+  {
+    switch (id)
+    {
+    case Opcode::ADB: r = Argument::Data(A + B); return true;
+    case Opcode::SBB: r = Argument::Data(A - B); return true;
+    case Opcode::MLB: r = Argument::Data(A * B); return true;
+    case Opcode::DVB: r = B ? Argument::Data(A / B) : 0; return B != 0;
+    case Opcode::MDA: r = B ? Argument::Data(A % B) : 0; return B != 0; // Runs the MDB handler
+    case Opcode::BLS: r = Argument::Data(A << B); return B < 32;
+    case Opcode::BRS: r = Argument::Data(A >> B); return B < 32;
+    case Opcode::AND: r = Argument::Data(A & B); return true;
+    case Opcode::BOR: r = Argument::Data(A | B); return true;
+    case Opcode::XOR: r = Argument::Data(A ^ B); return true;
+    default: return false;
+    }
+  }
+
+  static bool FoldAddr(Opcode id, Argument::Address A, Argument::Address B, Argument::Address& r)
+  {
+    switch (id)
+    {
+    case Opcode::ADA: r = A + B; return true;
+    case Opcode::SBA: r = A - B; return true;
+    case Opcode::MLA: r = A * B; return true;
+    case Opcode::DVA: r = B ? A / B : 0; return B != 0;
+    default: return false;
+    }
+  }
+
+  static bool FoldBranch(Opcode id, Argument::Data B, Argument::Data C, bool& taken)
+  {
+    switch (id)
+    {
+    case Opcode::JEQ: taken = B == C; return true;
+    case Opcode::JNE: taken = B != C; return true;
+    case Opcode::JGT: taken = B > C; return true;
+    case Opcode::JLT: taken = B < C; return true;
+    default: return false;
+    }
+  }
+
+  // Arithmetic on immediates becomes a store of the result, and branches on immediates become a jump or nothing
+  static bool Fold(Instruction& c)
+  {
+    Opcode id = Opcode(c.id);
+    if (id == Opcode::NOT)
+    {
+      if (!IsImmediate(c.arguments[0]))
+        return false;
+      Replace(c, Opcode::STB, { Argument(Argument::Data(~c.arguments[0].data)), c.arguments[1] });
+      return true;
+    }
+    if (c.arguments.size() < 3 || !IsImmediate(c.arguments[1]))
+      return false;
+    bool taken = false;
+    if (IsImmediate(c.arguments[2]) && FoldBranch(id, Argument::Data(c.arguments[1].data), Argument::Data(c.arguments[2].data), taken))
+    {
+      if (taken)
+        Replace(c, Opcode::JMP, { c.arguments[0] });
+      else if (IsImmediate(c.arguments[0])) // Otherwise resolving the target could still fail
+        Remove(c);
+      else
+        return false;
+      return true;
+    }
+    if (!IsImmediate(c.arguments[0]))
+      return false;
+
+    Argument::Data byte = 0;
+    Argument::Address addr = 0;
+    if (FoldByte(id, Argument::Data(c.arguments[0].data), Argument::Data(c.arguments[1].data), byte))
+      Replace(c, Opcode::STB, { Argument(byte), c.arguments[2] });
+    else if (FoldAddr(id, c.arguments[0].data, c.arguments[1].data, addr))
+      Replace(c, Opcode::STA, { Argument(addr), c.arguments[2] });
+    else
+      return false;
+    return true;
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Strength reduction
+
+  // True if value reads what destination addresses, as in ADB *$0 1 $0
+  static bool ReadsDestination(const Argument& value, const Argument& destination)
+  {
+    return value.type == Argument::Type::DATA && destination.type == Argument::Type::DATA
+      && value.data == destination.data && value.dereferenceCount == destination.dereferenceCount + 1;
+  }
+
+  // Adding or subtracting 1 in place becomes an increment or decrement
+  static bool Reduce(Instruction& c)
+  {
+    Opcode id = Opcode(c.id);
+    bool bytes = id == Opcode::ADB || id == Opcode::SBB;
+    if (!bytes && id != Opcode::ADA && id != Opcode::SBA)
+      return false;
+    const Argument& destination = c.arguments[2];
+    const Argument* amount = nullptr;
+    if (ReadsDestination(c.arguments[0], destination) && IsImmediate(c.arguments[1]))
+      amount = &c.arguments[1];
+    else if ((id == Opcode::ADB || id == Opcode::ADA) && ReadsDestination(c.arguments[1], destination) && IsImmediate(c.arguments[0]))
+      amount = &c.arguments[0];
+    if (!amount)
+      return false;
+
+    Argument::Address step = bytes ? Argument::Data(amount->data) : amount->data;
+    if (id == Opcode::SBB || id == Opcode::SBA)
+      step = bytes ? Argument::Data(0 - step) : 0 - step;
+    const Argument::Address minusOne = bytes ? 0xFF : 0xFFFFFFFF;
+    if (step == 1)
+      Replace(c, bytes ? Opcode::INB : Opcode::INA, { destination });
+    else if (step == minusOne)
+      Replace(c, bytes ? Opcode::DCB : Opcode::DCA, { destination });
+    else
+      return false;
+    return true;
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Jump threading
+
+  static bool IsJump(Opcode id)
+  {
+    return id == Opcode::JMP || id == Opcode::JEQ || id == Opcode::JNE || id == Opcode::JGT || id == Opcode::JLT || id == Opcode::CAL;
+  }
+
+  // Jumps skip lines with nothing to run and any unconditional jumps they would land on
+  static bool Thread(std::vector<Instruction>& inst, Instruction& c)
+  {
+    const size_t MAX_HOPS = 256; // Cycles of jumps to jumps are only followed this far
+    Argument& target = c.arguments[0];
+    size_t destination = JumpDestination(inst, target.data);
+    for (size_t hops = 0; hops < MAX_HOPS && destination < inst.size(); ++hops)
+    {
+      const Instruction& next = inst[destination];
+      if (next.id != uint8_t(Opcode::JMP) || !IsWellFormed(next) || !IsImmediate(next.arguments[0]))
+        break;
+      destination = JumpDestination(inst, next.arguments[0].data);
+    }
+    if (destination >= inst.size() || destination + 1 == target.data)
+      return false;
+    target.data = Argument::Address(destination + 1);
+    return true;
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Dead store elimination
+
+  // Byte range [begin, end) an instruction touches
+  struct Range
+  {
+    uint64_t begin;
+    uint64_t end;
+
+    bool Contains(const Range& o) const { return begin <= o.begin && o.end <= end; }
+  };
+
+  // Resolving the operand reads no memory, so it can't fail
+  static bool ReadsNothing(const Argument& a)
+  {
+    return a.dereferenceCount == 0;
+  }
+
+  // Memory a plain store writes, if it has no other effect and doesn't read memory
+  static bool PureStore(const Instruction& c, Range& write)
+  {
+    if (c.id != uint8_t(Opcode::STB) && c.id != uint8_t(Opcode::STA) && c.id != uint8_t(Opcode::STS))
+      return false;
+    const Argument& destination = c.arguments[1];
+    if (!IsImmediate(destination))
+      return false;
+    switch (Opcode(c.id))
+    {
+    case Opcode::STB:
+      write = { destination.data, uint64_t(destination.data) + 1 };
+      return IsImmediate(c.arguments[0]);
+    case Opcode::STA:
+      write = { destination.data, uint64_t(destination.data) + 4 };
+      return IsImmediate(c.arguments[0]);
+    case Opcode::STS:
+      write = { destination.data, uint64_t(destination.data) + c.arguments[0].stringLabel.size() + 1 };
+      return c.arguments[0].type == Argument::Type::STRING && c.arguments[0].dereferenceCount == 0;
+    default:
+      return false;
+    }
+  }
+
+  // Memory an instruction writes in order from its first byte, if nothing it does before writing can fail
+  static bool Overwrites(const Instruction& c, Range& write)
+  {
+    const std::vector<Argument>& a = c.arguments;
+    switch (Opcode(c.id))
+    {
+    case Opcode::STB:
+    case Opcode::STA:
+    case Opcode::STS:
+      if (!IsImmediate(a[1]) || (a[0].type == Argument::Type::DATA && Opcode(c.id) == Opcode::STS))
+        return false;
+      write = { a[1].data, uint64_t(a[1].data) + (Opcode(c.id) == Opcode::STB ? 1 : Opcode(c.id) == Opcode::STA ? 4 : a[0].stringLabel.size() + 1) };
+      return ReadsNothing(a[0]);
+    case Opcode::FIL:
+      if (!IsImmediate(a[1]) || !IsImmediate(a[2]))
+        return false;
+      write = { a[1].data, uint64_t(a[1].data) + a[2].data };
+      return write.end <= UINT32_MAX && ReadsNothing(a[0]); // FIL fills nothing when its range wraps
+    case Opcode::DVB: case Opcode::MDA:
+      if (a[1].data == 0)
+        return false;
+      // Fall through
+    case Opcode::ADB: case Opcode::SBB: case Opcode::MLB:
+    case Opcode::BLS: case Opcode::BRS: case Opcode::ROL: case Opcode::ROR:
+    case Opcode::AND: case Opcode::BOR: case Opcode::XOR:
+      if (!IsImmediate(a[2]))
+        return false;
+      write = { a[2].data, uint64_t(a[2].data) + 1 };
+      return ReadsNothing(a[0]) && ReadsNothing(a[1]);
+    case Opcode::DVA:
+      if (a[1].data == 0)
+        return false;
+      // Fall through
+    case Opcode::ADA: case Opcode::SBA: case Opcode::MLA:
+      if (!IsImmediate(a[2]))
+        return false;
+      write = { a[2].data, uint64_t(a[2].data) + 4 };
+      return ReadsNothing(a[0]) && ReadsNothing(a[1]);
+    case Opcode::NOT:
+      if (!IsImmediate(a[1]))
+        return false;
+      write = { a[1].data, uint64_t(a[1].data) + 1 };
+      return ReadsNothing(a[0]);
+    default:
+      return false;
+    }
+  }
+
+  // A store is dead if the instruction run straight after it is certain to overwrite it
+  // That instruction must read no memory, which could fault and stop the program with the store still visible,
+  // and must start writing at the stored bytes, which the store has just shown to be writable
+  static bool IsDeadStore(const std::vector<Instruction>& inst, size_t i)
+  {
+    Range stored = {};
+    if (!PureStore(inst[i], stored))
+      return false;
+    size_t next = NextExecuted(inst, i + 1);
+    if (next >= inst.size() || !IsWellFormed(inst[next]))
+      return false;
+    Range written = {};
+    return Overwrites(inst[next], written) && written.begin == stored.begin && written.Contains(stored);
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+  OptimizationReport OptimizeInstructions(std::vector<Instruction>& inst)
+  {
+    OptimizationReport report;
+    for (const Instruction& c : inst)
+      if (c.id != 0)
+        ++report.before;
+
+    for (Instruction& c : inst)
+    {
+      if (!IsWellFormed(c))
+        continue;
+      if (Fold(c))
+        ++report.folded;
+      else if (Reduce(c))
+        ++report.reduced;
+    }
+
+    for (size_t i = 0; i < inst.size(); ++i)
+    {
+      Instruction& c = inst[i];
+      if (!IsWellFormed(c) || !IsJump(Opcode(c.id)) || !IsImmediate(c.arguments[0]))
+        continue;
+      if (Thread(inst, c))
+        ++report.threaded;
+      // A jump to where execution would go anyway does nothing
+      if (c.id == uint8_t(Opcode::JMP) && JumpDestination(inst, c.arguments[0].data) == NextExecuted(inst, i + 1))
+      {
+        Remove(c);
+        ++report.threaded;
+      }
+    }
+
+    for (size_t i = 0; i < inst.size(); ++i)
+      if (IsWellFormed(inst[i]) && IsDeadStore(inst, i))
+      {
+        Remove(inst[i]);
+        ++report.deadStores;
+      }
+
+    for (const Instruction& c : inst)
+      if (c.id != 0)
+        ++report.after;
+    return report;
+  }
+}
@@ -0,0 +1,549 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "kipProgram.h"
+#include "kipMachine.h"
+#include "kipHandlers.h"
+
+// GCC and Clang support labels as values, which lets every handler dispatch
+// the next instruction itself rather than looping back to a shared switch
+#if defined(__GNUC__) && !defined(KIP_NO_THREADED_DISPATCH)
+#define KIP_THREADED_DISPATCH
+#endif
+
+namespace kip
+{
+  uint32_t Program::size() const
+  {
+    return uint32_t(opcodes.size());
+  }
+
+  const Operand* Program::GetOperands(uint32_t index) const
+  {
+    return operands.data() + size_t(index) * MAX_OPERANDS;
+  }
+
+  uint8_t Program::GetOpcode(uint32_t index) const
+  {
+    uint8_t id = opcodes[index];
+    if (id < uint8_t(Opcode::COUNT))
+      return id;
+    return uint8_t(superinstructions[id - uint8_t(Opcode::COUNT)].first);
+  }
+
+  uint32_t BytecodeProgram::size() const
+  {
+    return uint32_t(lines.size());
+  }
+
+  Program DecodeInstructions(const std::vector<Instruction>& inst, Instruction::Context& context)
+  {
+    Program program;
+    program.opcodes.reserve(inst.size());
+    program.operands.resize(inst.size() * Program::MAX_OPERANDS, { 0, 0, Argument::Type::INVALID });
+    program.sourceMap.reserve(inst.size());
+    std::map<std::string, uint32_t> interned;
+    for (uint32_t i = 0; i < inst.size(); ++i)
+    {
+      const Instruction& c = inst[i];
+      program.opcodes.push_back(c.id);
+      program.sourceMap.push_back(c.line);
+      for (uint8_t a = 0; a < c.arguments.size() && a < Program::MAX_OPERANDS; ++a)
+      {
+        const Argument& argument = c.arguments[a];
+        Operand& operand = program.operands[size_t(i) * Program::MAX_OPERANDS + a];
+        operand.dereferenceCount = argument.dereferenceCount;
+        operand.type = argument.type;
+        if (argument.type == Argument::Type::STRING)
+        {
+          std::map<std::string, uint32_t>::iterator it = interned.find(argument.stringLabel);
+          if (it == interned.end())
+          {
+            it = interned.insert({ argument.stringLabel, uint32_t(program.strings.size()) }).first;
+            program.strings.push_back(argument.stringLabel);
+          }
+          operand.data = it->second;
+        }
+        else
+          operand.data = argument.data;
+      }
+    }
+    Instruction::Context::Labels::const_iterator start = context.labels.find("START");
+    if (start != context.labels.end() && start->second.type == Argument::Type::DATA && start->second.dereferenceCount == 0)
+      program.start = start->second.data;
+    return program;
+  }
+
+  Program DecodeBytecode(const BytecodeProgram& bytecode)
+  {
+    Program program;
+    const uint32_t size = bytecode.size();
+    program.opcodes.reserve(size);
+    program.operands.resize(size_t(size) * Program::MAX_OPERANDS, { 0, 0, Argument::Type::INVALID });
+    program.sourceMap.reserve(size);
+    std::map<std::string, uint32_t> interned;
+    for (uint32_t i = 0; i < size; ++i)
+    {
+      const uint8_t* record = bytecode.image.data() + bytecode.lines[i];
+      uint8_t id = record[0] - uint8_t(Bytecode::DataType::INSTRUCTIONS_START);
+      if (id >= instructionCount)
+        id = 0;
+      program.opcodes.push_back(id);
+      program.sourceMap.push_back(instructionTable[id].string);
+      const uint8_t* p = record + 1;
+      for (uint8_t a = 0; a < instructionTable[id].argumentCount && a < Program::MAX_OPERANDS; ++a)
+      {
+        Operand& operand = program.operands[size_t(i) * Program::MAX_OPERANDS + a];
+        operand.type = Argument::Type(p[0]);
+        if (operand.type == Argument::Type::STRING)
+        {
+          std::string string((const char*)p + 1);
+          std::map<std::string, uint32_t>::iterator it = interned.find(string);
+          if (it == interned.end())
+          {
+            it = interned.insert({ string, uint32_t(program.strings.size()) }).first;
+            program.strings.push_back(string);
+          }
+          operand.data = it->second;
+          p += string.size() + 2;
+        }
+        else
+        {
+          // DATA operands are type, dereference count, then a big-endian value
+          if (operand.type == Argument::Type::DATA)
+          {
+            operand.dereferenceCount = p[1];
+            operand.data = (Argument::AddressOrData(p[2]) << 24) | (Argument::AddressOrData(p[3]) << 16) | (Argument::AddressOrData(p[4]) << 8) | Argument::AddressOrData(p[5]);
+          }
+          p += 6;
+        }
+      }
+    }
+    program.start = bytecode.start;
+    return program;
+  }
+
+  bool ReportInstruction(std::vector<InterpretResult>& r, uint32_t index, unsigned lnWidth, const std::string& source, const InstructionResult& ir, const InterpretResult& description)
+  {
+    std::string ln = "";
+    unsigned pad = lnWidth;
+    for (unsigned c = index + 1; c > 0 && pad > 0; c /= 10)
+      --pad;
+    ln.resize(pad, ' ');
+    ln += std::to_string(index + 1) + ": ";
+    std::string newstr = ln + source + " -> " + description.str;
+    if (!ir)
+    {
+      r.push_back(InterpretResult(false, newstr));
+      return false;
+    }
+    if (r.size() == 0 || r.back().str != newstr)
+      r.push_back(InterpretResult(true, newstr));
+    return true;
+  }
+
+  // Runs a program, counting the dispatches that start at each line when PROFILE is set
+  template <bool PROFILE>
+  static std::vector<InterpretResult> RunProgram(const Program& program, Memory& memory, Instruction::Context& context, uint8_t verbosity, uint64_t* counts)
+  {
+    std::vector<InterpretResult> r;
+    if (verbosity > KIP_VERBOSITY_RESERVE_LARGE)
+      r.reserve(100000);
+    else if (verbosity > KIP_VERBOSITY_RESERVE_SMALL)
+      r.reserve(5000);
+    unsigned lnWidth = 0;
+    for (size_t c = program.size() + 1; c > 0; c /= 10)
+      ++lnWidth;
+
+    // Resolve the verbosity check once instead of on every step
+    bool traced[256] = {};
+    for (uint8_t id = 0; id < instructionCount; ++id)
+      traced[id] = verbosity >= instructionTable[id].verbosity;
+
+    const uint8_t* const opcodes = program.opcodes.data();
+    const uint32_t size = program.size();
+    uint32_t index = 0;
+    InstructionResult ir(InstructionResult::Status::OK);
+    context.line = program.start;
+    try
+    {
+#ifdef KIP_THREADED_DISPATCH
+      // Each handler ends with its own indirect jump to the next one
+      static void* const dispatch[] = {
+        &&op_NOP,
+#define KIP_OPCODE_LABEL(name, handler) &&op_##name,
+        KIP_OPCODES(KIP_OPCODE_LABEL)
+#undef KIP_OPCODE_LABEL
+#define KIP_SUPERINSTRUCTION_LABEL(name, first, second) &&op_##name,
+        KIP_SUPERINSTRUCTIONS(KIP_SUPERINSTRUCTION_LABEL)
+#undef KIP_SUPERINSTRUCTION_LABEL
+      };
+#define KIP_DISPATCH() \
+      if (context.line >= size) \
+        goto finished; \
+      index = context.line++; \
+      if (PROFILE) \
+        ++counts[index]; \
+      goto *dispatch[opcodes[index]]
+
+      KIP_DISPATCH();
+    op_NOP:
+      KIP_DISPATCH();
+#define KIP_OPCODE_CASE(name, handler) \
+    op_##name: \
+      ir = Handlers::handler(memory, &context, ProgramOperands(program, index, memory)); \
+      ++context.executed; \
+      if (!ir || traced[uint8_t(Opcode::name)]) \
+        goto report; \
+      KIP_DISPATCH();
+      KIP_OPCODES(KIP_OPCODE_CASE)
+#undef KIP_OPCODE_CASE
+      // The second line is run straight after the first, as the next dispatch would have done
+#define KIP_SUPERINSTRUCTION_CASE(name, first, second) \
+    op_##name: \
+      ir = Handlers::first(memory, &context, ProgramOperands(program, index, memory)); \
+      ++context.executed; \
+      if (!ir || traced[uint8_t(Opcode::first)]) \
+        goto report; \
+      index = context.line++; \
+      ir = Handlers::second(memory, &context, ProgramOperands(program, index, memory)); \
+      ++context.executed; \
+      if (!ir || traced[uint8_t(Opcode::second)]) \
+        goto report; \
+      KIP_DISPATCH();
+      KIP_SUPERINSTRUCTIONS(KIP_SUPERINSTRUCTION_CASE)
+#undef KIP_SUPERINSTRUCTION_CASE
+    report:
+      if (!ReportInstruction(r, index, lnWidth, program.sourceMap[index], ir, Describe(program.GetOpcode(index), ir, ProgramOperands(program, index, memory))))
+        goto finished;
+      KIP_DISPATCH();
+#undef KIP_DISPATCH
+    finished:;
+#else
+      while (context.line < size)
+      {
+        index = context.line++;
+        if (PROFILE)
+          ++counts[index];
+        uint8_t id = opcodes[index];
+        switch (id)
+        {
+#define KIP_OPCODE_CASE(name, handler) \
+        case uint8_t(Opcode::name): \
+          ir = Handlers::handler(memory, &context, ProgramOperands(program, index, memory)); \
+          break;
+          KIP_OPCODES(KIP_OPCODE_CASE)
+#undef KIP_OPCODE_CASE
+#define KIP_SUPERINSTRUCTION_CASE(name, first, second) \
+        case uint8_t(Superinstruction::name): \
+          id = uint8_t(Opcode::first); \
+          ir = Handlers::first(memory, &context, ProgramOperands(program, index, memory)); \
+          if (!ir || traced[id]) \
+            break; \
+          ++context.executed; \
+          index = context.line++; \
+          id = uint8_t(Opcode::second); \
+          ir = Handlers::second(memory, &context, ProgramOperands(program, index, memory)); \
+          break;
+          KIP_SUPERINSTRUCTIONS(KIP_SUPERINSTRUCTION_CASE)
+#undef KIP_SUPERINSTRUCTION_CASE
+        default:
+          continue;
+        }
+        ++context.executed;
+        if ((!ir || traced[id]) && !ReportInstruction(r, index, lnWidth, program.sourceMap[index], ir, Describe(id, ir, ProgramOperands(program, index, memory))))
+          break;
+      }
+#endif
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
+      return r;
+    }
+    if (r.size() == 0 || r.back().success)
+      r.push_back(InterpretResult(true, "Executed successfully"));
+    return r;
+  }
+
+  std::vector<InterpretResult> InterpretProgram(const Program& program, Memory& memory, Instruction::Context& context, uint8_t verbosity)
+  {
+    return RunProgram<false>(program, memory, context, verbosity, nullptr);
+  }
+
+  std::vector<InterpretResult> InterpretProgram(const Program& program, Machine& machine, uint8_t verbosity)
+  {
+    return InterpretProgram(program, machine.memory, machine.context, verbosity);
+  }
+
+  void StartProgram(const Program& program, Instruction::Context& context)
+  {
+    context.line = program.start;
+  }
+
+  StopReason RunProgramFor(const Program& program, Memory& memory, Instruction::Context& context, uint64_t maxInstructions, std::vector<InterpretResult>& r, uint8_t verbosity)
+  {
+    unsigned lnWidth = 0;
+    for (size_t c = program.size() + 1; c > 0; c /= 10)
+      ++lnWidth;
+    bool traced[256] = {};
+    for (uint8_t id = 0; id < instructionCount; ++id)
+      traced[id] = verbosity >= instructionTable[id].verbosity;
+
+    // Lines run one at a time, even where a superinstruction starts, so a slice can end between any two
+    const uint32_t size = program.size();
+    uint64_t remaining = maxInstructions;
+    InstructionResult ir(InstructionResult::Status::OK);
+    try
+    {
+      while (context.line < size)
+      {
+        if (remaining == 0)
+          return StopReason::BUDGET;
+        const uint32_t index = context.line++;
+        const uint8_t id = program.GetOpcode(index);
+        switch (Opcode(id))
+        {
+#define KIP_OPCODE_CASE(name, handler) \
+        case Opcode::name: \
+          ir = Handlers::handler(memory, &context, ProgramOperands(program, index, memory)); \
+          break;
+          KIP_OPCODES(KIP_OPCODE_CASE)
+#undef KIP_OPCODE_CASE
+        default:
+          continue;
+        }
+        ++context.executed;
+        --remaining;
+        if ((!ir || traced[id]) && !ReportInstruction(r, index, lnWidth, program.sourceMap[index], ir, Describe(id, ir, ProgramOperands(program, index, memory))))
+          return StopReason::FAULT;
+      }
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
+      return StopReason::FAULT;
+    }
+    return context.line == uint32_t(-1) ? StopReason::HALTED : StopReason::FINISHED;
+  }
+
+  StopReason RunProgramFor(const Program& program, Machine& machine, uint64_t maxInstructions, std::vector<InterpretResult>& r, uint8_t verbosity)
+  {
+    return RunProgramFor(program, machine.memory, machine.context, maxInstructions, r, verbosity);
+  }
+
+  bool StepProgram(const Program& program, uint32_t index, Memory& memory, Instruction::Context& context, uint8_t verbosity, std::vector<InterpretResult>& r)
+  {
+    context.line = index + 1;
+    const uint8_t id = program.GetOpcode(index);
+    ProgramOperands operands(program, index, memory);
+    InstructionResult ir(InstructionResult::Status::OK);
+    switch (Opcode(id))
+    {
+#define KIP_OPCODE_CASE(name, handler) \
+    case Opcode::name: \
+      ir = Handlers::handler(memory, &context, operands); \
+      break;
+      KIP_OPCODES(KIP_OPCODE_CASE)
+#undef KIP_OPCODE_CASE
+    default:
+      return true;
+    }
+    ++context.executed;
+    if (!ir || IsTraced(id, verbosity))
+    {
+      unsigned lnWidth = 0;
+      for (size_t c = program.size() + 1; c > 0; c /= 10)
+        ++lnWidth;
+      return ReportInstruction(r, index, lnWidth, program.sourceMap[index], ir, Describe(id, ir, operands));
+    }
+    return true;
+  }
+
+  bool IsTraced(uint8_t id, uint8_t verbosity)
+  {
+    return id < instructionCount && verbosity >= instructionTable[id].verbosity;
+  }
+
+  std::vector<InterpretResult> ProfileProgram(const Program& program, Machine& machine, ProgramProfile& profile, uint8_t verbosity)
+  {
+    profile.lines.assign(program.size(), 0);
+    return RunProgram<true>(program, machine.memory, machine.context, verbosity, profile.lines.data());
+  }
+
+  std::vector<InterpretResult> FusionReport::Describe() const
+  {
+    std::vector<InterpretResult> r;
+    for (const Fusion& fusion : fusions)
+      r.push_back(InterpretResult(true, std::string(superinstructions[uint8_t(fusion.id) - uint8_t(Opcode::COUNT)].name)
+        + ": " + std::to_string(fusion.sites) + " sites, " + std::to_string(fusion.fires) + " dispatches saved"));
+    return r;
+  }
+
+  FusionReport FuseProgram(Program& program, const ProgramProfile* profile, uint64_t threshold)
+  {
+    struct Candidate
+    {
+      uint32_t line;
+      uint8_t fused;   // Index into superinstructions
+      uint64_t fires;  // Times the first line ran while profiling, each followed by the second
+    };
+    std::vector<Candidate> candidates;
+    const uint32_t size = program.size();
+    for (uint32_t i = 0; i + 1 < size; ++i)
+      for (uint8_t f = 0; f < superinstructionCount; ++f)
+        if (program.opcodes[i] == uint8_t(superinstructions[f].first) && program.opcodes[i + 1] == uint8_t(superinstructions[f].second))
+        {
+          uint64_t fires = profile && i < profile->lines.size() ? profile->lines[i] : 0;
+          if (!profile || fires >= threshold)
+            candidates.push_back({ i, f, fires });
+          break;
+        }
+
+    // Hottest pairs first, so a line shared by two candidates goes to the one that saves more
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.fires > b.fires; });
+    std::vector<bool> used(size, false);
+    uint32_t sites[256] = {};
+    uint64_t fires[256] = {};
+    for (const Candidate& c : candidates)
+    {
+      if (used[c.line] || used[c.line + 1])
+        continue;
+      used[c.line] = used[c.line + 1] = true;
+      program.opcodes[c.line] = uint8_t(Opcode::COUNT) + c.fused;
+      ++sites[c.fused];
+      fires[c.fused] += c.fires;
+    }
+
+    FusionReport report;
+    for (uint8_t f = 0; f < superinstructionCount; ++f)
+      if (sites[f] > 0)
+        report.fusions.push_back({ Superinstruction(uint8_t(Opcode::COUNT) + f), sites[f], fires[f] });
+    return report;
+  }
+
+
+  std::vector<InterpretResult> LoadBytecode(BytecodeProgram& program, Instruction::Context& context, const Bytecode::View& bc)
+  {
+    std::vector<InterpretResult> r;
+    uint32_t offset = 0;
+    program.image = bc;
+    program.header = BuildHeaderFromBytecode(bc, r, offset);
+    if (!r.back())
+      return r;
+    program.metadata = BuildMetadataFromBytecode(program.header, bc, r, offset);
+    if (!r.back())
+      return r;
+    std::string folder = context.folder; // Files used by BIN and SAV are still found next to the bytecode
+    context = BuildContextFromBytecode(bc, r, offset);
+    context.folder = folder;
+    if (!r.back())
+      return r;
+    for (InterpretResult sr : BuildLineOffsetsFromBytecode(program.lines, bc, offset))
+      r.push_back(sr);
+    if (!r.back())
+      return r;
+    program.start = 0;
+    Instruction::Context::Labels::const_iterator start = context.labels.find("START");
+    if (start != context.labels.end() && start->second.type == Argument::Type::DATA)
+      program.start = start->second.data;
+    return r;
+  }
+
+  std::vector<InterpretResult> InterpretBytecode(const BytecodeProgram& program, Memory& memory, Instruction::Context& context, uint8_t verbosity)
+  {
+    std::vector<InterpretResult> r;
+    if (verbosity > KIP_VERBOSITY_RESERVE_LARGE)
+      r.reserve(100000);
+    else if (verbosity > KIP_VERBOSITY_RESERVE_SMALL)
+      r.reserve(5000);
+    unsigned lnWidth = 0;
+    for (size_t c = program.size() + 1; c > 0; c /= 10)
+      ++lnWidth;
+
+    bool traced[256] = {};
+    for (uint8_t id = 0; id < instructionCount; ++id)
+      traced[id] = verbosity >= instructionTable[id].verbosity;
+
+    const uint8_t* const image = program.image.data();
+    const uint32_t* const lines = program.lines.data();
+    const uint32_t size = program.size();
+    InstructionResult ir(InstructionResult::Status::OK);
+    context.line = program.start;
+    try
+    {
+      while (context.line < size)
+      {
+        const uint32_t index = context.line++;
+        const uint8_t* const record = image + lines[index];
+        const uint8_t id = record[0] - uint8_t(Bytecode::DataType::INSTRUCTIONS_START);
+        switch (Opcode(id))
+        {
+#define KIP_OPCODE_CASE(name, handler) \
+        case Opcode::name: \
+          ir = Handlers::handler(memory, &context, BytecodeOperands(record, memory)); \
+          break;
+          KIP_OPCODES(KIP_OPCODE_CASE)
+#undef KIP_OPCODE_CASE
+        default:
+          continue;
+        }
+        ++context.executed;
+        if ((!ir || traced[id]) && !ReportInstruction(r, index, lnWidth, instructionTable[id].string, ir, Describe(id, ir, BytecodeOperands(record, memory))))
+          break;
+      }
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while interpreting bytecode: " + std::string(e.what())));
+      return r;
+    }
+    if (r.size() == 0 || r.back().success)
+      r.push_back(InterpretResult(true, "Executed successfully"));
+    return r;
+  }
+
+  std::vector<InterpretResult> InterpretBytecode(const Bytecode::View& bc, Machine& machine, uint8_t verbosity)
+  {
+    BytecodeProgram program;
+    std::vector<InterpretResult> r = LoadBytecode(program, machine.context, bc);
+    if (!r.back())
+      return r;
+    return InterpretBytecode(program, machine.memory, machine.context, verbosity);
+  }
+
+  InterpretResult SaveBytecodeFile(const std::string& filename, const Bytecode::View& bc)
+  {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+      return InterpretResult(false, "Could not open file " + filename + " for writing");
+    file.write((const char*)bc.data(), bc.size());
+    if (!file)
+      return InterpretResult(false, "Could not write bytecode to " + filename);
+    return InterpretResult(true, "Saved bytecode to " + filename);
+  }
+
+  std::vector<InterpretResult> LoadBytecodeFile(BytecodeProgram& program, Instruction::Context& context, MappedFile& file, const std::string& filename)
+  {
+    if (!file.Open(filename))
+      return std::vector<InterpretResult>(1, InterpretResult(false, "Could not map bytecode file " + filename));
+    size_t folder = filename.find_last_of("/\\");
+    context.folder = folder == std::string::npos ? "." : filename.substr(0, folder);
+    return LoadBytecode(program, context, Bytecode::View(file.data(), file.size()));
+  }
+
+  std::vector<InterpretResult> InterpretBytecodeFile(const std::string& filename, Machine& machine, uint8_t verbosity)
+  {
+    MappedFile file;
+    BytecodeProgram program;
+    std::vector<InterpretResult> r = LoadBytecodeFile(program, machine.context, file, filename);
+    if (!r.back())
+      return r;
+    return InterpretBytecode(program, machine.memory, machine.context, verbosity);
+  }
+}
@@ -0,0 +1,163 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "kipScheduler.h"
+
+namespace kip
+{
+  // The scheduler and queue a worker thread belongs to, so work submitted from a completion stays local
+  static thread_local const Scheduler* currentScheduler = nullptr;
+  static thread_local unsigned currentQueue = 0;
+
+  struct Scheduler::Job
+  {
+    std::shared_ptr<const Program> program;
+    std::unique_ptr<Machine> machine;
+    Completion done;
+    uint8_t verbosity;
+    std::vector<InterpretResult> results;
+  };
+
+  Scheduler::Scheduler(unsigned threadCount, uint64_t slice)
+    : slice(std::max<uint64_t>(slice, 1))
+  {
+    if (threadCount == 0)
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned t = 0; t < threadCount; ++t)
+      queues.push_back(std::make_unique<Queue>());
+    for (unsigned t = 0; t < threadCount; ++t)
+      threads.push_back(std::thread([this, t]() { Work(t); }));
+  }
+
+  Scheduler::~Scheduler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+
+  void Scheduler::Submit(std::shared_ptr<const Program> program, std::unique_ptr<Machine> machine, Completion done, uint8_t verbosity)
+  {
+    std::unique_ptr<Job> job(new Job{ std::move(program), std::move(machine), std::move(done), verbosity, {} });
+    StartProgram(*job->program, job->machine->context);
+    ++submitted;
+    ++outstanding;
+    const unsigned queue = currentScheduler == this ? currentQueue : next++ % unsigned(queues.size());
+    Push(queue, std::move(job), false);
+  }
+
+  void Scheduler::Wait()
+  {
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [this]() { return outstanding == 0; });
+  }
+
+  unsigned Scheduler::ThreadCount() const
+  {
+    return unsigned(threads.size());
+  }
+
+  Scheduler::Stats Scheduler::GetStats() const
+  {
+    Stats stats;
+    stats.submitted = submitted;
+    stats.completed = completed;
+    stats.slices = slices;
+    stats.steals = steals;
+    return stats;
+  }
+
+  void Scheduler::Work(unsigned self)
+  {
+    currentScheduler = this;
+    currentQueue = self;
+    while (!stopping)
+    {
+      std::unique_ptr<Job> job = Pop(self);
+      if (!job)
+      {
+        // Pushes bump queued before checking sleeping, and sleepers the other way round, so no wake-up is lost
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        ++sleeping;
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        --sleeping;
+        continue;
+      }
+      ++slices;
+      const StopReason reason = RunProgramFor(*job->program, *job->machine, slice, job->results, job->verbosity);
+      if (reason == StopReason::BUDGET)
+        Push(self, std::move(job), true);
+      else
+        Finish(std::move(job), reason);
+    }
+  }
+
+  void Scheduler::Push(unsigned queue, std::unique_ptr<Job> job, bool requeue)
+  {
+    size_t size;
+    {
+      std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+      queues[queue]->jobs.push_back(std::move(job));
+      size = queues[queue]->jobs.size();
+    }
+    ++queued;
+    // A thread putting back its only machine will run it again itself
+    if ((!requeue || size > 1) && sleeping > 0)
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      wake.notify_one();
+    }
+  }
+
+  std::unique_ptr<Scheduler::Job> Scheduler::Pop(unsigned self)
+  {
+    std::unique_ptr<Job> job;
+    if (queued == 0)
+      return job;
+    {
+      Queue& own = *queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.jobs.empty())
+      {
+        job = std::move(own.jobs.front());
+        own.jobs.pop_front();
+      }
+    }
+    for (size_t i = 1; !job && i < queues.size(); ++i)
+    {
+      Queue& victim = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty())
+      {
+        job = std::move(victim.jobs.back());
+        victim.jobs.pop_back();
+        ++steals;
+      }
+    }
+    if (job)
+      --queued;
+    return job;
+  }
+
+  void Scheduler::Finish(std::unique_ptr<Job> job, StopReason reason)
+  {
+    if (reason != StopReason::FAULT)
+      job->results.push_back(InterpretResult(true, "Executed successfully"));
+    if (job->done)
+      job->done(job->machine, reason, job->results);
+    job.reset();
+    ++completed;
+    if (--outstanding == 0)
+    {
+      std::lock_guard<std::mutex> lock(doneMutex);
+      done.notify_all();
+    }
+  }
+}
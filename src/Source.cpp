@@ -0,0 +1,151 @@
+#include "pch.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "kipSource.h"
+#include "kipMachine.h"
+#include "kipProgram.h"
+
+namespace kip
+{
+  SourceFile::SourceFile()
+  {
+  }
+
+  InterpretResult SourceFile::Open(const std::string& filename)
+  {
+    this->filename = filename;
+    text = std::string_view();
+    lines.clear();
+    buffer.clear();
+    if (mapping.Open(filename))
+    {
+      text = std::string_view((const char*)mapping.data(), mapping.size());
+      SplitLines(text);
+      return InterpretResult(true, "Loaded " + filename);
+    }
+
+    // Empty files and things that can't be mapped, like pipes
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+      return InterpretResult(false, "Could not open file " + filename);
+    const size_t chunk = 1 << 16;
+    while (file)
+    {
+      size_t size = buffer.size();
+      buffer.resize(size + chunk);
+      file.read(&buffer[size], chunk);
+      buffer.resize(size + size_t(file.gcount()));
+    }
+    text = buffer;
+    SplitLines(text);
+    return InterpretResult(true, "Loaded " + filename);
+  }
+
+  void SourceFile::SplitLines(std::string_view text)
+  {
+    // There is always one more line than there are line breaks, even if the last one is empty
+    size_t start = 0;
+    while (true)
+    {
+      size_t end = text.find('\n', start);
+      std::string_view line = text.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+      if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+      lines.push_back(line);
+      if (end == std::string_view::npos)
+        break;
+      start = end + 1;
+    }
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+  InterpretResult Source::Open(const std::string& filename)
+  {
+    files.clear();
+    lines.clear();
+    SourceFile& file = Add();
+    InterpretResult r = file.Open(filename);
+    if (!r)
+      return r;
+    lines = file.lines;
+    folder = std::filesystem::path(filename).parent_path().string();
+    return r;
+  }
+
+  SourceFile& Source::Add()
+  {
+    files.push_back(std::unique_ptr<SourceFile>(new SourceFile()));
+    return *files.back();
+  }
+
+  const SourceFile* Source::Find(const std::string& filename) const
+  {
+    for (const std::unique_ptr<SourceFile>& file : files)
+      if (file->filename == filename)
+        return file.get();
+    return nullptr;
+  }
+
+  std::vector<InterpretResult> BuildContext(Instruction::Context& context, Source& source)
+  {
+    std::vector<InterpretResult> results;
+    try
+    {
+      for (InterpretResult sr : BuildContextImports(context, source))
+      {
+        results.push_back(sr);
+        if (!sr.success)
+        {
+          results.push_back(InterpretResult(false, "Failed to build context due to error in import parsing"));
+          return results;
+        }
+      }
+      for (InterpretResult sr : BuildContextLabels(context, source.lines))
+      {
+        results.push_back(sr);
+        if (!sr.success)
+        {
+          results.push_back(InterpretResult(false, "Failed to build context due to error in label parsing"));
+          return results;
+        }
+      }
+    }
+    catch (const std::exception& e)
+    {
+      results.push_back(InterpretResult(false, "Exception was thrown while interpreting instructions: " + std::string(e.what())));
+      return results;
+    }
+    results.push_back(InterpretResult(true, "Built context successfully"));
+    return results;
+  }
+
+  std::vector<InterpretResult> InterpretFile(const std::string& filename, Machine& machine, uint8_t verbosity)
+  {
+    Source source;
+    std::vector<InterpretResult> r(1, source.Open(filename));
+    if (!r.back())
+      return r;
+    machine.context.folder = source.folder;
+    r = BuildContext(machine.context, source);
+    if (!r.back())
+      return r;
+
+    Program program;
+    try
+    {
+      program = DecodeInstructions(BuildInstructions(machine.context, source.lines), machine.context);
+    }
+    catch (const std::exception& e)
+    {
+      std::vector<InterpretResult> results;
+      results.push_back(InterpretResult(false, "Exception was thrown while building instructions: " + std::string(e.what())));
+      return results;
+    }
+    return InterpretProgram(program, machine, verbosity);
+  }
+}
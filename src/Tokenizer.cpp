@@ -0,0 +1,78 @@
+#include "pch.h"
+
+#include <charconv>
+#include "kipTokenizer.h"
+
+namespace kip
+{
+  Tokenizer::Tokenizer(std::string_view line)
+    : rest(line)
+  {
+  }
+
+  bool Tokenizer::Next(std::string_view& token)
+  {
+    size_t start = 0;
+    while (start < rest.size() && rest[start] == ' ')
+      ++start;
+    if (start == rest.size() || IsCommentCharacter(rest[start]))
+    {
+      rest = std::string_view();
+      return false;
+    }
+    size_t end = start + 1;
+    if (rest[start] == '\"')
+    {
+      while (end < rest.size() && rest[end] != '\"')
+        ++end;
+      if (end < rest.size())
+        ++end; // Keep the closing quote; a missing one is reported by whoever reads the literal
+    }
+    else
+    {
+      while (end < rest.size() && rest[end] != ' ' && !IsCommentCharacter(rest[end]))
+        ++end;
+    }
+    token = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return true;
+  }
+
+  bool IsCommentCharacter(char c)
+  {
+    return c == ';' || c == '|' || c == '?' || c == '}';
+  }
+
+  bool ParseLiteral(std::string_view token, Argument::AddressOrData& value)
+  {
+    if (token.empty())
+      return false;
+    const char* first = token.data();
+    const char* last = token.data() + token.size();
+    std::from_chars_result r;
+    switch (token[0])
+    {
+    case '$': // Hex value
+      r = std::from_chars(first + 1, last, value, 16);
+      break;
+    case ':': // Binary value
+      r = std::from_chars(first + 1, last, value, 2);
+      break;
+    case '#': // Octal value
+      r = std::from_chars(first + 1, last, value, 8);
+      break;
+    case '-': // Negative decimal value
+    {
+      int32_t signedValue = 0;
+      r = std::from_chars(first, last, signedValue, 10);
+      if (r.ec == std::errc())
+        value = Argument::AddressOrData(signedValue);
+      break;
+    }
+    default: // Decimal value
+      r = std::from_chars(first + (*first == '+'), last, value, 10);
+      break;
+    }
+    return r.ec == std::errc() && r.ptr == last;
+  }
+}
@@ -0,0 +1,517 @@
+#include "pch.h"
+
+#include <cctype>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "kipTranspiler.h"
+#include "kipHandlers.h"
+#include "kipSource.h"
+
+namespace kip
+{
+namespace Transpiler
+{
+  // Written once at the top of every generated file
+  const char* const PREAMBLE =
+    "#include <cstdint>\n"
+    "#include <cstring>\n"
+    "#include <string>\n"
+    "#include <vector>\n"
+    "#include \"kip.h\"\n"
+    "\n"
+    "namespace\n"
+    "{\n"
+    "  // Operands resolved only through DATA blocks, without side effects; false sends the line to StepProgram\n"
+    "  inline bool KipAddr(const kip::Memory& memory, uint32_t data, uint8_t dereferences, uint32_t& out)\n"
+    "  {\n"
+    "    for (; dereferences > 0; --dereferences)\n"
+    "    {\n"
+    "      const kip::Argument::Data* p = memory.Translate(data, 4);\n"
+    "      if (!p)\n"
+    "        return false;\n"
+    "      std::memcpy(&data, p, 4);\n"
+    "    }\n"
+    "    out = data;\n"
+    "    return true;\n"
+    "  }\n"
+    "\n"
+    "  inline bool KipByte(const kip::Memory& memory, uint32_t data, uint8_t dereferences, uint32_t& out)\n"
+    "  {\n"
+    "    const kip::Argument::Data* p = KipAddr(memory, data, dereferences - 1, data) ? memory.Translate(data, 1) : nullptr;\n"
+    "    if (!p)\n"
+    "      return false;\n"
+    "    out = *p;\n"
+    "    return true;\n"
+    "  }\n"
+    "}\n";
+
+  static bool IsIdentifier(const std::string& name)
+  {
+    if (name.empty() || std::isdigit((unsigned char)name[0]))
+      return false;
+    for (char c : name)
+      if (!std::isalnum((unsigned char)c) && c != '_')
+        return false;
+    return true;
+  }
+
+  // Octal escapes, unlike hex ones, can't swallow the characters after them
+  static std::string Quote(const std::string& s)
+  {
+    std::string r = "\"";
+    for (char c : s)
+    {
+      unsigned char u = (unsigned char)c;
+      if (c == '"' || c == '\\')
+      {
+        r += '\\';
+        r += c;
+      }
+      else if (u < 0x20 || u >= 0x7F)
+      {
+        const char digits[] = { '\\', char('0' + (u >> 6)), char('0' + ((u >> 3) & 7)), char('0' + (u & 7)), 0 };
+        r += digits;
+      }
+      else
+        r += c;
+    }
+    return r + "\"";
+  }
+
+  // Source text safe to put after //, or nothing if it would continue onto the next line
+  static std::string Comment(const std::string& source)
+  {
+    std::string r;
+    for (char c : source)
+      r += ((unsigned char)c < 0x20) ? ' ' : c;
+    while (!r.empty() && r.back() == ' ')
+      r.pop_back();
+    size_t first = r.find_first_not_of(' ');
+    if (first == std::string::npos || r.back() == '\\')
+      return "";
+    return " // " + r.substr(first);
+  }
+
+  static std::string Literal(uint32_t value)
+  {
+    return std::to_string(value) + "u";
+  }
+
+  // One instruction's inline path: checks that may fail without side effects, then statements that can't fail
+  class Inline
+  {
+  public:
+    // Value of a byte operand, resolving it into var when it's read from memory
+    std::string Byte(const Operand& o, const char* var)
+    {
+      if (o.type != Argument::Type::DATA)
+        possible = false;
+      if (o.dereferenceCount == 0)
+        return Literal(o.data & 0xFF);
+      checks.push_back("KipByte(memory, " + Literal(o.data) + ", " + std::to_string(o.dereferenceCount) + ", " + var + ")");
+      return var;
+    }
+
+    std::string Addr(const Operand& o, const char* var)
+    {
+      if (o.type != Argument::Type::DATA)
+        possible = false;
+      if (o.dereferenceCount == 0)
+        return Literal(o.data);
+      checks.push_back("KipAddr(memory, " + Literal(o.data) + ", " + std::to_string(o.dereferenceCount) + ", " + var + ")");
+      return var;
+    }
+
+    void Translate(const std::string& address, unsigned count, const char* pointer)
+    {
+      checks.push_back("(" + std::string(pointer) + " = memory.Translate(" + address + ", " + std::to_string(count) + "))");
+    }
+
+    // Operand values the handler would refuse or leave to the host's undefined behaviour
+    void Require(const std::string& condition)
+    {
+      checks.push_back(condition);
+    }
+
+    std::vector<std::string> checks;
+    std::vector<std::string> body;
+    bool possible = true;
+  };
+
+  class Writer
+  {
+  public:
+    Writer(std::string& cpp, const Program& program)
+      : cpp(cpp), program(program), size(program.size())
+    {
+    }
+
+    void Table()
+    {
+      cpp += "  static const kip::Program program = []\n  {\n";
+      cpp += "    [[maybe_unused]] const kip::Argument::Type N = kip::Argument::Type::INVALID, D = kip::Argument::Type::DATA, S = kip::Argument::Type::STRING;\n";
+      cpp += "    kip::Program decoded;\n";
+      cpp += "    decoded.opcodes = {";
+      for (uint32_t i = 0; i < size; ++i)
+        cpp += std::string(i % 32 == 0 ? "\n      " : " ") + std::to_string(program.GetOpcode(i)) + ",";
+      cpp += "\n    };\n";
+      cpp += "    decoded.operands = {\n";
+      for (uint32_t i = 0; i < size; ++i)
+      {
+        cpp += "     ";
+        const Operand* o = program.GetOperands(i);
+        for (uint8_t a = 0; a < Program::MAX_OPERANDS; ++a)
+        {
+          std::string type;
+          switch (o[a].type)
+          {
+          case Argument::Type::INVALID: type = "N"; break;
+          case Argument::Type::DATA: type = "D"; break;
+          case Argument::Type::STRING: type = "S"; break;
+          default: type = "kip::Argument::Type(" + std::to_string(unsigned(o[a].type)) + ")"; break;
+          }
+          cpp += " { " + Literal(o[a].data) + ", " + std::to_string(o[a].dereferenceCount) + ", " + type + " },";
+        }
+        cpp += "\n";
+      }
+      cpp += "    };\n";
+      cpp += "    decoded.strings = {\n";
+      for (const std::string& s : program.strings)
+        cpp += "      " + Quote(s) + ",\n";
+      cpp += "    };\n";
+      cpp += "    decoded.sourceMap = {\n";
+      for (const std::string& s : program.sourceMap)
+        cpp += "      " + Quote(s) + ",\n";
+      cpp += "    };\n";
+      cpp += "    decoded.start = " + Literal(program.start) + ";\n";
+      cpp += "    return decoded;\n  }();\n";
+    }
+
+    // Jumps with computed targets, and lines the interpreter ran, continue from context.line through a switch
+    void Dispatch(bool redispatched)
+    {
+      if (redispatched)
+        cpp += "  dispatch:\n";
+      cpp += "    switch (context.line)\n    {\n";
+      for (uint32_t i = 0; i < size; ++i)
+        cpp += "    case " + std::to_string(i) + ": goto L" + std::to_string(i) + ";\n";
+      cpp += "    default: goto finished;\n    }\n";
+    }
+
+    void Line(uint32_t index)
+    {
+      cpp += "  L" + std::to_string(index) + ":" + Comment(program.sourceMap[index]) + "\n";
+      const uint8_t id = program.GetOpcode(index);
+      if (id == 0)
+        return;
+
+      Inline in;
+      std::string next; // How the inline path leaves, when it doesn't fall through
+      bool branches = false;
+      if (!Build(index, id, in, next, branches) || !in.possible)
+      {
+        Step(index, branches, "    ");
+        return;
+      }
+
+      cpp += "    if (traced[" + std::to_string(id) + "]";
+      for (const std::string& check : in.checks)
+        cpp += " || !" + check;
+      cpp += ")\n    {\n";
+      Step(index, branches, "      ");
+      cpp += "    }\n    else\n    {\n";
+      for (const std::string& statement : in.body)
+        cpp += "      " + statement + "\n";
+      cpp += "      ++context.executed;\n";
+      if (!next.empty())
+        cpp += "      " + next + "\n";
+      cpp += "    }\n";
+    }
+
+    void End()
+    {
+      cpp += "    context.line = " + Literal(size) + ";\n";
+      cpp += "  finished:;\n";
+    }
+
+    bool redispatches = false; // Whether any line went back through the dispatch switch
+
+  private:
+    // Runs the line through the interpreter, then carries on wherever it left context.line
+    void Step(uint32_t index, bool branches, const std::string& indent)
+    {
+      cpp += indent + "if (!kip::StepProgram(program, " + std::to_string(index) + ", memory, context, verbosity, r))\n";
+      cpp += indent + "  goto finished;\n";
+      if (branches)
+      {
+        cpp += indent + "goto dispatch;\n";
+        redispatches = true;
+      }
+    }
+
+    // Transfer to the line a jump operand names, which is one past the line's index
+    std::string Goto(const Operand& target, const std::string& value)
+    {
+      if (target.dereferenceCount > 0)
+      {
+        redispatches = true;
+        return "{ context.line = " + value + " - 1; goto dispatch; }";
+      }
+      uint32_t line = target.data - 1;
+      if (line < size)
+        return "goto L" + std::to_string(line) + ";";
+      return "{ context.line = " + Literal(line) + "; goto finished; }";
+    }
+
+    bool Build(uint32_t index, uint8_t id, Inline& in, std::string& next, bool& branches)
+    {
+      const Operand* o = program.GetOperands(index);
+      switch (Opcode(id))
+      {
+      case Opcode::STB:
+      {
+        std::string a = in.Byte(o[0], "a");
+        in.Translate(in.Addr(o[1], "b"), 1, "p");
+        in.body.push_back("*p = kip::Argument::Data(" + a + ");");
+        return true;
+      }
+      case Opcode::STA:
+      {
+        std::string a = in.Addr(o[0], "a");
+        in.Translate(in.Addr(o[1], "b"), 4, "p");
+        in.body.push_back("v = " + a + ";");
+        in.body.push_back("std::memcpy(p, &v, 4);");
+        return true;
+      }
+      case Opcode::PUB:
+      case Opcode::PUA:
+      {
+        const bool byte = Opcode(id) == Opcode::PUB;
+        std::string a = byte ? in.Byte(o[0], "a") : in.Addr(o[0], "a");
+        in.Translate(byte ? "sp - 1" : "sp - 4", byte ? 1 : 4, "p");
+        if (byte)
+          in.body.push_back("*p = kip::Argument::Data(" + a + ");");
+        else
+        {
+          in.body.push_back("v = " + a + ";");
+          in.body.push_back("std::memcpy(p, &v, 4);");
+        }
+        in.body.push_back(byte ? "sp -= 1;" : "sp -= 4;");
+        return true;
+      }
+      case Opcode::POB:
+      case Opcode::POA:
+      {
+        const unsigned count = Opcode(id) == Opcode::POB ? 1 : 4;
+        std::string a = in.Addr(o[0], "a");
+        in.Translate("sp", count, "q");
+        in.Translate(a, count, "p");
+        in.body.push_back(count == 1 ? "*p = *q;" : "std::memmove(p, q, 4);");
+        in.body.push_back("sp += " + std::to_string(count) + ";");
+        return true;
+      }
+      case Opcode::JMP:
+        branches = true;
+        next = Goto(o[0], in.Addr(o[0], "a"));
+        return true;
+      case Opcode::JEQ:
+      case Opcode::JNE:
+      case Opcode::JGT:
+      case Opcode::JLT:
+      {
+        static const char* const comparisons[] = { " == ", " != ", " > ", " < " };
+        branches = true;
+        std::string a = in.Addr(o[0], "a");
+        std::string b = in.Byte(o[1], "b");
+        std::string c = in.Byte(o[2], "c");
+        next = "if (" + b + comparisons[id - uint8_t(Opcode::JEQ)] + c + ")\n        " + Goto(o[0], a);
+        return true;
+      }
+      case Opcode::HLT:
+        branches = true;
+        next = "context.line = uint32_t(-1);\n      goto finished;";
+        return true;
+      case Opcode::CAL:
+      {
+        branches = true;
+        std::string a = in.Addr(o[0], "a");
+        in.Translate("sp - 4", 4, "p");
+        in.body.push_back("v = " + Literal(index + 2) + ";"); // The line after this one, as a label value
+        in.body.push_back("std::memcpy(p, &v, 4);");
+        in.body.push_back("sp -= 4;");
+        next = Goto(o[0], a);
+        return true;
+      }
+      case Opcode::ADB: case Opcode::SBB: case Opcode::MLB: case Opcode::DVB: case Opcode::MDA:
+      case Opcode::BLS: case Opcode::BRS: case Opcode::AND: case Opcode::BOR: case Opcode::XOR:
+      {
+        std::string op;
+        switch (Opcode(id))
+        {
+        case Opcode::ADB: op = " + "; break;
+        case Opcode::SBB: op = " - "; break;
+        case Opcode::MLB: op = " * "; break;
+        case Opcode::DVB: op = " / "; break;
+        case Opcode::MDA: op = " % "; break; // Runs the byte handler
+        case Opcode::BLS: op = " << "; break;
+        case Opcode::BRS: op = " >> "; break;
+        case Opcode::AND: op = " & "; break;
+        case Opcode::BOR: op = " | "; break;
+        default: op = " ^ "; break;
+        }
+        std::string a = in.Byte(o[0], "a");
+        std::string b = in.Byte(o[1], "b");
+        if (op == " / " || op == " % ")
+          in.Require("(" + b + " != 0)");
+        else if (op == " << " || op == " >> ")
+          in.Require("(" + b + " < 32)");
+        in.Translate(in.Addr(o[2], "c"), 1, "p");
+        in.body.push_back("*p = kip::Argument::Data(" + a + op + b + ");");
+        return true;
+      }
+      case Opcode::ADA: case Opcode::SBA: case Opcode::MLA: case Opcode::DVA:
+      {
+        static const char* const operators[] = { " + ", " - ", " * ", " / " };
+        const std::string op = operators[Opcode(id) == Opcode::ADA ? 0 : Opcode(id) == Opcode::SBA ? 1 : Opcode(id) == Opcode::MLA ? 2 : 3];
+        std::string a = in.Addr(o[0], "a");
+        std::string b = in.Addr(o[1], "b");
+        if (op == " / ")
+          in.Require("(" + b + " != 0)");
+        in.Translate(in.Addr(o[2], "c"), 4, "p");
+        in.body.push_back("v = " + a + op + b + ";");
+        in.body.push_back("std::memcpy(p, &v, 4);");
+        return true;
+      }
+      case Opcode::NOT:
+      {
+        std::string a = in.Byte(o[0], "a");
+        in.Translate(in.Addr(o[1], "b"), 1, "p");
+        in.body.push_back("*p = kip::Argument::Data(~" + a + ");");
+        return true;
+      }
+      case Opcode::INB:
+      case Opcode::DCB:
+        in.Translate(in.Addr(o[0], "a"), 1, "p");
+        in.body.push_back(Opcode(id) == Opcode::INB ? "++*p;" : "--*p;");
+        return true;
+      case Opcode::INA:
+      case Opcode::DCA:
+        in.Translate(in.Addr(o[0], "a"), 4, "p");
+        in.body.push_back("std::memcpy(&v, p, 4);");
+        in.body.push_back(Opcode(id) == Opcode::INA ? "++v;" : "--v;");
+        in.body.push_back("std::memcpy(p, &v, 4);");
+        return true;
+      default:
+        // Strings, files, bulk memory and debugging output are always stepped; ROL and ROR are rare
+        branches = false;
+        return false;
+      }
+    }
+
+    std::string& cpp;
+    const Program& program;
+    const uint32_t size;
+  };
+}
+
+  std::vector<InterpretResult> TranspileProgram(std::string& cpp, const Program& program, const std::string& name)
+  {
+    std::vector<InterpretResult> r;
+    if (!Transpiler::IsIdentifier(name))
+    {
+      r.push_back(InterpretResult(false, "Function name is not a C++ identifier: " + name));
+      return r;
+    }
+
+    const uint32_t size = program.size();
+    cpp = "// Generated from " + std::to_string(size) + " lines of kip by TranspileProgram; regenerate rather than editing\n";
+    cpp += Transpiler::PREAMBLE;
+    cpp += "\nstd::vector<kip::InterpretResult> " + name + "(kip::Memory& memory, kip::Instruction::Context& context, uint8_t verbosity)\n{\n";
+    Transpiler::Writer writer(cpp, program);
+    writer.Table();
+    cpp +=
+      "  bool traced[256] = {};\n"
+      "  for (uint8_t id = 0; id < uint8_t(kip::Opcode::COUNT); ++id)\n"
+      "    traced[id] = kip::IsTraced(id, verbosity);\n"
+      "  [[maybe_unused]] kip::Argument::Address& sp = memory.RawStackPointer();\n"
+      "  std::vector<kip::InterpretResult> r;\n"
+      "  [[maybe_unused]] uint32_t a = 0, b = 0, c = 0, v = 0;\n"
+      "  [[maybe_unused]] kip::Argument::Data* p = nullptr;\n"
+      "  [[maybe_unused]] kip::Argument::Data* q = nullptr;\n"
+      "  try\n  {\n"
+      "    context.line = program.start;\n";
+    std::string lines;
+    Transpiler::Writer body(lines, program);
+    for (uint32_t i = 0; i < size; ++i)
+      body.Line(i);
+    body.End();
+    writer.Dispatch(body.redispatches);
+    cpp += lines;
+    cpp +=
+      "  }\n"
+      "  catch (const std::exception& e)\n  {\n"
+      "    r.push_back(kip::InterpretResult(false, \"Exception was thrown while interpreting instructions: \" + std::string(e.what())));\n"
+      "    return r;\n  }\n"
+      "  if (r.size() == 0 || r.back().success)\n"
+      "    r.push_back(kip::InterpretResult(true, \"Executed successfully\"));\n"
+      "  return r;\n}\n";
+    r.push_back(InterpretResult(true, "Transpiled " + std::to_string(size) + " lines into " + name));
+    return r;
+  }
+
+  std::vector<InterpretResult> TranspileInstructions(std::string& cpp, const std::vector<Instruction>& inst, Instruction::Context& context, const std::string& name)
+  {
+    return TranspileProgram(cpp, DecodeInstructions(inst, context), name);
+  }
+
+  std::vector<InterpretResult> TranspileBytecode(std::string& cpp, const Bytecode::View& bc, const std::string& name)
+  {
+    BytecodeProgram program;
+    Instruction::Context context;
+    std::vector<InterpretResult> r = LoadBytecode(program, context, bc);
+    if (!r.back())
+      return r;
+    return TranspileProgram(cpp, DecodeBytecode(program), name);
+  }
+
+  std::vector<InterpretResult> TranspileFile(const std::string& filename, const std::string& output, const std::string& name)
+  {
+    Source source;
+    std::vector<InterpretResult> r(1, source.Open(filename));
+    if (!r.back())
+      return r;
+    Instruction::Context context;
+    context.folder = source.folder;
+    r = BuildContext(context, source);
+    if (!r.back())
+      return r;
+
+    std::string cpp;
+    try
+    {
+      r = TranspileInstructions(cpp, BuildInstructions(context, source.lines), context, name);
+    }
+    catch (const std::exception& e)
+    {
+      r.push_back(InterpretResult(false, "Exception was thrown while building instructions: " + std::string(e.what())));
+      return r;
+    }
+    if (!r.back())
+      return r;
+
+    std::ofstream file(output, std::ios::binary);
+    if (!file.is_open())
+    {
+      r.push_back(InterpretResult(false, "Could not open file " + output + " for writing"));
+      return r;
+    }
+    file << cpp;
+    if (!file)
+      r.push_back(InterpretResult(false, "Could not write C++ to " + output));
+    else
+      r.push_back(InterpretResult(true, "Saved C++ to " + output));
+    return r;
+  }
+}
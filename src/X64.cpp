@@ -0,0 +1,412 @@
+#include "pch.h"
+
+#include <cstring>
+
+#include "kipX64.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace kip
+{
+namespace X64
+{
+  static uint8_t Low(Reg r)
+  {
+    return uint8_t(r) & 7;
+  }
+
+  static bool High(Reg r)
+  {
+    return uint8_t(r) >= 8;
+  }
+
+  Label Emitter::NewLabel()
+  {
+    Label label;
+    label.id = uint32_t(labels.size());
+    labels.push_back(uint32_t(-1));
+    return label;
+  }
+
+  void Emitter::Bind(Label label)
+  {
+    labels[label.id] = uint32_t(buffer.size());
+  }
+
+  bool Emitter::IsBound(Label label) const
+  {
+    return label.id < labels.size() && labels[label.id] != uint32_t(-1);
+  }
+
+  uint32_t Emitter::Offset(Label label) const
+  {
+    return labels[label.id];
+  }
+
+  bool Emitter::Finish()
+  {
+    for (const Fixup& fixup : fixups)
+    {
+      if (labels[fixup.label] == uint32_t(-1))
+        return false;
+      int32_t rel = int32_t(labels[fixup.label] - (fixup.at + 4));
+      std::memcpy(buffer.data() + fixup.at, &rel, sizeof(rel));
+    }
+    fixups.clear();
+    return true;
+  }
+
+  const std::vector<uint8_t>& Emitter::code() const
+  {
+    return buffer;
+  }
+
+  /////////////////////////////
+  // Encoding                //
+  /////////////////////////////
+
+  void Emitter::Byte(uint8_t b)
+  {
+    buffer.push_back(b);
+  }
+
+  void Emitter::Dword(uint32_t d)
+  {
+    for (unsigned i = 0; i < 4; ++i)
+      buffer.push_back(uint8_t(d >> (i * 8)));
+  }
+
+  void Emitter::Rex(bool w, Reg reg, Reg base, bool byteRegister)
+  {
+    // Without a REX prefix, byte registers 4-7 mean ah, ch, dh and bh rather than spl, bpl, sil and dil
+    bool needed = w || High(reg) || High(base) || (byteRegister && uint8_t(reg) >= 4);
+    if (needed)
+      Byte(0x40 | (w ? 8 : 0) | (High(reg) ? 4 : 0) | (High(base) ? 1 : 0));
+  }
+
+  void Emitter::ModRm(Reg reg, Reg rm)
+  {
+    Byte(0xC0 | (Low(reg) << 3) | Low(rm));
+  }
+
+  void Emitter::ModRm(Reg reg, Reg base, int32_t disp)
+  {
+    // rbp and r13 can't be addressed without a displacement, and rsp and r12 need a SIB byte
+    uint8_t mod = 0x80;
+    if (disp == 0 && Low(base) != 5)
+      mod = 0x00;
+    else if (disp >= -128 && disp <= 127)
+      mod = 0x40;
+    Byte(mod | (Low(reg) << 3) | Low(base));
+    if (Low(base) == 4)
+      Byte(0x24);
+    if (mod == 0x40)
+      Byte(uint8_t(int8_t(disp)));
+    else if (mod == 0x80)
+      Dword(uint32_t(disp));
+  }
+
+  void Emitter::Op(uint8_t opcode, Reg reg, Reg rm, bool w)
+  {
+    Rex(w, reg, rm);
+    Byte(opcode);
+    ModRm(reg, rm);
+  }
+
+  void Emitter::Op(uint8_t opcode, Reg reg, Reg base, int32_t disp, bool w, bool byteRegister)
+  {
+    Rex(w, reg, base, byteRegister);
+    Byte(opcode);
+    ModRm(reg, base, disp);
+  }
+
+  void Emitter::Group(uint8_t opcode, uint8_t extension, Reg rm, bool w)
+  {
+    Rex(w, Reg::RAX, rm);
+    Byte(opcode);
+    ModRm(Reg(extension), rm);
+  }
+
+  void Emitter::Jump(Label target)
+  {
+    fixups.push_back({ uint32_t(buffer.size()), target.id });
+    Dword(0);
+  }
+
+  /////////////////////////////
+  // Data movement           //
+  /////////////////////////////
+
+  void Emitter::MovImm(Reg dst, uint32_t imm)
+  {
+    Rex(false, Reg::RAX, dst);
+    Byte(0xB8 + Low(dst));
+    Dword(imm);
+  }
+
+  void Emitter::MovImm64(Reg dst, uint64_t imm)
+  {
+    Rex(true, Reg::RAX, dst);
+    Byte(0xB8 + Low(dst));
+    Dword(uint32_t(imm));
+    Dword(uint32_t(imm >> 32));
+  }
+
+  void Emitter::Mov(Reg dst, Reg src)
+  {
+    Op(0x89, src, dst);
+  }
+
+  void Emitter::Mov64(Reg dst, Reg src)
+  {
+    Op(0x89, src, dst, true);
+  }
+
+  void Emitter::Load(Reg dst, Reg base, int32_t disp)
+  {
+    Op(0x8B, dst, base, disp);
+  }
+
+  void Emitter::Load64(Reg dst, Reg base, int32_t disp)
+  {
+    Op(0x8B, dst, base, disp, true);
+  }
+
+  void Emitter::LoadByte(Reg dst, Reg base, int32_t disp)
+  {
+    Rex(false, dst, base);
+    Byte(0x0F);
+    Byte(0xB6);
+    ModRm(dst, base, disp);
+  }
+
+  void Emitter::Store(Reg base, int32_t disp, Reg src)
+  {
+    Op(0x89, src, base, disp);
+  }
+
+  void Emitter::StoreByte(Reg base, int32_t disp, Reg src)
+  {
+    Op(0x88, src, base, disp, false, true);
+  }
+
+  void Emitter::StoreImm(Reg base, int32_t disp, uint32_t imm)
+  {
+    Op(0xC7, Reg::RAX, base, disp);
+    Dword(imm);
+  }
+
+  void Emitter::AddImm64(Reg base, int32_t disp, int32_t imm)
+  {
+    Op(0x81, Reg::RAX, base, disp, true);
+    Dword(uint32_t(imm));
+  }
+
+  /////////////////////////////
+  // Arithmetic              //
+  /////////////////////////////
+
+  void Emitter::Add(Reg dst, Reg src)
+  {
+    Op(0x01, src, dst);
+  }
+
+  void Emitter::Add64(Reg dst, Reg src)
+  {
+    Op(0x01, src, dst, true);
+  }
+
+  void Emitter::Add64(Reg dst, Reg base, int32_t disp)
+  {
+    Op(0x03, dst, base, disp, true);
+  }
+
+  void Emitter::Sub(Reg dst, Reg src)
+  {
+    Op(0x29, src, dst);
+  }
+
+  void Emitter::And(Reg dst, Reg src)
+  {
+    Op(0x21, src, dst);
+  }
+
+  void Emitter::Or(Reg dst, Reg src)
+  {
+    Op(0x09, src, dst);
+  }
+
+  void Emitter::Xor(Reg dst, Reg src)
+  {
+    Op(0x31, src, dst);
+  }
+
+  void Emitter::Imul(Reg dst, Reg src)
+  {
+    Rex(false, dst, src);
+    Byte(0x0F);
+    Byte(0xAF);
+    ModRm(dst, src);
+  }
+
+  void Emitter::Div(Reg src)
+  {
+    Group(0xF7, 6, src);
+  }
+
+  void Emitter::Not(Reg dst)
+  {
+    Group(0xF7, 2, dst);
+  }
+
+  void Emitter::AddImm(Reg dst, int32_t imm)
+  {
+    Group(0x81, 0, dst);
+    Dword(uint32_t(imm));
+  }
+
+  void Emitter::AndImm(Reg dst, uint32_t imm)
+  {
+    Group(0x81, 4, dst);
+    Dword(imm);
+  }
+
+  void Emitter::ShlImm(Reg dst, uint8_t imm)
+  {
+    Group(0xC1, 4, dst);
+    Byte(imm);
+  }
+
+  void Emitter::ShrImm(Reg dst, uint8_t imm)
+  {
+    Group(0xC1, 5, dst);
+    Byte(imm);
+  }
+
+  void Emitter::ShlCl(Reg dst)
+  {
+    Group(0xD3, 4, dst);
+  }
+
+  void Emitter::ShrCl(Reg dst)
+  {
+    Group(0xD3, 5, dst);
+  }
+
+  void Emitter::Cmp(Reg a, Reg b)
+  {
+    Op(0x39, b, a);
+  }
+
+  void Emitter::CmpImm(Reg a, uint32_t imm)
+  {
+    Group(0x81, 7, a);
+    Dword(imm);
+  }
+
+  void Emitter::Cmp(Reg base, int32_t disp, Reg b)
+  {
+    Op(0x39, b, base, disp);
+  }
+
+  void Emitter::Test64(Reg a, Reg b)
+  {
+    Op(0x85, b, a, true);
+  }
+
+  /////////////////////////////
+  // Control flow            //
+  /////////////////////////////
+
+  void Emitter::Push(Reg src)
+  {
+    Rex(false, Reg::RAX, src);
+    Byte(0x50 + Low(src));
+  }
+
+  void Emitter::Pop(Reg dst)
+  {
+    Rex(false, Reg::RAX, dst);
+    Byte(0x58 + Low(dst));
+  }
+
+  void Emitter::AddRsp(int32_t imm)
+  {
+    Group(0x81, 0, Reg::RSP, true);
+    Dword(uint32_t(imm));
+  }
+
+  void Emitter::Call(Reg target)
+  {
+    Group(0xFF, 2, target);
+  }
+
+  void Emitter::Jmp(Reg target)
+  {
+    Group(0xFF, 4, target);
+  }
+
+  void Emitter::Jmp(Label target)
+  {
+    Byte(0xE9);
+    Jump(target);
+  }
+
+  void Emitter::Jcc(Cond cond, Label target)
+  {
+    Byte(0x0F);
+    Byte(0x80 | uint8_t(cond));
+    Jump(target);
+  }
+
+  void Emitter::Ret()
+  {
+    Byte(0xC3);
+  }
+
+  /////////////////////////////
+
+  uint8_t* AllocateCode(const std::vector<uint8_t>& code)
+  {
+    if (code.empty())
+      return nullptr;
+#ifdef _WIN32
+    void* pages = VirtualAlloc(NULL, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (pages == NULL)
+      return nullptr;
+    std::memcpy(pages, code.data(), code.size());
+    DWORD previous = 0;
+    if (!VirtualProtect(pages, code.size(), PAGE_EXECUTE_READ, &previous))
+    {
+      VirtualFree(pages, 0, MEM_RELEASE);
+      return nullptr;
+    }
+    FlushInstructionCache(GetCurrentProcess(), pages, code.size());
+#else
+    void* pages = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED)
+      return nullptr;
+    std::memcpy(pages, code.data(), code.size());
+    if (mprotect(pages, code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+      munmap(pages, code.size());
+      return nullptr;
+    }
+#endif
+    return (uint8_t*)pages;
+  }
+
+  void FreeCode(uint8_t* code, size_t size)
+  {
+    if (!code)
+      return;
+#ifdef _WIN32
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, size);
+#endif
+  }
+}
+}